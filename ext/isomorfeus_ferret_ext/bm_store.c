@@ -8,13 +8,13 @@
 
 void my_os_write_voff_t(FrtOutStream *os, register frt_off_t num) {
     if (!(num&0x7f)) {
-        if (os->buf.pos >= FRT_BUFFER_SIZE) {
+        if (os->buf.pos >= os->buf.size) {
             frt_os_write_byte(os, (frt_uchar)num);
         } else {
             write_byte(os, (frt_uchar)num);
         }
     } else if (!(num&0x3fff)) {
-        if (os->buf.pos >= FRT_BUFFER_SIZE - 1) {
+        if (os->buf.pos >= os->buf.size - 1) {
             frt_os_write_byte(os, (frt_uchar)(0x80 | (0x3f & num))); num >>= 6;
             frt_os_write_byte(os, (frt_uchar)num);
         } else {
@@ -22,7 +22,7 @@ void my_os_write_voff_t(FrtOutStream *os, register frt_off_t num) {
             write_byte(os, (frt_uchar)num);
         }
     } else if (!(num&0x1fffff)) {
-        if (os->buf.pos >= FRT_BUFFER_SIZE - 2) {
+        if (os->buf.pos >= os->buf.size - 2) {
             frt_os_write_byte(os, (frt_uchar)(0xc0 | (0x1f & num))); num >>= 5;
             frt_os_write_byte(os, (frt_uchar)(0xff| num)); num >>= 8;
             frt_os_write_byte(os, (frt_uchar)num);
@@ -32,7 +32,7 @@ void my_os_write_voff_t(FrtOutStream *os, register frt_off_t num) {
             write_byte(os, (frt_uchar)num);
         }
     } else if (!(num&0xfffff)) {
-        if (os->buf.pos >= FRT_BUFFER_SIZE - 3) {
+        if (os->buf.pos >= os->buf.size - 3) {
             frt_os_write_byte(os, (frt_uchar)(0xe0 | (0x0f & num))); num >>= 4;
             frt_os_write_byte(os, (frt_uchar)(0xff | num)); num >>= 8;
             frt_os_write_byte(os, (frt_uchar)(0xff | num)); num >>= 8;
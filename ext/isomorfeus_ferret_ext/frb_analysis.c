@@ -489,31 +489,55 @@ const rb_data_type_t frb_token_filter_t = {
  * Wrapped TokenStream
  ****************************************************************************/
 
-static void cwrts_destroy_i(FrtTokenStream *ts) {
+/* The wrapped TokenStream methods call into ruby so they may need to
+ * reacquire the GVL when called while indexing or searching. */
+
+static void *cwrts_destroy_gvl_i(void *arg) {
+    FrtTokenStream *ts = (FrtTokenStream *)arg;
     rb_hash_delete(object_space, ((VALUE)ts)|1);
     free(ts);
+    return NULL;
 }
 
-static FrtToken *cwrts_next(FrtTokenStream *ts) {
+static void cwrts_destroy_i(FrtTokenStream *ts) {
+    frt_thread_call_with_gvl(&cwrts_destroy_gvl_i, ts);
+}
+
+static void *cwrts_next_gvl_i(void *arg) {
+    FrtTokenStream *ts = (FrtTokenStream *)arg;
     VALUE rtoken = rb_funcall(ts->rts, id_next, 0);
     return frb_set_token(&(ts->token), rtoken);
 }
 
+static FrtToken *cwrts_next(FrtTokenStream *ts) {
+    return (FrtToken *)frt_thread_call_with_gvl(&cwrts_next_gvl_i, ts);
+}
+
+static void *cwrts_reset_gvl_i(void *arg) {
+    FrtTokenStream *ts = (FrtTokenStream *)arg;
+    rb_funcall(ts->rts, id_reset, 1, rb_str_new2(ts->text));
+    return ts;
+}
+
 static FrtTokenStream *cwrts_reset(FrtTokenStream *ts, char *text, rb_encoding *encoding) {
     ts->t = ts->text = text;
     ts->length = strlen(text);
     ts->encoding = encoding;
-    rb_funcall(ts->rts, id_reset, 1, rb_str_new2(text));
-    return ts;
+    return (FrtTokenStream *)frt_thread_call_with_gvl(&cwrts_reset_gvl_i, ts);
 }
 
-static FrtTokenStream *cwrts_clone_i(FrtTokenStream *orig_ts) {
-    FrtTokenStream *new_ts = frt_ts_clone_size(orig_ts, sizeof(FrtTokenStream));
-    VALUE rts = new_ts->rts = rb_funcall(orig_ts->rts, id_clone, 0);
+static void *cwrts_clone_gvl_i(void *arg) {
+    FrtTokenStream *new_ts = (FrtTokenStream *)arg;
+    VALUE rts = new_ts->rts = rb_funcall(new_ts->rts, id_clone, 0);
     rb_hash_aset(object_space, ((VALUE)new_ts)|1, rts);
     return new_ts;
 }
 
+static FrtTokenStream *cwrts_clone_i(FrtTokenStream *orig_ts) {
+    FrtTokenStream *new_ts = frt_ts_clone_size(orig_ts, sizeof(FrtTokenStream));
+    return (FrtTokenStream *)frt_thread_call_with_gvl(&cwrts_clone_gvl_i, new_ts);
+}
+
 static FrtTokenStream *frb_get_cwrapped_rts(VALUE rts) {
     FrtTokenStream *ts;
     if (frb_is_cclass(rts) && DATA_PTR(rts)) {
@@ -556,8 +580,7 @@ static const char *TOKEN_RE =
 static VALUE rtoken_re;
 
 static void rets_destroy_i(FrtTokenStream *ts) {
-    rb_hash_delete(object_space, ((VALUE)ts)|1);
-    free(ts);
+    frt_thread_call_with_gvl(&cwrts_destroy_gvl_i, ts);
 }
 
 /*
@@ -615,7 +638,8 @@ static VALUE scan_once(VALUE rstr, VALUE pat, long *start) {
   return Qnil;
 }
 
-static FrtToken *rets_next(FrtTokenStream *ts) {
+static void *rets_next_gvl_i(void *arg) {
+    FrtTokenStream *ts = (FrtTokenStream *)arg;
     VALUE ret;
     long rtok_len;
     int beg, end;
@@ -643,6 +667,10 @@ static FrtToken *rets_next(FrtTokenStream *ts) {
     }
 }
 
+static FrtToken *rets_next(FrtTokenStream *ts) {
+    return (FrtToken *)frt_thread_call_with_gvl(&rets_next_gvl_i, ts);
+}
+
 static FrtTokenStream *rets_reset(FrtTokenStream *ts, char *text, rb_encoding *encoding) {
     frt_ts_reset(ts, text, encoding);
     RETS(ts)->curr_ind = 0;
@@ -1134,18 +1162,37 @@ const rb_data_type_t frb_analyzer_t = {
     .flags = RUBY_TYPED_FREE_IMMEDIATELY
 };
 
-static void cwa_destroy_i(FrtAnalyzer *a) {
+static void *cwa_destroy_gvl_i(void *arg) {
+    FrtAnalyzer *a = (FrtAnalyzer *)arg;
     rb_hash_delete(object_space, ((VALUE)a)|1);
     free(a);
+    return NULL;
 }
 
-static FrtTokenStream *cwa_get_ts(FrtAnalyzer *a, ID field, char *text, rb_encoding *encoding) {
-    VALUE rstr = rb_str_new_cstr(text);
-    rb_enc_associate(rstr, encoding);
-    VALUE rts = rb_funcall(CWA(a)->ranalyzer, id_token_stream, 2, rb_str_new_cstr(rb_id2name(field)), rstr);
+static void cwa_destroy_i(FrtAnalyzer *a) {
+    frt_thread_call_with_gvl(&cwa_destroy_gvl_i, a);
+}
+
+typedef struct CwaGetTsArgs {
+    FrtAnalyzer *a;
+    ID field;
+    char *text;
+    rb_encoding *encoding;
+} CwaGetTsArgs;
+
+static void *cwa_get_ts_gvl_i(void *arg) {
+    CwaGetTsArgs *args = (CwaGetTsArgs *)arg;
+    VALUE rstr = rb_str_new_cstr(args->text);
+    rb_enc_associate(rstr, args->encoding);
+    VALUE rts = rb_funcall(CWA(args->a)->ranalyzer, id_token_stream, 2, rb_str_new_cstr(rb_id2name(args->field)), rstr);
     return frb_get_cwrapped_rts(rts);
 }
 
+static FrtTokenStream *cwa_get_ts(FrtAnalyzer *a, ID field, char *text, rb_encoding *encoding) {
+    CwaGetTsArgs args = { .a = a, .field = field, .text = text, .encoding = encoding };
+    return (FrtTokenStream *)frt_thread_call_with_gvl(&cwa_get_ts_gvl_i, &args);
+}
+
 FrtAnalyzer *frb_get_cwrapped_analyzer(VALUE ranalyzer) {
     FrtAnalyzer *a = NULL;
     if (frb_is_cclass(ranalyzer) && DATA_PTR(ranalyzer)) {
@@ -16,6 +16,10 @@ static VALUE sym_untokenized_omit_norms;
 static VALUE sym_with_offsets;
 static VALUE sym_with_positions;
 static VALUE sym_with_positions_offsets;
+static VALUE sym_doc_values;
+static VALUE sym_numeric;
+static VALUE sym_sorted;
+static VALUE sym_sorted_set;
 
 extern VALUE sym_boost;
 
@@ -111,6 +115,32 @@ void frb_fi_get_params(VALUE roptions, unsigned int *bits, float *boost) {
         rb_raise(rb_eArgError, ":%s isn't a valid argument for :term_vector. Please choose from [:no, :yes, "
                  ":with_positions, :with_offsets, :with_positions_offsets]", rb_id2name(SYM2ID(v)));
     }
+
+    v = rb_hash_aref(roptions, sym_doc_values);
+    if (Qnil != v) Check_Type(v, T_SYMBOL);
+    if (v == sym_no || v == sym_false || v == Qfalse) {
+        *bits &= ~FRT_FI_DOC_VALUES_BM;
+    } else if (v == sym_numeric) {
+        *bits = (*bits & ~FRT_FI_DOC_VALUES_BM) | FRT_FI_DOC_VALUES_NUMERIC_BM;
+    } else if (v == sym_sorted) {
+        *bits = (*bits & ~FRT_FI_DOC_VALUES_BM) | FRT_FI_DOC_VALUES_SORTED_BM;
+    } else if (v == sym_sorted_set) {
+        *bits = (*bits & ~FRT_FI_DOC_VALUES_BM) | FRT_FI_DOC_VALUES_SORTED_SET_BM;
+    } else if (v == Qnil) {
+        /* leave as default */
+    } else {
+        rb_raise(rb_eArgError, ":%s isn't a valid argument for :doc_values. Please choose from [:no, :numeric, "
+                 ":sorted, :sorted_set]", rb_id2name(SYM2ID(v)));
+    }
+}
+
+static VALUE frb_doc_values_sym(unsigned int bits) {
+    switch (bits_doc_values_type(bits)) {
+        case FRT_DOC_VALUES_NUMERIC:    return sym_numeric;
+        case FRT_DOC_VALUES_SORTED:     return sym_sorted;
+        case FRT_DOC_VALUES_SORTED_SET: return sym_sorted_set;
+        default:                        return sym_no;
+    }
 }
 
 static void frb_fi_free(void *p) {
@@ -153,8 +183,8 @@ VALUE frb_get_field_info(FrtFieldInfo *fi) {
  *
  *  Create a new FieldInfo object with the name +name+ and the properties
  *  specified in +options+. The available options are [:store, :compression,
- *  :index, :term_vector, :boost]. See the description of FieldInfo for more
- *  information on these properties.
+ *  :index, :term_vector, :doc_values, :boost]. See the description of
+ *  FieldInfo for more information on these properties.
  */
 static VALUE frb_fi_alloc(VALUE rclass) {
     FrtFieldInfo *fi = frt_fi_alloc();
@@ -298,6 +328,18 @@ static VALUE frb_fi_has_norms(VALUE self) {
     return bits_has_norms(fi->bits) ? Qtrue : Qfalse;
 }
 
+/*
+ *  call-seq:
+ *     fi.doc_values -> symbol
+ *
+ *  Return how the field's values are kept in the doc values columns, one of
+ *  :no, :numeric, :sorted or :sorted_set.
+ */
+static VALUE frb_fi_doc_values(VALUE self) {
+    FrtFieldInfo *fi = (FrtFieldInfo *)DATA_PTR(self);
+    return frb_doc_values_sym(fi->bits);
+}
+
 /*
  *  call-seq:
  *     fi.boost -> boost
@@ -372,6 +414,11 @@ static VALUE frb_fi_to_h(VALUE self) {
     }
     rb_hash_aset(hash, sym_term_vector, val);
 
+    // :doc_values, only listed for fields which have them
+    if (bits_doc_values_type(fi->bits)) {
+        rb_hash_aset(hash, sym_doc_values, frb_doc_values_sym(fi->bits));
+    }
+
     // :boost
     rb_hash_aset(hash, sym_boost, rb_float_new((double)fi->boost));
 
@@ -426,6 +473,16 @@ static VALUE frb_fi_to_h(VALUE self) {
  *  +:with_positions_offsets+. Note that you need to store the positions to
  *  associate offsets with individual terms in the term_vector.
  *
+ *  === :doc_values
+ *
+ *  Doc values keep each document's value of the field in a column per
+ *  segment. Sorting by the field reads the column instead of walking all of
+ *  the field's terms and IndexReader#doc_values returns the values of all
+ *  documents. +:numeric+ fields hold an integer per document, +:sorted+
+ *  fields a string and +:sorted_set+ fields any number of strings. The
+ *  values are taken as they are added, they aren't analyzed. By default
+ *  fields have no doc values (+:no+).
+ *
  *  == Property Table
  *
  *    Property       Value                     Description
@@ -445,6 +502,12 @@ static VALUE frb_fi_to_h(VALUE self) {
  *                  | :bz2                    | Compress field using BZip2
  *                  |                         |
  *                  | :lz4                    | Compress field using LZ4
+ *                  |                         |
+ *                  |                         | Ignored in segments written
+ *                  |                         | with the :block
+ *                  |                         | stored_fields_format, which
+ *                  |                         | LZ4 compresses whole blocks
+ *                  |                         | of documents instead.
  *     -------------|-------------------------|------------------------------
  *     :index       | :no                     | Do not make this field
  *                  |                         | searchable.
@@ -484,6 +547,15 @@ static VALUE frb_fi_to_h(VALUE self) {
  *                  | :with_positions_offsets | Store term-vectors with
  *                  | (default)               | positions and offsets.
  *     -------------|-------------------------|------------------------------
+ *     :doc_values  | :no (default)           | No doc values column.
+ *                  |                         |
+ *                  | :numeric                | An integer per document.
+ *                  |                         |
+ *                  | :sorted                 | A string per document.
+ *                  |                         |
+ *                  | :sorted_set             | Any number of strings per
+ *                  |                         | document.
+ *     -------------|-------------------------|------------------------------
  *     :boost       | Float                   | The boost property is used to
  *                  |                         | set the default boost for a
  *                  |                         | field. This boost value will
@@ -506,6 +578,9 @@ static VALUE frb_fi_to_h(VALUE self) {
  *
  *    fi = FieldInfo.new(:image, :store => :yes, :compression => :brotli, :index => :no,
  *                       :term_vector => :no)
+ *
+ *    fi = FieldInfo.new(:price, :store => :no, :index => :no,
+ *                       :term_vector => :no, :doc_values => :numeric)
  */
 void Init_FieldInfo(void) {
     sym_store = ID2SYM(rb_intern("store"));
@@ -526,6 +601,11 @@ void Init_FieldInfo(void) {
     sym_with_offsets = ID2SYM(rb_intern("with_offsets"));
     sym_with_positions_offsets = ID2SYM(rb_intern("with_positions_offsets"));
 
+    sym_doc_values = ID2SYM(rb_intern("doc_values"));
+    sym_numeric = ID2SYM(rb_intern("numeric"));
+    sym_sorted = ID2SYM(rb_intern("sorted"));
+    sym_sorted_set = ID2SYM(rb_intern("sorted_set"));
+
     cFieldInfo = rb_define_class_under(mIndex, "FieldInfo", rb_cObject);
     rb_define_alloc_func(cFieldInfo, frb_fi_alloc);
 
@@ -543,6 +623,7 @@ void Init_FieldInfo(void) {
     rb_define_method(cFieldInfo, "store_offsets?",
                                                 frb_fi_store_offsets, 0);
     rb_define_method(cFieldInfo, "has_norms?",  frb_fi_has_norms, 0);
+    rb_define_method(cFieldInfo, "doc_values",  frb_fi_doc_values, 0);
     rb_define_method(cFieldInfo, "boost",       frb_fi_boost, 0);
     rb_define_method(cFieldInfo, "to_s",        frb_fi_to_s, 0);
     rb_define_method(cFieldInfo, "to_h",        frb_fi_to_h, 0);
@@ -14,6 +14,7 @@ VALUE cTermDocEnum;
 
 VALUE cIndexWriter;
 VALUE cIndexReader;
+VALUE cStoredFieldsCache;
 
 VALUE sym_analyzer;
 VALUE sym_boost;
@@ -30,6 +31,20 @@ static VALUE sym_max_buffered_docs;
 static VALUE sym_max_merge_docs;
 static VALUE sym_max_field_length;
 static VALUE sym_use_compound_file;
+static VALUE sym_max_doc_writers;
+static VALUE sym_max_merge_threads;
+static VALUE sym_max_merge_bytes_per_sec;
+static VALUE sym_merge_policy;
+static VALUE sym_max_merged_segment_bytes;
+static VALUE sym_deletes_pct_allowed;
+static VALUE sym_log_doc;
+static VALUE sym_tiered;
+static VALUE sym_postings_format;
+static VALUE sym_vint;
+static VALUE sym_block;
+static VALUE sym_stored_fields_format;
+static VALUE sym_plain;
+static VALUE sym_index_sort;
 static VALUE sym_field_infos;
 
 static ID fsym_content;
@@ -37,6 +52,7 @@ static ID id_term;
 static ID id_fld_num_map;
 static ID id_field_num;
 static ID id_boost;
+static ID id_stored_cache;
 
 extern VALUE sym_each;
 extern rb_encoding *utf8_encoding;
@@ -46,6 +62,7 @@ extern VALUE frb_get_analyzer(FrtAnalyzer *a);
 extern VALUE frb_get_field_info(FrtFieldInfo *fi);
 extern VALUE frb_get_lazy_doc(FrtLazyDoc *lazy_doc);
 extern void frb_set_term(VALUE rterm, FrtTerm *t);
+extern VALUE frb_get_sort(VALUE rval);
 
 extern void Init_FieldInfo(void);
 extern void Init_LazyDoc(void);
@@ -519,16 +536,21 @@ static VALUE frb_te_set_field(VALUE self, VALUE rfield) {
  *    #   ["cantaloupe",12]
  *    # ]
  */
-static VALUE frb_te_to_json(int argc, VALUE *argv, VALUE self) {
-    FrtTermEnum *te = (FrtTermEnum *)DATA_PTR(self);
-    VALUE rjson;
+typedef struct TeToJsonArgs {
+    FrtTermEnum *te;
+    bool fast;
+} TeToJsonArgs;
+
+static void *frb_te_to_json_without_gvl_i(void *arg) {
+    TeToJsonArgs *args = (TeToJsonArgs *)arg;
+    FrtTermEnum *te = args->te;
     char *json, *jp;
     char *term;
     int capa = 65536;
     jp = json = FRT_ALLOC_N(char, capa);
     *(jp++) = '[';
 
-    if (argc > 0) {
+    if (args->fast) {
         while (NULL != (term = te->next(te))) {
             /* enough room for for term after converting " to '"' and frequency
              * plus some extra for good measure */
@@ -568,7 +590,16 @@ static VALUE frb_te_to_json(int argc, VALUE *argv, VALUE self) {
     if (*(jp-1) == ',') jp--;
     *(jp++) = ']';
     *jp = '\0';
+    return json;
+}
 
+static VALUE frb_te_to_json(int argc, VALUE *argv, VALUE self) {
+    TeToJsonArgs args;
+    VALUE rjson;
+    char *json;
+    args.te = (FrtTermEnum *)DATA_PTR(self);
+    args.fast = argc > 0;
+    json = (char *)frb_thread_call_without_gvl(&frb_te_to_json_without_gvl_i, &args);
     rjson = rb_str_new2(json);
     free(json);
     return rjson;
@@ -957,15 +988,65 @@ void frb_iw_mark(void *p) {
  *  exclusively by the index writer. The garbage collector will do this
  *  automatically if not called explicitly.
  */
+static void *frb_iw_close_without_gvl_i(void *arg) {
+    frt_iw_close((FrtIndexWriter *)arg);
+    return NULL;
+}
+
 static VALUE frb_iw_close(VALUE self) {
     FrtIndexWriter *iw = (FrtIndexWriter *)DATA_PTR(self);
     ((struct RData *)(self))->data = NULL;
     ((struct RData *)(self))->dmark = NULL;
     ((struct RData *)(self))->dfree = NULL;
-    frt_iw_close(iw);
+    frb_thread_call_without_gvl_uninterruptible(&frb_iw_close_without_gvl_i, iw);
     return Qnil;
 }
 
+static int frb_get_merge_policy_type(VALUE rval)
+{
+    if (rval == sym_log_doc) {
+        return FRT_MERGE_POLICY_LOG_DOC;
+    } else if (rval == sym_tiered) {
+        return FRT_MERGE_POLICY_TIERED;
+    }
+    return -1;
+}
+
+static VALUE frb_merge_policy_sym(FrtMergePolicyType type)
+{
+    return type == FRT_MERGE_POLICY_TIERED ? sym_tiered : sym_log_doc;
+}
+
+static int frb_get_postings_format(VALUE rval)
+{
+    if (rval == sym_vint) {
+        return FRT_POSTINGS_FORMAT_VINT;
+    } else if (rval == sym_block) {
+        return FRT_POSTINGS_FORMAT_BLOCK;
+    }
+    return -1;
+}
+
+static VALUE frb_postings_format_sym(FrtPostingsFormat format)
+{
+    return format == FRT_POSTINGS_FORMAT_BLOCK ? sym_block : sym_vint;
+}
+
+static int frb_get_stored_fields_format(VALUE rval)
+{
+    if (rval == sym_plain) {
+        return FRT_STORED_FIELDS_FORMAT_PLAIN;
+    } else if (rval == sym_block) {
+        return FRT_STORED_FIELDS_FORMAT_BLOCK;
+    }
+    return -1;
+}
+
+static VALUE frb_stored_fields_format_sym(FrtStoredFieldsFormat format)
+{
+    return format == FRT_STORED_FIELDS_FORMAT_BLOCK ? sym_block : sym_plain;
+}
+
 #define SET_INT_ATTR(attr) \
     do {\
         if (RTEST(rval = rb_hash_aref(roptions, sym_##attr)))\
@@ -1018,6 +1099,7 @@ extern rb_data_type_t frb_store_t;
 
 static VALUE frb_iw_init(int argc, VALUE *argv, VALUE self) {
     VALUE roptions, rval;
+    volatile VALUE rsort = Qnil;
     bool create = false;
     bool create_if_missing = true;
     FrtStore *store = NULL;
@@ -1061,6 +1143,39 @@ static VALUE frb_iw_init(int argc, VALUE *argv, VALUE self) {
             SET_INT_ATTR(max_buffered_docs);
             SET_INT_ATTR(max_merge_docs);
             SET_INT_ATTR(max_field_length);
+            SET_INT_ATTR(max_doc_writers);
+            SET_INT_ATTR(max_merge_threads);
+            SET_INT_ATTR(max_merge_bytes_per_sec);
+            SET_INT_ATTR(deletes_pct_allowed);
+            if (RTEST(rval = rb_hash_aref(roptions, sym_max_merged_segment_bytes))) {
+                config.max_merged_segment_bytes = (frt_off_t)NUM2LL(rval);
+            }
+            if (RTEST(rval = rb_hash_aref(roptions, sym_merge_policy))) {
+                int type = frb_get_merge_policy_type(rval);
+                if (type < 0) {
+                    FRT_RAISE(FRT_ARG_ERROR, "merge_policy must be :log_doc or :tiered");
+                }
+                config.merge_policy = (FrtMergePolicyType)type;
+            }
+            if (RTEST(rval = rb_hash_aref(roptions, sym_postings_format))) {
+                int format = frb_get_postings_format(rval);
+                if (format < 0) {
+                    FRT_RAISE(FRT_ARG_ERROR, "postings_format must be :vint or :block");
+                }
+                config.postings_format = (FrtPostingsFormat)format;
+            }
+            if (RTEST(rval = rb_hash_aref(roptions, sym_stored_fields_format))) {
+                int format = frb_get_stored_fields_format(rval);
+                if (format < 0) {
+                    FRT_RAISE(FRT_ARG_ERROR, "stored_fields_format must be :plain or :block");
+                }
+                config.stored_fields_format = (FrtStoredFieldsFormat)format;
+            }
+            if (RTEST(rval = rb_hash_aref(roptions, sym_index_sort))) {
+                /* the IndexWriter keeps its own copy of the sort */
+                rsort = frb_get_sort(rval);
+                config.index_sort = (struct FrtSort *)DATA_PTR(rsort);
+            }
         }
         if (NULL == store) {
             store = frt_open_ram_store(NULL);
@@ -1111,11 +1226,16 @@ static VALUE frb_iw_init(int argc, VALUE *argv, VALUE self) {
  *  Returns the number of documents in the Index. Note that deletions won't be
  *  taken into account until the FrtIndexWriter has been committed.
  */
+static void *frb_iw_doc_count_without_gvl_i(void *arg) {
+    return (void *)(long)frt_iw_doc_count((FrtIndexWriter *)arg);
+}
+
 static VALUE
 frb_iw_get_doc_count(VALUE self)
 {
     FrtIndexWriter *iw = (FrtIndexWriter *)DATA_PTR(self);
-    return INT2FIX(frt_iw_doc_count(iw));
+    /* the writer mutex may be held by a thread adding a document */
+    return INT2FIX((int)(long)frb_thread_call_without_gvl(&frb_iw_doc_count_without_gvl_i, iw));
 }
 
 static int
@@ -1146,7 +1266,9 @@ frb_hash_to_doc_i(VALUE key, VALUE value, VALUE arg)
                 }
                 break;
             case T_STRING:
-                frt_df_add_data_len(df, rs2s(value), RSTRING_LEN(value), rb_enc_get(value));
+                /* copy the data as the document is added without the GVL */
+                df->destroy_data = true;
+                frt_df_add_data_len(df, rstrdup(value), RSTRING_LEN(value), rb_enc_get(value));
                 break;
             default:
                 val = rb_obj_as_string(value);
@@ -1188,11 +1310,13 @@ frb_get_doc(VALUE rdoc)
             break;
         case T_SYMBOL:
             /* TODO: clean up this ugly cast */
-            df = frt_df_add_data(frt_df_new(fsym_content), (char *)rb_id2name(SYM2ID(rdoc)), rb_enc_get(rdoc));
+            df = frt_df_add_data(frt_df_new(fsym_content), frt_estrdup(rb_id2name(SYM2ID(rdoc))), rb_enc_get(rdoc));
+            df->destroy_data = true;
             frt_doc_add_field(doc, df);
             break;
         case T_STRING:
-            df = frt_df_add_data_len(frt_df_new(fsym_content), rs2s(rdoc), RSTRING_LEN(rdoc), rb_enc_get(rdoc));
+            df = frt_df_add_data_len(frt_df_new(fsym_content), rstrdup(rdoc), RSTRING_LEN(rdoc), rb_enc_get(rdoc));
+            df->destroy_data = true;
             frt_doc_add_field(doc, df);
             break;
         default:
@@ -1213,13 +1337,28 @@ frb_get_doc(VALUE rdoc)
  *  Add a document to the index. See Document. A document can also be a simple
  *  hash object.
  */
+typedef struct IwAddDocArgs {
+    FrtIndexWriter *iw;
+    FrtDocument *doc;
+} IwAddDocArgs;
+
+static void *frb_iw_add_doc_without_gvl_i(void *arg) {
+    IwAddDocArgs *volatile args = (IwAddDocArgs *)arg;
+    FRT_TRY
+        frt_iw_add_doc(args->iw, args->doc);
+    FRT_XFINALLY
+        frt_doc_destroy(args->doc);
+    FRT_XENDTRY
+    return NULL;
+}
+
 static VALUE
 frb_iw_add_doc(VALUE self, VALUE rdoc)
 {
-    FrtIndexWriter *iw = (FrtIndexWriter *)DATA_PTR(self);
-    FrtDocument *doc = frb_get_doc(rdoc);
-    frt_iw_add_doc(iw, doc);
-    frt_doc_destroy(doc);
+    IwAddDocArgs args;
+    args.iw = (FrtIndexWriter *)DATA_PTR(self);
+    args.doc = frb_get_doc(rdoc);
+    frb_thread_call_without_gvl(&frb_iw_add_doc_without_gvl_i, &args);
     return self;
 }
 
@@ -1235,11 +1374,16 @@ frb_iw_add_doc(VALUE self, VALUE rdoc)
  *  indexing speed (except for the time taken to complete the optimization
  *  process).
  */
+static void *frb_iw_optimize_without_gvl_i(void *arg) {
+    frt_iw_optimize((FrtIndexWriter *)arg);
+    return NULL;
+}
+
 static VALUE
 frb_iw_optimize(VALUE self)
 {
     FrtIndexWriter *iw = (FrtIndexWriter *)DATA_PTR(self);
-    frt_iw_optimize(iw);
+    frb_thread_call_without_gvl(&frb_iw_optimize_without_gvl_i, iw);
     return self;
 }
 
@@ -1251,16 +1395,134 @@ frb_iw_optimize(VALUE self)
  *  memory. You should call this method if you want to read the latest index
  *  with an IndexWriter.
  */
+static void *frb_iw_commit_without_gvl_i(void *arg) {
+    frt_iw_commit((FrtIndexWriter *)arg);
+    return NULL;
+}
+
 static VALUE
 frb_iw_commit(VALUE self)
 {
     FrtIndexWriter *iw = (FrtIndexWriter *)DATA_PTR(self);
-    frt_iw_commit(iw);
+    frb_thread_call_without_gvl(&frb_iw_commit_without_gvl_i, iw);
     return self;
 }
 
+/****************************************************************************
+ *
+ * StoredFieldsCache Methods
+ *
+ ****************************************************************************/
+
+static void frb_sc_free(void *p) {
+    if (p) frt_sc_deref((FrtStoredCache *)p);
+}
+
+static size_t frb_sc_size(const void *p) {
+    return p ? (size_t)frt_sc_bytes((FrtStoredCache *)p) : 0;
+}
+
+const rb_data_type_t frb_stored_cache_t = {
+    .wrap_struct_name = "FrbStoredFieldsCache",
+    .function = {
+        .dmark = NULL,
+        .dfree = frb_sc_free,
+        .dsize = frb_sc_size,
+        .dcompact = NULL,
+        .reserved = {0},
+    },
+    .parent = NULL,
+    .data = NULL,
+    .flags = RUBY_TYPED_FREE_IMMEDIATELY
+};
+
+static VALUE frb_sc_alloc(VALUE rclass) {
+    return TypedData_Wrap_Struct(rclass, &frb_stored_cache_t, NULL);
+}
+
+static FrtStoredCache *frb_get_sc(VALUE self) {
+    FrtStoredCache *sc;
+    TypedData_Get_Struct(self, FrtStoredCache, &frb_stored_cache_t, sc);
+    if (!sc) rb_raise(rb_eArgError, "StoredFieldsCache is not initialized");
+    return sc;
+}
+
+/*
+ *  call-seq:
+ *     StoredFieldsCache.new(max_size = 16_777_216) -> stored_fields_cache
+ *
+ *  Create a cache holding up to +max_size+ bytes of decompressed stored field
+ *  data. Attach it to one or more IndexReaders with
+ *  IndexReader#stored_fields_cache= so that documents loaded over and over
+ *  again don't need to be decompressed each time. The least recently used
+ *  data is dropped when the cache is full.
+ */
+static VALUE
+frb_sc_init(int argc, VALUE *argv, VALUE self)
+{
+    VALUE rmax_size;
+    long long max_size = 16 * 1024 * 1024;
+    if (DATA_PTR(self)) rb_raise(rb_eArgError, "StoredFieldsCache is already initialized");
+    rb_scan_args(argc, argv, "01", &rmax_size);
+    if (argc > 0) {
+        max_size = NUM2LL(rmax_size);
+        if (max_size < 0) rb_raise(rb_eArgError, "max_size must not be negative");
+    }
+    DATA_PTR(self) = frt_sc_new((frt_off_t)max_size);
+    return self;
+}
+
+/*
+ *  call-seq:
+ *     stored_fields_cache.hits -> integer
+ *
+ *  Return the number of times stored field data was found in the cache.
+ */
+static VALUE
+frb_sc_hits(VALUE self)
+{
+    return ULL2NUM(frt_sc_hits(frb_get_sc(self)));
+}
+
+/*
+ *  call-seq:
+ *     stored_fields_cache.misses -> integer
+ *
+ *  Return the number of times stored field data had to be decompressed.
+ */
+static VALUE
+frb_sc_misses(VALUE self)
+{
+    return ULL2NUM(frt_sc_misses(frb_get_sc(self)));
+}
+
+/*
+ *  call-seq:
+ *     stored_fields_cache.size -> integer
+ *
+ *  Return the number of bytes currently held by the cache.
+ */
+static VALUE
+frb_sc_bytes(VALUE self)
+{
+    return LL2NUM(frt_sc_bytes(frb_get_sc(self)));
+}
+
+/*
+ *  call-seq:
+ *     stored_fields_cache.max_size -> integer
+ *
+ *  Return the maximum number of bytes the cache holds.
+ */
+static VALUE
+frb_sc_max_bytes(VALUE self)
+{
+    return LL2NUM(frt_sc_max_bytes(frb_get_sc(self)));
+}
+
 /* index reader intermission */
 static VALUE frb_ir_close(VALUE self);
+static void frb_ir_set_field_num_map(VALUE self, FrtIndexReader *ir);
 
 void frb_ir_free(void *p) {
     frt_ir_close((FrtIndexReader *)p);
@@ -1276,10 +1538,9 @@ void frb_ir_mark(void *p) {
             if (mr->sub_readers[i]->rir)
                 rb_gc_mark(mr->sub_readers[i]->rir);
         }
-    } else {
-        if (ir->store && ir->store->rstore)
-            rb_gc_mark(ir->store->rstore);
     }
+    if (ir->store && ir->store->rstore)
+        rb_gc_mark(ir->store->rstore);
 }
 
 static size_t frb_index_reader_t_size(const void *p) {
@@ -1301,6 +1562,59 @@ const rb_data_type_t frb_index_reader_t = {
     .flags = RUBY_TYPED_FREE_IMMEDIATELY
 };
 
+/*
+ *  call-seq:
+ *     iw.reader -> index_reader
+ *
+ *  Open an IndexReader on all the documents added to the index so far without
+ *  closing the IndexWriter. Documents still buffered in memory are flushed to
+ *  a new segment first. The reader sees the index as it was when the reader
+ *  was opened, use #reader_latest? to find out whether a new one is needed.
+ *
+ *  Documents can't be deleted through this reader, use the IndexWriter
+ *  instead.
+ */
+static void *frb_iw_get_reader_without_gvl_i(void *arg) {
+    return frt_iw_get_reader((FrtIndexWriter *)arg, NULL);
+}
+
+static VALUE
+frb_iw_get_reader(VALUE self)
+{
+    FrtIndexWriter *iw = (FrtIndexWriter *)DATA_PTR(self);
+    FrtIndexReader *ir = (FrtIndexReader *)frb_thread_call_without_gvl(&frb_iw_get_reader_without_gvl_i, iw);
+    VALUE rir = TypedData_Wrap_Struct(cIndexReader, &frb_index_reader_t, ir);
+    ir->rir = rir;
+    frb_ir_set_field_num_map(rir, ir);
+    return rir;
+}
+
+/*
+ *  call-seq:
+ *     iw.reader_latest?(index_reader) -> bool
+ *
+ *  Return false if documents have been added to or deleted from the index
+ *  since +index_reader+ was opened with #reader.
+ */
+typedef struct IwReaderIsLatestArgs {
+    FrtIndexWriter *iw;
+    FrtIndexReader *ir;
+} IwReaderIsLatestArgs;
+
+static void *frb_iw_reader_is_latest_without_gvl_i(void *arg) {
+    IwReaderIsLatestArgs *args = (IwReaderIsLatestArgs *)arg;
+    return frt_iw_reader_is_latest(args->iw, args->ir) ? (void *)1 : NULL;
+}
+
+static VALUE
+frb_iw_reader_is_latest(VALUE self, VALUE rir)
+{
+    IwReaderIsLatestArgs args;
+    args.iw = (FrtIndexWriter *)DATA_PTR(self);
+    TypedData_Get_Struct(rir, FrtIndexReader, &frb_index_reader_t, args.ir);
+    return frb_thread_call_without_gvl(&frb_iw_reader_is_latest_without_gvl_i, &args) ? Qtrue : Qfalse;
+}
+
 /*
  *  call-seq:
  *     iw.add_readers(reader_array) -> iw
@@ -1311,22 +1625,38 @@ const rb_data_type_t frb_index_reader_t = {
  *  machines. Then you can finish by merging all of the indexes into a single
  *  index.
  */
+typedef struct IwAddReadersArgs {
+    FrtIndexWriter *iw;
+    FrtIndexReader **irs;
+    int r_cnt;
+} IwAddReadersArgs;
+
+static void *frb_iw_add_readers_without_gvl_i(void *arg) {
+    IwAddReadersArgs *volatile args = (IwAddReadersArgs *)arg;
+    FRT_TRY
+        frt_iw_add_readers(args->iw, args->irs, args->r_cnt);
+    FRT_XFINALLY
+        free(args->irs);
+    FRT_XENDTRY
+    return NULL;
+}
+
 static VALUE frb_iw_add_readers(VALUE self, VALUE rreaders) {
-    FrtIndexWriter *iw = (FrtIndexWriter *)DATA_PTR(self);
+    IwAddReadersArgs args;
     int i;
-    FrtIndexReader **irs;
     Check_Type(rreaders, T_ARRAY);
 
-    irs = FRT_ALLOC_N(FrtIndexReader *, RARRAY_LEN(rreaders));
-    i = RARRAY_LEN(rreaders);
+    args.iw = (FrtIndexWriter *)DATA_PTR(self);
+    args.r_cnt = RARRAY_LEN(rreaders);
+    args.irs = FRT_ALLOC_N(FrtIndexReader *, args.r_cnt);
+    i = args.r_cnt;
     while (i-- > 0) {
         FrtIndexReader *ir;
         TypedData_Get_Struct(RARRAY_PTR(rreaders)[i], FrtIndexReader, &frb_index_reader_t, ir);
         FRT_REF(ir);
-        irs[i] = ir;
+        args.irs[i] = ir;
     }
-    frt_iw_add_readers(iw, irs, RARRAY_LEN(rreaders));
-    free(irs);
+    frb_thread_call_without_gvl(&frb_iw_add_readers_without_gvl_i, &args);
     return self;
 }
 
@@ -1341,22 +1671,53 @@ static VALUE frb_iw_add_readers(VALUE self, VALUE rreaders) {
  *  in them. There are of course exceptions to this rule. For example, you may
  *  want to delete all documents with the term "viagra" when deleting spam.
  */
+typedef struct IwDeleteArgs {
+    FrtIndexWriter *iw;
+    ID field;
+    char **terms;
+    int term_cnt;
+} IwDeleteArgs;
+
+static void *frb_iw_delete_without_gvl_i(void *arg) {
+    IwDeleteArgs *volatile args = (IwDeleteArgs *)arg;
+    int i;
+    FRT_TRY
+        frt_iw_delete_terms(args->iw, args->field, args->terms, args->term_cnt);
+    FRT_XFINALLY
+        for (i = 0; i < args->term_cnt; i++) {
+            free(args->terms[i]);
+        }
+        free(args->terms);
+    FRT_XENDTRY
+    return NULL;
+}
+
 static VALUE
 frb_iw_delete(VALUE self, VALUE rfield, VALUE rterm)
 {
-    FrtIndexWriter *iw = (FrtIndexWriter *)DATA_PTR(self);
+    IwDeleteArgs args;
+    int i;
+    args.iw = (FrtIndexWriter *)DATA_PTR(self);
+    args.field = frb_field(rfield);
     if (TYPE(rterm) == T_ARRAY) {
-        const int term_cnt = RARRAY_LEN(rterm);
-        int i;
-        char **terms = FRT_ALLOC_N(char *, term_cnt);
-        for (i = 0; i < term_cnt; i++) {
-            terms[i] = StringValuePtr(RARRAY_PTR(rterm)[i]);
+        args.term_cnt = RARRAY_LEN(rterm);
+        for (i = 0; i < args.term_cnt; i++) {
+            StringValue(RARRAY_PTR(rterm)[i]);
         }
-        frt_iw_delete_terms(iw, frb_field(rfield), terms, term_cnt);
-        free(terms);
     } else {
-        frt_iw_delete_term(iw, frb_field(rfield), StringValuePtr(rterm));
+        StringValue(rterm);
+        args.term_cnt = 1;
     }
+    /* the terms are copied as they are deleted without the GVL */
+    args.terms = FRT_ALLOC_N(char *, args.term_cnt);
+    if (TYPE(rterm) == T_ARRAY) {
+        for (i = 0; i < args.term_cnt; i++) {
+            args.terms[i] = rstrdup(RARRAY_PTR(rterm)[i]);
+        }
+    } else {
+        args.terms[0] = rstrdup(rterm);
+    }
+    frb_thread_call_without_gvl(&frb_iw_delete_without_gvl_i, &args);
     return self;
 }
 
@@ -1661,6 +2022,245 @@ frb_iw_set_use_compound_file(VALUE self, VALUE rval)
     return rval;
 }
 
+/*
+ *  call-seq:
+ *     iw.max_doc_writers -> number
+ *
+ *  Return the current value of max_doc_writers
+ */
+static VALUE
+frb_iw_get_max_doc_writers(VALUE self)
+{
+    FrtIndexWriter *iw = (FrtIndexWriter *)DATA_PTR(self);
+    return INT2FIX(iw->config.max_doc_writers);
+}
+
+/*
+ *  call-seq:
+ *     iw.max_doc_writers = max_doc_writers -> max_doc_writers
+ *
+ *  Set the max_doc_writers parameter
+ */
+static VALUE
+frb_iw_set_max_doc_writers(VALUE self, VALUE rval)
+{
+    FrtIndexWriter *iw = (FrtIndexWriter *)DATA_PTR(self);
+    iw->config.max_doc_writers = FIX2INT(rval);
+    return rval;
+}
+
+/*
+ *  call-seq:
+ *     iw.max_merge_threads -> number
+ *
+ *  Return the current value of max_merge_threads
+ */
+static VALUE
+frb_iw_get_max_merge_threads(VALUE self)
+{
+    FrtIndexWriter *iw = (FrtIndexWriter *)DATA_PTR(self);
+    return INT2FIX(iw->config.max_merge_threads);
+}
+
+/*
+ *  call-seq:
+ *     iw.max_merge_threads = max_merge_threads -> max_merge_threads
+ *
+ *  Set the max_merge_threads parameter
+ */
+static VALUE
+frb_iw_set_max_merge_threads(VALUE self, VALUE rval)
+{
+    FrtIndexWriter *iw = (FrtIndexWriter *)DATA_PTR(self);
+    iw->config.max_merge_threads = FIX2INT(rval);
+    return rval;
+}
+
+/*
+ *  call-seq:
+ *     iw.max_merge_bytes_per_sec -> number
+ *
+ *  Return the current value of max_merge_bytes_per_sec
+ */
+static VALUE
+frb_iw_get_max_merge_bytes_per_sec(VALUE self)
+{
+    FrtIndexWriter *iw = (FrtIndexWriter *)DATA_PTR(self);
+    return INT2FIX(iw->config.max_merge_bytes_per_sec);
+}
+
+/*
+ *  call-seq:
+ *     iw.max_merge_bytes_per_sec = max_merge_bytes_per_sec -> max_merge_bytes_per_sec
+ *
+ *  Set the max_merge_bytes_per_sec parameter
+ */
+static VALUE
+frb_iw_set_max_merge_bytes_per_sec(VALUE self, VALUE rval)
+{
+    FrtIndexWriter *iw = (FrtIndexWriter *)DATA_PTR(self);
+    iw->config.max_merge_bytes_per_sec = FIX2INT(rval);
+    return rval;
+}
+
+/*
+ *  call-seq:
+ *     iw.merge_policy -> :log_doc or :tiered
+ *
+ *  Return the merge policy used to pick the segments to merge
+ */
+static VALUE
+frb_iw_get_merge_policy(VALUE self)
+{
+    FrtIndexWriter *iw = (FrtIndexWriter *)DATA_PTR(self);
+    return frb_merge_policy_sym(iw->config.merge_policy);
+}
+
+/*
+ *  call-seq:
+ *     iw.merge_policy = merge_policy -> merge_policy
+ *
+ *  Set the merge policy, either :log_doc or :tiered. The new policy is used
+ *  from the next merge on.
+ */
+static void *frb_iw_set_merge_policy_without_gvl_i(void *arg) {
+    FrtIndexWriter *iw = (FrtIndexWriter *)arg;
+    frt_iw_set_merge_policy(iw, frt_merge_policy_new(iw->config.merge_policy));
+    return NULL;
+}
+
+static VALUE
+frb_iw_set_merge_policy(VALUE self, VALUE rval)
+{
+    FrtIndexWriter *iw = (FrtIndexWriter *)DATA_PTR(self);
+    int type = frb_get_merge_policy_type(rval);
+    if (type < 0) {
+        rb_raise(rb_eArgError, "merge_policy must be :log_doc or :tiered");
+    }
+    iw->config.merge_policy = (FrtMergePolicyType)type;
+    frb_thread_call_without_gvl(&frb_iw_set_merge_policy_without_gvl_i, iw);
+    return rval;
+}
+
+/*
+ *  call-seq:
+ *     iw.postings_format -> :vint or :block
+ *
+ *  Return the format new segments store their postings in
+ */
+static VALUE
+frb_iw_get_postings_format(VALUE self)
+{
+    FrtIndexWriter *iw = (FrtIndexWriter *)DATA_PTR(self);
+    return frb_postings_format_sym(iw->config.postings_format);
+}
+
+/*
+ *  call-seq:
+ *     iw.postings_format = postings_format -> postings_format
+ *
+ *  Set the postings format, either :vint or :block. Segments written and
+ *  merged from now on use the new format, existing segments keep theirs.
+ */
+static VALUE
+frb_iw_set_postings_format(VALUE self, VALUE rval)
+{
+    FrtIndexWriter *iw = (FrtIndexWriter *)DATA_PTR(self);
+    int format = frb_get_postings_format(rval);
+    if (format < 0) {
+        rb_raise(rb_eArgError, "postings_format must be :vint or :block");
+    }
+    iw->config.postings_format = (FrtPostingsFormat)format;
+    return rval;
+}
+
+/*
+ *  call-seq:
+ *     iw.stored_fields_format -> :plain or :block
+ *
+ *  Return the format new segments store their stored fields in
+ */
+static VALUE
+frb_iw_get_stored_fields_format(VALUE self)
+{
+    FrtIndexWriter *iw = (FrtIndexWriter *)DATA_PTR(self);
+    return frb_stored_fields_format_sym(iw->config.stored_fields_format);
+}
+
+/*
+ *  call-seq:
+ *     iw.stored_fields_format = stored_fields_format -> stored_fields_format
+ *
+ *  Set the stored fields format, either :plain or :block. Segments written
+ *  and merged from now on use the new format, existing segments keep theirs.
+ *  :block segments ignore the :compression of each field.
+ */
+static VALUE
+frb_iw_set_stored_fields_format(VALUE self, VALUE rval)
+{
+    FrtIndexWriter *iw = (FrtIndexWriter *)DATA_PTR(self);
+    int format = frb_get_stored_fields_format(rval);
+    if (format < 0) {
+        rb_raise(rb_eArgError, "stored_fields_format must be :plain or :block");
+    }
+    iw->config.stored_fields_format = (FrtStoredFieldsFormat)format;
+    return rval;
+}
+
+/*
+ *  call-seq:
+ *     iw.max_merged_segment_bytes -> number
+ *
+ *  Return the current value of max_merged_segment_bytes
+ */
+static VALUE
+frb_iw_get_max_merged_segment_bytes(VALUE self)
+{
+    FrtIndexWriter *iw = (FrtIndexWriter *)DATA_PTR(self);
+    return LL2NUM(iw->config.max_merged_segment_bytes);
+}
+
+/*
+ *  call-seq:
+ *     iw.max_merged_segment_bytes = max_merged_segment_bytes -> max_merged_segment_bytes
+ *
+ *  Set the max_merged_segment_bytes parameter
+ */
+static VALUE
+frb_iw_set_max_merged_segment_bytes(VALUE self, VALUE rval)
+{
+    FrtIndexWriter *iw = (FrtIndexWriter *)DATA_PTR(self);
+    iw->config.max_merged_segment_bytes = (frt_off_t)NUM2LL(rval);
+    return rval;
+}
+
+/*
+ *  call-seq:
+ *     iw.deletes_pct_allowed -> number
+ *
+ *  Return the current value of deletes_pct_allowed
+ */
+static VALUE
+frb_iw_get_deletes_pct_allowed(VALUE self)
+{
+    FrtIndexWriter *iw = (FrtIndexWriter *)DATA_PTR(self);
+    return INT2FIX(iw->config.deletes_pct_allowed);
+}
+
+/*
+ *  call-seq:
+ *     iw.deletes_pct_allowed = deletes_pct_allowed -> deletes_pct_allowed
+ *
+ *  Set the deletes_pct_allowed parameter
+ */
+static VALUE
+frb_iw_set_deletes_pct_allowed(VALUE self, VALUE rval)
+{
+    FrtIndexWriter *iw = (FrtIndexWriter *)DATA_PTR(self);
+    iw->config.deletes_pct_allowed = FIX2INT(rval);
+    return rval;
+}
+
 /****************************************************************************
  *
  * IndexReader Methods
@@ -1701,46 +2301,53 @@ static VALUE frb_ir_alloc(VALUE rclass) {
     return TypedData_Wrap_Struct(rclass, &frb_index_reader_t, ir);
 }
 
-static VALUE frb_ir_init(VALUE self, VALUE rdir) {
-    FrtStore *store = NULL;
-    FrtIndexReader *ir;
+static void frb_ir_set_field_num_map(VALUE self, FrtIndexReader *ir) {
     int i;
-    FrtFieldInfos *fis;
+    FrtFieldInfos *fis = ir->fis;
     VALUE rfield_num_map = rb_hash_new();
-    int ex_code = 0;
-    const char *msg = NULL;
+    for (i = 0; i < fis->size; i++) {
+        FrtFieldInfo *fi = fis->fields[i];
+        rb_hash_aset(rfield_num_map, ID2SYM(fi->name), INT2FIX(fi->number));
+    }
+    rb_ivar_set(self, id_fld_num_map, rfield_num_map);
+}
+
+static VALUE frb_ir_init(VALUE self, VALUE rdir) {
+    FrtStore *volatile store = NULL;
+    FrtIndexReader *volatile ir;
+    volatile int ex_code = 0;
+    const char *volatile msg = NULL;
     FRT_TRY
         if (TYPE(rdir) == T_ARRAY) {
-            VALUE rdirs = rdir;
             const int reader_cnt = RARRAY_LEN(rdir);
             FrtIndexReader **sub_readers = FRT_ALLOC_N(FrtIndexReader *, reader_cnt);
             int i;
             for (i = 0; i < reader_cnt; i++) {
-                rdir = RARRAY_PTR(rdirs)[i];
-                switch (TYPE(rdir)) {
+                VALUE rsub_dir = RARRAY_PTR(rdir)[i];
+                switch (TYPE(rsub_dir)) {
                     case T_DATA:
-                        if (CLASS_OF(rdir) == cIndexReader) {
-                            TypedData_Get_Struct(rdir, FrtIndexReader, &frb_index_reader_t, sub_readers[i]);
+                        if (CLASS_OF(rsub_dir) == cIndexReader) {
+                            TypedData_Get_Struct(rsub_dir, FrtIndexReader, &frb_index_reader_t, sub_readers[i]);
                             continue;
-                        } else if (RTEST(rb_obj_is_kind_of(rdir, cDirectory))) {
-                            store = DATA_PTR(rdir);
+                        } else if (RTEST(rb_obj_is_kind_of(rsub_dir, cDirectory))) {
+                            store = DATA_PTR(rsub_dir);
                         } else {
                             FRT_RAISE(FRT_ARG_ERROR, "A Multi-IndexReader can only "
                                     "be created from other IndexReaders, "
                                     "Directory objects or file-system paths. "
                                     "Not %s",
-                                    rs2s(rb_obj_as_string(rdir)));
+                                    rs2s(rb_obj_as_string(rsub_dir)));
                         }
                         break;
                     case T_STRING:
-                        frb_create_dir(rdir);
-                        store = frt_open_fs_store(rs2s(rdir));
+                        frb_create_dir(rsub_dir);
+                        store = frt_open_fs_store(rs2s(rsub_dir));
                         break;
                     default:
                         FRT_RAISE(FRT_ARG_ERROR, "%s isn't a valid directory "
                                 "argument. You should use either a String or "
                                 "a Directory",
-                                rs2s(rb_obj_as_string(rdir)));
+                                rs2s(rb_obj_as_string(rsub_dir)));
                         break;
                 }
                 sub_readers[i] = frt_ir_open(NULL, store);
@@ -1780,13 +2387,7 @@ static VALUE frb_ir_init(VALUE self, VALUE rdir) {
     }
 
     ir->rir = self;
-
-    fis = ir->fis;
-    for (i = 0; i < fis->size; i++) {
-        FrtFieldInfo *fi = fis->fields[i];
-        rb_hash_aset(rfield_num_map, ID2SYM(fi->name), INT2FIX(fi->number));
-    }
-    rb_ivar_set(self, id_fld_num_map, rfield_num_map);
+    frb_ir_set_field_num_map(self, ir);
 
     return self;
 }
@@ -1860,11 +2461,16 @@ frb_ir_get_norms_into(VALUE self, VALUE rfield, VALUE rnorms, VALUE roffset)
  *  Commit any deletes made by this particular IndexReader to the index. This
  *  will use open a Commit lock.
  */
+static void *frb_ir_commit_without_gvl_i(void *arg) {
+    frt_ir_commit((FrtIndexReader *)arg);
+    return NULL;
+}
+
 static VALUE
 frb_ir_commit(VALUE self)
 {
     FrtIndexReader *ir = (FrtIndexReader *)DATA_PTR(self);
-    frt_ir_commit(ir);
+    frb_thread_call_without_gvl(&frb_ir_commit_without_gvl_i, ir);
     return self;
 }
 
@@ -1911,11 +2517,25 @@ frb_ir_has_deletions(VALUE self)
  *  document_id is the number used to reference documents in the index and is
  *  returned by search methods.
  */
+typedef struct IrDeleteArgs {
+    FrtIndexReader *ir;
+    int doc_num;
+} IrDeleteArgs;
+
+/* obtaining the write lock may fail, the error is raised in ruby */
+static void *frb_ir_delete_without_gvl_i(void *arg) {
+    IrDeleteArgs *args = (IrDeleteArgs *)arg;
+    frt_ir_delete_doc(args->ir, args->doc_num);
+    return NULL;
+}
+
 static VALUE
 frb_ir_delete(VALUE self, VALUE rdoc_id)
 {
-    FrtIndexReader *ir = (FrtIndexReader *)DATA_PTR(self);
-    frt_ir_delete_doc(ir, FIX2INT(rdoc_id));
+    IrDeleteArgs args;
+    args.ir = (FrtIndexReader *)DATA_PTR(self);
+    args.doc_num = FIX2INT(rdoc_id);
+    frb_thread_call_without_gvl(&frb_ir_delete_without_gvl_i, &args);
     return self;
 }
 
@@ -2057,6 +2677,65 @@ frb_ir_is_latest(VALUE self)
     return frt_ir_is_latest(ir) ? Qtrue : Qfalse;
 }
 
+/*
+ *  call-seq:
+ *     index_reader.reopen -> index_reader
+ *
+ *  Return an IndexReader on the latest version of the index. If the index
+ *  hasn't changed this is the IndexReader itself. Otherwise a new IndexReader
+ *  is returned which shares everything already read for the unchanged
+ *  segments with this one, so only new and changed segments are read. This
+ *  IndexReader still needs to be closed in that case.
+ */
+static void *frb_ir_reopen_without_gvl_i(void *arg) {
+    return frt_ir_reopen((FrtIndexReader *)arg);
+}
+
+static VALUE
+frb_ir_reopen(VALUE self)
+{
+    FrtIndexReader *ir = (FrtIndexReader *)DATA_PTR(self);
+    FrtIndexReader *new_ir = (FrtIndexReader *)frb_thread_call_without_gvl(&frb_ir_reopen_without_gvl_i, ir);
+    VALUE rir;
+    if (new_ir == ir) {
+        return self;
+    }
+    rir = TypedData_Wrap_Struct(cIndexReader, &frb_index_reader_t, new_ir);
+    new_ir->rir = rir;
+    frb_ir_set_field_num_map(rir, new_ir);
+    rb_ivar_set(rir, id_stored_cache, rb_ivar_get(self, id_stored_cache));
+    return rir;
+}
+
+/*
+ *  call-seq:
+ *     index_reader.stored_fields_cache = stored_fields_cache -> stored_fields_cache
+ *
+ *  Cache the decompressed stored fields read by this IndexReader in
+ *  +stored_fields_cache+, see StoredFieldsCache. Set it to nil to stop
+ *  caching. IndexReaders returned by #reopen use the same cache.
+ */
+static VALUE
+frb_ir_set_stored_cache(VALUE self, VALUE rsc)
+{
+    FrtIndexReader *ir = (FrtIndexReader *)DATA_PTR(self);
+    frt_ir_set_stored_cache(ir, NIL_P(rsc) ? NULL : frb_get_sc(rsc));
+    rb_ivar_set(self, id_stored_cache, rsc);
+    return rsc;
+}
+
+/*
+ *  call-seq:
+ *     index_reader.stored_fields_cache -> stored_fields_cache
+ *
+ *  Return the StoredFieldsCache used by this IndexReader or nil.
+ */
+static VALUE
+frb_ir_get_stored_cache(VALUE self)
+{
+    return rb_ivar_get(self, id_stored_cache);
+}
+
 /*
  *  call-seq:
  *     index_reader.term_vector(doc_id, field) -> TermVector
@@ -2234,6 +2913,86 @@ frb_ir_term_count(VALUE self, VALUE rfield)
     return INT2FIX(count);
 }
 
+static VALUE
+frb_dv_str(const char *str)
+{
+    VALUE rstr = rb_str_new2(str);
+    rb_enc_associate(rstr, utf8_encoding);
+    return rstr;
+}
+
+static void
+frb_ir_add_doc_values(FrtIndexReader *ir, ID field, VALUE rvals, int base)
+{
+    if (FRT_MULTI_READER == ir->type) {
+        FrtMultiReader *mr = (FrtMultiReader *)ir;
+        int i;
+        for (i = 0; i < mr->r_cnt; i++) {
+            frb_ir_add_doc_values(mr->sub_readers[i], field, rvals,
+                                  base + mr->starts[i]);
+        }
+    } else {
+        FrtDocValues *dv = frt_sr_get_doc_values(ir, field);
+        int i, j, cnt;
+        const int *ords;
+        if (NULL == dv) {
+            return;
+        }
+        for (i = 0; i < dv->size; i++) {
+            VALUE rval = Qnil;
+            if (!frt_dv_has_value(dv, i)) {
+                continue;
+            }
+            switch (dv->type) {
+                case FRT_DOC_VALUES_NUMERIC:
+                    rval = LL2NUM(frt_dv_get_long(dv, i));
+                    break;
+                case FRT_DOC_VALUES_SORTED:
+                    rval = frb_dv_str(dv->ords[frt_dv_get_ord(dv, i)]);
+                    break;
+                case FRT_DOC_VALUES_SORTED_SET:
+                    cnt = frt_dv_get_ords(dv, i, &ords);
+                    rval = rb_ary_new2(cnt);
+                    for (j = 0; j < cnt; j++) {
+                        rb_ary_push(rval, frb_dv_str(dv->ords[ords[j]]));
+                    }
+                    break;
+                default:
+                    break;
+            }
+            rb_ary_store(rvals, base + i, rval);
+        }
+    }
+}
+
+/*
+ *  call-seq:
+ *     index_reader.doc_values(field) -> array
+ *
+ *  Returns the doc values stored for the field +field+ as an array with one
+ *  entry per document number. Entries are Integers for +:numeric+ fields,
+ *  Strings for +:sorted+ fields and Arrays of Strings for +:sorted_set+
+ *  fields. Documents without a value for the field are +nil+. Raises an
+ *  ArgumentError if +field+ wasn't added with the +:doc_values+ option.
+ */
+static VALUE
+frb_ir_doc_values(VALUE self, VALUE rfield)
+{
+    FrtIndexReader *ir = (FrtIndexReader *)DATA_PTR(self);
+    FrtFieldInfo *fi = frt_fis_get_field(ir->fis, frb_field(rfield));
+    VALUE rvals;
+    if (NULL == fi || !bits_doc_values_type(fi->bits)) {
+        rb_raise(rb_eArgError, "field :%s has no doc values",
+                 rb_id2name(frb_field(rfield)));
+    }
+    rvals = rb_ary_new2(ir->max_doc(ir));
+    if (ir->max_doc(ir) > 0) {
+        rb_ary_store(rvals, ir->max_doc(ir) - 1, Qnil);
+    }
+    frb_ir_add_doc_values(ir, fi->name, rvals, 0);
+    return rvals;
+}
+
 /*
  *  call-seq:
  *     index_reader.fields -> array of field-names
@@ -2662,6 +3421,68 @@ static void Init_TermVector(void) {
  *                        having too many files open at the same time. The
  *                        default is true but performance is better if this is
  *                        set to false.
+ *  max_doc_writers::     Default: 1. The number of documents that may be
+ *                        analyzed at the same time. Each thread adding
+ *                        documents gets its own buffer which is flushed to
+ *                        its own segment so indexing from several threads
+ *                        can use several cores. Note that each buffer may
+ *                        use up to +:max_buffer_memory+.
+ *  max_merge_threads::   Default: 0. The number of background threads used
+ *                        to merge segments. With the default of 0 segments
+ *                        are merged by the thread adding the document which
+ *                        triggered the merge, so the occasional call to
+ *                        add_document can take a long time. Background
+ *                        merges are finished before documents are deleted,
+ *                        the index is optimized or the writer is closed.
+ *  max_merge_bytes_per_sec:: Default: 0. Throttle background merges to
+ *                        write at most this many bytes per second so that
+ *                        they don't starve searches of I/O. 0 means no limit.
+ *  merge_policy::        Default: :log_doc. How segments are picked for
+ *                        merging. :log_doc merges segments once
+ *                        +:merge_factor+ segments with a similar number of
+ *                        documents have been written. :tiered looks at the
+ *                        size of the segments instead, prefers merging
+ *                        evenly sized segments and segments with many
+ *                        deleted documents and never creates segments
+ *                        larger than +:max_merged_segment_bytes+.
+ *  max_merged_segment_bytes:: Default: 5GB. The largest segment the :tiered
+ *                        merge policy will create.
+ *  deletes_pct_allowed:: Default: 20. When using the :tiered merge policy,
+ *                        segments with a larger percentage of deleted
+ *                        documents get rewritten to reclaim the space.
+ *  postings_format::     Default: :vint. How the documents each term occurs
+ *                        in are stored. :vint stores each document number
+ *                        and frequency as a variable length integer. :block
+ *                        packs them, and the positions of the term, in
+ *                        blocks of 128 values which are much faster to
+ *                        decode, speeding up queries on frequent terms
+ *                        and phrases. :doc_skip_interval is ignored for
+ *                        :block segments since they can only skip whole
+ *                        blocks. Each segment records its own format so the
+ *                        format of an existing index can be changed; merged
+ *                        segments are written in the new format.
+ *  stored_fields_format:: Default: :plain. How the stored fields are
+ *                        written. :plain writes each document's values on
+ *                        their own, compressing each value separately if its
+ *                        field is compressed. :block gathers the values of
+ *                        consecutive documents into LZ4 compressed blocks of
+ *                        about 16KB, which compress much better when the
+ *                        values are short, and keeps the last block read so
+ *                        documents which are close together are loaded
+ *                        without decompressing them again. The compression
+ *                        set for each field is ignored in :block segments.
+ *                        Like +:postings_format+ it can be changed for an
+ *                        existing index.
+ *  index_sort::          Default: nil. Keep the documents of each segment
+ *                        sorted by this Sort, given in any form the :sort
+ *                        search option takes. Searches sorted the same way
+ *                        (or by the first fields of it) which set
+ *                        :total_hits_threshold can then stop reading a
+ *                        segment as soon as they have found enough hits in
+ *                        it. Each SortField needs a type other than :auto,
+ *                        :score or :doc_id. Flushed segments are rewritten
+ *                        in sort order and merges are run in the writing
+ *                        thread even if +:max_merge_threads+ is set.
  *
  *
  *  === Deleting Documents
@@ -2694,6 +3515,20 @@ void Init_IndexWriter(void) {
     sym_max_merge_docs    = ID2SYM(rb_intern("max_merge_docs"));
     sym_max_field_length  = ID2SYM(rb_intern("max_field_length"));
     sym_use_compound_file = ID2SYM(rb_intern("use_compound_file"));
+    sym_max_doc_writers   = ID2SYM(rb_intern("max_doc_writers"));
+    sym_max_merge_threads = ID2SYM(rb_intern("max_merge_threads"));
+    sym_max_merge_bytes_per_sec = ID2SYM(rb_intern("max_merge_bytes_per_sec"));
+    sym_merge_policy      = ID2SYM(rb_intern("merge_policy"));
+    sym_max_merged_segment_bytes = ID2SYM(rb_intern("max_merged_segment_bytes"));
+    sym_deletes_pct_allowed = ID2SYM(rb_intern("deletes_pct_allowed"));
+    sym_log_doc           = ID2SYM(rb_intern("log_doc"));
+    sym_tiered            = ID2SYM(rb_intern("tiered"));
+    sym_postings_format   = ID2SYM(rb_intern("postings_format"));
+    sym_vint              = ID2SYM(rb_intern("vint"));
+    sym_block             = ID2SYM(rb_intern("block"));
+    sym_stored_fields_format = ID2SYM(rb_intern("stored_fields_format"));
+    sym_plain             = ID2SYM(rb_intern("plain"));
+    sym_index_sort        = ID2SYM(rb_intern("index_sort"));
 
     cIndexWriter = rb_define_class_under(mIndex, "IndexWriter", rb_cObject);
     rb_define_alloc_func(cIndexWriter, frb_iw_alloc);
@@ -2711,6 +3546,14 @@ void Init_IndexWriter(void) {
     rb_define_const(cIndexWriter, "DEFAULT_MAX_MERGE_DOCS", INT2FIX(frt_default_config.max_merge_docs));
     rb_define_const(cIndexWriter, "DEFAULT_MAX_FIELD_LENGTH", INT2FIX(frt_default_config.max_field_length));
     rb_define_const(cIndexWriter, "DEFAULT_USE_COMPOUND_FILE", frt_default_config.use_compound_file ? Qtrue : Qfalse);
+    rb_define_const(cIndexWriter, "DEFAULT_MAX_DOC_WRITERS", INT2FIX(frt_default_config.max_doc_writers));
+    rb_define_const(cIndexWriter, "DEFAULT_MAX_MERGE_THREADS", INT2FIX(frt_default_config.max_merge_threads));
+    rb_define_const(cIndexWriter, "DEFAULT_MAX_MERGE_BYTES_PER_SEC", INT2FIX(frt_default_config.max_merge_bytes_per_sec));
+    rb_define_const(cIndexWriter, "DEFAULT_MERGE_POLICY", frb_merge_policy_sym(frt_default_config.merge_policy));
+    rb_define_const(cIndexWriter, "DEFAULT_MAX_MERGED_SEGMENT_BYTES", LL2NUM(frt_default_config.max_merged_segment_bytes));
+    rb_define_const(cIndexWriter, "DEFAULT_DELETES_PCT_ALLOWED", INT2FIX(frt_default_config.deletes_pct_allowed));
+    rb_define_const(cIndexWriter, "DEFAULT_POSTINGS_FORMAT", frb_postings_format_sym(frt_default_config.postings_format));
+    rb_define_const(cIndexWriter, "DEFAULT_STORED_FIELDS_FORMAT", frb_stored_fields_format_sym(frt_default_config.stored_fields_format));
 
     rb_define_method(cIndexWriter, "initialize",   frb_iw_init, -1);
     rb_define_method(cIndexWriter, "doc_count",    frb_iw_get_doc_count, 0);
@@ -2719,6 +3562,8 @@ void Init_IndexWriter(void) {
     rb_define_method(cIndexWriter, "<<",           frb_iw_add_doc, 1);
     rb_define_method(cIndexWriter, "optimize",     frb_iw_optimize, 0);
     rb_define_method(cIndexWriter, "commit",       frb_iw_commit, 0);
+    rb_define_method(cIndexWriter, "reader",       frb_iw_get_reader, 0);
+    rb_define_method(cIndexWriter, "reader_latest?", frb_iw_reader_is_latest, 1);
     rb_define_method(cIndexWriter, "add_readers",  frb_iw_add_readers, 1);
     rb_define_method(cIndexWriter, "delete",       frb_iw_delete, 2);
     rb_define_method(cIndexWriter, "field_infos",  frb_iw_field_infos, 0);
@@ -2752,6 +3597,29 @@ void Init_IndexWriter(void) {
 
     rb_define_method(cIndexWriter, "use_compound_file",  frb_iw_get_use_compound_file, 0);
     rb_define_method(cIndexWriter, "use_compound_file=", frb_iw_set_use_compound_file, 1);
+
+    rb_define_method(cIndexWriter, "max_doc_writers",  frb_iw_get_max_doc_writers, 0);
+    rb_define_method(cIndexWriter, "max_doc_writers=", frb_iw_set_max_doc_writers, 1);
+
+    rb_define_method(cIndexWriter, "max_merge_threads",  frb_iw_get_max_merge_threads, 0);
+    rb_define_method(cIndexWriter, "max_merge_threads=", frb_iw_set_max_merge_threads, 1);
+
+    rb_define_method(cIndexWriter, "max_merge_bytes_per_sec",  frb_iw_get_max_merge_bytes_per_sec, 0);
+    rb_define_method(cIndexWriter, "max_merge_bytes_per_sec=", frb_iw_set_max_merge_bytes_per_sec, 1);
+
+    rb_define_method(cIndexWriter, "merge_policy",  frb_iw_get_merge_policy, 0);
+    rb_define_method(cIndexWriter, "merge_policy=", frb_iw_set_merge_policy, 1);
+
+    rb_define_method(cIndexWriter, "max_merged_segment_bytes",  frb_iw_get_max_merged_segment_bytes, 0);
+    rb_define_method(cIndexWriter, "max_merged_segment_bytes=", frb_iw_set_max_merged_segment_bytes, 1);
+
+    rb_define_method(cIndexWriter, "deletes_pct_allowed",  frb_iw_get_deletes_pct_allowed, 0);
+    rb_define_method(cIndexWriter, "deletes_pct_allowed=", frb_iw_set_deletes_pct_allowed, 1);
+
+    rb_define_method(cIndexWriter, "postings_format",  frb_iw_get_postings_format, 0);
+    rb_define_method(cIndexWriter, "postings_format=", frb_iw_set_postings_format, 1);
+    rb_define_method(cIndexWriter, "stored_fields_format",  frb_iw_get_stored_fields_format, 0);
+    rb_define_method(cIndexWriter, "stored_fields_format=", frb_iw_set_stored_fields_format, 1);
 }
 
 /*
@@ -2780,6 +3648,7 @@ void Init_IndexReader(void) {
     rb_define_method(cIndexReader, "num_docs",       frb_ir_num_docs,      0);
     rb_define_method(cIndexReader, "undelete_all",   frb_ir_undelete_all,  0);
     rb_define_method(cIndexReader, "latest?",        frb_ir_is_latest,     0);
+    rb_define_method(cIndexReader, "reopen",         frb_ir_reopen,        0);
     rb_define_method(cIndexReader, "get_document",   frb_ir_get_doc,      -1);
     rb_define_method(cIndexReader, "[]",             frb_ir_get_doc,      -1);
     rb_define_method(cIndexReader, "term_vector",    frb_ir_term_vector,   2);
@@ -2789,6 +3658,7 @@ void Init_IndexReader(void) {
     rb_define_method(cIndexReader, "term_docs_for",  frb_ir_term_docs_for, 2);
     rb_define_method(cIndexReader, "term_positions_for", frb_ir_t_pos_for, 2);
     rb_define_method(cIndexReader, "doc_freq",       frb_ir_doc_freq,      2);
+    rb_define_method(cIndexReader, "doc_values",     frb_ir_doc_values,    1);
     rb_define_method(cIndexReader, "terms",          frb_ir_terms,         1);
     rb_define_method(cIndexReader, "terms_from",     frb_ir_terms_from,    2);
     rb_define_method(cIndexReader, "term_count",     frb_ir_term_count,    1);
@@ -2799,6 +3669,37 @@ void Init_IndexReader(void) {
     rb_define_method(cIndexReader, "version",        frb_ir_version,       0);
     rb_define_method(cIndexReader, "each",           frb_ir_each,          0);
     rb_define_method(cIndexReader, "to_enum",        frb_ir_to_enum,       0);
+    rb_define_method(cIndexReader, "stored_fields_cache",  frb_ir_get_stored_cache, 0);
+    rb_define_method(cIndexReader, "stored_fields_cache=", frb_ir_set_stored_cache, 1);
+}
+
+/*
+ *  Document-class: Ferret::Index::StoredFieldsCache
+ *
+ *  == Summary
+ *
+ *  A StoredFieldsCache keeps the stored fields of recently loaded documents
+ *  decompressed in memory. Only data which needs decompressing is cached,
+ *  that is compressed fields and all fields of segments written with the
+ *  :block stored fields format. It can be shared by several IndexReaders.
+ *
+ *  === Example
+ *
+ *    cache = StoredFieldsCache.new(64 * 1024 * 1024)
+ *    reader.stored_fields_cache = cache
+ *    reader[12][:content]
+ *    reader[12][:content] # read from the cache
+ */
+static void Init_StoredFieldsCache(void) {
+    id_stored_cache = rb_intern("@stored_fields_cache");
+
+    cStoredFieldsCache = rb_define_class_under(mIndex, "StoredFieldsCache", rb_cObject);
+    rb_define_alloc_func(cStoredFieldsCache, frb_sc_alloc);
+    rb_define_method(cStoredFieldsCache, "initialize", frb_sc_init,      -1);
+    rb_define_method(cStoredFieldsCache, "hits",       frb_sc_hits,       0);
+    rb_define_method(cStoredFieldsCache, "misses",     frb_sc_misses,     0);
+    rb_define_method(cStoredFieldsCache, "size",       frb_sc_bytes,      0);
+    rb_define_method(cStoredFieldsCache, "max_size",   frb_sc_max_bytes,  0);
 }
 
 /* rdoc hack
@@ -2840,4 +3741,5 @@ void Init_Index(void) {
     Init_LazyDoc();
     Init_IndexWriter();
     Init_IndexReader();
+    Init_StoredFieldsCache();
 }
@@ -28,6 +28,7 @@ static ID id_to_h;
 static ID id_to_proc;
 static ID id_transform_keys;
 static ID id_transform_values;
+static ID id_stored_bytes;
 
 FrtLazyDoc empty_lazy_doc = {0};
 VALUE cLazyDoc;
@@ -35,8 +36,44 @@ VALUE cLazyDoc;
 typedef struct rLazyDoc {
   FrtHash    *hash;
   FrtLazyDoc *doc;
+  VALUE      rstored_bytes;
 } rLazyDoc;
 
+/* values at least this long which can be read in place are not copied */
+#define FRB_ZERO_COPY_MIN_LEN 4096
+
+/****************************************************************************
+ *
+ * Stored Bytes
+ *
+ ****************************************************************************/
+
+/* Keeps the data the values of a LazyDoc are read from alive for the strings
+ * pointing straight at it. Each of these strings references it */
+
+static void frb_sb_free(void *p) {
+  frt_is_close((FrtInStream *)p);
+}
+
+static size_t frb_sb_size(const void *p) {
+  (void)p;
+  return sizeof(FrtInStream);
+}
+
+const rb_data_type_t frb_sb_t = {
+  .wrap_struct_name = "FrbStoredBytes",
+  .function = {
+    .dmark = NULL,
+    .dfree = frb_sb_free,
+    .dsize = frb_sb_size,
+    .dcompact = NULL,
+    .reserved = {0},
+  },
+  .parent = NULL,
+  .data = NULL,
+  .flags = RUBY_TYPED_FREE_IMMEDIATELY
+};
+
 /****************************************************************************
  *
  * LazyDoc Methods
@@ -62,7 +99,9 @@ void rld_mark(void *key, void *value, void *arg) {
 }
 
 static void frb_ld_mark(void *p) {
-  frt_h_each(((rLazyDoc *)p)->hash, rld_mark, NULL);
+  rLazyDoc *rld = (rLazyDoc *)p;
+  frt_h_each(rld->hash, rld_mark, NULL);
+  rb_gc_mark(rld->rstored_bytes);
 }
 
 const rb_data_type_t frb_ld_t = {
@@ -83,6 +122,7 @@ VALUE frb_get_lazy_doc(FrtLazyDoc *lazy_doc) {
   rLazyDoc *rld = FRT_ALLOC(rLazyDoc);
   rld->hash = frt_h_new_ptr(NULL);
   rld->doc = lazy_doc;
+  rld->rstored_bytes = Qnil;
   return TypedData_Wrap_Struct(cLazyDoc, &frb_ld_t, rld);
 }
 
@@ -90,27 +130,51 @@ static VALUE frb_ld_alloc(VALUE rclass) {
   rLazyDoc *rld = FRT_ALLOC(rLazyDoc);
   rld->hash = frt_h_new_ptr(NULL);
   rld->doc = &empty_lazy_doc;
+  rld->rstored_bytes = Qnil;
   return TypedData_Wrap_Struct(rclass, &frb_ld_t, rld);
 }
 
+/* Large values which are memory mapped or have been decompressed already
+ * are returned as frozen strings pointing right at the data instead of being
+ * copied twice. Each of these strings keeps the data alive through a hidden
+ * reference to the LazyDoc's stored bytes. */
+static VALUE frb_ld_df_value(rLazyDoc *rld, FrtLazyDocField *lazy_df, int i) {
+  rb_encoding *enc = lazy_df->data[i].encoding;
+  const char *ptr;
+  VALUE rstr;
+  /* peeking only works for uncompressed values so the stored length is the
+   * length of the data */
+  if (lazy_df->data[i].length >= FRB_ZERO_COPY_MIN_LEN
+      && rb_enc_mbminlen(enc) == 1
+      && NULL != (ptr = frt_lazy_df_peek_data(lazy_df, i))) {
+    if (NIL_P(rld->rstored_bytes)) {
+      rld->rstored_bytes = TypedData_Wrap_Struct(rb_cObject, &frb_sb_t,
+          frt_is_clone(rld->doc->fields_in));
+    }
+    rstr = rb_enc_str_new_static(ptr, lazy_df->data[i].length, enc);
+    rb_ivar_set(rstr, id_stored_bytes, rld->rstored_bytes);
+    return rb_obj_freeze(rstr);
+  }
+  /* a compressed value only has its real length once it is decompressed */
+  ptr = frt_lazy_df_get_data(lazy_df, i);
+  rstr = rb_str_new(ptr, lazy_df->data[i].length);
+  rb_enc_associate(rstr, enc);
+  return rstr;
+}
+
 static VALUE frb_ld_df_load(VALUE self, VALUE rkey, FrtLazyDocField *lazy_df) {
   rLazyDoc *rld = DATA_PTR(self);
   VALUE rdata;
   if (lazy_df->size == 1) {
-    char *data = frt_lazy_df_get_data(lazy_df, 0);
-    rdata = rb_str_new(data, lazy_df->data[0].length);
-    rb_enc_associate(rdata, lazy_df->data[0].encoding);
+    rdata = frb_ld_df_value(rld, lazy_df, 0);
   } else {
     int i;
-    VALUE rstr;
     rdata = rb_ary_new2(lazy_df->size);
     for (i = 0; i < lazy_df->size; i++) {
-      char *data = frt_lazy_df_get_data(lazy_df, i);
-      rstr = rb_str_new(data, lazy_df->data[i].length);
-      rb_enc_associate(rstr, lazy_df->data[i].encoding);
-      rb_ary_store(rdata, i, rstr);
+      rb_ary_store(rdata, i, frb_ld_df_value(rld, lazy_df, i));
     }
   }
+  lazy_df->loaded = true;
   frt_h_set(rld->hash, (void *)rkey, (void *)rdata);
   return rdata;
 }
@@ -607,6 +671,11 @@ static VALUE frb_ld_values_at(int argc, VALUE *argv, VALUE self) {
  *  Methods from the Hash class, that would modify the LazyDoc itself,
  *  are not supported, .
  *
+ *  Large values which are stored uncompressed are not copied when the index
+ *  is memory mapped (see Store::MMapDirectory) or when they come from a
+ *  block of the :block stored fields format. They are returned as frozen
+ *  strings instead, use +dup+ to get a string which can be changed.
+ *
  *  == Example
  *
  *    doc = index_reader[0]
@@ -648,6 +717,8 @@ void Init_LazyDoc(void) {
   id_to_proc = rb_intern("to_proc");
   id_transform_keys = rb_intern("transform_keys");
   id_transform_values = rb_intern("transform_values");
+  /* not a valid instance variable name so it is hidden from ruby code */
+  id_stored_bytes = rb_intern("stored_bytes");
 
   cLazyDoc = rb_define_class_under(mIndex, "LazyDoc", rb_cObject);
   rb_include_module(cLazyDoc, rb_mEnumerable);
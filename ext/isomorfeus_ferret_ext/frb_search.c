@@ -110,6 +110,7 @@ static ID id_hits;
 static ID id_total_hits;
 static ID id_max_score;
 static ID id_searcher;
+static ID id_total_hits_exact;
 
 /* Search */
 static VALUE sym_offset;
@@ -120,6 +121,7 @@ static VALUE sym_sort;
 static VALUE sym_filter;
 static VALUE sym_filter_proc;
 static VALUE sym_c_filter_proc;
+static VALUE sym_total_hits_threshold;
 
 static VALUE sym_excerpt_length;
 static VALUE sym_num_excerpts;
@@ -164,7 +166,8 @@ static VALUE frb_get_td(FrtTopDocs *td, VALUE rsearcher) {
     }
 
     rtop_docs = rb_struct_new(cTopDocs, INT2FIX(td->total_hits), hit_ary,
-                              rb_float_new((double)td->max_score), rsearcher, NULL);
+                              rb_float_new((double)td->max_score), rsearcher,
+                              td->total_hits_exact ? Qtrue : Qfalse, NULL);
     frt_td_destroy(td);
     return rtop_docs;
 }
@@ -190,8 +193,9 @@ static VALUE frb_td_to_s(int argc, VALUE *argv, VALUE self) {
         field = frb_field(argv[0]);
     }
 
-    sprintf(str, "TopDocs: total_hits = %ld, max_score = %lf [\n",
+    sprintf(str, "TopDocs: total_hits = %ld%s, max_score = %lf [\n",
             FIX2LONG(rb_funcall(self, id_total_hits, 0)),
+            RTEST(rb_funcall(self, id_total_hits_exact, 0)) ? "" : "+",
             NUM2DBL(rb_funcall(self, id_max_score, 0)));
     p = (int)strlen(str);
 
@@ -2980,6 +2984,14 @@ static VALUE frb_sort_init(int argc, VALUE *argv, VALUE self) {
     return self;
 }
 
+/* turn anything the :sort option accepts into a Sort */
+VALUE frb_get_sort(VALUE rval) {
+    if (TYPE(rval) != T_DATA || CLASS_OF(rval) == cSortField) {
+        rval = frb_sort_init(1, &rval, frb_sort_alloc(cSort));
+    }
+    return rval;
+}
+
 /*
  *  call-seq:
  *     sort.fields -> Array
@@ -3050,6 +3062,51 @@ static VALUE frb_sea_get_reader(VALUE self) {
     return ((FrtIndexSearcher *)sea)->ir->rir;
 }
 
+/*
+ *  call-seq:
+ *     searcher.max_threads -> integer
+ *
+ *  Return the number of threads used to search the segments of the index,
+ *  or the sub-searchers of a MultiSearcher. See #max_threads=.
+ */
+static VALUE frb_sea_get_max_threads(VALUE self) {
+    GET_SEA();
+    if (rb_obj_is_kind_of(self, cMultiSearcher) == Qtrue) {
+        return INT2FIX(((FrtMultiSearcher *)sea)->max_threads);
+    }
+    return INT2FIX(((FrtIndexSearcher *)sea)->max_threads);
+}
+
+/*
+ *  call-seq:
+ *     searcher.max_threads = num_threads -> num_threads
+ *
+ *  Set the number of threads used to search an index made up of several
+ *  segments. Each segment is scored on its own and the hits are merged once
+ *  all of them have been scored, which cuts the latency of expensive
+ *  queries on large indexes. The default is 1, ie the segments are searched
+ *  one after the other. Searches with a +:filter_proc+ are always run in a
+ *  single thread, as are queries holding filters written in ruby.
+ *
+ *  On a MultiSearcher this sets the number of sub-searchers searched at
+ *  once. Searches with a +:filter_proc+ or a filter written in ruby are run
+ *  one sub-searcher after the other, and queries holding filters written in
+ *  ruby can't be run on several threads at all.
+ */
+static VALUE frb_sea_set_max_threads(VALUE self, VALUE rmax_threads) {
+    GET_SEA();
+    int max_threads = FIX2INT(rmax_threads);
+    if (max_threads < 1) {
+        rb_raise(rb_eArgError, "max_threads must be at least 1");
+    }
+    if (rb_obj_is_kind_of(self, cMultiSearcher) == Qtrue) {
+        ((FrtMultiSearcher *)sea)->max_threads = max_threads;
+    } else {
+        ((FrtIndexSearcher *)sea)->max_threads = max_threads;
+    }
+    return rmax_threads;
+}
+
 /*
  *  call-seq:
  *     searcher.doc_freq(field, term) -> integer
@@ -3076,6 +3133,116 @@ static VALUE frb_sea_doc(VALUE self, VALUE rdoc_id) {
     return frb_get_lazy_doc(sea->get_lazy_doc(sea, FIX2INT(rdoc_id)));
 }
 
+static VALUE frb_df_to_value(FrtDocField *df) {
+    int i;
+    VALUE rdata;
+    if (df->size == 1) {
+        rdata = rb_str_new(df->data[0], df->lengths[0]);
+        rb_enc_associate(rdata, df->encodings[0]);
+        return rdata;
+    }
+    rdata = rb_ary_new2(df->size);
+    for (i = 0; i < df->size; i++) {
+        VALUE rstr = rb_str_new(df->data[i], df->lengths[i]);
+        rb_enc_associate(rstr, df->encodings[i]);
+        rb_ary_store(rdata, i, rstr);
+    }
+    return rdata;
+}
+
+typedef struct FrbDocsToHashes {
+    FrtDocument **docs;
+    int         cnt;
+} FrbDocsToHashes;
+
+static VALUE frb_docs_to_hashes(VALUE arg) {
+    FrbDocsToHashes *dth = (FrbDocsToHashes *)arg;
+    VALUE rdocs = rb_ary_new2(dth->cnt);
+    int i, j;
+    for (i = 0; i < dth->cnt; i++) {
+        FrtDocument *doc = dth->docs[i];
+        VALUE rdoc = rb_hash_new();
+        for (j = 0; j < doc->size; j++) {
+            FrtDocField *df = doc->fields[j];
+            rb_hash_aset(rdoc, ID2SYM(df->name), frb_df_to_value(df));
+        }
+        frt_doc_destroy(doc);
+        dth->docs[i] = NULL;
+        rb_ary_store(rdocs, i, rdoc);
+    }
+    return rdocs;
+}
+
+/* free the documents left over if converting them raised */
+static VALUE frb_docs_destroy(VALUE arg) {
+    FrbDocsToHashes *dth = (FrbDocsToHashes *)arg;
+    frt_docs_destroy(dth->docs, dth->cnt);
+    return Qnil;
+}
+
+/*
+ *  call-seq:
+ *     searcher.get_documents(doc_ids, fields = nil) -> Array of Hash
+ *
+ *  Retrieve the stored fields of all the documents +doc_ids+ at once, for
+ *  example all the hits of a result page. Each document is returned as a Hash
+ *  of field names to their values, in the same order as +doc_ids+. Only the
+ *  +fields+ given, a field or an Array of fields, are loaded unless +fields+
+ *  is nil.
+ *
+ *  This is much faster than loading each document with #get_document as the
+ *  documents are read in the order they are stored in the index and the
+ *  documents stored close to each other are read together.
+ *
+ *    docs = searcher.get_documents(top_docs.hits.map {|hit| hit.doc}, [:title])
+ */
+static VALUE frb_sea_get_docs(int argc, VALUE *argv, VALUE self) {
+    GET_SEA();
+    VALUE rdoc_ids, rfields, rdocs, rdoc_nums_buf, rfield_ids_buf, rdocs_buf;
+    int i, cnt, max_doc, field_cnt = 0;
+    int *doc_nums;
+    ID *fields = NULL;
+    FrtDocument **docs;
+    FrbDocsToHashes dth;
+
+    rb_scan_args(argc, argv, "11", &rdoc_ids, &rfields);
+    Check_Type(rdoc_ids, T_ARRAY);
+    cnt = (int)RARRAY_LEN(rdoc_ids);
+    max_doc = sea->max_doc(sea);
+    doc_nums = ALLOCV_N(int, rdoc_nums_buf, cnt);
+    for (i = 0; i < cnt; i++) {
+        doc_nums[i] = NUM2INT(RARRAY_PTR(rdoc_ids)[i]);
+        if (doc_nums[i] < 0 || doc_nums[i] >= max_doc) {
+            rb_raise(rb_eArgError, "document %d is out of range (0..%d)",
+                     doc_nums[i], max_doc - 1);
+        }
+    }
+    if (!NIL_P(rfields)) {
+        if (TYPE(rfields) == T_ARRAY) {
+            field_cnt = (int)RARRAY_LEN(rfields);
+            fields = ALLOCV_N(ID, rfield_ids_buf, field_cnt);
+            for (i = 0; i < field_cnt; i++) {
+                fields[i] = frb_field(RARRAY_PTR(rfields)[i]);
+            }
+        } else {
+            field_cnt = 1;
+            fields = ALLOCV_N(ID, rfield_ids_buf, 1);
+            fields[0] = frb_field(rfields);
+        }
+    }
+
+    docs = ALLOCV_N(FrtDocument *, rdocs_buf, cnt);
+    sea->get_docs(sea, doc_nums, cnt, fields, field_cnt, docs);
+    dth.docs = docs;
+    dth.cnt = cnt;
+    rdocs = rb_ensure(frb_docs_to_hashes, (VALUE)&dth, frb_docs_destroy,
+                      (VALUE)&dth);
+    ALLOCV_END(rdocs_buf);
+    if (fields) ALLOCV_END(rfield_ids_buf);
+    ALLOCV_END(rdoc_nums_buf);
+    return rdocs;
+}
+
 /*
  *  call-seq:
  *     searcher.max_doc -> number
@@ -3090,20 +3257,41 @@ static VALUE frb_sea_max_doc(VALUE self) {
     return INT2FIX(sea->max_doc(sea));
 }
 
-static float call_filter_proc(int doc_id, float score, FrtSearcher *sea, void *arg) {
-    VALUE val = rb_funcall((VALUE)arg, id_call, 3, INT2FIX(doc_id), rb_float_new((double)score), sea->rsea);
+/* The filter procs and wrapped filters call into ruby so they may need to
+ * reacquire the GVL as searches are run without it. */
+
+typedef struct FilterProcArgs {
+    int doc_id;
+    float score;
+    FrtSearcher *sea;
+    VALUE proc;
+} FilterProcArgs;
+
+static void *call_filter_proc_gvl_i(void *arg) {
+    FilterProcArgs *args = (FilterProcArgs *)arg;
+    VALUE val = rb_funcall(args->proc, id_call, 3, INT2FIX(args->doc_id), rb_float_new((double)args->score), args->sea->rsea);
     switch (TYPE(val)) {
         case T_NIL:
         case T_FALSE:
-            return 0.0f;
+            args->score = 0.0f;
+            break;
         case T_FLOAT:
         {
             double d = NUM2DBL(val);
-            return (d >= 0.0 && d <= 1.0) ? (float)d : 1.0f;
+            args->score = (d >= 0.0 && d <= 1.0) ? (float)d : 1.0f;
+            break;
         }
         default:
-            return 1.0f;
+            args->score = 1.0f;
+            break;
     }
+    return NULL;
+}
+
+static float call_filter_proc(int doc_id, float score, FrtSearcher *sea, void *arg) {
+    FilterProcArgs args = { .doc_id = doc_id, .score = score, .sea = sea, .proc = (VALUE)arg };
+    frt_thread_call_with_gvl(&call_filter_proc_gvl_i, &args);
+    return args.score;
 }
 
 typedef struct CWrappedFilter {
@@ -3113,22 +3301,52 @@ typedef struct CWrappedFilter {
 
 #define CWF(filt) ((CWrappedFilter *)(filt))
 
+typedef struct CWFiltArgs {
+    FrtFilter *filt;
+    FrtFilter *o;
+    FrtIndexReader *ir;
+    unsigned long long hash;
+    int eq;
+} CWFiltArgs;
+
+static void *cwfilt_hash_gvl_i(void *arg) {
+    CWFiltArgs *args = (CWFiltArgs *)arg;
+    args->hash = (unsigned long long)NUM2ULONG(rb_funcall(CWF(args->filt)->rfilter, id_hash, 0));
+    return NULL;
+}
+
 static unsigned long long cwfilt_hash(FrtFilter *filt) {
-    return (unsigned long long)NUM2ULONG(rb_funcall(CWF(filt)->rfilter, id_hash, 0));
+    CWFiltArgs args = { .filt = filt };
+    frt_thread_call_with_gvl(&cwfilt_hash_gvl_i, &args);
+    return args.hash;
+}
+
+static void *cwfilt_eq_gvl_i(void *arg) {
+    CWFiltArgs *args = (CWFiltArgs *)arg;
+    args->eq = RTEST(rb_funcall(CWF(args->filt)->rfilter, id_eql, 1, CWF(args->o)->rfilter));
+    return NULL;
 }
 
 static int cwfilt_eq(FrtFilter *filt, FrtFilter *o) {
-    return RTEST(rb_funcall(CWF(filt)->rfilter, id_eql, 1, CWF(o)->rfilter));
+    CWFiltArgs args = { .filt = filt, .o = o };
+    frt_thread_call_with_gvl(&cwfilt_eq_gvl_i, &args);
+    return args.eq;
 }
 
-static FrtBitVector *cwfilt_get_bv_i(FrtFilter *filt, FrtIndexReader *ir) {
-    VALUE rbv = rb_funcall(CWF(filt)->rfilter, id_bits, 1, ir->rir);
+static void *cwfilt_get_bv_gvl_i(void *arg) {
+    CWFiltArgs *args = (CWFiltArgs *)arg;
+    VALUE rbv = rb_funcall(CWF(args->filt)->rfilter, id_bits, 1, args->ir->rir);
     FrtBitVector *bv;
     bv = DATA_PTR(rbv);
     FRT_REF(bv);
     return bv;
 }
 
+static FrtBitVector *cwfilt_get_bv_i(FrtFilter *filt, FrtIndexReader *ir) {
+    CWFiltArgs args = { .filt = filt, .ir = ir };
+    return (FrtBitVector *)frt_thread_call_with_gvl(&cwfilt_get_bv_gvl_i, &args);
+}
+
 FrtFilter *frb_get_cwrapped_filter(VALUE rval) {
     FrtFilter *filter;
     if (frb_is_cclass(rval) && DATA_PTR(rval)) {
@@ -3139,24 +3357,59 @@ FrtFilter *frb_get_cwrapped_filter(VALUE rval) {
         filter->hash         = &cwfilt_hash;
         filter->eq           = &cwfilt_eq;
         filter->get_bv_i     = &cwfilt_get_bv_i;
+        /* ruby filters are passed the ruby IndexReader so they can't be
+         * evaluated per segment */
+        filter->per_segment  = false;
         CWF(filter)->rfilter = rval;
     }
     return filter;
 }
 
+typedef struct SeaSearchArgs {
+    FrtSearcher *sea;
+    FrtQuery *query;
+    int offset;
+    int limit;
+    FrtFilter *filter;
+    FrtSort *sort;
+    FrtPostFilter *post_filter;
+    int total_hits_threshold;
+    int *doc_array;
+    int start_doc;
+} SeaSearchArgs;
+
+static void *frb_sea_search_without_gvl_i(void *arg) {
+    SeaSearchArgs *volatile args = (SeaSearchArgs *)arg;
+    FrtTopDocs *volatile td = NULL;
+    FRT_TRY
+        td = args->sea->search(args->sea, args->query, args->offset, args->limit,
+                               args->filter, args->sort, args->post_filter, 0,
+                               args->total_hits_threshold);
+    FRT_XFINALLY
+        if (args->filter) frt_filt_deref(args->filter);
+    FRT_XENDTRY
+    return td;
+}
+
+static void *frb_sea_search_unscored_without_gvl_i(void *arg) {
+    SeaSearchArgs *args = (SeaSearchArgs *)arg;
+    return (void *)(long)args->sea->search_unscored(args->sea, args->query,
+                                                    args->doc_array, args->limit,
+                                                    args->start_doc);
+}
+
 static FrtTopDocs *frb_sea_search_internal(FrtQuery *query, VALUE roptions, FrtSearcher *sea) {
     VALUE rval;
-    int offset = 0, limit = 10;
+    VALUE rsort = Qnil;
+    FrtTopDocs *td;
+    int offset = 0, limit = 10, total_hits_threshold = INT_MAX;
     FrtFilter *filter = NULL;
     FrtSort *sort = NULL;
-    FrtTopDocs *td;
+    SeaSearchArgs args;
 
     FrtPostFilter post_filter_holder;
     FrtPostFilter *post_filter = NULL;
 
-    int ex_code = 0;
-    const char *msg = NULL;
-
     if (Qnil != roptions) {
         if (Qnil != (rval = rb_hash_aref(roptions, sym_offset))) {
             offset = FIX2INT(rval);
@@ -3177,9 +3430,6 @@ static FrtTopDocs *frb_sea_search_internal(FrtQuery *query, VALUE roptions, FrtS
                          rs2s(rb_obj_as_string(rval)));
             }
         }
-        if (Qnil != (rval = rb_hash_aref(roptions, sym_filter))) {
-            filter = frb_get_cwrapped_filter(rval);
-        }
         if (Qnil != (rval = rb_hash_aref(roptions, sym_c_filter_proc))) {
                 post_filter = DATA_PTR(rval);
         }
@@ -3198,24 +3448,33 @@ static FrtTopDocs *frb_sea_search_internal(FrtQuery *query, VALUE roptions, FrtS
             }
         }
         if (Qnil != (rval = rb_hash_aref(roptions, sym_sort))) {
-            if (TYPE(rval) != T_DATA || CLASS_OF(rval) == cSortField) {
-                rval = frb_sort_init(1, &rval, frb_sort_alloc(cSort));
-            }
-            TypedData_Get_Struct(rval, FrtSort, &frb_sort_t, sort);
+            /* frb_get_sort may create a new Sort which must outlive the
+             * search below */
+            rsort = frb_get_sort(rval);
+            TypedData_Get_Struct(rsort, FrtSort, &frb_sort_t, sort);
+        }
+        if (Qnil != (rval = rb_hash_aref(roptions, sym_total_hits_threshold))) {
+            total_hits_threshold = NUM2INT(rval);
+            if (total_hits_threshold < 0)
+                rb_raise(rb_eArgError, ":total_hits_threshold must be >= 0");
+        }
+        /* the filter is referenced here and released by the search, so no
+         * option may raise after this point */
+        if (Qnil != (rval = rb_hash_aref(roptions, sym_filter))) {
+            filter = frb_get_cwrapped_filter(rval);
         }
     }
 
-    FRT_TRY
-        td = sea->search(sea, query, offset, limit, filter, sort, post_filter, 0);
-        if (filter) frt_filt_deref(filter);
-    FRT_XCATCHALL
-        ex_code = xcontext.excode;
-        msg = xcontext.msg;
-        FRT_HANDLED();
-    FRT_XENDTRY
-
-    if (ex_code && msg) { frb_raise(ex_code, msg); }
-
+    args.sea = sea;
+    args.query = query;
+    args.offset = offset;
+    args.limit = limit;
+    args.filter = filter;
+    args.sort = sort;
+    args.post_filter = post_filter;
+    args.total_hits_threshold = total_hits_threshold;
+    td = (FrtTopDocs *)frb_thread_call_without_gvl(&frb_sea_search_without_gvl_i, &args);
+    RB_GC_GUARD(rsort);
     return td;
 }
 
@@ -3256,6 +3515,13 @@ static FrtTopDocs *frb_sea_search_internal(FrtQuery *query, VALUE roptions, FrtS
  *                  and 1.0 to be used as a factor to scale the score of the
  *                  object. This can be used, for example, to weight the score
  *                  of a matched document by it's age.
+ *  :total_hits_threshold:: Default: all. The number of matches to count
+ *                  exactly. Once that many have been counted the search may
+ *                  skip the documents which can't make it into the results,
+ *                  or stop altogether when sorting by document number, so
+ *                  +total_hits+ is only a lower bound, see
+ *                  TopDocs#total_hits_exact?. This makes searches for the
+ *                  best few of very many matches a lot faster.
  */
 static VALUE frb_sea_search(int argc, VALUE *argv, VALUE self) {
     GET_SEA();
@@ -3306,6 +3572,12 @@ static VALUE frb_sea_search(int argc, VALUE *argv, VALUE self) {
  *                  and the Searcher object as its parameters and returns a
  *                  Boolean value specifying whether the result should be
  *                  included in the result set.
+ *  :total_hits_threshold:: Default: all. The number of matches to count
+ *                  exactly. Once that many have been counted the search may
+ *                  skip the documents which can't make it into the results,
+ *                  or stop altogether when sorting by document number, so
+ *                  +total_hits+ is only a lower bound. This makes searches
+ *                  for the best few of very many matches a lot faster.
  */
 static VALUE frb_sea_search_each(int argc, VALUE *argv, VALUE self) {
     int i;
@@ -3377,6 +3649,7 @@ static VALUE frb_sea_scan(int argc, VALUE *argv, VALUE self) {
     int *doc_array;
     VALUE rdoc_array;
     int start_doc = 0, limit = 50;
+    SeaSearchArgs args;
     GET_SEA();
     rb_scan_args(argc, argv, "11", &rquery, &roptions);
     FrtQuery *q = DATA_PTR(rquery);
@@ -3409,7 +3682,12 @@ static VALUE frb_sea_scan(int argc, VALUE *argv, VALUE self) {
     }
 
     doc_array = FRT_ALLOC_N(int, limit);
-    count = sea->search_unscored(sea, q, doc_array, limit, start_doc);
+    args.sea = sea;
+    args.query = q;
+    args.doc_array = doc_array;
+    args.limit = limit;
+    args.start_doc = start_doc;
+    count = (int)(long)frb_thread_call_without_gvl(&frb_sea_search_unscored_without_gvl_i, &args);
     rdoc_array = rb_ary_new2(count);
     for (i = 0; i < count; i++) {
       rb_ary_store(rdoc_array, i, INT2FIX(doc_array[i]));
@@ -3632,8 +3910,8 @@ static VALUE frb_sea_init(VALUE self, VALUE obj) {
  ****************************************************************************/
 
 static size_t frb_multi_searcher_size(const void *p) {
-    return sizeof(FrtMultiSearcher);
     (void)p;
+    return sizeof(FrtMultiSearcher);
 }
 
 static void frb_ms_free(void *p) {
@@ -3826,6 +4104,14 @@ static void Init_Hit(void) {
  *    top_docs.hits.each do |hit|
  *      puts "#{hit.doc} scored #{hit.score * 100.0 / top_docs.max_score}"
  *    end
+ *
+ *  When the search was run with a +:total_hits_threshold+ it may have
+ *  stopped counting the matches early. TopDocs#total_hits_exact? is false
+ *  then and +total_hits+ is only a lower bound, as is +max_score+ for a
+ *  search sorted by document number;
+ *
+ *    top_docs = searcher.search(query, :total_hits_threshold => 1000)
+ *    puts "#{top_docs.total_hits}#{'+' unless top_docs.total_hits_exact?} results"
  */
 static void Init_TopDocs(void) {
     const char *td_class = "TopDocs";
@@ -3834,6 +4120,7 @@ static void Init_TopDocs(void) {
                                 "hits",
                                 "max_score",
                                 "searcher",
+                                "total_hits_exact",
                                 NULL);
     rb_set_class_path(cTopDocs, mSearch, td_class);
     rb_const_set(mSearch, rb_intern(td_class), cTopDocs);
@@ -3843,6 +4130,8 @@ static void Init_TopDocs(void) {
     id_total_hits = rb_intern("total_hits");
     id_max_score = rb_intern("max_score");
     id_searcher = rb_intern("searcher");
+    id_total_hits_exact = rb_intern("total_hits_exact");
+    rb_define_alias(cTopDocs, "total_hits_exact?", "total_hits_exact");
 }
 
 /*
@@ -4879,6 +5168,7 @@ static void Init_Searcher(void) {
     sym_filter          = ID2SYM(rb_intern("filter"));
     sym_filter_proc     = ID2SYM(rb_intern("filter_proc"));
     sym_c_filter_proc   = ID2SYM(rb_intern("c_filter_proc"));
+    sym_total_hits_threshold = ID2SYM(rb_intern("total_hits_threshold"));
     sym_sort            = ID2SYM(rb_intern("sort"));
 
     sym_excerpt_length  = ID2SYM(rb_intern("excerpt_length"));
@@ -4894,9 +5184,12 @@ static void Init_Searcher(void) {
     rb_define_method(cSearcher, "initialize", frb_sea_init, 1);
     rb_define_method(cSearcher, "close", frb_sea_close, 0);
     rb_define_method(cSearcher, "reader", frb_sea_get_reader, 0);
+    rb_define_method(cSearcher, "max_threads", frb_sea_get_max_threads, 0);
+    rb_define_method(cSearcher, "max_threads=", frb_sea_set_max_threads, 1);
     rb_define_method(cSearcher, "doc_freq", frb_sea_doc_freq, 2);
     rb_define_method(cSearcher, "get_document", frb_sea_doc, 1);
     rb_define_method(cSearcher, "[]", frb_sea_doc, 1);
+    rb_define_method(cSearcher, "get_documents", frb_sea_get_docs, -1);
     rb_define_method(cSearcher, "max_doc", frb_sea_max_doc, 0);
     rb_define_method(cSearcher, "search", frb_sea_search, -1);
     rb_define_method(cSearcher, "search_each", frb_sea_search_each, -1);
@@ -10,6 +10,7 @@ VALUE cLockError;
 VALUE cDirectory;
 VALUE cRAMDirectory;
 VALUE cFSDirectory;
+VALUE cMMapDirectory;
 
 /****************************************************************************
  * Lock Methods
@@ -390,7 +391,8 @@ static VALUE frb_ramdir_init(int argc, VALUE *argv, VALUE self) {
  *  create:: set to true if you want any existing files in the directory to be
  *           deleted
  */
-static VALUE frb_fsdir_new(int argc, VALUE *argv, VALUE klass) {
+static VALUE frb_fsdir_open(int argc, VALUE *argv, VALUE klass,
+                            FrtStore *(*open_store)(const char *pathname)) {
     VALUE self, rpath, rcreate;
     FrtStore *store;
     bool create;
@@ -404,7 +406,7 @@ static VALUE frb_fsdir_new(int argc, VALUE *argv, VALUE klass) {
     if (!rb_funcall(rb_cFile, id_is_directory, 1, rpath)) {
         rb_raise(cFileNotFoundError, "No directory <%s> found. Use :create => true to create one.", rs2s(rpath));
     }
-    store = frt_open_fs_store(rs2s(rpath));
+    store = open_store(rs2s(rpath));
     if (create) store->clear_all(store);
     self = store->rstore;
     if (self == Qnil || DATA_PTR(self) == NULL) {
@@ -418,6 +420,31 @@ static VALUE frb_fsdir_new(int argc, VALUE *argv, VALUE klass) {
     return self;
 }
 
+static VALUE frb_fsdir_new(int argc, VALUE *argv, VALUE klass) {
+    return frb_fsdir_open(argc, argv, klass, &frt_open_fs_store);
+}
+
+/****************************************************************************
+ *
+ * MMapDirectory Methods
+ *
+ ****************************************************************************/
+
+/*
+ *  call-seq:
+ *     MMapDirectory.new(/path/to/index/, create = false)
+ *
+ *  Create a new MMapDirectory at +/path/to/index/+. The parameters are the
+ *  same as for FSDirectory.new.
+ *
+ *  path::   path to index directory. Must be a valid path on your system
+ *  create:: set to true if you want any existing files in the directory to be
+ *           deleted
+ */
+static VALUE frb_mmapdir_new(int argc, VALUE *argv, VALUE klass) {
+    return frb_fsdir_open(argc, argv, klass, &frt_open_mmap_store);
+}
+
 /****************************************************************************
  *
  * Init Function
@@ -518,6 +545,23 @@ void Init_FSDirectory(void) {
     rb_define_singleton_method(cFSDirectory, "new", frb_fsdir_new, -1);
 }
 
+/*
+ *  Document-class: Ferret::Store::MMapDirectory
+ *
+ *  File-system resident Directory implementation which memory maps the
+ *  files it reads. Searches read the index straight from the operating
+ *  system's page cache instead of copying it into buffers first, which
+ *  speeds up random access to large indexes. Files are written the same way
+ *  as by FSDirectory.
+ *
+ *    index = Index::Index.new(:dir => MMapDirectory.new("/path/to/index"))
+ */
+void Init_MMapDirectory(void) {
+    cMMapDirectory = rb_define_class_under(mStore, "MMapDirectory", cFSDirectory);
+    rb_define_alloc_func(cMMapDirectory, frb_store_alloc);
+    rb_define_singleton_method(cMMapDirectory, "new", frb_mmapdir_new, -1);
+}
+
 /* rdoc hack
 extern VALUE mFerret = rb_define_module("Ferret");
 */
@@ -539,4 +583,5 @@ void Init_Store(void) {
     Init_Lock();
     Init_RAMDirectory();
     Init_FSDirectory();
+    Init_MMapDirectory();
 }
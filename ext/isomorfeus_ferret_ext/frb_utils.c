@@ -766,6 +766,7 @@ static void frb_pq_mark(void *p) {
         if (pq->heap[i])
             rb_gc_mark_maybe(pq->heap[i]);
     }
+    rb_gc_mark(pq->proc);
 }
 
 static void frb_pq_free(void *p) {
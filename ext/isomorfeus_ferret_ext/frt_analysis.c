@@ -2,6 +2,7 @@
 #include <ctype.h>
 #include "frt_analysis.h"
 #include "frt_hash.h"
+#include "frt_threading.h"
 #include "libstemmer.h"
 
 /*****************************************************************************/
@@ -22,6 +23,58 @@ extern OnigCodePoint cp_at;
 extern OnigCodePoint cp_ampersand;
 extern OnigCodePoint cp_colon;
 
+/* Most indexed text is plain ASCII. ASCII code points are classified by the
+ * ctype table and only the rest are handed to the onigmo encoding. */
+static inline bool cp_enc_isalnum(OnigCodePoint cp, rb_encoding *enc) {
+    return (cp < 0x80) ? rb_isalnum((int)cp) : rb_enc_isalnum(cp, enc);
+}
+
+static inline bool cp_enc_isalpha(OnigCodePoint cp, rb_encoding *enc) {
+    return (cp < 0x80) ? rb_isalpha((int)cp) : rb_enc_isalpha(cp, enc);
+}
+
+static inline bool cp_enc_isdigit(OnigCodePoint cp, rb_encoding *enc) {
+    return (cp < 0x80) ? rb_isdigit((int)cp) : rb_enc_isdigit(cp, enc);
+}
+
+static inline bool cp_enc_isspace(OnigCodePoint cp, rb_encoding *enc) {
+    return (cp < 0x80) ? rb_isspace((int)cp) : rb_enc_isspace(cp, enc);
+}
+
+#define FRT_ASCII_ONES      0x0101010101010101ULL
+#define FRT_ASCII_HIGH_BITS 0x8080808080808080ULL
+
+/* Get the length of the run of ASCII bytes at the start of +s+. Eight bytes
+ * are checked at a time. */
+static inline int ascii_run_len(const char *s, int len) {
+    int i = 0;
+    frt_u64 w;
+    for (; i + 8 <= len; i += 8) {
+        memcpy(&w, s + i, 8);
+        if (w & FRT_ASCII_HIGH_BITS) break;
+    }
+    while (i < len && !((unsigned char)s[i] & 0x80)) i++;
+    return i;
+}
+
+/* Lowercase a run of ASCII bytes in place, eight bytes at a time. A byte is
+ * uppercase when adding (0x80 - 'A') sets its high bit and adding
+ * (0x7f - 'Z') doesn't. */
+static inline void ascii_downcase(char *s, int len) {
+    int i = 0;
+    frt_u64 w, ge_a, gt_z;
+    for (; i + 8 <= len; i += 8) {
+        memcpy(&w, s + i, 8);
+        ge_a = w + (0x80 - 'A') * FRT_ASCII_ONES;
+        gt_z = w + (0x7f - 'Z') * FRT_ASCII_ONES;
+        w |= ((ge_a ^ gt_z) & FRT_ASCII_HIGH_BITS) >> 2;
+        memcpy(s + i, &w, 8);
+    }
+    for (; i < len; i++) {
+        if (s[i] >= 'A' && s[i] <= 'Z') s[i] |= 0x20;
+    }
+}
+
 static int cp_isnumpunc(OnigCodePoint cp) {
     return (cp == cp_dot || cp == cp_comma || cp == cp_backslash || cp == cp_slash || cp == cp_underscore || cp == cp_dash);
 }
@@ -31,7 +84,7 @@ static int cp_isurlpunc(OnigCodePoint cp) {
 }
 
 static int cp_enc_isurlc(OnigCodePoint cp, rb_encoding *enc) {
-    return (cp_isurlpunc(cp) || rb_enc_isalnum(cp, enc));
+    return (cp_isurlpunc(cp) || cp_enc_isalnum(cp, enc));
 }
 
 static int cp_isurlxatpunc(OnigCodePoint cp) {
@@ -39,13 +92,13 @@ static int cp_isurlxatpunc(OnigCodePoint cp) {
 }
 
 static int cp_enc_isurlxatc(OnigCodePoint cp, rb_encoding *enc){
-    return (cp_isurlxatpunc(cp) || rb_enc_isalnum(cp, enc));
+    return (cp_isurlxatpunc(cp) || cp_enc_isalnum(cp, enc));
 }
 
 static bool cp_enc_istok(OnigCodePoint cp, rb_encoding *enc) {
-    if (rb_enc_isspace(cp, enc)) /* most common so check first. */
+    if (cp_enc_isspace(cp, enc)) /* most common so check first. */
         return false;
-    if (rb_enc_isalnum(cp, enc) || cp_isnumpunc(cp) ||
+    if (cp_enc_isalnum(cp, enc) || cp_isnumpunc(cp) ||
         cp == cp_ampersand || cp == cp_at || cp == cp_apostrophe || cp == cp_colon) {
         return true;
     }
@@ -57,6 +110,11 @@ static inline int get_cp(char *start, char *end, int *cp_len, rb_encoding *enc)
         *cp_len = 0;
         return 0;
     }
+    /* an ASCII byte is a whole character in any single byte unit encoding */
+    if (!((unsigned char)*start & 0x80) && rb_enc_mbminlen(enc) == 1) {
+        *cp_len = 1;
+        return (unsigned char)*start;
+    }
     return rb_enc_codepoint_len(start, end, cp_len, enc);
 }
 
@@ -64,6 +122,23 @@ static inline int get_cp(char *start, char *end, int *cp_len, rb_encoding *enc)
 /*** FrtToken ****************************************************************/
 /*****************************************************************************/
 
+typedef struct TkEconvArgs {
+    rb_encoding *encoding;
+    const unsigned char *sp;
+    const unsigned char *s_end;
+    unsigned char *dp;
+    unsigned char *d_end;
+} TkEconvArgs;
+
+static void *tk_econv_to_utf8_i(void *arg) {
+    TkEconvArgs *ea = (TkEconvArgs *)arg;
+    rb_econv_t *ec = rb_econv_open(rb_enc_name(ea->encoding), "UTF-8", RUBY_ECONV_INVALID_REPLACE);
+    assert(ec != NULL);
+    rb_econv_convert(ec, &ea->sp, ea->s_end, &ea->dp, ea->d_end, 0);
+    rb_econv_close(ec);
+    return NULL;
+}
+
 FrtToken *frt_tk_set(FrtToken *tk, char *text, int tlen, frt_off_t start, frt_off_t end, int pos_inc, rb_encoding *encoding) {
     if (tlen >= FRT_MAX_WORD_SIZE) {
         char *head_last = rb_enc_left_char_head(text, text + FRT_MAX_WORD_SIZE - 1, text + tlen, encoding);
@@ -73,13 +148,15 @@ FrtToken *frt_tk_set(FrtToken *tk, char *text, int tlen, frt_off_t start, frt_of
     if (encoding == utf8_encoding) {
         memcpy(tk->text, text, sizeof(char) * tlen);
     } else {
-        const unsigned char *sp = (unsigned char *)text;
-        unsigned char *dp = (unsigned char *)tk->text;
-        rb_econv_t *ec = rb_econv_open(rb_enc_name(encoding), "UTF-8", RUBY_ECONV_INVALID_REPLACE);
-        assert(ec != NULL);
-        rb_econv_convert(ec, &sp, (unsigned char *)text + tlen, &dp, (unsigned char *)tk->text + FRT_MAX_WORD_SIZE - 1, 0);
-        rb_econv_close(ec);
-        tlen = dp - (unsigned char *)tk->text;
+        TkEconvArgs ea;
+        ea.encoding = encoding;
+        ea.sp = (unsigned char *)text;
+        ea.s_end = (unsigned char *)text + tlen;
+        ea.dp = (unsigned char *)tk->text;
+        ea.d_end = (unsigned char *)tk->text + FRT_MAX_WORD_SIZE - 1;
+        /* the converter may have to be loaded by ruby */
+        frt_thread_call_with_gvl(&tk_econv_to_utf8_i, &ea);
+        tlen = ea.dp - (unsigned char *)tk->text;
     }
     tk->text[tlen] = '\0';
     tk->len = tlen;    // in bytes in utf8_encoding
@@ -237,7 +314,7 @@ static FrtToken *wst_next(FrtTokenStream *ts)
     if (cp < 1)
         return NULL;
 
-    while (cp_len > 0 && rb_enc_isspace(cp, enc)) {
+    while (cp_len > 0 && cp_enc_isspace(cp, enc)) {
         t += cp_len;
         cp = get_cp(t, end, &cp_len, enc);
     }
@@ -249,7 +326,7 @@ static FrtToken *wst_next(FrtTokenStream *ts)
     do {
         t += cp_len;
         cp = get_cp(t, end, &cp_len, enc);
-    } while (cp_len > 0 && !rb_enc_isspace(cp, enc));
+    } while (cp_len > 0 && !cp_enc_isspace(cp, enc));
 
     ts->t = t;
     return frt_tk_set_ts(&(ts->token), start, t, ts->text, 1, enc);
@@ -286,7 +363,7 @@ static FrtToken *lt_next(FrtTokenStream *ts) {
     if (cp < 1)
         return NULL;
 
-    while (cp_len > 0 && !rb_enc_isalpha(cp, enc)) {
+    while (cp_len > 0 && !cp_enc_isalpha(cp, enc)) {
         t += cp_len;
         cp = get_cp(t, end, &cp_len, enc);
     }
@@ -298,7 +375,7 @@ static FrtToken *lt_next(FrtTokenStream *ts) {
     do {
         t += cp_len;
         cp = get_cp(t, end, &cp_len, enc);
-    } while (cp_len > 0 && rb_enc_isalpha(cp, enc));
+    } while (cp_len > 0 && cp_enc_isalpha(cp, enc));
 
     ts->t = t;
     return frt_tk_set_ts(&(ts->token), start, t, ts->text, 1, enc);
@@ -329,7 +406,16 @@ static int std_get_alnum(FrtTokenStream *ts, char *token, OnigCodePoint cp, int
     char *tt = ts->t;
     int cp_len = *cp_len_p;
 
-    while (cp > 0 && rb_enc_isalnum(cp, enc)) {
+    if (rb_enc_mbminlen(enc) == 1) {
+        /* plain ASCII words are scanned bytewise */
+        while (t < end && rb_isalnum((unsigned char)*t)) t++;
+        if (t > ts->t) {
+            tt = ts->t + FRT_MIN(t - ts->t, FRT_MAX_WORD_SIZE - 1);
+            cp = get_cp(t, end, &cp_len, enc);
+        }
+    }
+
+    while (cp > 0 && cp_enc_isalnum(cp, enc)) {
         if ((t - ts->t + cp_len) < FRT_MAX_WORD_SIZE)
             tt += cp_len;
         t += cp_len;
@@ -359,11 +445,11 @@ static int std_get_number(FrtTokenStream *ts, char *start, char *end, OnigCodePo
     int seen_digit = false;
 
     while (cp > 0 && last_seen_digit >= 0) {
-        while ((cp > 0) && rb_enc_isalnum(cp, enc)) {
-            if ((last_seen_digit < 2) && rb_enc_isdigit(cp, enc)) {
+        while ((cp > 0) && cp_enc_isalnum(cp, enc)) {
+            if ((last_seen_digit < 2) && cp_enc_isdigit(cp, enc)) {
                 last_seen_digit = 2;
             }
-            if ((seen_digit == false) && rb_enc_isdigit(cp, enc)) {
+            if ((seen_digit == false) && cp_enc_isdigit(cp, enc)) {
                 seen_digit = true;
             }
             t += cp_len;
@@ -371,7 +457,7 @@ static int std_get_number(FrtTokenStream *ts, char *start, char *end, OnigCodePo
         }
         last_seen_digit--;
         cp_1 = get_cp(t + cp_len, end, &cp_1_len, enc);
-        if (!cp_isnumpunc(cp) || !rb_enc_isalnum(cp_1, enc)) {
+        if (!cp_isnumpunc(cp) || !cp_enc_isalnum(cp_1, enc)) {
             break;
         }
         t += cp_len;
@@ -390,7 +476,7 @@ static int std_get_apostrophe(FrtTokenStream *ts, char *input, OnigCodePoint cp,
     char *end = ts->text + ts->length;
     char *t = input;
 
-    while (cp_len > 0 && (rb_enc_isalpha(cp, enc) || cp == cp_apostrophe)) {
+    while (cp_len > 0 && (cp_enc_isalpha(cp, enc) || cp == cp_apostrophe)) {
         t += cp_len;
         cp = get_cp(t, end, &cp_len, enc);
     }
@@ -439,7 +525,7 @@ static int std_get_company_name(FrtTokenStream *ts, char *start, char* end) {
     int cp_len = 0;
 
     cp = get_cp(t, end, &cp_len, enc);
-    while (cp > 0 && (rb_enc_isalpha(cp, enc) || cp == cp_at || cp == cp_ampersand)) {
+    while (cp > 0 && (cp_enc_isalpha(cp, enc) || cp == cp_at || cp == cp_ampersand)) {
         t += cp_len;
         cp = get_cp(t, end, &cp_len, enc);
     }
@@ -456,10 +542,10 @@ static int std_advance_to_start(FrtTokenStream *ts, int *cp_len_p, OnigCodePoint
     char *t = ts->t;
 
     cp = get_cp(t, end, &cp_len, enc);
-    while (cp > 0 && !rb_enc_isalnum(cp, enc)) {
+    while (cp > 0 && !cp_enc_isalnum(cp, enc)) {
         if (cp_isnumpunc(cp)) {
             cp_next = get_cp(t + cp_len, end, &cp_len_next, enc);
-            if (cp_next > 0 && rb_enc_isdigit(cp_next, enc))
+            if (cp_next > 0 && cp_enc_isdigit(cp_next, enc))
                 break;
         }
         t += cp_len;
@@ -550,7 +636,7 @@ static FrtToken *std_next(FrtTokenStream *ts) {
 
     // already got cp and cp_len from get_alnum above
     // cp = get_cp(start, end, &cp_len, enc);
-    if ((rb_enc_isdigit(cp, enc) || cp_isnumpunc(cp))
+    if ((cp_enc_isdigit(cp, enc) || cp_isnumpunc(cp))
         && ((len = std_get_number(ts, start, end, cp, cp_len, enc)) > 0)) { /* possibly a number */
         num_end = start + len;
         cp = get_cp(num_end, end, &cp_len, enc);
@@ -575,7 +661,7 @@ static FrtToken *std_next(FrtTokenStream *ts) {
             t += cp_len;
             cp = get_cp(t, end, &cp_len, enc);
         }
-        if (rb_enc_isalpha(cp, enc) &&
+        if (cp_enc_isalpha(cp, enc) &&
                (memcmp(token, "ftp", 3) == 0 ||
                 memcmp(token, "http", 4) == 0 ||
                 memcmp(token, "https", 5) == 0 ||
@@ -597,7 +683,7 @@ static FrtToken *std_next(FrtTokenStream *ts) {
 
     cp = get_cp(t, end, &cp_len, enc);
     while (cp_enc_isurlxatc(cp, enc)) {
-        if (is_acronym && !rb_enc_isalpha(cp, enc) && (cp != cp_dot)) {
+        if (is_acronym && !cp_enc_isalpha(cp, enc) && (cp != cp_dot)) {
             is_acronym = false;
         }
         if (cp_isurlxatpunc(cp) && cp_isurlxatpunc(prev_cp)) {
@@ -630,7 +716,7 @@ static FrtToken *std_next(FrtTokenStream *ts) {
             for (s = start; s < t - 1; s += cp_len) {
                 cp = get_cp(s, end, &cp_len, enc);
                 cp_1 = get_cp(s + cp_len, end, &cp_1_len, enc);
-                if (rb_enc_isalpha(cp, enc) && (cp_1 != cp_dot))
+                if (cp_enc_isalpha(cp, enc) && (cp_1 != cp_dot))
                     is_acronym = false;
             }
         }
@@ -914,7 +1000,7 @@ static FrtToken *hf_next(FrtTokenStream *ts) {
         while (cp > 0) {
             if (cp == cp_dash || cp == cp_hyphen) {
                 seen_hyphen = true;
-            } else if (!rb_enc_isalpha(cp, enc)) {
+            } else if (!cp_enc_isalpha(cp, enc)) {
                 seen_other_punc = true;
                 break;
             }
@@ -973,6 +1059,7 @@ FrtTokenStream *frt_hyphen_filter_new(FrtTokenStream *sub_ts) {
 
 static FrtToken *lcf_next(FrtTokenStream *ts) {
     int len = 0;
+    int ascii_len;
     OnigCaseFoldType fold_type = ONIGENC_CASE_DOWNCASE;
     rb_encoding *enc = utf8_encoding; // Token encoding is always UTF-8
     char buf[FRT_MAX_WORD_SIZE + 20]; // CASE_MAPPING_ADDITIONAL_LENGTH
@@ -982,12 +1069,22 @@ static FrtToken *lcf_next(FrtTokenStream *ts) {
     if (tk == NULL) { return tk; }
     if (tk->len < 1) { return tk; }
 
-    const OnigUChar *t = (const OnigUChar *)tk->text;
+    /* the leading ASCII run is lowercased in place, onigmo only maps the
+     * rest of the token */
+    ascii_len = ascii_run_len(tk->text, tk->len);
+    ascii_downcase(tk->text, ascii_len);
+    if (ascii_len == tk->len) { return tk; }
+
+    const OnigUChar *t = (const OnigUChar *)(tk->text + ascii_len);
 
     len = enc->case_map(&fold_type, &t, (const OnigUChar *)(tk->text + tk->len), (OnigUChar *)buf, (OnigUChar *)buf_end, enc);
-    tk->len = len;
-    memcpy(tk->text, buf, len);
-    tk->text[len] = '\0';
+    if (ascii_len + len >= FRT_MAX_WORD_SIZE) {
+        /* a downcased character can be longer than the original */
+        len = rb_enc_left_char_head(buf, buf + FRT_MAX_WORD_SIZE - 1 - ascii_len, buf + len, enc) - buf;
+    }
+    memcpy(tk->text + ascii_len, buf, len);
+    tk->len = ascii_len + len;
+    tk->text[tk->len] = '\0';
 
     return tk;
 }
@@ -112,8 +112,8 @@ static void cmpdi_read_i(FrtInStream *is, frt_uchar *b, int len) {
               cis->length, start + len);
     }
 
-    frt_is_seek(cis->sub, cis->offset + start);
-    frt_is_read_bytes(cis->sub, b, len);
+    /* all the streams of the compound file read through cis->sub */
+    frt_is_read_bytes_at(cis->sub, cis->offset + start, b, len);
 }
 
 static const struct FrtInStreamMethods CMPD_IN_STREAM_METHODS = {
@@ -124,9 +124,17 @@ static const struct FrtInStreamMethods CMPD_IN_STREAM_METHODS = {
 };
 
 static FrtInStream *cmpd_create_input(FrtInStream *sub_is, frt_off_t offset, frt_off_t length) {
-    FrtInStream *is = frt_is_new();
+    FrtInStream *is;
     FrtCompoundInStream *cis = FRT_ALLOC(FrtCompoundInStream);
 
+    /* a mapped compound file hands out views of its mapping. They hold a
+     * reference to +sub_is+ so the mapping outlives them */
+    if (frt_is_mapped(sub_is)) {
+        is = frt_is_new_mapped(sub_is->buf.buf + offset, length);
+    } else {
+        is = frt_is_new();
+    }
+
     cis->sub = sub_is;
     FRT_REF(sub_is);
     cis->offset = offset;
@@ -228,6 +236,8 @@ FrtStore *frt_open_cmpd_store(FrtStore *store, const char *name) {
 
     new_store               = frt_store_new();
     new_store->dir.cmpd     = cmpd;
+    /* the files in here belong to the index in +store+ */
+    new_store->generation   = store->generation;
     new_store->touch        = &cmpd_touch;
     new_store->exists       = &cmpd_exists;
     new_store->remove       = &cmpd_remove;
@@ -276,16 +286,15 @@ static void cw_copy_file(FrtCompoundWriter *cw, FrtCWFileEntry *src, FrtOutStrea
     frt_off_t start_ptr = frt_os_pos(os);
     frt_off_t end_ptr;
     frt_off_t remainder, length, len;
-    frt_uchar buffer[FRT_BUFFER_SIZE];
 
     FrtInStream *is = cw->store->open_input(cw->store, src->name);
+    frt_is_set_buffer_size(is, FRT_SEQUENTIAL_BUFFER_SIZE);
 
     remainder = length = frt_is_length(is);
 
     while (remainder > 0) {
-        len = FRT_MIN(remainder, FRT_BUFFER_SIZE);
-        frt_is_read_bytes(is, buffer, len);
-        frt_os_write_bytes(os, buffer, len);
+        len = FRT_MIN(remainder, FRT_SEQUENTIAL_BUFFER_SIZE);
+        frt_is2os_copy_bytes(is, os, (int)len);
         remainder -= len;
     }
 
@@ -317,6 +326,7 @@ void frt_cw_close(FrtCompoundWriter *cw, FrtDeleter *dlr) {
     }
 
     os = cw->store->new_output(cw->store, cw->name);
+    frt_os_set_buffer_size(os, FRT_SEQUENTIAL_BUFFER_SIZE);
 
     frt_os_write_vint(os, frt_ary_size(cw->file_entries));
 
@@ -127,3 +127,13 @@ void frt_doc_destroy(FrtDocument *doc) {
     free(doc->fields);
     free(doc);
 }
+
+void frt_docs_destroy(FrtDocument **docs, int cnt) {
+    int i;
+    for (i = 0; i < cnt; i++) {
+        if (docs[i]) {
+            frt_doc_destroy(docs[i]);
+            docs[i] = NULL;
+        }
+    }
+}
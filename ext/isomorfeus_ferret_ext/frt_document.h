@@ -49,5 +49,7 @@ extern FrtDocument *frt_doc_new();
 extern FrtDocField *frt_doc_add_field(FrtDocument *doc, FrtDocField *df);
 extern FrtDocField *frt_doc_get_field(FrtDocument *doc, ID name);
 extern void frt_doc_destroy(FrtDocument *doc);
+/* destroy the documents of +docs+ which aren't NULL, setting them to NULL */
+extern void frt_docs_destroy(FrtDocument **docs, int cnt);
 
 #endif
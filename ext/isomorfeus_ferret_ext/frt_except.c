@@ -25,23 +25,17 @@ FILE *frt_x_exception_stream = NULL;
 
 const char *const FRT_UNSUPPORTED_ERROR_MSG = "Unsupported operation";
 const char *const FRT_EOF_ERROR_MSG = "Read past end of file";
-char frt_xmsg_buffer[FRT_XMSG_BUFFER_SIZE];
-char frt_xmsg_buffer_final[FRT_XMSG_BUFFER_FINAL_SIZE];
+/* thread local so that exceptions raised concurrently don't clobber each
+ * other's messages */
+_Thread_local char frt_xmsg_buffer[FRT_XMSG_BUFFER_SIZE];
+_Thread_local char frt_xmsg_buffer_final[FRT_XMSG_BUFFER_FINAL_SIZE];
 
-static frt_thread_key_t exception_stack_key;
-static frt_thread_once_t exception_stack_key_once = FRT_THREAD_ONCE_INIT;
-
-static void exception_stack_alloc(void) {
-    frt_thread_key_create(&exception_stack_key, NULL);
-    frt_thread_setspecific(exception_stack_key, NULL);
-}
+/* each native thread has its own stack of exception contexts */
+static _Thread_local frt_xcontext_t *exception_stack = NULL;
 
 void frt_xpush_context(frt_xcontext_t *context) {
-    frt_xcontext_t *top_context;
-    frt_thread_once(&exception_stack_key_once, *exception_stack_alloc);
-    top_context = (frt_xcontext_t *)frt_thread_getspecific(exception_stack_key);
-    context->next = top_context;
-    frt_thread_setspecific(exception_stack_key, context);
+    context->next = exception_stack;
+    exception_stack = context;
     context->handled = true;
     context->in_finally = false;
 }
@@ -54,9 +48,7 @@ static void frt_xraise_context(frt_xcontext_t *context, volatile int excode, con
 }
 
 void frt_xraise(int excode, const char *const msg) {
-    frt_xcontext_t *top_context;
-    frt_thread_once(&exception_stack_key_once, *exception_stack_alloc);
-    top_context = (frt_xcontext_t *)frt_thread_getspecific(exception_stack_key);
+    frt_xcontext_t *top_context = exception_stack;
 
     if (!top_context) {
         FRT_XEXIT(ERROR_TYPES[excode], msg);
@@ -72,11 +64,9 @@ void frt_xraise(int excode, const char *const msg) {
 }
 
 void frt_xpop_context(void) {
-    frt_xcontext_t *top_cxt, *context;
-    frt_thread_once(&exception_stack_key_once, *exception_stack_alloc);
-    top_cxt = (frt_xcontext_t *)frt_thread_getspecific(exception_stack_key);
-    context = top_cxt->next;
-    frt_thread_setspecific(exception_stack_key, context);
+    frt_xcontext_t *top_cxt = exception_stack;
+    frt_xcontext_t *context = top_cxt->next;
+    exception_stack = context;
     if (!top_cxt->handled) {
         if (context) {
             frt_xraise_context(context, top_cxt->excode, top_cxt->msg);
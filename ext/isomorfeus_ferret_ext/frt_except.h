@@ -182,7 +182,7 @@ extern void frt_xraise(int excode, const char *const msg);
 extern void frt_xpush_context(frt_xcontext_t *context);
 extern void frt_xpop_context();
 
-extern char frt_xmsg_buffer[FRT_XMSG_BUFFER_SIZE];
-extern char frt_xmsg_buffer_final[FRT_XMSG_BUFFER_FINAL_SIZE];
+extern _Thread_local char frt_xmsg_buffer[FRT_XMSG_BUFFER_SIZE];
+extern _Thread_local char frt_xmsg_buffer_final[FRT_XMSG_BUFFER_FINAL_SIZE];
 
 #endif
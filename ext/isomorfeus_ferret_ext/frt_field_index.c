@@ -12,7 +12,8 @@
 static unsigned long long field_index_hash(const void *p)
 {
     FrtFieldIndex *self = (FrtFieldIndex *)p;
-    return frt_str_hash(rb_id2name(self->field)) ^ (unsigned long long)(self->klass);
+    /* hash the ID itself, looking up its name isn't safe without the GVL */
+    return frt_ptr_hash((void *)self->field) ^ (unsigned long long)(self->klass);
 }
 
 static int field_index_eq(const void *p1, const void *p2)
@@ -29,24 +30,123 @@ static void field_index_destroy(void *p)
     if (self->index) {
         self->klass->destroy_index(self->index);
     }
+    if (self->dv_index) {
+        free(self->dv_index->starts);
+        free(self->dv_index->dvs);
+        free(self->dv_index);
+    }
     free(self);
 }
 
-FrtFieldIndex *frt_field_index_get(FrtIndexReader *ir, ID field, const FrtFieldIndexClass *klass) {
+static FrtFieldIndex *field_index_get_i(FrtIndexReader *ir, ID field, const FrtFieldIndexClass *klass, FrtFieldInfo *fi);
+
+/*
+ * Build the field index of a MultiReader by copying in the field indexes of
+ * each of its sub-readers. The sub-reader indexes are cached on the cores of
+ * the sub-readers, see frt_ir_core, which are shared between reopened readers
+ * so after an index update only the new segments need to be read.
+ */
+static void field_index_merge_sub_indexes(FrtFieldIndex *self, FrtIndexReader *ir, FrtFieldInfo *fi)
+{
+    FrtMultiReader *mr = (FrtMultiReader *)ir;
+    int i;
+    for (i = 0; i < mr->r_cnt; i++) {
+        FrtIndexReader *sub_reader = mr->sub_readers[i];
+        FrtIndexReader *core = frt_ir_core(sub_reader);
+        FrtFieldInfo *sub_fi = frt_fis_get_field(sub_reader->fis, fi->name);
+        FrtFieldIndex *volatile sub_index = NULL;
+        if (!sub_fi) {
+            continue; /* the field doesn't exist in this sub-index */
+        }
+        frt_mutex_lock(&core->field_index_mutex);
+        FRT_TRY
+            sub_index = field_index_get_i(core, fi->name, self->klass, sub_fi);
+        FRT_XFINALLY
+            frt_mutex_unlock(&core->field_index_mutex);
+        FRT_XENDTRY
+        if (sub_index->index) {
+            self->klass->merge_index(self->index, sub_index->index, mr->starts[i],
+                                     sub_reader->max_doc(sub_reader));
+        } else if (sub_index->dv_index) {
+            self->klass->merge_doc_values(self->index,
+                                          sub_index->dv_index->dvs[0],
+                                          mr->starts[i]);
+        }
+    }
+}
+
+/* the column of +sub_reader+'s field, NULL if it doesn't suit +klass+ */
+static FrtDocValues *field_index_get_doc_values(const FrtFieldIndexClass *klass,
+                                                FrtIndexReader *sub_reader,
+                                                ID field)
+{
+    FrtDocValues *dv = frt_sr_get_doc_values(sub_reader, field);
+    return (dv && klass->uses_doc_values(dv->type)) ? dv : NULL;
+}
+
+/*
+ * Segments hold the values of doc values fields in a column which the sort
+ * comparators read in place, so the index isn't built at all. A MultiReader
+ * reads the columns of its segments as long as every segment with the field
+ * has one and the values of one segment can be compared with those of
+ * another.
+ */
+static bool field_index_use_doc_values(FrtFieldIndex *self, FrtIndexReader *ir, FrtFieldInfo *fi)
+{
+    const FrtFieldIndexClass *klass = self->klass;
+    FrtDocValuesIndex *dvi;
+    int i;
+
+    if (NULL == klass->uses_doc_values || !bits_doc_values_type(fi->bits)) {
+        return false;
+    }
+    if (ir->type == FRT_SEGMENT_READER) {
+        FrtDocValues *dv = field_index_get_doc_values(klass, ir, fi->name);
+        if (NULL == dv) {
+            return false;
+        }
+        dvi = FRT_ALLOC(FrtDocValuesIndex);
+        dvi->size = 1;
+        dvi->starts = FRT_ALLOC_N(int, 2);
+        dvi->starts[0] = 0;
+        dvi->starts[1] = ir->max_doc(ir);
+        dvi->dvs = FRT_ALLOC_N(FrtDocValues *, 1);
+        dvi->dvs[0] = dv;
+    } else if (ir->type == FRT_MULTI_READER && klass->merge_index) {
+        FrtMultiReader *mr = (FrtMultiReader *)ir;
+        FrtDocValues **dvs = FRT_ALLOC_AND_ZERO_N(FrtDocValues *, mr->r_cnt);
+        for (i = 0; i < mr->r_cnt; i++) {
+            FrtIndexReader *sub_reader = mr->sub_readers[i];
+            if (NULL == frt_fis_get_field(sub_reader->fis, fi->name)) {
+                continue; /* the field doesn't exist in this sub-index */
+            }
+            if (sub_reader->type != FRT_SEGMENT_READER || NULL ==
+                (dvs[i] = field_index_get_doc_values(klass, sub_reader, fi->name))) {
+                free(dvs);
+                return false;
+            }
+        }
+        dvi = FRT_ALLOC(FrtDocValuesIndex);
+        dvi->size = mr->r_cnt;
+        dvi->starts = FRT_ALLOC_N(int, mr->r_cnt + 1);
+        memcpy(dvi->starts, mr->starts, (mr->r_cnt + 1) * sizeof(int));
+        dvi->dvs = dvs;
+    } else {
+        return false;
+    }
+    self->dv_index = dvi;
+    return true;
+}
+
+static FrtFieldIndex *field_index_get_i(FrtIndexReader *ir, ID field, const FrtFieldIndexClass *klass, FrtFieldInfo *fi)
+{
     int length = 0;
     FrtTermEnum *volatile te = NULL;
     FrtTermDocEnum *volatile tde = NULL;
-    FrtFieldInfo *fi = frt_fis_get_field(ir->fis, field);
-    const volatile int field_num = fi ? fi->number : -1;
+    const int field_num = fi->number;
     FrtFieldIndex *volatile self = NULL;
     FrtFieldIndex key;
 
-    if (field_num < 0) {
-        FRT_RAISE(FRT_ARG_ERROR,
-              "Cannot sort by field \"%s\". It doesn't exist in the index.",
-              rb_id2name(field));
-    }
-
     if (!ir->field_index_cache) {
         ir->field_index_cache = frt_h_new(&field_index_hash, &field_index_eq,
                                       NULL, &field_index_destroy);
@@ -57,7 +157,7 @@ FrtFieldIndex *frt_field_index_get(FrtIndexReader *ir, ID field, const FrtFieldI
     self = (FrtFieldIndex *)frt_h_get(ir->field_index_cache, &key);
 
     if (self == NULL) {
-        self = FRT_ALLOC(FrtFieldIndex);
+        self = FRT_ALLOC_AND_ZERO(FrtFieldIndex);
         self->klass = klass;
         /* FieldIndex only lives as long as the IndexReader lives so we can
          * just use the field_infos field symbol */
@@ -68,17 +168,23 @@ FrtFieldIndex *frt_field_index_get(FrtIndexReader *ir, ID field, const FrtFieldI
             FRT_TRY
             {
                 void *index;
-                tde = ir->term_docs(ir);
-                te = ir->terms(ir, field_num);
-                index = self->index = klass->create_index(length);
-                while (te->next(te)) {
-                    tde->seek_te(tde, te);
-                    klass->handle_term(index, tde, te->curr_term);
+                if (field_index_use_doc_values(self, ir, fi)) {
+                    /* the columns are read in place */
+                } else if (index = self->index = klass->create_index(length),
+                           ir->type == FRT_MULTI_READER && klass->merge_index) {
+                    field_index_merge_sub_indexes(self, ir, fi);
+                } else {
+                    tde = ir->term_docs(ir);
+                    te = ir->terms(ir, field_num);
+                    while (te->next(te)) {
+                        tde->seek_te(tde, te);
+                        klass->handle_term(index, tde, te->curr_term);
+                    }
                 }
             }
             FRT_XFINALLY
-                tde->close(tde);
-                te->close(te);
+                if (tde) tde->close(tde);
+                if (te) te->close(te);
             FRT_XENDTRY
         }
         frt_h_set(ir->field_index_cache, self, self);
@@ -87,6 +193,21 @@ FrtFieldIndex *frt_field_index_get(FrtIndexReader *ir, ID field, const FrtFieldI
     return self;
 }
 
+FrtFieldIndex *frt_field_index_get(FrtIndexReader *ir, ID field, const FrtFieldIndexClass *klass) {
+    FrtFieldInfo *fi;
+
+    ir = frt_ir_core(ir);
+    fi = frt_fis_get_field(ir->fis, field);
+
+    if (fi == NULL) {
+        FRT_RAISE(FRT_ARG_ERROR,
+              "Cannot sort by field \"%s\". It doesn't exist in the index.",
+              rb_id2name(field));
+    }
+
+    return field_index_get_i(ir, field, klass, fi);
+}
+
 /******************************************************************************
  * ByteFieldIndex < FieldIndex
  *
@@ -120,11 +241,20 @@ static void byte_destroy_index(void *p)
     free(&index[-1]);
 }
 
+/* numeric values or string ords, both of which sort like the term ranks */
+static bool byte_uses_doc_values(FrtDocValuesType type)
+{
+    return type != FRT_DOC_VALUES_NONE;
+}
+
 const FrtFieldIndexClass FRT_BYTE_FIELD_INDEX_CLASS = {
     "byte",
     &byte_create_index,
     &byte_destroy_index,
-    &byte_handle_term
+    &byte_handle_term,
+    NULL, /* byte values are term ranks so they can't be merged across readers */
+    &byte_uses_doc_values,
+    NULL
 };
 
 /******************************************************************************
@@ -135,6 +265,11 @@ static void *integer_create_index(int size)
     return FRT_ALLOC_AND_ZERO_N(long, size);
 }
 
+static void integer_merge_index(void *index_ptr, void *sub_index_ptr, int start, int size)
+{
+    memcpy((long *)index_ptr + start, sub_index_ptr, size * sizeof(long));
+}
+
 static void integer_handle_term(void *index_ptr,
                                 FrtTermDocEnum *tde,
                                 const char *text)
@@ -147,11 +282,28 @@ static void integer_handle_term(void *index_ptr,
     }
 }
 
+static bool numeric_uses_doc_values(FrtDocValuesType type)
+{
+    return type == FRT_DOC_VALUES_NUMERIC;
+}
+
+static void integer_merge_doc_values(void *index_ptr, FrtDocValues *dv, int start)
+{
+    long *index = (long *)index_ptr + start;
+    int i;
+    for (i = 0; i < dv->size; i++) {
+        index[i] = (long)frt_dv_get_long(dv, i);
+    }
+}
+
 const FrtFieldIndexClass FRT_INTEGER_FIELD_INDEX_CLASS = {
     "integer",
     &integer_create_index,
     &free,
-    &integer_handle_term
+    &integer_handle_term,
+    &integer_merge_index,
+    &numeric_uses_doc_values,
+    &integer_merge_doc_values
 };
 
 /******************************************************************************
@@ -163,6 +315,11 @@ static void *float_create_index(int size)
     return FRT_ALLOC_AND_ZERO_N(float, size);
 }
 
+static void float_merge_index(void *index_ptr, void *sub_index_ptr, int start, int size)
+{
+    memcpy((float *)index_ptr + start, sub_index_ptr, size * sizeof(float));
+}
+
 static void float_handle_term(void *index_ptr,
                               FrtTermDocEnum *tde,
                               const char *text)
@@ -175,11 +332,23 @@ static void float_handle_term(void *index_ptr,
     }
 }
 
+static void float_merge_doc_values(void *index_ptr, FrtDocValues *dv, int start)
+{
+    float *index = (float *)index_ptr + start;
+    int i;
+    for (i = 0; i < dv->size; i++) {
+        index[i] = (float)frt_dv_get_long(dv, i);
+    }
+}
+
 const FrtFieldIndexClass FRT_FLOAT_FIELD_INDEX_CLASS = {
     "float",
     &float_create_index,
     &free,
-    &float_handle_term
+    &float_handle_term,
+    &float_merge_index,
+    &numeric_uses_doc_values,
+    &float_merge_doc_values
 };
 
 /******************************************************************************
@@ -202,8 +371,10 @@ static void string_destroy_index(void *p)
     FrtStringIndex *self = (FrtStringIndex *)p;
     int i;
     free(self->index);
-    for (i = 0; i < self->v_size; i++) {
-        free(self->values[i]);
+    if (!self->shares_values) {
+        for (i = 0; i < self->v_size; i++) {
+            free(self->values[i]);
+        }
     }
     free(self->values);
     free(self);
@@ -225,9 +396,72 @@ static void string_handle_term(void *index_ptr,
     index->v_size++;
 }
 
+/*
+ * The merged index points at the values of the sub-reader indexes rather
+ * than copying them. The sub-readers are referenced by the MultiReader so
+ * they outlive its field index cache.
+ */
+static void string_merge_index(void *index_ptr, void *sub_index_ptr, int start, int size)
+{
+    FrtStringIndex *index = (FrtStringIndex *)index_ptr;
+    FrtStringIndex *sub_index = (FrtStringIndex *)sub_index_ptr;
+    const int offset = index->v_size - 1;
+    int i;
+
+    index->shares_values = true;
+    if (index->v_size + sub_index->v_size > index->v_capa) {
+        while (index->v_size + sub_index->v_size > index->v_capa) {
+            index->v_capa *= 2;
+        }
+        FRT_REALLOC_N(index->values, char *, index->v_capa);
+    }
+    memcpy(index->values + index->v_size, sub_index->values + 1,
+           (sub_index->v_size - 1) * sizeof(char *));
+    index->v_size += sub_index->v_size - 1;
+
+    for (i = 0; i < size; i++) {
+        const long val = sub_index->index[i];
+        index->index[start + i] = val ? val + offset : 0;
+    }
+}
+
+static bool string_uses_doc_values(FrtDocValuesType type)
+{
+    return type == FRT_DOC_VALUES_SORTED || type == FRT_DOC_VALUES_SORTED_SET;
+}
+
+/*
+ * Like string_merge_index the values point at the column's ords. The column
+ * is cached on the SegmentReader which the MultiReader references.
+ */
+static void string_merge_doc_values(void *index_ptr, FrtDocValues *dv, int start)
+{
+    FrtStringIndex *index = (FrtStringIndex *)index_ptr;
+    const int offset = index->v_size;
+    int i;
+
+    index->shares_values = true;
+    if (index->v_size + dv->ord_cnt > index->v_capa) {
+        while (index->v_size + dv->ord_cnt > index->v_capa) {
+            index->v_capa *= 2;
+        }
+        FRT_REALLOC_N(index->values, char *, index->v_capa);
+    }
+    memcpy(index->values + index->v_size, dv->ords, dv->ord_cnt * sizeof(char *));
+    index->v_size += dv->ord_cnt;
+
+    for (i = 0; i < dv->size; i++) {
+        const int ord = frt_dv_get_ord(dv, i);
+        index->index[start + i] = ord < 0 ? 0 : ord + offset;
+    }
+}
+
 const FrtFieldIndexClass FRT_STRING_FIELD_INDEX_CLASS = {
     "string",
     &string_create_index,
     &string_destroy_index,
-    &string_handle_term
+    &string_handle_term,
+    &string_merge_index,
+    &string_uses_doc_values,
+    &string_merge_doc_values
 };
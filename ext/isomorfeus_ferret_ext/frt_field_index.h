@@ -15,6 +15,7 @@ typedef struct FrtStringIndex {
     char **values;
     int  v_size;
     int  v_capa;
+    bool shares_values : 1;
 } FrtStringIndex;
 
 typedef struct FrtFieldIndexClass FrtFieldIndexClass;
@@ -23,12 +24,34 @@ struct FrtFieldIndexClass {
     void *(*create_index)(int size);
     void  (*destroy_index)(void *p);
     void  (*handle_term)(void *index, FrtTermDocEnum *tde, const char *text);
+    /* copy a sub-reader's index into index starting at start. May be NULL
+     * in which case a MultiReader's index is built from its terms. */
+    void  (*merge_index)(void *index, void *sub_index, int start, int size);
+    /* whether the values can be read straight from a doc values column of
+     * +type+ instead of building the index. May be NULL */
+    bool  (*uses_doc_values)(FrtDocValuesType type);
+    /* copy a sub-reader's doc values column into index starting at start,
+     * like merge_index. May be NULL if merge_index is */
+    void  (*merge_doc_values)(void *index, FrtDocValues *dv, int start);
 };
 
+/*
+ * The doc values columns of the segments of a reader, read in place of an
+ * index. Document +doc+ of the reader is in the segment +i+ for which
+ * starts[i] <= doc < starts[i + 1]. dvs[i] is NULL if that segment doesn't
+ * have the field.
+ */
+typedef struct FrtDocValuesIndex {
+    int          size;
+    int          *starts;
+    FrtDocValues **dvs;
+} FrtDocValuesIndex;
+
 typedef struct FrtFieldIndex {
     ID    field;
     const FrtFieldIndexClass *klass;
     void  *index;
+    FrtDocValuesIndex *dv_index; /* set instead of index */
 } FrtFieldIndex;
 
 extern const FrtFieldIndexClass FRT_INTEGER_FIELD_INDEX_CLASS;
@@ -17,17 +17,63 @@ void frt_filt_deref(FrtFilter *filt) {
     if (FRT_DEREF(filt) == 0) filt->destroy_i(filt);
 }
 
+/* filters may be shared by searches running in parallel */
+static frt_mutex_t filt_cache_mutex = FRT_MUTEX_INITIALIZER;
+
+/*
+ * Stitch the bits of each of a MultiReader's sub-readers together. The
+ * sub-reader bits are cached on the sub-readers which are shared by reopened
+ * readers so after an index update the filter only needs to be evaluated
+ * against the new segments.
+ */
+static FrtBitVector *filt_get_bv_per_segment(FrtFilter *filt, FrtIndexReader *ir) {
+    FrtMultiReader *mr = (FrtMultiReader *)ir;
+    FrtBitVector *bv = frt_bv_new_capa(ir->max_doc(ir));
+    int i;
+    for (i = 0; i < mr->r_cnt; i++) {
+        FrtIndexReader *sub_reader = mr->sub_readers[i];
+        FrtBitVector *sub_bv = frt_filt_get_bv(filt, sub_reader);
+        const int start = mr->starts[i];
+        const int sub_max_doc = sub_reader->max_doc(sub_reader);
+        int bit = -1;
+        while ((bit = frt_bv_scan_next_from(sub_bv, bit + 1)) >= 0
+               && bit < sub_max_doc) {
+            frt_bv_set(bv, start + bit);
+        }
+        if (sub_bv->extends_as_ones) {
+            for (bit = sub_bv->size; bit < sub_max_doc; bit++) {
+                frt_bv_set(bv, start + bit);
+            }
+        }
+    }
+    return bv;
+}
+
 FrtBitVector *frt_filt_get_bv(FrtFilter *filt, FrtIndexReader *ir) {
-    FrtCacheObject *co = (FrtCacheObject *)frt_h_get(filt->cache, ir);
+    FrtCacheObject *co;
+    ir = frt_ir_core(ir);
+    frt_mutex_lock(&filt_cache_mutex);
+    co = (FrtCacheObject *)frt_h_get(filt->cache, ir);
+    frt_mutex_unlock(&filt_cache_mutex);
 
     if (!co) {
-        FrtBitVector *bv;
-        if (!ir->cache) {
-            frt_ir_add_cache(ir);
+        /* the bits are calculated outside of the lock as a wrapped filter
+         * may need to call back into ruby */
+        FrtBitVector *bv = (filt->per_segment && ir->type == FRT_MULTI_READER)
+            ? filt_get_bv_per_segment(filt, ir)
+            : filt->get_bv_i(filt, ir);
+        frt_mutex_lock(&filt_cache_mutex);
+        co = (FrtCacheObject *)frt_h_get(filt->cache, ir);
+        if (!co) {
+            if (!ir->cache) {
+                frt_ir_add_cache(ir);
+            }
+            co = frt_co_create(filt->cache, ir->cache, filt, ir,
+                           (frt_free_ft)&frt_bv_destroy, (void *)bv);
+        } else {
+            frt_bv_destroy(bv);
         }
-        bv = filt->get_bv_i(filt, ir);
-        co = frt_co_create(filt->cache, ir->cache, filt, ir,
-                       (frt_free_ft)&frt_bv_destroy, (void *)bv);
+        frt_mutex_unlock(&filt_cache_mutex);
     }
     return (FrtBitVector *)co->obj;
 }
@@ -54,6 +100,7 @@ FrtFilter *frt_filt_create(size_t size, ID name) {
     filt->hash      = &frt_filt_hash_default;
     filt->eq        = &frt_filt_eq_default;
     filt->destroy_i = &frt_filt_destroy_i;
+    filt->per_segment = true;
     filt->ref_cnt   = 1;
     filt->rfilter   = Qnil;
     return filt;
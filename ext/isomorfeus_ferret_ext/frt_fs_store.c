@@ -28,6 +28,7 @@
 # define DIR_SEPARATOR_CHAR '/'
 # include <unistd.h>
 # include <dirent.h>
+# include <sys/mman.h>
 #endif
 #ifndef O_BINARY
 # define O_BINARY 0
@@ -286,10 +287,119 @@ static FrtOutStream *fs_new_output(FrtStore *store, const char *filename)
     return os;
 }
 
+/*
+ * A file open for reading. All input streams of a file share one descriptor
+ * which they read with pread, so any number of readers and threads can use
+ * it at once without seeking it. Windows has no pread, there each input
+ * stream opens its own descriptor and seeks it before reading.
+ */
+struct FrtFSFile {
+    int       fd;
+    int       ref_cnt;          /* guarded by fs_files_mutex */
+    char      *path;
+    dev_t     dev;
+    ino_t     ino;
+};
+
+#if !defined POSH_OS_WIN32 && !defined POSH_OS_WIN64
+# define FS_SHARE_FILES
+#endif
+
+/* the shared files by path */
+static FrtHash *fs_files = NULL;
+static frt_mutex_t fs_files_mutex = FRT_MUTEX_INITIALIZER;
+
+/*
+ * A shared file may only be handed out again while its path still names the
+ * file that was opened. Once it has been deleted or replaced, new input
+ * streams have to open the new file.
+ */
+static bool fs_file_is_current(FrtFSFile *fsf)
+{
+    struct stat stt;
+    return !stat(fsf->path, &stt) && stt.st_dev == fsf->dev
+        && stt.st_ino == fsf->ino;
+}
+
+static FrtFSFile *fs_file_open(const char *path)
+{
+    FrtFSFile *fsf = NULL;
+    struct stat stt;
+    int fd;
+
+    frt_mutex_lock(&fs_files_mutex);
+#ifdef FS_SHARE_FILES
+    if (!fs_files) {
+        fs_files = frt_h_new_str(NULL, NULL);
+        frt_register_for_cleanup(fs_files, (frt_free_ft)frt_h_destroy);
+    }
+    fsf = (FrtFSFile *)frt_h_get(fs_files, path);
+    if (fsf && !fs_file_is_current(fsf)) {
+        /* streams still reading the old file keep it open */
+        frt_h_del(fs_files, path);
+        fsf = NULL;
+    }
+#endif
+    if (NULL == fsf) {
+        fd = open(path, O_RDONLY | O_BINARY);
+        if (fd < 0) {
+            frt_mutex_unlock(&fs_files_mutex);
+            FRT_RAISE(FRT_FILE_NOT_FOUND_ERROR,
+                  "tried to open \"%s\" but it doesn't exist: <%s>",
+                  path, strerror(errno));
+        }
+        fsf = FRT_ALLOC_AND_ZERO(FrtFSFile);
+        fsf->fd = fd;
+        fsf->path = frt_estrdup(path);
+        if (!fstat(fd, &stt)) {
+            fsf->dev = stt.st_dev;
+            fsf->ino = stt.st_ino;
+        }
+#ifdef FS_SHARE_FILES
+        frt_h_set(fs_files, fsf->path, fsf);
+#endif
+    }
+    fsf->ref_cnt++;
+    frt_mutex_unlock(&fs_files_mutex);
+    return fsf;
+}
+
+static void fs_file_close(FrtFSFile *fsf)
+{
+    int err = 0;
+    frt_mutex_lock(&fs_files_mutex);
+    if (--fsf->ref_cnt == 0) {
+        if (fs_files && frt_h_get(fs_files, fsf->path) == fsf) {
+            frt_h_del(fs_files, fsf->path);
+        }
+        if (close(fsf->fd)) {
+            err = errno;
+        }
+        free(fsf->path);
+        free(fsf);
+    }
+    frt_mutex_unlock(&fs_files_mutex);
+    if (err) {
+        FRT_RAISE(FRT_IO_ERROR, "%s", strerror(err));
+    }
+}
+
 static void fsi_read_i(FrtInStream *is, frt_uchar *path, int len)
 {
-    int fd = is->f->file.fd;
+    int fd = is->f->file.fsf->fd;
     frt_off_t pos = frt_is_pos(is);
+#ifdef FS_SHARE_FILES
+    int read_len = 0;
+    while (read_len < len) {
+        ssize_t res = pread(fd, path + read_len, len - read_len, pos + read_len);
+        if (res <= 0) {
+            if (res < 0 && errno == EINTR) continue;
+            FRT_RAISE(FRT_IO_ERROR, "couldn't read %d chars from %s: <%s>",
+                  len, is->d.path, res < 0 ? strerror(errno) : "end of file");
+        }
+        read_len += (int)res;
+    }
+#else
     if (pos != lseek(fd, 0, SEEK_CUR)) {
         lseek(fd, pos, SEEK_SET);
     }
@@ -300,31 +410,36 @@ static void fsi_read_i(FrtInStream *is, frt_uchar *path, int len)
                   len, path, strerror(errno));
         }
     }
+#endif
 }
 
 static void fsi_seek_i(FrtInStream *is, frt_off_t pos) {
-#if (defined POSH_OS_WIN32 || defined POSH_OS_WIN64)
-    if (_lseeki64(is->f->file.fd, pos, SEEK_SET) < 0) {
+#ifdef FS_SHARE_FILES
+    /* pread is given the position so the descriptor is never seeked */
+    (void)is;
+    (void)pos;
 #else
-    if (lseek(is->f->file.fd, pos, SEEK_SET) < 0) {
-#endif
+# if (defined POSH_OS_WIN32 || defined POSH_OS_WIN64)
+    if (_lseeki64(is->f->file.fsf->fd, pos, SEEK_SET) < 0) {
+# else
+    if (lseek(is->f->file.fsf->fd, pos, SEEK_SET) < 0) {
+# endif
         FRT_RAISE(FRT_IO_ERROR, "seeking pos %"FRT_OFF_T_PFX"d: <%s>",
               pos, strerror(errno));
     }
+#endif
 }
 
 static void fsi_close_i(FrtInStream *is)
 {
-    if (close(is->f->file.fd)) {
-        FRT_RAISE(FRT_IO_ERROR, "%s", strerror(errno));
-    }
     if (is->d.path) free(is->d.path);
+    fs_file_close(is->f->file.fsf);
 }
 
 static frt_off_t fsi_length_i(FrtInStream *is)
 {
     struct stat stt;
-    if (fstat(is->f->file.fd, &stt)) {
+    if (fstat(is->f->file.fsf->fd, &stt)) {
         FRT_RAISE(FRT_IO_ERROR, "fstat failed: <%s>", strerror(errno));
     }
     return stt.st_size;
@@ -341,19 +456,93 @@ static FrtInStream *fs_open_input(FrtStore *store, const char *filename)
 {
     FrtInStream *is;
     char path[FRT_MAX_FILE_PATH];
+    FrtFSFile *fsf = fs_file_open(join_path(path, store->dir.path, filename));
+    is = frt_is_new();
+    is->f->file.fsf = fsf;
+    is->f->ref_cnt = 1;
+    is->d.path = frt_estrdup(path);
+    is->m = &FS_IN_STREAM_METHODS;
+    return is;
+}
+
+#if !defined POSH_OS_WIN32 && !defined POSH_OS_WIN64
+/*
+ * Memory mapped input streams. The stream's buffer covers the whole mapping
+ * so the read functions below are only needed by code which goes around the
+ * buffer.
+ */
+static void mmapi_read_i(FrtInStream *is, frt_uchar *buf, int len)
+{
+    frt_off_t pos = frt_is_pos(is);
+    if (pos + len > is->f->file.map.len) {
+        FRT_RAISE(FRT_EOF_ERROR, "couldn't read %d chars from %s", len,
+                  is->d.path);
+    }
+    memcpy(buf, is->f->file.map.addr + pos, len);
+}
+
+static void mmapi_seek_i(FrtInStream *is, frt_off_t pos)
+{
+    (void)is;
+    (void)pos;
+}
+
+static void mmapi_close_i(FrtInStream *is)
+{
+    if (munmap(is->f->file.map.addr, is->f->file.map.len)) {
+        FRT_RAISE(FRT_IO_ERROR, "%s", strerror(errno));
+    }
+    if (is->d.path) free(is->d.path);
+}
+
+static frt_off_t mmapi_length_i(FrtInStream *is)
+{
+    return is->f->file.map.len;
+}
+
+static const struct FrtInStreamMethods MMAP_IN_STREAM_METHODS = {
+    mmapi_read_i,
+    mmapi_seek_i,
+    mmapi_length_i,
+    mmapi_close_i
+};
+
+static FrtInStream *mmap_open_input(FrtStore *store, const char *filename)
+{
+    FrtInStream *is;
+    struct stat stt;
+    void *addr;
+    char path[FRT_MAX_FILE_PATH];
     int fd = open(join_path(path, store->dir.path, filename), O_RDONLY | O_BINARY);
     if (fd < 0) {
         FRT_RAISE(FRT_FILE_NOT_FOUND_ERROR,
               "tried to open \"%s\" but it doesn't exist: <%s>",
               path, strerror(errno));
     }
-    is = frt_is_new();
-    is->f->file.fd = fd;
-    is->f->ref_cnt = 1;
+    if (fstat(fd, &stt)) {
+        close(fd);
+        FRT_RAISE(FRT_IO_ERROR, "fstat failed: <%s>", strerror(errno));
+    }
+    if (stt.st_size == 0) {
+        /* empty files can't be mapped */
+        close(fd);
+        return fs_open_input(store, filename);
+    }
+    addr = mmap(NULL, stt.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    /* the mapping stays valid after the file is closed */
+    close(fd);
+    if (addr == MAP_FAILED) {
+        FRT_RAISE(FRT_IO_ERROR, "couldn't map \"%s\": <%s>", path,
+              strerror(errno));
+    }
+    is = frt_is_new_mapped((const frt_uchar *)addr, stt.st_size);
+    is->f->file.map.addr = (frt_uchar *)addr;
+    is->f->file.map.len = stt.st_size;
     is->d.path = frt_estrdup(path);
-    is->m = &FS_IN_STREAM_METHODS;
+    is->m = &MMAP_IN_STREAM_METHODS;
     return is;
 }
+#endif
 
 #define LOCK_OBTAIN_TIMEOUT 50
 
@@ -423,6 +612,7 @@ static void fs_close_lock_i(FrtLock *lock)
 }
 
 static FrtHash *stores = NULL;
+static FrtHash *mmap_stores = NULL;
 
 static frt_mutex_t stores_mutex = FRT_MUTEX_INITIALIZER;
 
@@ -433,6 +623,13 @@ static void fs_close_i(FrtStore *store)
     frt_mutex_unlock(&stores_mutex);
 }
 
+static void mmap_close_i(FrtStore *store)
+{
+    frt_mutex_lock(&stores_mutex);
+    frt_h_del(mmap_stores, store->dir.path);
+    frt_mutex_unlock(&stores_mutex);
+}
+
 static FrtStore *fs_store_new(const char *pathname)
 {
     FrtStore *new_store = frt_store_new();
@@ -503,3 +700,29 @@ FrtStore *frt_open_fs_store(const char *pathname)
 
     return store;
 }
+
+FrtStore *frt_open_mmap_store(const char *pathname)
+{
+    FrtStore *store = NULL;
+
+    if (!mmap_stores) {
+        mmap_stores = frt_h_new_str(NULL, (frt_free_ft)fs_destroy);
+        frt_register_for_cleanup(mmap_stores, (frt_free_ft)frt_h_destroy);
+    }
+
+    frt_mutex_lock(&stores_mutex);
+    store = (FrtStore *)frt_h_get(mmap_stores, pathname);
+    if (store) {
+        FRT_REF(store);
+    } else {
+        store = fs_store_new(pathname);
+#if !defined POSH_OS_WIN32 && !defined POSH_OS_WIN64
+        store->open_input = &mmap_open_input;
+#endif
+        store->close_i    = &mmap_close_i;
+        frt_h_set(mmap_stores, store->dir.path, store);
+    }
+    frt_mutex_unlock(&stores_mutex);
+
+    return store;
+}
@@ -0,0 +1,564 @@
+#include "frt_fst.h"
+#include <string.h>
+
+/*
+ * The transducer is built from sorted terms with the incremental algorithm
+ * of Daciuk et al. The builder keeps the path of the last term added as the
+ * "frontier". When the next term is added the frontier nodes below the
+ * common prefix can no longer change, so they are frozen: serialized and
+ * looked up in a table of the nodes written so far, which is how equal
+ * suffixes end up sharing their nodes.
+ *
+ * The output of a term is its ordinal. It is put on the arc where the term
+ * branches off the previous term, so the output of a path is the ordinal of
+ * the first (smallest) term through it. Arc outputs therefore grow with the
+ * arc labels of a node and final nodes never need an output of their own.
+ *
+ * A compiled node is a vint header (arc count << 2 | fixed << 1 | final)
+ * followed by its arcs in label order. Small nodes write each arc as a label
+ * byte, a vint with the distance back to the target node (usually the node
+ * written just before) shifted left by one and a flag for whether the arc
+ * has an output, and then the output, if any, as a vint. Nodes with
+ * FST_FIXED_ARC_MIN or more arcs use fixed width arcs with absolute target
+ * addresses so they can be binary searched.
+ */
+
+#define FST_FIXED_ARC_MIN 8
+#define FST_FIXED_ARC_SIZE 9
+#define FST_MAX_NODE_SIZE (5 + 256 * FST_FIXED_ARC_SIZE)
+#define FST_TABLE_INIT_CAPA 256
+
+typedef struct FstArc {
+    int label;
+    int output;
+    int target;
+} FstArc;
+
+typedef struct FstNode {
+    int addr;
+    const frt_uchar *arcs;
+    int cnt;
+    bool fixed;
+    bool final;
+} FstNode;
+
+typedef struct FstBuildNode {
+    FstArc *arcs;
+    int size;
+    int capa;
+    bool final;
+} FstBuildNode;
+
+typedef struct FstTableEntry {
+    unsigned long hash;
+    int addr;
+    bool used;
+} FstTableEntry;
+
+struct FrtFstBuilder {
+    FstBuildNode frontier[FRT_MAX_WORD_SIZE + 1];
+    int acc[FRT_MAX_WORD_SIZE + 1];
+    frt_uchar last[FRT_MAX_WORD_SIZE + 1];
+    int last_len;
+    int count;
+    frt_uchar *bytes;
+    int size;
+    int capa;
+    FstTableEntry *table;
+    int table_size;
+    int table_capa;
+    frt_uchar scratch[FST_MAX_NODE_SIZE];
+};
+
+/****************************************************************************
+ * Encoding
+ ****************************************************************************/
+
+static frt_uchar *fst_write_vint(frt_uchar *p, unsigned int i)
+{
+    while (i > 127) {
+        *p++ = (frt_uchar)((i & 0x7f) | 0x80);
+        i >>= 7;
+    }
+    *p++ = (frt_uchar)i;
+    return p;
+}
+
+static frt_uchar *fst_write_u32(frt_uchar *p, unsigned int i)
+{
+    p[0] = (frt_uchar)i;
+    p[1] = (frt_uchar)(i >> 8);
+    p[2] = (frt_uchar)(i >> 16);
+    p[3] = (frt_uchar)(i >> 24);
+    return p + 4;
+}
+
+static inline const frt_uchar *fst_read_vint(const frt_uchar *p, int *i)
+{
+    unsigned int res = *p & 0x7f;
+    int shift = 7;
+    while (*p++ & 0x80) {
+        res |= (unsigned int)(*p & 0x7f) << shift;
+        shift += 7;
+    }
+    *i = (int)res;
+    return p;
+}
+
+static inline int fst_read_u32(const frt_uchar *p)
+{
+    return (int)((unsigned int)p[0] | ((unsigned int)p[1] << 8)
+                 | ((unsigned int)p[2] << 16) | ((unsigned int)p[3] << 24));
+}
+
+/****************************************************************************
+ * Reading
+ ****************************************************************************/
+
+static inline void fst_node(const FrtFst *fst, int addr, FstNode *node)
+{
+    int header;
+    node->addr = addr;
+    node->arcs = fst_read_vint(fst->bytes + addr, &header);
+    node->cnt = header >> 2;
+    node->fixed = (header & 2) != 0;
+    node->final = (header & 1) != 0;
+}
+
+/* only for fixed width nodes */
+static inline void fst_arc_at(const FstNode *node, int i, FstArc *arc)
+{
+    const frt_uchar *p = node->arcs + i * FST_FIXED_ARC_SIZE;
+    arc->label = p[0];
+    arc->output = fst_read_u32(p + 1);
+    arc->target = fst_read_u32(p + 5);
+}
+
+/* only for variable width nodes */
+static inline const frt_uchar *fst_read_arc(const FstNode *node,
+                                            const frt_uchar *p, FstArc *arc)
+{
+    int distance;
+    arc->label = *p++;
+    p = fst_read_vint(p, &distance);
+    arc->target = node->addr - (distance >> 1);
+    if (distance & 1) {
+        return fst_read_vint(p, &arc->output);
+    }
+    arc->output = 0;
+    return p;
+}
+
+/*
+ * Find the arc labeled +label+ and the arc with the largest label smaller
+ * than +label+. Returns true if the arc was found.
+ */
+static bool fst_find_arc(const FstNode *node, int label, FstArc *arc,
+                         FstArc *lower, bool *has_lower)
+{
+    *has_lower = false;
+    if (node->fixed) {
+        int lo = 0, hi = node->cnt - 1;
+        while (lo <= hi) {
+            int mid = (lo + hi) >> 1;
+            int mid_label = node->arcs[mid * FST_FIXED_ARC_SIZE];
+            if (mid_label < label) {
+                lo = mid + 1;
+            } else if (mid_label > label) {
+                hi = mid - 1;
+            } else {
+                fst_arc_at(node, mid, arc);
+                if (mid > 0) {
+                    fst_arc_at(node, mid - 1, lower);
+                    *has_lower = true;
+                }
+                return true;
+            }
+        }
+        if (hi >= 0) {
+            fst_arc_at(node, hi, lower);
+            *has_lower = true;
+        }
+    } else {
+        const frt_uchar *p = node->arcs;
+        int i;
+        for (i = 0; i < node->cnt; i++) {
+            p = fst_read_arc(node, p, arc);
+            if (arc->label == label) {
+                return true;
+            } else if (arc->label > label) {
+                break;
+            }
+            *lower = *arc;
+            *has_lower = true;
+        }
+    }
+    return false;
+}
+
+static void fst_last_arc(const FstNode *node, FstArc *arc)
+{
+    if (node->fixed) {
+        fst_arc_at(node, node->cnt - 1, arc);
+    } else {
+        const frt_uchar *p = node->arcs;
+        int i;
+        for (i = 0; i < node->cnt; i++) {
+            p = fst_read_arc(node, p, arc);
+        }
+    }
+}
+
+int frt_fst_get(FrtFst *fst, const char *term)
+{
+    const frt_uchar *t = (const frt_uchar *)term;
+    FstNode node;
+    FstArc arc, lower;
+    bool has_lower;
+    int acc = 0;
+
+    fst_node(fst, fst->root, &node);
+    for (; *t; t++) {
+        if (!fst_find_arc(&node, *t, &arc, &lower, &has_lower)) {
+            return -1;
+        }
+        acc += arc.output;
+        fst_node(fst, arc.target, &node);
+    }
+    return node.final ? acc : -1;
+}
+
+int frt_fst_floor(FrtFst *fst, const char *term, char *buf, int *len)
+{
+    const frt_uchar *t = (const frt_uchar *)term;
+    FstNode node;
+    FstArc arc, lower, best_arc = {0, 0, 0};
+    bool found, has_lower, best_is_arc = false;
+    int acc = 0, depth = 0, best = -1, best_depth = 0;
+
+    /* remember the last place where the path to a smaller term leaves the
+     * path of +term+. The deeper it is the larger that term is and at the
+     * same depth a smaller arc beats the prefix itself. */
+    fst_node(fst, fst->root, &node);
+    while (true) {
+        if (node.final) {
+            best = acc;
+            best_depth = depth;
+            best_is_arc = false;
+        }
+        if (t[depth] == '\0') {
+            break;
+        }
+        found = fst_find_arc(&node, t[depth], &arc, &lower, &has_lower);
+        if (has_lower) {
+            best = acc + lower.output;
+            best_depth = depth;
+            best_arc = lower;
+            best_is_arc = true;
+        }
+        if (!found) {
+            break;
+        }
+        acc += arc.output;
+        fst_node(fst, arc.target, &node);
+        depth++;
+    }
+
+    if (best < 0) {
+        return -1;
+    }
+    if (buf) {
+        memcpy(buf, term, best_depth);
+    }
+    if (best_is_arc) {
+        /* the largest term below the smaller arc */
+        if (buf) {
+            buf[best_depth] = (char)best_arc.label;
+        }
+        best_depth++;
+        fst_node(fst, best_arc.target, &node);
+        while (node.cnt > 0) {
+            fst_last_arc(&node, &arc);
+            if (buf) {
+                buf[best_depth] = (char)arc.label;
+            }
+            best_depth++;
+            best += arc.output;
+            fst_node(fst, arc.target, &node);
+        }
+    }
+    if (buf) {
+        buf[best_depth] = '\0';
+    }
+    if (len) {
+        *len = best_depth;
+    }
+    return best;
+}
+
+int frt_fst_get_term(FrtFst *fst, int ord, char *buf)
+{
+    FstNode node;
+    FstArc arc, next;
+    int acc = 0, depth = 0;
+
+    if (ord < 0 || ord >= fst->count) {
+        return -1;
+    }
+    fst_node(fst, fst->root, &node);
+    while (!node.final || acc != ord) {
+        /* follow the last arc whose output doesn't take us past +ord+ */
+        if (node.fixed) {
+            int lo = 0, hi = node.cnt - 1;
+            while (lo <= hi) {
+                int mid = (lo + hi) >> 1;
+                fst_arc_at(&node, mid, &next);
+                if (acc + next.output <= ord) {
+                    lo = mid + 1;
+                } else {
+                    hi = mid - 1;
+                }
+            }
+            fst_arc_at(&node, hi, &arc);
+        } else {
+            const frt_uchar *p = node.arcs;
+            int i;
+            p = fst_read_arc(&node, p, &arc);
+            for (i = 1; i < node.cnt; i++) {
+                p = fst_read_arc(&node, p, &next);
+                if (acc + next.output > ord) {
+                    break;
+                }
+                arc = next;
+            }
+        }
+        buf[depth++] = (char)arc.label;
+        acc += arc.output;
+        fst_node(fst, arc.target, &node);
+    }
+    buf[depth] = '\0';
+    return depth;
+}
+
+void frt_fst_destroy(FrtFst *fst)
+{
+    free(fst->bytes);
+    free(fst);
+}
+
+/****************************************************************************
+ * Building
+ ****************************************************************************/
+
+FrtFstBuilder *frt_fstb_new(void)
+{
+    FrtFstBuilder *fstb = FRT_ALLOC_AND_ZERO(FrtFstBuilder);
+    fstb->capa = 1024;
+    fstb->bytes = FRT_ALLOC_N(frt_uchar, fstb->capa);
+    fstb->table_capa = FST_TABLE_INIT_CAPA;
+    fstb->table = FRT_ALLOC_AND_ZERO_N(FstTableEntry, fstb->table_capa);
+    return fstb;
+}
+
+void frt_fstb_destroy(FrtFstBuilder *fstb)
+{
+    int i;
+    for (i = 0; i <= FRT_MAX_WORD_SIZE; i++) {
+        free(fstb->frontier[i].arcs);
+    }
+    free(fstb->table);
+    free(fstb->bytes);
+    free(fstb);
+}
+
+static unsigned long fstb_hash(const FstBuildNode *bnode)
+{
+    unsigned long hash = bnode->final ? 1 : 0;
+    int i;
+    for (i = 0; i < bnode->size; i++) {
+        const FstArc *arc = &bnode->arcs[i];
+        hash = (hash ^ (unsigned long)arc->label) * 16777619UL;
+        hash = (hash ^ (unsigned long)arc->output) * 16777619UL;
+        hash = (hash ^ (unsigned long)arc->target) * 16777619UL;
+    }
+    return hash;
+}
+
+static bool fstb_node_eq(FrtFstBuilder *fstb, int addr, const FstBuildNode *bnode)
+{
+    FrtFst fst;
+    FstNode node;
+    FstArc arc;
+    const frt_uchar *p;
+    int i;
+
+    fst.bytes = fstb->bytes;
+    fst_node(&fst, addr, &node);
+    if (node.cnt != bnode->size || node.final != bnode->final) {
+        return false;
+    }
+    p = node.arcs;
+    for (i = 0; i < node.cnt; i++) {
+        if (node.fixed) {
+            fst_arc_at(&node, i, &arc);
+        } else {
+            p = fst_read_arc(&node, p, &arc);
+        }
+        if (arc.label != bnode->arcs[i].label
+            || arc.output != bnode->arcs[i].output
+            || arc.target != bnode->arcs[i].target) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void fstb_table_grow(FrtFstBuilder *fstb)
+{
+    int i, capa = fstb->table_capa * 2;
+    FstTableEntry *table = FRT_ALLOC_AND_ZERO_N(FstTableEntry, capa);
+    for (i = 0; i < fstb->table_capa; i++) {
+        FstTableEntry *entry = &fstb->table[i];
+        if (entry->used) {
+            unsigned long j = entry->hash & (capa - 1);
+            while (table[j].used) {
+                j = (j + 1) & (capa - 1);
+            }
+            table[j] = *entry;
+        }
+    }
+    free(fstb->table);
+    fstb->table = table;
+    fstb->table_capa = capa;
+}
+
+/* write the frontier node at +depth+ unless an equal node has been written
+ * already and return its address */
+static int fstb_freeze(FrtFstBuilder *fstb, int depth)
+{
+    FstBuildNode *bnode = &fstb->frontier[depth];
+    frt_uchar *p = fstb->scratch;
+    bool fixed = bnode->size >= FST_FIXED_ARC_MIN;
+    unsigned long hash = fstb_hash(bnode);
+    unsigned long i = hash & (fstb->table_capa - 1);
+    int j, len, addr;
+
+    while (fstb->table[i].used) {
+        FstTableEntry *entry = &fstb->table[i];
+        if (entry->hash == hash && fstb_node_eq(fstb, entry->addr, bnode)) {
+            bnode->size = 0;
+            bnode->final = false;
+            return entry->addr;
+        }
+        i = (i + 1) & (fstb->table_capa - 1);
+    }
+
+    addr = fstb->size;
+    p = fst_write_vint(p, (bnode->size << 2) | (fixed ? 2 : 0)
+                          | (bnode->final ? 1 : 0));
+    for (j = 0; j < bnode->size; j++) {
+        FstArc *arc = &bnode->arcs[j];
+        *p++ = (frt_uchar)arc->label;
+        if (fixed) {
+            p = fst_write_u32(p, arc->output);
+            p = fst_write_u32(p, arc->target);
+        } else {
+            p = fst_write_vint(p, ((addr - arc->target) << 1)
+                                  | (arc->output ? 1 : 0));
+            if (arc->output) {
+                p = fst_write_vint(p, arc->output);
+            }
+        }
+    }
+    len = (int)(p - fstb->scratch);
+    bnode->size = 0;
+    bnode->final = false;
+
+    if (addr + len > fstb->capa) {
+        do {
+            fstb->capa <<= 1;
+        } while (addr + len > fstb->capa);
+        FRT_REALLOC_N(fstb->bytes, frt_uchar, fstb->capa);
+    }
+    memcpy(fstb->bytes + addr, fstb->scratch, len);
+    fstb->size += len;
+    fstb->table[i].hash = hash;
+    fstb->table[i].addr = addr;
+    fstb->table[i].used = true;
+    if (++fstb->table_size * 3 > fstb->table_capa * 2) {
+        fstb_table_grow(fstb);
+    }
+    return addr;
+}
+
+/* freeze the frontier nodes deeper than +depth+ */
+static void fstb_freeze_to(FrtFstBuilder *fstb, int depth)
+{
+    int d;
+    for (d = fstb->last_len; d > depth; d--) {
+        FstBuildNode *parent = &fstb->frontier[d - 1];
+        parent->arcs[parent->size - 1].target = fstb_freeze(fstb, d);
+    }
+}
+
+int frt_fstb_add(FrtFstBuilder *fstb, const char *term, int term_len)
+{
+    const frt_uchar *t = (const frt_uchar *)term;
+    int prefix = 0, d;
+
+    if (term_len > FRT_MAX_WORD_SIZE) {
+        FRT_RAISE(FRT_ARG_ERROR, "term of length %d is too long for the fst",
+                  term_len);
+    }
+    if (fstb->count > 0) {
+        int max_prefix = FRT_MIN(term_len, fstb->last_len);
+        while (prefix < max_prefix && t[prefix] == fstb->last[prefix]) {
+            prefix++;
+        }
+        if (prefix == term_len) {
+            if (term_len == fstb->last_len) {
+                return fstb->count - 1;
+            }
+            FRT_RAISE(FRT_ARG_ERROR, "terms must be added to the fst in order");
+        }
+        if (prefix < fstb->last_len && t[prefix] < fstb->last[prefix]) {
+            FRT_RAISE(FRT_ARG_ERROR, "terms must be added to the fst in order");
+        }
+    }
+
+    fstb_freeze_to(fstb, prefix);
+
+    for (d = prefix; d < term_len; d++) {
+        FstBuildNode *bnode = &fstb->frontier[d];
+        FstArc *arc;
+        if (bnode->size >= bnode->capa) {
+            bnode->capa = bnode->capa ? bnode->capa * 2 : 4;
+            FRT_REALLOC_N(bnode->arcs, FstArc, bnode->capa);
+        }
+        arc = &bnode->arcs[bnode->size++];
+        arc->label = t[d];
+        arc->output = (d == prefix) ? fstb->count - fstb->acc[d] : 0;
+        arc->target = 0;
+        fstb->acc[d + 1] = fstb->count;
+    }
+    fstb->frontier[term_len].final = true;
+
+    memcpy(fstb->last, t, term_len);
+    fstb->last_len = term_len;
+    return fstb->count++;
+}
+
+FrtFst *frt_fstb_finish(FrtFstBuilder *fstb)
+{
+    FrtFst *fst = FRT_ALLOC(FrtFst);
+
+    fstb_freeze_to(fstb, 0);
+    fst->root = fstb_freeze(fstb, 0);
+    fst->count = fstb->count;
+    fst->size = fstb->size;
+    fst->bytes = fstb->bytes;
+    FRT_REALLOC_N(fst->bytes, frt_uchar, fst->size > 0 ? fst->size : 1);
+    fstb->bytes = NULL;
+    frt_fstb_destroy(fstb);
+    return fst;
+}
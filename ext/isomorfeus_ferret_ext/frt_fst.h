@@ -0,0 +1,106 @@
+#ifndef FRT_FST_H
+#define FRT_FST_H
+
+#include "frt_global.h"
+
+/**
+ * An FrtFst is a compact, immutable finite state transducer which maps a
+ * sorted set of terms to their ordinals, ie. the n-th term added maps to n.
+ * Common prefixes and common suffixes of the terms are stored only once and
+ * the output of each term is spread over the arcs of its path, so the
+ * transducer takes a fraction of the memory a plain array of terms would.
+ *
+ * Besides exact lookups it can find the largest term less than or equal to a
+ * given term and it can get a term back from its ordinal, which is all a term
+ * dictionary index needs.
+ */
+typedef struct FrtFst {
+    /** the compiled nodes. Nodes only point to nodes written before them */
+    frt_uchar *bytes;
+    /** the number of bytes used by the compiled nodes */
+    int size;
+    /** the address of the root node in +bytes+ */
+    int root;
+    /** the number of terms in the transducer */
+    int count;
+} FrtFst;
+
+typedef struct FrtFstBuilder FrtFstBuilder;
+
+/**
+ * Create a new FrtFstBuilder. Terms are added with frt_fstb_add and the
+ * FrtFst is created with frt_fstb_finish.
+ *
+ * @return a new FrtFstBuilder
+ */
+extern FrtFstBuilder *frt_fstb_new(void);
+
+/**
+ * Add a term to the FrtFstBuilder. Terms must be added in sorted (strcmp)
+ * order. Adding the previous term again has no effect.
+ *
+ * @param fstb the builder to add the term to
+ * @param term the term to add
+ * @param term_len the length of +term+. It must not be larger than
+ *   FRT_MAX_WORD_SIZE
+ * @return the ordinal of +term+
+ * @raise FRT_ARG_ERROR if +term+ is out of order or too long
+ */
+extern int frt_fstb_add(FrtFstBuilder *fstb, const char *term, int term_len);
+
+/**
+ * Compile the terms added so far into an FrtFst and destroy the builder.
+ *
+ * @param fstb the builder to compile. It is freed by this call
+ * @return the compiled FrtFst
+ */
+extern FrtFst *frt_fstb_finish(FrtFstBuilder *fstb);
+
+/**
+ * Destroy an FrtFstBuilder without compiling it.
+ *
+ * @param fstb the builder to destroy
+ */
+extern void frt_fstb_destroy(FrtFstBuilder *fstb);
+
+/**
+ * Get the ordinal of +term+.
+ *
+ * @param fst the transducer to search
+ * @param term the term to look for
+ * @return the ordinal of +term+ or -1 if it isn't in the transducer
+ */
+extern int frt_fst_get(FrtFst *fst, const char *term);
+
+/**
+ * Find the largest term less than or equal to +term+.
+ *
+ * @param fst the transducer to search
+ * @param term the term to look for
+ * @param buf if not NULL the term found is copied into +buf+ which must be
+ *   able to hold FRT_MAX_WORD_SIZE + 1 bytes
+ * @param len if not NULL it is set to the length of the term found
+ * @return the ordinal of the term found or -1 if all terms are greater
+ *   than +term+
+ */
+extern int frt_fst_floor(FrtFst *fst, const char *term, char *buf, int *len);
+
+/**
+ * Get the term with ordinal +ord+.
+ *
+ * @param fst the transducer to search
+ * @param ord the ordinal of the term
+ * @param buf the buffer to copy the term into. It must be able to hold
+ *   FRT_MAX_WORD_SIZE + 1 bytes
+ * @return the length of the term or -1 if +ord+ is out of range
+ */
+extern int frt_fst_get_term(FrtFst *fst, int ord, char *buf);
+
+/**
+ * Destroy an FrtFst, freeing all of its memory.
+ *
+ * @param fst the transducer to destroy
+ */
+extern void frt_fst_destroy(FrtFst *fst);
+
+#endif
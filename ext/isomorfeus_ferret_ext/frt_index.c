@@ -1,15 +1,20 @@
 #include "frt_global.h"
 #include "frt_index.h"
+#include "frt_search.h"
 #include "frt_similarity.h"
 #include "frt_helper.h"
 #include "frt_array.h"
 #include <string.h>
 #include <limits.h>
+#include <errno.h>
 #include <ctype.h>
+#include <time.h>
+#include <math.h>
 #include "brotli_decode.h"
 #include "brotli_encode.h"
 #include "bzlib.h"
 #include "lz4frame.h"
+#include "lz4.h"
 
 // #undef close
 // #undef read
@@ -38,7 +43,16 @@ const FrtConfig frt_default_config = {
     10000,          /* max_buffered_docs */
     INT_MAX,        /* max_merge_docs */
     10000,          /* maximum field length (number of terms) */
-    true            /* use compound file by default */
+    true,           /* use compound file by default */
+    1,              /* max_doc_writers, documents analyzed concurrently */
+    0,              /* max_merge_threads, merge in the writing thread */
+    0,              /* max_merge_bytes_per_sec, don't throttle merges */
+    FRT_MERGE_POLICY_LOG_DOC, /* merge segments by document count */
+    0x140000000LL,  /* max_merged_segment_bytes is 5Gb (tiered policy only) */
+    20,             /* deletes_pct_allowed (tiered policy only) */
+    FRT_POSTINGS_FORMAT_VINT, /* postings_format, a vint per document */
+    FRT_STORED_FIELDS_FORMAT_PLAIN, /* stored_fields_format, value by value */
+    NULL            /* index_sort, documents are kept in the order added */
 };
 
 static void ste_reset(FrtTermEnum *te);
@@ -53,12 +67,13 @@ static char *ste_next(FrtTermEnum *te);
 
 /* *** Must be three characters *** */
 static const char *INDEX_EXTENSIONS[] = {
-    "frq", "prx", "fdx", "fdt", "tfx", "tix", "tis", "del", "gen", "cfs"
+    "frq", "prx", "fdx", "fdt", "fdb", "tfx", "tix", "tis", "dvd", "del", "gen",
+    "cfs"
 };
 
 /* *** Must be three characters *** */
 static const char *COMPOUND_EXTENSIONS[] = {
-    "frq", "prx", "fdx", "fdt", "tfx", "tix", "tis"
+    "frq", "prx", "fdx", "fdt", "fdb", "tfx", "tix", "tis", "dvd"
 };
 
 static const char BASE36_DIGITMAP[] = "0123456789abcdefghijklmnopqrstuvwxyz";
@@ -268,7 +283,7 @@ char *frt_fi_to_s(FrtFieldInfo *fi)
     const char *fi_name = rb_id2name(fi->name);
     char *str = FRT_ALLOC_N(char, strlen(fi_name) + 200);
     char *s = str;
-    s += sprintf(str, "[\"%s\":(%s%s%s%s%s%s%s%s", fi_name,
+    s += sprintf(str, "[\"%s\":(%s%s%s%s%s%s%s%s%s", fi_name,
                  bits_is_stored(fi->bits) ? "is_stored, " : "",
                  bits_is_compressed(fi->bits) ? "is_compressed, " : "",
                  bits_is_indexed(fi->bits) ? "is_indexed, " : "",
@@ -276,7 +291,8 @@ char *frt_fi_to_s(FrtFieldInfo *fi)
                  bits_omit_norms(fi->bits) ? "omit_norms, " : "",
                  bits_store_term_vector(fi->bits) ? "store_term_vector, " : "",
                  bits_store_positions(fi->bits) ? "store_positions, " : "",
-                 bits_store_offsets(fi->bits) ? "store_offsets, " : "");
+                 bits_store_offsets(fi->bits) ? "store_offsets, " : "",
+                 bits_doc_values_type(fi->bits) ? "doc_values, " : "");
     s -= 2;
     if (*s != ',') {
         s += 2;
@@ -347,6 +363,18 @@ FrtFieldInfo *frt_fis_get_or_add_field(FrtFieldInfos *fis, ID name) {
     return fi;
 }
 
+/* the FieldInfo objects are shared with the original, only the list of fields
+ * is copied so fields added to the original don't show up in the copy */
+static FrtFieldInfos *fis_clone(FrtFieldInfos *fis)
+{
+    int i;
+    FrtFieldInfos *clone = frt_fis_new(fis->bits);
+    for (i = 0; i < fis->size; i++) {
+        frt_fis_add_field(clone, fis->fields[i]);
+    }
+    return clone;
+}
+
 FrtFieldInfos *frt_fis_read(FrtInStream *is)
 {
     FrtFieldInfos *volatile fis = NULL;
@@ -501,6 +529,78 @@ static bool fis_has_vectors(FrtFieldInfos *fis)
  *
  ****************************************************************************/
 
+/*
+ * Index sort
+ *
+ * The index sort is copied into sort fields owned by the IndexWriter or
+ * SegmentInfo so that it doesn't depend on the lifetime of the ruby Sort it
+ * came from. Only fields with a fixed type can be used as the type of an
+ * AUTO field could change from one segment to the next. Trailing DOC fields
+ * are dropped as documents with equal keys keep their order anyway.
+ */
+static FrtSort *index_sort_clone(FrtSort *sort)
+{
+    FrtSort *clone;
+    int i, size = sort->size;
+
+    while (size > 0 && FRT_SORT_TYPE_DOC == sort->sort_fields[size - 1]->type
+           && !sort->sort_fields[size - 1]->reverse) {
+        size--;
+    }
+    for (i = 0; i < size; i++) {
+        FrtSortField *sf = sort->sort_fields[i];
+        if (sf->type < FRT_SORT_TYPE_BYTE || sf->type > FRT_SORT_TYPE_STRING) {
+            FRT_RAISE(FRT_ARG_ERROR, "Can't sort the index by %s. The index "
+                      "sort may only hold byte, integer, float and string "
+                      "fields", sf->type == FRT_SORT_TYPE_AUTO
+                      ? rb_id2name(sf->field) : "score or document number");
+        }
+    }
+    if (0 == size) {
+        return NULL;
+    }
+    clone = frt_sort_new();
+    for (i = 0; i < size; i++) {
+        FrtSortField *sf = sort->sort_fields[i];
+        frt_sort_add_sort_field(clone, frt_sort_field_new(sf->field, sf->type,
+                                                          sf->reverse));
+    }
+    return clone;
+}
+
+static FrtSort *index_sort_read(FrtInStream *is)
+{
+    FrtSort *volatile sort = frt_sort_new();
+    FRT_TRY
+        int i;
+        const int size = frt_is_read_vint(is);
+        for (i = 0; i < size; i++) {
+            char *field = frt_is_read_string_safe(is);
+            int type = frt_is_read_vint(is);
+            bool reverse = frt_is_read_byte(is) != 0;
+            frt_sort_add_sort_field(sort, frt_sort_field_new(rb_intern(field),
+                                                             (SortType)type,
+                                                             reverse));
+            free(field);
+        }
+    FRT_XCATCHALL
+        frt_sort_destroy(sort);
+    FRT_XENDTRY
+    return sort;
+}
+
+static void index_sort_write(FrtSort *sort, FrtOutStream *os)
+{
+    int i;
+    frt_os_write_vint(os, sort->size);
+    for (i = 0; i < sort->size; i++) {
+        FrtSortField *sf = sort->sort_fields[i];
+        frt_os_write_string(os, rb_id2name(sf->field));
+        frt_os_write_vint(os, sf->type);
+        frt_os_write_byte(os, sf->reverse ? 1 : 0);
+    }
+}
+
 FrtSegmentInfo *frt_si_new(char *name, int doc_cnt, FrtStore *store)
 {
     FrtSegmentInfo *si = FRT_ALLOC(FrtSegmentInfo);
@@ -513,12 +613,45 @@ FrtSegmentInfo *frt_si_new(char *name, int doc_cnt, FrtStore *store)
     si->norm_gens_size = 0;
     si->ref_cnt = 1;
     si->use_compound_file = false;
+    si->is_merging = false;
+    si->postings_format = FRT_POSTINGS_FORMAT_VINT;
+    si->stored_fields_format = FRT_STORED_FIELDS_FORMAT_PLAIN;
+    si->multi_level_skips = true;
+    si->skip_impacts = true;
+    si->index_sort = NULL;
+    si->size_in_bytes = -1;
+    si->size_is_cfs = false;
+    si->del_cnt = 0;
+    si->del_cnt_gen = -1;
     return si;
 }
 
+static FrtSegmentInfo *si_clone(FrtSegmentInfo *si)
+{
+    FrtSegmentInfo *clone = frt_si_new(frt_estrdup(si->name), si->doc_cnt, si->store);
+    clone->del_gen = si->del_gen;
+    clone->use_compound_file = si->use_compound_file;
+    clone->postings_format = si->postings_format;
+    clone->stored_fields_format = si->stored_fields_format;
+    clone->multi_level_skips = si->multi_level_skips;
+    clone->skip_impacts = si->skip_impacts;
+    clone->index_sort = si->index_sort ? index_sort_clone(si->index_sort) : NULL;
+    clone->size_in_bytes = si->size_in_bytes;
+    clone->size_is_cfs = si->size_is_cfs;
+    clone->del_cnt = si->del_cnt;
+    clone->del_cnt_gen = si->del_cnt_gen;
+    clone->norm_gens_size = si->norm_gens_size;
+    if (0 < si->norm_gens_size) {
+        clone->norm_gens = FRT_ALLOC_N(int, si->norm_gens_size);
+        memcpy(clone->norm_gens, si->norm_gens, si->norm_gens_size * sizeof(int));
+    }
+    return clone;
+}
+
 static FrtSegmentInfo *si_read(FrtStore *store, FrtInStream *is)
 {
     FrtSegmentInfo *volatile si = FRT_ALLOC_AND_ZERO(FrtSegmentInfo);
+    frt_uchar flags;
     FRT_TRY
         si->store = store;
         FRT_REF(store);
@@ -534,10 +667,21 @@ static FrtSegmentInfo *si_read(FrtStore *store, FrtInStream *is)
                 si->norm_gens[i] = frt_is_read_vint(is);
             }
         }
-        si->use_compound_file = (bool)frt_is_read_byte(is);
+        /* the postings format shares the byte with use_compound_file so
+         * indexes written before it was added can still be read */
+        flags = frt_is_read_byte(is);
+        si->use_compound_file = (bool)(flags & 1);
+        si->postings_format = (FrtPostingsFormat)((flags >> 1) & 1);
+        si->multi_level_skips = (bool)((flags >> 2) & 1);
+        si->skip_impacts = (bool)((flags >> 3) & 1);
+        if ((flags >> 4) & 1) {
+            si->index_sort = index_sort_read(is);
+        }
+        si->stored_fields_format = (FrtStoredFieldsFormat)((flags >> 5) & 1);
     FRT_XCATCHALL
         frt_store_close(si->store);
         free(si->name);
+        free(si->norm_gens);
         free(si);
     FRT_XENDTRY
     return si;
@@ -555,7 +699,15 @@ static void si_write(FrtSegmentInfo *si, FrtOutStream *os)
             frt_os_write_vint(os, si->norm_gens[i]);
         }
     }
-    frt_os_write_byte(os, (frt_uchar)si->use_compound_file);
+    frt_os_write_byte(os, (frt_uchar)(si->use_compound_file
+                                      | (si->postings_format << 1)
+                                      | (si->multi_level_skips << 2)
+                                      | (si->skip_impacts << 3)
+                                      | ((si->index_sort != NULL) << 4)
+                                      | (si->stored_fields_format << 5)));
+    if (si->index_sort) {
+        index_sort_write(si->index_sort, os);
+    }
 }
 
 void frt_si_close(FrtSegmentInfo *si) {
@@ -563,6 +715,7 @@ void frt_si_close(FrtSegmentInfo *si) {
         frt_store_close(si->store);
         free(si->name);
         free(si->norm_gens);
+        if (si->index_sort) frt_sort_destroy(si->index_sort);
         free(si);
     }
 }
@@ -910,9 +1063,32 @@ FrtSegmentInfos *frt_sis_new(FrtFieldInfos *fis)
     sis->generation = -1;
     sis->capa = 4;
     sis->segs = FRT_ALLOC_N(FrtSegmentInfo *, sis->capa);
+    sis->ref_cnt = 1;
     return sis;
 }
 
+/* copy the SegmentInfos so that a reader can keep using them while the
+ * IndexWriter carries on changing the original */
+static FrtSegmentInfos *sis_clone(FrtSegmentInfos *sis)
+{
+    int i;
+    FrtFieldInfos *fis = fis_clone(sis->fis);
+    FrtSegmentInfos *clone = frt_sis_new(fis);
+    frt_fis_deref(fis);
+    clone->format = sis->format;
+    clone->version = sis->version;
+    clone->counter = sis->counter;
+    clone->generation = sis->generation;
+    if (sis->store) {
+        clone->store = sis->store;
+        FRT_REF(sis->store);
+    }
+    for (i = 0; i < sis->size; i++) {
+        frt_sis_add_si(clone, si_clone(sis->segs[i]));
+    }
+    return clone;
+}
+
 FrtSegmentInfo *frt_sis_new_segment(FrtSegmentInfos *sis, int doc_cnt, FrtStore *store)
 {
     return frt_sis_add_si(sis, frt_si_new(new_segment(sis->counter++), doc_cnt, store));
@@ -920,15 +1096,17 @@ FrtSegmentInfo *frt_sis_new_segment(FrtSegmentInfos *sis, int doc_cnt, FrtStore
 
 void frt_sis_destroy(FrtSegmentInfos *sis)
 {
-    int i;
-    const int sis_size = sis->size;
-    for (i = 0; i < sis_size; i++) {
-        frt_si_close(sis->segs[i]);
+    if (FRT_DEREF(sis) == 0) {
+        int i;
+        const int sis_size = sis->size;
+        for (i = 0; i < sis_size; i++) {
+            frt_si_close(sis->segs[i]);
+        }
+        if (sis->store) frt_store_close(sis->store);
+        if (sis->fis) frt_fis_deref(sis->fis);
+        free(sis->segs);
+        free(sis);
     }
-    if (sis->store) frt_store_close(sis->store);
-    if (sis->fis) frt_fis_deref(sis->fis);
-    free(sis->segs);
-    free(sis);
 }
 
 FrtSegmentInfo *frt_sis_add_si(FrtSegmentInfos *sis, FrtSegmentInfo *si)
@@ -941,6 +1119,21 @@ FrtSegmentInfo *frt_sis_add_si(FrtSegmentInfos *sis, FrtSegmentInfo *si)
     return si;
 }
 
+static FrtSegmentInfo *sis_insert_si(FrtSegmentInfos *sis, FrtSegmentInfo *si, int at)
+{
+    int i;
+    if (sis->size >= sis->capa) {
+        sis->capa <<= 1;
+        FRT_REALLOC_N(sis->segs, FrtSegmentInfo *, sis->capa);
+    }
+    for (i = sis->size; i > at; i--) {
+        sis->segs[i] = sis->segs[i-1];
+    }
+    sis->segs[at] = si;
+    sis->size++;
+    return si;
+}
+
 void frt_sis_del_at(FrtSegmentInfos *sis, int at)
 {
     int i;
@@ -972,6 +1165,7 @@ static void frt_sis_read_i(FrtStore *store, FindSegmentsFile *fsf, FrtIndexReade
     char seg_file_name[FRT_SEGMENT_NAME_MAX_LENGTH];
     FrtInStream *volatile is = NULL;
     FrtSegmentInfos *volatile sis = FRT_ALLOC_AND_ZERO(FrtSegmentInfos);
+    sis->ref_cnt = 1;
     segfn_for_generation(seg_file_name, fsf->generation);
     fsf->ret.sis = NULL;
     FRT_TRY
@@ -1072,6 +1266,208 @@ frt_u64 frt_sis_read_current_version(FrtStore *store)
     return fsf.ret.uint64;
 }
 
+/****************************************************************************
+ *
+ * FrtStoredCache
+ *
+ ****************************************************************************/
+
+/* The data of each entry is an InStream over the decompressed bytes so
+ * blocks can be handed out as clones without copying them. Entries are keyed
+ * by the segment's FrtStoredCacheKey, the kind of the data and where it is.
+ * A block is found by its address in the .fdb file. A compressed value is
+ * found by the block it is in, or SC_NO_BLOCK if it is in the .fdt file, and
+ * its position in there. Segments merged from older indexes can have both.
+ * Segments are never changed once written so readers of the same segment
+ * share entries. */
+#define SC_NO_BLOCK ((frt_off_t)-1)
+
+typedef enum {
+    SC_VALUE,
+    SC_BLOCK
+} StoredCacheKind;
+
+typedef struct StoredCacheEntry {
+    FrtStoredCacheKey key;
+    StoredCacheKind kind;
+    frt_off_t   block;
+    frt_off_t   pos;
+    FrtInStream *data;
+    struct StoredCacheEntry *prev;
+    struct StoredCacheEntry *next;
+} StoredCacheEntry;
+
+struct FrtStoredCache {
+    _Atomic unsigned int ref_cnt;
+    frt_mutex_t      mutex;
+    FrtHash          *entries;
+    StoredCacheEntry *head;     /* the most recently used entry */
+    StoredCacheEntry *tail;     /* the least recently used entry */
+    frt_off_t        bytes;
+    frt_off_t        max_bytes;
+    frt_u64          hits;
+    frt_u64          misses;
+};
+
+static unsigned long sc_entry_hash(const void *key)
+{
+    const StoredCacheEntry *e = (const StoredCacheEntry *)key;
+    return (unsigned long)(e->key.store_gen * 0x9E3779B97F4A7C15ULL
+                           ^ frt_str_hash(e->key.segment) ^ (frt_u64)e->pos
+                           ^ ((frt_u64)e->block << 20) ^ e->kind);
+}
+
+static int sc_entry_eq(const void *key1, const void *key2)
+{
+    const StoredCacheEntry *e1 = (const StoredCacheEntry *)key1;
+    const StoredCacheEntry *e2 = (const StoredCacheEntry *)key2;
+    return e1->key.store_gen == e2->key.store_gen && e1->pos == e2->pos
+        && e1->block == e2->block && e1->kind == e2->kind
+        && 0 == strcmp(e1->key.segment, e2->key.segment);
+}
+
+static void sc_entry_destroy(StoredCacheEntry *e)
+{
+    frt_is_close(e->data);
+    free(e->key.segment);
+    free(e);
+}
+
+FrtStoredCache *frt_sc_new(frt_off_t max_bytes)
+{
+    FrtStoredCache *sc = FRT_ALLOC_AND_ZERO(FrtStoredCache);
+    frt_mutex_init(&sc->mutex, NULL);
+    sc->entries = frt_h_new(&sc_entry_hash, &sc_entry_eq, NULL, NULL);
+    sc->max_bytes = max_bytes;
+    sc->ref_cnt = 1;
+    return sc;
+}
+
+static void sc_unlink(FrtStoredCache *sc, StoredCacheEntry *e)
+{
+    if (e->prev) e->prev->next = e->next; else sc->head = e->next;
+    if (e->next) e->next->prev = e->prev; else sc->tail = e->prev;
+}
+
+static void sc_push(FrtStoredCache *sc, StoredCacheEntry *e)
+{
+    e->prev = NULL;
+    e->next = sc->head;
+    if (sc->head) sc->head->prev = e; else sc->tail = e;
+    sc->head = e;
+}
+
+void frt_sc_deref(FrtStoredCache *sc)
+{
+    if (FRT_DEREF(sc) == 0) {
+        StoredCacheEntry *e = sc->head;
+        while (e) {
+            StoredCacheEntry *next = e->next;
+            sc_entry_destroy(e);
+            e = next;
+        }
+        frt_h_destroy(sc->entries);
+        frt_mutex_destroy(&sc->mutex);
+        free(sc);
+    }
+}
+
+/* get a clone of the data of +kind+ at +pos+ in +block+ of the segment +key+
+ * or NULL */
+static FrtInStream *sc_get(FrtStoredCache *sc, const FrtStoredCacheKey *key,
+                           StoredCacheKind kind, frt_off_t block,
+                           frt_off_t pos)
+{
+    StoredCacheEntry lookup, *e;
+    FrtInStream *data = NULL;
+    lookup.key = *key;
+    lookup.kind = kind;
+    lookup.block = block;
+    lookup.pos = pos;
+    frt_mutex_lock(&sc->mutex);
+    if (NULL != (e = (StoredCacheEntry *)frt_h_get(sc->entries, &lookup))) {
+        sc_unlink(sc, e);
+        sc_push(sc, e);
+        data = frt_is_clone(e->data);
+        sc->hits++;
+    } else {
+        sc->misses++;
+    }
+    frt_mutex_unlock(&sc->mutex);
+    return data;
+}
+
+/* add +data+, which the cache takes over, evicting the least recently used
+ * entries to make room for it */
+static void sc_put(FrtStoredCache *sc, const FrtStoredCacheKey *key,
+                   StoredCacheKind kind, frt_off_t block, frt_off_t pos,
+                   FrtInStream *data)
+{
+    StoredCacheEntry *e;
+    const frt_off_t len = frt_is_length(data);
+    if (len > sc->max_bytes) {
+        frt_is_close(data);
+        return;
+    }
+    e = FRT_ALLOC(StoredCacheEntry);
+    e->key.store_gen = key->store_gen;
+    e->key.segment = frt_estrdup(key->segment);
+    e->kind = kind;
+    e->block = block;
+    e->pos = pos;
+    e->data = data;
+    frt_mutex_lock(&sc->mutex);
+    if (frt_h_get(sc->entries, e)) {
+        /* another thread got there first */
+        frt_mutex_unlock(&sc->mutex);
+        sc_entry_destroy(e);
+        return;
+    }
+    frt_h_set(sc->entries, e, e);
+    sc_push(sc, e);
+    sc->bytes += len;
+    while (sc->bytes > sc->max_bytes) {
+        StoredCacheEntry *lru = sc->tail;
+        sc_unlink(sc, lru);
+        frt_h_rem(sc->entries, lru, false);
+        sc->bytes -= frt_is_length(lru->data);
+        sc_entry_destroy(lru);
+    }
+    frt_mutex_unlock(&sc->mutex);
+}
+
+frt_u64 frt_sc_hits(FrtStoredCache *sc)
+{
+    frt_u64 hits;
+    frt_mutex_lock(&sc->mutex);
+    hits = sc->hits;
+    frt_mutex_unlock(&sc->mutex);
+    return hits;
+}
+
+frt_u64 frt_sc_misses(FrtStoredCache *sc)
+{
+    frt_u64 misses;
+    frt_mutex_lock(&sc->mutex);
+    misses = sc->misses;
+    frt_mutex_unlock(&sc->mutex);
+    return misses;
+}
+
+frt_off_t frt_sc_bytes(FrtStoredCache *sc)
+{
+    frt_off_t bytes;
+    frt_mutex_lock(&sc->mutex);
+    bytes = sc->bytes;
+    frt_mutex_unlock(&sc->mutex);
+    return bytes;
+}
+
+frt_off_t frt_sc_max_bytes(FrtStoredCache *sc)
+{
+    return sc->max_bytes;
+}
+
 /****************************************************************************
  *
  * LazyDocField
@@ -1309,6 +1705,43 @@ static char *is_read_compressed_bytes(FrtInStream *is, int compressed_len, int *
     }
 }
 
+/* read a compressed value like is_read_compressed_bytes, taking it from the
+ * cache if it has it. +is+ is +block+, or starts at +base+ in the .fdt file
+ * if +block+ is SC_NO_BLOCK */
+static char *sc_read_compressed_bytes(FrtStoredCache *sc,
+                                      const FrtStoredCacheKey *key,
+                                      frt_off_t block, frt_off_t base,
+                                      FrtInStream *is, int compressed_len,
+                                      int *len,
+                                      FrtCompressionType compression)
+{
+    char *text;
+    FrtInStream *cached;
+    frt_off_t pos;
+
+    if (NULL == sc) {
+        return is_read_compressed_bytes(is, compressed_len, len, compression);
+    }
+    pos = frt_is_pos(is);
+    if (NULL != (cached = sc_get(sc, key, SC_VALUE, block, base + pos))) {
+        *len = (int)frt_is_length(cached);
+        text = FRT_ALLOC_N(char, *len + 1);
+        memcpy(text, cached->buf.buf, *len);
+        text[*len] = '\0';
+        frt_is_close(cached);
+        frt_is_seek(is, pos + compressed_len);
+        return text;
+    }
+    text = is_read_compressed_bytes(is, compressed_len, len, compression);
+    if (text && *len >= 0) {
+        frt_uchar *copy = FRT_ALLOC_N(frt_uchar, *len);
+        memcpy(copy, text, *len);
+        sc_put(sc, key, SC_VALUE, block, base + pos,
+               frt_is_new_owned(copy, *len));
+    }
+    return text;
+}
+
 char *frt_lazy_df_get_data(FrtLazyDocField *self, int i) {
     char *text = NULL;
     if (i < self->size && i >= 0) {
@@ -1317,7 +1750,7 @@ char *frt_lazy_df_get_data(FrtLazyDocField *self, int i) {
             const int read_len = self->data[i].length + 1;
             frt_is_seek(self->doc->fields_in, self->data[i].start);
             if (self->data[i].compression != FRT_COMPRESSION_NONE) {
-                self->data[i].text = text = is_read_compressed_bytes(self->doc->fields_in, read_len, &(self->data[i].length), self->data[i].compression);
+                self->data[i].text = text = sc_read_compressed_bytes(self->doc->cache, &self->doc->cache_key, self->doc->cache_block, 0, self->doc->fields_in, read_len, &(self->data[i].length), self->data[i].compression);
             } else {
                 self->data[i].text = text = FRT_ALLOC_N(char, read_len);
                 frt_is_read_bytes(self->doc->fields_in, (frt_uchar *)text, read_len);
@@ -1330,6 +1763,16 @@ char *frt_lazy_df_get_data(FrtLazyDocField *self, int i) {
     return text;
 }
 
+const char *frt_lazy_df_peek_data(FrtLazyDocField *self, int i) {
+    FrtInStream *is = self->doc->fields_in;
+    if (i < 0 || i >= self->size
+        || self->data[i].compression != FRT_COMPRESSION_NONE
+        || NULL == is || !frt_is_mapped(is)) {
+        return NULL;
+    }
+    return (const char *)is->buf.buf + self->data[i].start;
+}
+
 void frt_lazy_df_get_bytes(FrtLazyDocField *self, char *buf, int start, int len) {
     if (self->compression != FRT_COMPRESSION_NONE && !self->decompressed) {
         int i;
@@ -1390,13 +1833,17 @@ void frt_lazy_df_get_bytes(FrtLazyDocField *self, char *buf, int start, int len)
  *
  ****************************************************************************/
 
-static FrtLazyDoc *lazy_doc_new(int size, FrtInStream *fdt_in)
+static FrtLazyDoc *lazy_doc_new(int size)
 {
     FrtLazyDoc *self = FRT_ALLOC(FrtLazyDoc);
     self->field_dictionary = frt_h_new_ptr((frt_free_ft)&lazy_df_destroy);
     self->size = size;
     self->fields = FRT_ALLOC_AND_ZERO_N(FrtLazyDocField *, size);
-    self->fields_in = frt_is_clone(fdt_in);
+    self->fields_in = NULL;
+    self->cache = NULL;
+    self->cache_key.store_gen = 0;
+    self->cache_key.segment = NULL;
+    self->cache_block = SC_NO_BLOCK;
     self->loaded = false;
     return self;
 }
@@ -1404,7 +1851,13 @@ static FrtLazyDoc *lazy_doc_new(int size, FrtInStream *fdt_in)
 void frt_lazy_doc_close(FrtLazyDoc *self)
 {
     frt_h_destroy(self->field_dictionary);
-    frt_is_close(self->fields_in);
+    if (self->fields_in) {
+        frt_is_close(self->fields_in);
+    }
+    if (self->cache) {
+        frt_sc_deref(self->cache);
+        free(self->cache_key.segment);
+    }
     free(self->fields);
     free(self);
 }
@@ -1421,13 +1874,138 @@ FrtLazyDocField *frt_lazy_doc_get(FrtLazyDoc *self, ID field) {
     return (FrtLazyDocField *)frt_h_get(self->field_dictionary, (void *)field);
 }
 
+/****************************************************************************
+ * FrtStoredBlockReader
+ ****************************************************************************/
+
+/* LZ4 only looks back this far so the dictionary is the end of the first
+ * block */
+#define STORED_BLOCK_DICT_SIZE 65536
+
+/*
+ * With FRT_STORED_FIELDS_FORMAT_BLOCK the header of each document stays in
+ * the .fdt file, followed by the address of its block in the .fdb file and
+ * the offset of its values in the decompressed block. Each block is
+ *
+ *   vint raw_len, vint compressed_len, compressed_len bytes of LZ4 data
+ *
+ * and all blocks but the first are compressed with the first one as their
+ * dictionary. The last block read is kept as the documents of a result page
+ * are usually close together.
+ */
+struct FrtStoredBlockReader {
+    FrtInStream *fdb_in;
+    FrtInStream *dict;          /* the first block, read when first needed */
+    FrtInStream *block;         /* the last block read */
+    frt_off_t   block_ptr;
+};
+
+static FrtStoredBlockReader *sbr_open(FrtStore *store, const char *file_name)
+{
+    FrtStoredBlockReader *sbr = FRT_ALLOC_AND_ZERO(FrtStoredBlockReader);
+    sbr->fdb_in = store->open_input(store, file_name);
+    sbr->block_ptr = -1;
+    return sbr;
+}
+
+static FrtStoredBlockReader *sbr_clone(FrtStoredBlockReader *orig)
+{
+    FrtStoredBlockReader *sbr = FRT_ALLOC(FrtStoredBlockReader);
+    sbr->fdb_in = frt_is_clone(orig->fdb_in);
+    sbr->dict = orig->dict ? frt_is_clone(orig->dict) : NULL;
+    sbr->block = orig->block ? frt_is_clone(orig->block) : NULL;
+    sbr->block_ptr = orig->block_ptr;
+    return sbr;
+}
+
+static void sbr_close(FrtStoredBlockReader *sbr)
+{
+    if (sbr->block) frt_is_close(sbr->block);
+    if (sbr->dict) frt_is_close(sbr->dict);
+    frt_is_close(sbr->fdb_in);
+    free(sbr);
+}
+
+static FrtInStream *sbr_read_block(FrtStoredBlockReader *sbr, frt_off_t ptr)
+{
+    FrtInStream *fdb_in = sbr->fdb_in;
+    const char *dict = NULL, *comp;
+    char *own = NULL, *raw;
+    int raw_len, comp_len, dict_len = 0, res;
+
+    if (ptr > 0) {
+        if (NULL == sbr->dict) {
+            sbr->dict = sbr_read_block(sbr, 0);
+        }
+        dict_len = (int)frt_is_length(sbr->dict);
+        dict = (const char *)sbr->dict->buf.buf;
+        if (dict_len > STORED_BLOCK_DICT_SIZE) {
+            dict += dict_len - STORED_BLOCK_DICT_SIZE;
+            dict_len = STORED_BLOCK_DICT_SIZE;
+        }
+    }
+
+    frt_is_seek(fdb_in, ptr);
+    raw_len = frt_is_read_vint(fdb_in);
+    comp_len = frt_is_read_vint(fdb_in);
+    if (frt_is_mapped(fdb_in)
+        && frt_is_pos(fdb_in) + comp_len <= frt_is_length(fdb_in)) {
+        /* decompress straight from the mapping */
+        comp = (const char *)fdb_in->buf.buf + frt_is_pos(fdb_in);
+    } else {
+        comp = own = FRT_ALLOC_N(char, comp_len);
+        frt_is_read_bytes(fdb_in, (frt_uchar *)own, comp_len);
+    }
+
+    raw = FRT_ALLOC_N(char, raw_len);
+    if (dict) {
+        res = LZ4_decompress_safe_usingDict(comp, raw, comp_len, raw_len,
+                                            dict, dict_len);
+    } else {
+        res = LZ4_decompress_safe(comp, raw, comp_len, raw_len);
+    }
+    free(own);
+    if (res != raw_len) {
+        free(raw);
+        FRT_RAISE(FRT_IO_ERROR, "corrupt stored fields block at "
+                  "%"FRT_OFF_T_PFX"d", ptr);
+    }
+    return frt_is_new_owned((frt_uchar *)raw, raw_len);
+}
+
+/* get the block at +ptr+, looking in +sc+ first if it isn't NULL. The
+ * block stays valid until the next call so callers which keep it must clone
+ * it */
+static FrtInStream *sbr_get_block(FrtStoredBlockReader *sbr, frt_off_t ptr,
+                                  FrtStoredCache *sc,
+                                  const FrtStoredCacheKey *key)
+{
+    if (ptr != sbr->block_ptr) {
+        FrtInStream *block = sc ? sc_get(sc, key, SC_BLOCK, ptr, 0) : NULL;
+        if (NULL == block) {
+            block = (0 == ptr && sbr->dict)
+                  ? frt_is_clone(sbr->dict)
+                  : sbr_read_block(sbr, ptr);
+            if (sc) {
+                sc_put(sc, key, SC_BLOCK, ptr, 0, frt_is_clone(block));
+            }
+        }
+        if (sbr->block) {
+            frt_is_close(sbr->block);
+        }
+        sbr->block = block;
+        sbr->block_ptr = ptr;
+    }
+    return sbr->block;
+}
+
 /****************************************************************************
  * FrtFieldsReader
  ****************************************************************************/
 
 #define FIELDS_IDX_PTR_SIZE 12
 
-FrtFieldsReader *frt_fr_open(FrtStore *store, const char *segment, FrtFieldInfos *fis) {
+FrtFieldsReader *frt_fr_open(FrtStore *store, const char *segment, FrtFieldInfos *fis, FrtStoredFieldsFormat format) {
     FrtFieldsReader *fr = FRT_ALLOC(FrtFieldsReader);
     char file_name[FRT_SEGMENT_NAME_MAX_LENGTH];
     size_t segment_len = strlen(segment);
@@ -1440,7 +2018,17 @@ FrtFieldsReader *frt_fr_open(FrtStore *store, const char *segment, FrtFieldInfos
     fr->fdt_in = store->open_input(store, file_name);
     strcpy(file_name + segment_len, ".fdx");
     fr->fdx_in = store->open_input(store, file_name);
+    /* each document only needs the two pointers around it */
+    frt_is_set_buffer_size(fr->fdx_in, FRT_RANDOM_BUFFER_SIZE);
     fr->size = frt_is_length(fr->fdx_in) / FIELDS_IDX_PTR_SIZE;
+    fr->sbr = NULL;
+    fr->cache = NULL;
+    fr->cache_key.store_gen = store->generation;
+    fr->cache_key.segment = frt_estrdup(segment);
+    if (FRT_STORED_FIELDS_FORMAT_BLOCK == format) {
+        strcpy(file_name + segment_len, ".fdb");
+        fr->sbr = sbr_open(store, file_name);
+    }
     fr->store = store;
     FRT_REF(store);
 
@@ -1454,14 +2042,36 @@ FrtFieldsReader *frt_fr_clone(FrtFieldsReader *orig) {
     FRT_REF(fr->store);
     fr->fdx_in = frt_is_clone(orig->fdx_in);
     fr->fdt_in = frt_is_clone(orig->fdt_in);
+    fr->cache_key.segment = frt_estrdup(orig->cache_key.segment);
+    if (orig->sbr) {
+        fr->sbr = sbr_clone(orig->sbr);
+    }
+    if (fr->cache) {
+        FRT_REF(fr->cache);
+    }
 
     return fr;
 }
 
+/* Cache the decompressed data read by +fr+ and its later clones in +sc+.
+ * NULL detaches the cache */
+void frt_fr_set_stored_cache(FrtFieldsReader *fr, FrtStoredCache *sc) {
+    if (sc) FRT_REF(sc);
+    if (fr->cache) frt_sc_deref(fr->cache);
+    fr->cache = sc;
+}
+
 void frt_fr_close(FrtFieldsReader *fr) {
+    if (fr->sbr) {
+        sbr_close(fr->sbr);
+    }
+    if (fr->cache) {
+        frt_sc_deref(fr->cache);
+    }
     frt_is_close(fr->fdt_in);
     frt_is_close(fr->fdx_in);
     frt_store_close(fr->store);
+    free(fr->cache_key.segment);
     free(fr);
 }
 
@@ -1478,37 +2088,59 @@ static FrtDocField *frt_fr_df_new(ID name, int size, FrtCompressionType compress
     return df;
 }
 
-static void frt_fr_read_compressed_fields(FrtFieldsReader *fr, FrtDocField *df, FrtCompressionType compression) {
+static void frt_fr_read_compressed_fields(FrtFieldsReader *fr, frt_off_t block, frt_off_t base, FrtInStream *fdt_in, FrtDocField *df, FrtCompressionType compression) {
     int i;
     const int df_size = df->size;
-    FrtInStream *fdt_in = fr->fdt_in;
 
     for (i = 0; i < df_size; i++) {
         const int compressed_len = df->lengths[i] + 1;
-        df->data[i] = is_read_compressed_bytes(fdt_in, compressed_len, &(df->lengths[i]), compression);
+        df->data[i] = sc_read_compressed_bytes(fr->cache, &fr->cache_key, block, base, fdt_in, compressed_len, &(df->lengths[i]), compression);
     }
 }
 
-FrtDocument *frt_fr_get_doc(FrtFieldsReader *fr, int doc_num)
+/* get the stream the values of a document are read from once its field
+ * headers have been read from +fdt_in+, positioned at its first value */
+static FrtInStream *fr_values_in(FrtFieldsReader *fr, FrtInStream *fdt_in)
+{
+    if (fr->sbr) {
+        const frt_off_t block_ptr = frt_is_read_voff_t(fdt_in);
+        const int offset = frt_is_read_vint(fdt_in);
+        FrtInStream *block = sbr_get_block(fr->sbr, block_ptr, fr->cache,
+                                           &fr->cache_key);
+        frt_is_seek(block, offset);
+        return block;
+    }
+    return fdt_in;
+}
+
+/* read the document +fdt_in+ is positioned at. +fdt_in+ starts at +base+ in
+ * the .fdt file. If +wanted+ isn't NULL only the fields whose numbers are set
+ * in it are read, the others are skipped */
+static FrtDocument *fr_read_doc(FrtFieldsReader *fr, FrtInStream *fdt_in,
+                                frt_off_t base, const bool *wanted)
 {
     int i, j;
-    frt_off_t pos;
-    int stored_cnt;
+    frt_off_t block = SC_NO_BLOCK;
     FrtDocument *doc = frt_doc_new();
-    FrtInStream *fdx_in = fr->fdx_in;
-    FrtInStream *fdt_in = fr->fdt_in;
-
-    frt_is_seek(fdx_in, doc_num * FIELDS_IDX_PTR_SIZE);
-    pos = (off_t)frt_is_read_u64(fdx_in);
-    frt_is_seek(fdt_in, pos);
-    stored_cnt = frt_is_read_vint(fdt_in);
+    const int stored_cnt = frt_is_read_vint(fdt_in);
+    /* the length of the skipped values in front of each field read */
+    frt_off_t *skips = wanted ? FRT_ALLOC_AND_ZERO_N(frt_off_t, stored_cnt + 1) : NULL;
 
     for (i = 0; i < stored_cnt; i++) {
         const int field_num = frt_is_read_vint(fdt_in);
         FrtFieldInfo *fi = fr->fis->fields[field_num];
         const int df_size = frt_is_read_vint(fdt_in);
-        FrtDocField *df = frt_fr_df_new(fi->name, df_size, frt_fi_get_compression(fi));
+        FrtDocField *df;
 
+        if (wanted && !wanted[field_num]) {
+            for (j = 0; j < df_size; j++) {
+                skips[doc->size] += 1 + frt_is_read_vint(fdt_in);
+                frt_is_read_vint(fdt_in);
+                frt_is_read_vint(fdt_in);
+            }
+            continue;
+        }
+        df = frt_fr_df_new(fi->name, df_size, frt_fi_get_compression(fi));
         for (j = 0; j < df_size; j++) {
             df->lengths[j] = frt_is_read_vint(fdt_in);
             df->encodings[j] = rb_enc_from_index(frt_is_read_vint(fdt_in));
@@ -1517,10 +2149,18 @@ FrtDocument *frt_fr_get_doc(FrtFieldsReader *fr, int doc_num)
 
         frt_doc_add_field(doc, df);
     }
-    for (i = 0; i < stored_cnt; i++) {
+    if (doc->size > 0 && fr->sbr) {
+        fdt_in = fr_values_in(fr, fdt_in);
+        block = fr->sbr->block_ptr;
+        base = 0;
+    }
+    for (i = 0; i < doc->size; i++) {
         FrtDocField *df = doc->fields[i];
+        if (skips && skips[i] > 0) {
+            frt_is_seek(fdt_in, frt_is_pos(fdt_in) + skips[i]);
+        }
         if (df->compression != FRT_COMPRESSION_NONE) {
-            frt_fr_read_compressed_fields(fr, df, df->compression);
+            frt_fr_read_compressed_fields(fr, block, base, fdt_in, df, df->compression);
         } else {
             const int df_size = df->size;
             for (j = 0; j < df_size; j++) {
@@ -1531,10 +2171,146 @@ FrtDocument *frt_fr_get_doc(FrtFieldsReader *fr, int doc_num)
             }
         }
     }
+    free(skips);
 
     return doc;
 }
 
+FrtDocument *frt_fr_get_doc(FrtFieldsReader *fr, int doc_num)
+{
+    frt_is_seek(fr->fdx_in, doc_num * FIELDS_IDX_PTR_SIZE);
+    frt_is_seek(fr->fdt_in, (frt_off_t)frt_is_read_u64(fr->fdx_in));
+    return fr_read_doc(fr, fr->fdt_in, 0, NULL);
+}
+
+/* documents less than this many bytes apart in the .fdt file are read
+ * together, as long as the read doesn't get larger than FR_MAX_RUN_LEN */
+#define FR_MAX_RUN_GAP FRT_BUFFER_SIZE
+#define FR_MAX_RUN_LEN (256 * 1024)
+
+typedef struct FrDocRef {
+    int       doc_num;
+    int       index;    /* the position of the document in the request */
+    frt_off_t start;
+    frt_off_t end;
+} FrDocRef;
+
+static int fr_doc_ref_cmp(const void *p1, const void *p2)
+{
+    const FrDocRef *r1 = (const FrDocRef *)p1;
+    const FrDocRef *r2 = (const FrDocRef *)p2;
+    if (r1->doc_num != r2->doc_num) {
+        return r1->doc_num < r2->doc_num ? -1 : 1;
+    }
+    return r1->index - r2->index;
+}
+
+void frt_fr_get_docs(FrtFieldsReader *fr, const int *doc_nums, int cnt,
+                     const ID *fields, int field_cnt, FrtDocument **docs)
+{
+    int i, j, k;
+    bool *volatile wanted = NULL;
+    FrDocRef *refs;
+    FrtInStream *volatile run_in = NULL;
+    volatile bool success = false;
+    FrtInStream *fdx_in = fr->fdx_in;
+    FrtInStream *fdt_in = fr->fdt_in;
+    const bool mapped = frt_is_mapped(fdt_in);
+
+    for (i = 0; i < cnt; i++) {
+        if (doc_nums[i] < 0 || doc_nums[i] >= fr->size) {
+            FRT_RAISE(FRT_INDEX_ERROR, "Document %d is out of range 0..%d",
+                      doc_nums[i], fr->size - 1);
+        }
+    }
+    if (cnt <= 0) {
+        return;
+    }
+
+    refs = FRT_ALLOC_N(FrDocRef, cnt);
+    for (i = 0; i < cnt; i++) {
+        refs[i].doc_num = doc_nums[i];
+        refs[i].index = i;
+    }
+    qsort(refs, cnt, sizeof(FrDocRef), &fr_doc_ref_cmp);
+
+    if (fields) {
+        wanted = FRT_ALLOC_AND_ZERO_N(bool, fr->fis->size);
+        for (i = 0; i < field_cnt; i++) {
+            FrtFieldInfo *fi = frt_fis_get_field(fr->fis, fields[i]);
+            if (fi) {
+                wanted[fi->number] = true;
+            }
+        }
+    }
+
+    memset(docs, 0, cnt * sizeof(FrtDocument *));
+    FRT_TRY
+        /* a document ends where the next one starts so a single pass over the
+         * sorted .fdx entries gets the range of each document */
+        for (i = 0; i < cnt; i++) {
+            const int doc_num = refs[i].doc_num;
+            if (i > 0 && refs[i - 1].doc_num == doc_num) {
+                refs[i].start = refs[i - 1].start;
+                refs[i].end = refs[i - 1].end;
+                continue;
+            }
+            frt_is_seek(fdx_in, doc_num * FIELDS_IDX_PTR_SIZE);
+            refs[i].start = (frt_off_t)frt_is_read_u64(fdx_in);
+            if (doc_num + 1 < fr->size) {
+                frt_is_seek(fdx_in, (doc_num + 1) * FIELDS_IDX_PTR_SIZE);
+                refs[i].end = (frt_off_t)frt_is_read_u64(fdx_in);
+            } else {
+                refs[i].end = frt_is_length(fdt_in);
+            }
+        }
+
+        /* read each run of documents close to each other at once */
+        for (i = 0; i < cnt; i = j) {
+            const frt_off_t run_start = refs[i].start;
+            frt_off_t run_end = refs[i].end;
+            frt_off_t base = 0;
+
+            run_in = fdt_in;
+            for (j = i + 1; j < cnt; j++) {
+                if (refs[j].start > run_end + FR_MAX_RUN_GAP
+                    || refs[j].end - run_start > FR_MAX_RUN_LEN) {
+                    break;
+                }
+                if (refs[j].end > run_end) {
+                    run_end = refs[j].end;
+                }
+            }
+            if (!mapped && j - i > 1) {
+                const frt_off_t len = run_end - run_start;
+                frt_uchar *bytes = FRT_ALLOC_N(frt_uchar, len);
+                run_in = frt_is_new_owned(bytes, len);
+                frt_is_seek(fdt_in, run_start);
+                frt_is_read_bytes(fdt_in, bytes, (int)len);
+                base = run_start;
+            }
+            for (k = i; k < j; k++) {
+                frt_is_seek(run_in, refs[k].start - base);
+                docs[refs[k].index] = fr_read_doc(fr, run_in, base, wanted);
+            }
+            if (run_in != fdt_in) {
+                frt_is_close(run_in);
+            }
+            run_in = NULL;
+        }
+        success = true;
+    FRT_XFINALLY
+        if (!success) {
+            if (run_in && run_in != fdt_in) {
+                frt_is_close(run_in);
+            }
+            frt_docs_destroy(docs, cnt);
+        }
+        free(wanted);
+        free(refs);
+    FRT_XENDTRY
+}
+
 FrtLazyDoc *frt_fr_get_lazy_doc(FrtFieldsReader *fr, int doc_num)
 {
     int start = 0;
@@ -1550,7 +2326,7 @@ FrtLazyDoc *frt_fr_get_lazy_doc(FrtFieldsReader *fr, int doc_num)
     frt_is_seek(fdt_in, pos);
     stored_cnt = frt_is_read_vint(fdt_in);
 
-    lazy_doc = lazy_doc_new(stored_cnt, fdt_in);
+    lazy_doc = lazy_doc_new(stored_cnt);
     for (i = 0; i < stored_cnt; i++) {
         FrtFieldInfo *fi = fr->fis->fields[frt_is_read_vint(fdt_in)];
         const int df_size = frt_is_read_vint(fdt_in);
@@ -1568,6 +2344,18 @@ FrtLazyDoc *frt_fr_get_lazy_doc(FrtFieldsReader *fr, int doc_num)
         lazy_df->len = start - field_start - 1;
         lazy_doc_add_field(lazy_doc, lazy_df, i);
     }
+    if (stored_cnt > 0) {
+        fdt_in = fr_values_in(fr, fdt_in);
+    }
+    lazy_doc->fields_in = frt_is_clone(fdt_in);
+    if (fr->cache) {
+        lazy_doc->cache = fr->cache;
+        lazy_doc->cache_block = stored_cnt > 0 && fr->sbr
+                              ? fr->sbr->block_ptr : SC_NO_BLOCK;
+        lazy_doc->cache_key.store_gen = fr->cache_key.store_gen;
+        lazy_doc->cache_key.segment = frt_estrdup(fr->cache_key.segment);
+        FRT_REF(fr->cache);
+    }
     /* correct the starts to their correct absolute positions */
     const frt_off_t abs_start = frt_is_pos(fdt_in);
     for (i = 0; i < stored_cnt; i++) {
@@ -1715,34 +2503,684 @@ FrtTermVector *frt_fr_get_field_tv(FrtFieldsReader *fr, int doc_num, int field_n
 
 /****************************************************************************
  *
- * FrtFieldsWriter
+ * FrtDocValues
+ *
+ * The doc values of a segment are written to its .dvd file as;
+ *
+ *   vint doc_cnt, vint field_cnt
+ *   for each field: vint field_num, byte type, u64 length, the field's column
+ *
+ * numeric:    u64 min, byte width, doc_cnt packed values
+ * sorted:     vint ord_cnt, the distinct values in order, byte width,
+ *             doc_cnt packed ords
+ * sorted set: vint ord_cnt, the distinct values in order, doc_cnt vint counts
+ *             followed by each document's ords as vint deltas
  *
  ****************************************************************************/
 
-FrtFieldsWriter *frt_fw_open(FrtStore *store, const char *segment, FrtFieldInfos *fis) {
-    FrtFieldsWriter *fw = FRT_ALLOC(FrtFieldsWriter);
-    char file_name[FRT_SEGMENT_NAME_MAX_LENGTH];
-    size_t segment_len = strlen(segment);
+#define DOC_VALUES_INIT_CAPA 16
+
+/* a value added to a doc values field, kept until the segment is written */
+typedef struct DocValue {
+    int     doc_num;
+    int     ord;
+    frt_i64 num;
+    char    *str;
+} DocValue;
+
+typedef struct DocValuesField {
+    int              field_num;
+    FrtDocValuesType type;
+    int              size;
+    int              capa;
+    DocValue         *values;
+} DocValuesField;
+
+struct FrtDocValuesWriter {
+    DocValuesField **fields; /* by field number, NULL if a field has no values */
+    int            size;
+};
+
+static FrtDocValuesWriter *dvw_new(void)
+{
+    return FRT_ALLOC_AND_ZERO(FrtDocValuesWriter);
+}
+
+static void dvw_destroy(FrtDocValuesWriter *dvw)
+{
+    int i, j;
+    for (i = 0; i < dvw->size; i++) {
+        DocValuesField *dvf = dvw->fields[i];
+        if (dvf) {
+            for (j = 0; j < dvf->size; j++) {
+                free(dvf->values[j].str);
+            }
+            free(dvf->values);
+            free(dvf);
+        }
+    }
+    free(dvw->fields);
+    free(dvw);
+}
+
+static DocValue *dvw_add(FrtDocValuesWriter *dvw, int field_num,
+                         FrtDocValuesType type, int doc_num)
+{
+    DocValuesField *dvf;
+    DocValue *dv;
+    if (field_num >= dvw->size) {
+        FRT_REALLOC_N(dvw->fields, DocValuesField *, field_num + 1);
+        FRT_ZEROSET_N(dvw->fields + dvw->size, DocValuesField *,
+                      field_num + 1 - dvw->size);
+        dvw->size = field_num + 1;
+    }
+    if (NULL == (dvf = dvw->fields[field_num])) {
+        dvf = dvw->fields[field_num] = FRT_ALLOC_AND_ZERO(DocValuesField);
+        dvf->field_num = field_num;
+        dvf->type = type;
+        dvf->capa = DOC_VALUES_INIT_CAPA;
+        dvf->values = FRT_ALLOC_N(DocValue, dvf->capa);
+    }
+    if (dvf->size >= dvf->capa) {
+        dvf->capa <<= 1;
+        FRT_REALLOC_N(dvf->values, DocValue, dvf->capa);
+    }
+    dv = &dvf->values[dvf->size++];
+    dv->doc_num = doc_num;
+    dv->ord = 0;
+    dv->num = 0;
+    dv->str = NULL;
+    return dv;
+}
+
+static void dvw_add_num(FrtDocValuesWriter *dvw, int field_num, int doc_num,
+                        frt_i64 num)
+{
+    dvw_add(dvw, field_num, FRT_DOC_VALUES_NUMERIC, doc_num)->num = num;
+}
+
+static void dvw_add_str(FrtDocValuesWriter *dvw, int field_num,
+                        FrtDocValuesType type, int doc_num,
+                        const char *str, int len)
+{
+    DocValue *dv = dvw_add(dvw, field_num, type, doc_num);
+    dv->str = FRT_ALLOC_N(char, len + 1);
+    memcpy(dv->str, str, len);
+    dv->str[len] = '\0';
+}
+
+/* the number of bytes needed to pack values up to max */
+static int dv_width(frt_u64 max)
+{
+    int width = 0;
+    while (max) {
+        width++;
+        max >>= 8;
+    }
+    return width;
+}
+
+static void dv_write_packed(FrtOutStream *os, frt_u64 *packed, int cnt)
+{
+    frt_u64 max = 0;
+    frt_uchar buf[8];
+    int i, j, width;
+    for (i = 0; i < cnt; i++) {
+        if (packed[i] > max) max = packed[i];
+    }
+    width = dv_width(max);
+    frt_os_write_byte(os, (frt_uchar)width);
+    for (i = 0; i < cnt; i++) {
+        frt_u64 val = packed[i];
+        for (j = width - 1; j >= 0; j--) {
+            buf[j] = (frt_uchar)(val & 0xFF);
+            val >>= 8;
+        }
+        frt_os_write_bytes(os, buf, width);
+    }
+}
+
+static int dv_str_cmp(const void *p1, const void *p2)
+{
+    return strcmp(*(char **)p1, *(char **)p2);
+}
+
+static int dv_doc_ord_cmp(const void *p1, const void *p2)
+{
+    const DocValue *dv1 = (const DocValue *)p1;
+    const DocValue *dv2 = (const DocValue *)p2;
+    if (dv1->doc_num != dv2->doc_num) {
+        return dv1->doc_num < dv2->doc_num ? -1 : 1;
+    }
+    return dv1->ord < dv2->ord ? -1 : (dv1->ord > dv2->ord);
+}
+
+static void dvf_write_numeric(DocValuesField *dvf, FrtOutStream *os, int doc_cnt)
+{
+    frt_u64 *packed = FRT_ALLOC_AND_ZERO_N(frt_u64, doc_cnt + 1);
+    frt_i64 min = dvf->size ? dvf->values[0].num : 0;
+    int i;
+    for (i = 1; i < dvf->size; i++) {
+        if (dvf->values[i].num < min) min = dvf->values[i].num;
+    }
+    /* values never reach INT64_MIN so the packed values can't overflow */
+    for (i = 0; i < dvf->size; i++) {
+        packed[dvf->values[i].doc_num] =
+            (frt_u64)dvf->values[i].num - (frt_u64)min + 1;
+    }
+    frt_os_write_u64(os, (frt_u64)min);
+    dv_write_packed(os, packed, doc_cnt);
+    free(packed);
+}
+
+static void dvf_write_strings(DocValuesField *dvf, FrtOutStream *os, int doc_cnt)
+{
+    char **ords = FRT_ALLOC_N(char *, dvf->size + 1);
+    int i, ord_cnt = 0;
+
+    for (i = 0; i < dvf->size; i++) {
+        ords[i] = dvf->values[i].str;
+    }
+    qsort(ords, dvf->size, sizeof(char *), &dv_str_cmp);
+    for (i = 0; i < dvf->size; i++) {
+        if (0 == ord_cnt || 0 != strcmp(ords[ord_cnt - 1], ords[i])) {
+            ords[ord_cnt++] = ords[i];
+        }
+    }
+    for (i = 0; i < dvf->size; i++) {
+        char **ord = (char **)bsearch(&dvf->values[i].str, ords, ord_cnt,
+                                      sizeof(char *), &dv_str_cmp);
+        dvf->values[i].ord = (int)(ord - ords);
+    }
+    frt_os_write_vint(os, ord_cnt);
+    for (i = 0; i < ord_cnt; i++) {
+        frt_os_write_string(os, ords[i]);
+    }
+    free(ords);
+
+    if (FRT_DOC_VALUES_SORTED == dvf->type) {
+        frt_u64 *packed = FRT_ALLOC_AND_ZERO_N(frt_u64, doc_cnt + 1);
+        for (i = 0; i < dvf->size; i++) {
+            packed[dvf->values[i].doc_num] = (frt_u64)dvf->values[i].ord + 1;
+        }
+        dv_write_packed(os, packed, doc_cnt);
+        free(packed);
+    } else {
+        int *counts = FRT_ALLOC_AND_ZERO_N(int, doc_cnt + 1);
+        int last_doc = -1, last_ord = 0;
+        qsort(dvf->values, dvf->size, sizeof(DocValue), &dv_doc_ord_cmp);
+        for (i = 0; i < dvf->size; i++) {
+            const DocValue *dv = &dvf->values[i];
+            if (dv->doc_num != last_doc || dv->ord != last_ord) {
+                counts[dv->doc_num]++;
+            }
+            last_doc = dv->doc_num;
+            last_ord = dv->ord;
+        }
+        for (i = 0; i < doc_cnt; i++) {
+            frt_os_write_vint(os, counts[i]);
+        }
+        last_doc = -1;
+        for (i = 0; i < dvf->size; i++) {
+            const DocValue *dv = &dvf->values[i];
+            if (dv->doc_num != last_doc) {
+                frt_os_write_vint(os, dv->ord);
+            } else if (dv->ord != last_ord) {
+                frt_os_write_vint(os, dv->ord - last_ord);
+            }
+            last_doc = dv->doc_num;
+            last_ord = dv->ord;
+        }
+        free(counts);
+    }
+}
+
+static void dvw_write(FrtDocValuesWriter *dvw, FrtOutStream *os, int doc_cnt)
+{
+    FrtOutStream *buffer = frt_ram_new_buffer();
+    int i, field_cnt = 0;
+
+    for (i = 0; i < dvw->size; i++) {
+        if (dvw->fields[i]) field_cnt++;
+    }
+    frt_os_write_vint(os, doc_cnt);
+    frt_os_write_vint(os, field_cnt);
+    for (i = 0; i < dvw->size; i++) {
+        DocValuesField *dvf = dvw->fields[i];
+        if (NULL == dvf) continue;
+        frt_ramo_reset(buffer);
+        if (FRT_DOC_VALUES_NUMERIC == dvf->type) {
+            dvf_write_numeric(dvf, buffer, doc_cnt);
+        } else {
+            dvf_write_strings(dvf, buffer, doc_cnt);
+        }
+        frt_os_write_vint(os, dvf->field_num);
+        frt_os_write_byte(os, (frt_uchar)dvf->type);
+        frt_os_write_u64(os, (frt_u64)frt_os_pos(buffer));
+        frt_ramo_write_to(buffer, os);
+    }
+    frt_ram_destroy_buffer(buffer);
+}
+
+static FrtDocValues *dv_new(FrtDocValuesType type, int size)
+{
+    FrtDocValues *dv = FRT_ALLOC_AND_ZERO(FrtDocValues);
+    dv->type = type;
+    dv->size = size;
+    return dv;
+}
+
+static void dv_destroy(FrtDocValues *dv)
+{
+    int i;
+    for (i = 0; i < dv->ord_cnt; i++) {
+        free(dv->ords[i]);
+    }
+    free(dv->ords);
+    if (dv->is) {
+        frt_is_close(dv->is);
+    } else {
+        free((frt_uchar *)dv->packed);
+    }
+    free(dv->set_starts);
+    free(dv->set_ords);
+    free(dv);
+}
+
+static void dv_read_packed(FrtDocValues *dv, FrtInStream *is)
+{
+    dv->width = frt_is_read_byte(is);
+    if (dv->width > 0 && dv->size > 0) {
+        const frt_off_t len = (frt_off_t)dv->size * dv->width;
+        if (frt_is_mapped(is)) {
+            /* use the mapped column in place */
+            if (frt_is_pos(is) + len > frt_is_length(is)) {
+                FRT_RAISE(FRT_EOF_ERROR, "doc values column runs past the "
+                          "end of the file");
+            }
+            dv->packed = is->buf.buf + frt_is_pos(is);
+            dv->is = frt_is_clone(is);
+            frt_is_seek(is, frt_is_pos(is) + len);
+        } else {
+            frt_uchar *packed = FRT_ALLOC_N(frt_uchar, len);
+            dv->packed = packed;
+            frt_is_read_bytes(is, packed, (int)len);
+        }
+    }
+}
+
+static void dv_read_column(FrtDocValues *dv, FrtInStream *is)
+{
+    int i, j, ord_cnt;
+    if (FRT_DOC_VALUES_NUMERIC == dv->type) {
+        dv->min = (frt_i64)frt_is_read_u64(is);
+        dv_read_packed(dv, is);
+        return;
+    }
+    ord_cnt = frt_is_read_vint(is);
+    dv->ords = FRT_ALLOC_N(char *, ord_cnt + 1);
+    for (i = 0; i < ord_cnt; i++) {
+        dv->ords[i] = frt_is_read_string_safe(is);
+        dv->ord_cnt++;
+    }
+    if (FRT_DOC_VALUES_SORTED == dv->type) {
+        dv_read_packed(dv, is);
+        return;
+    }
+    dv->set_starts = FRT_ALLOC_N(int, dv->size + 1);
+    dv->set_starts[0] = 0;
+    for (i = 0; i < dv->size; i++) {
+        dv->set_starts[i + 1] = dv->set_starts[i] + frt_is_read_vint(is);
+    }
+    dv->set_ords = FRT_ALLOC_N(int, dv->set_starts[dv->size] + 1);
+    for (i = 0; i < dv->size; i++) {
+        int ord = 0;
+        for (j = dv->set_starts[i]; j < dv->set_starts[i + 1]; j++) {
+            ord += frt_is_read_vint(is);
+            dv->set_ords[j] = ord;
+        }
+    }
+}
+
+/* read the column of field +field_num+ from a .dvd file. Returns NULL if
+ * the segment holds no values for the field */
+static FrtDocValues *dv_read(FrtInStream *is, int field_num)
+{
+    int doc_cnt, field_cnt, i;
+
+    frt_is_seek(is, 0);
+    doc_cnt = frt_is_read_vint(is);
+    field_cnt = frt_is_read_vint(is);
+    for (i = 0; i < field_cnt; i++) {
+        const int fnum = frt_is_read_vint(is);
+        const FrtDocValuesType type = (FrtDocValuesType)frt_is_read_byte(is);
+        const frt_off_t length = (frt_off_t)frt_is_read_u64(is);
+        if (fnum == field_num) {
+            FrtDocValues *volatile dv = dv_new(type, doc_cnt);
+            FRT_TRY
+                dv_read_column(dv, is);
+            FRT_XCATCHALL
+                dv_destroy(dv);
+            FRT_XENDTRY
+            return dv;
+        }
+        frt_is_seek(is, frt_is_pos(is) + length);
+    }
+    return NULL;
+}
+
+static frt_u64 dv_packed(FrtDocValues *dv, int doc_num)
+{
+    const frt_uchar *p;
+    frt_u64 val = 0;
+    int i;
+    if (NULL == dv->packed || doc_num < 0 || doc_num >= dv->size) {
+        return 0;
+    }
+    p = dv->packed + (size_t)doc_num * dv->width;
+    for (i = 0; i < dv->width; i++) {
+        val = (val << 8) | p[i];
+    }
+    return val;
+}
+
+bool frt_dv_has_value(FrtDocValues *dv, int doc_num)
+{
+    if (FRT_DOC_VALUES_SORTED_SET == dv->type) {
+        return doc_num >= 0 && doc_num < dv->size && dv->set_starts
+            && dv->set_starts[doc_num + 1] > dv->set_starts[doc_num];
+    }
+    return dv_packed(dv, doc_num) != 0;
+}
+
+/* the value of a numeric field, 0 if the document has none */
+frt_i64 frt_dv_get_long(FrtDocValues *dv, int doc_num)
+{
+    frt_u64 packed;
+    if (FRT_DOC_VALUES_NUMERIC != dv->type
+        || 0 == (packed = dv_packed(dv, doc_num))) {
+        return 0;
+    }
+    return (frt_i64)(packed - 1 + (frt_u64)dv->min);
+}
+
+/* the ord of a sorted field's value or the lowest ord of a sorted set, -1 if
+ * the document has no value */
+int frt_dv_get_ord(FrtDocValues *dv, int doc_num)
+{
+    const int *ords;
+    switch (dv->type) {
+        case FRT_DOC_VALUES_SORTED:
+            return (int)dv_packed(dv, doc_num) - 1;
+        case FRT_DOC_VALUES_SORTED_SET:
+            return frt_dv_get_ords(dv, doc_num, &ords) > 0 ? ords[0] : -1;
+        default:
+            return -1;
+    }
+}
+
+/* point +ords+ at the ords of a sorted set document and return their count */
+int frt_dv_get_ords(FrtDocValues *dv, int doc_num, const int **ords)
+{
+    if (FRT_DOC_VALUES_SORTED_SET != dv->type || NULL == dv->set_starts
+        || doc_num < 0 || doc_num >= dv->size) {
+        *ords = NULL;
+        return 0;
+    }
+    *ords = dv->set_ords + dv->set_starts[doc_num];
+    return dv->set_starts[doc_num + 1] - dv->set_starts[doc_num];
+}
+
+/* numeric doc values are decimal integers. INT64_MIN is left out so that
+ * any range of values can be packed with 0 left for missing values */
+static bool dv_parse_long(const char *text, int len, frt_i64 *num)
+{
+    char buf[32];
+    char *end;
+    long long val;
+    if (len <= 0 || len >= (int)sizeof(buf)) {
+        return false;
+    }
+    memcpy(buf, text, len);
+    buf[len] = '\0';
+    errno = 0;
+    val = strtoll(buf, &end, 10);
+    if (0 != errno || end != buf + len || LLONG_MIN == val) {
+        return false;
+    }
+    *num = (frt_i64)val;
+    return true;
+}
+
+static void dv_check_doc_field(FrtFieldInfo *fi, FrtDocField *df)
+{
+    const FrtDocValuesType type = bits_doc_values_type(fi->bits);
+    int i;
+    if (FRT_DOC_VALUES_SORTED_SET != type && df->size > 1) {
+        FRT_RAISE(FRT_ARG_ERROR, "Field :%s has %d values but only sorted set "
+                  "doc values can hold more than one", rb_id2name(fi->name),
+                  df->size);
+    }
+    if (FRT_DOC_VALUES_NUMERIC == type) {
+        frt_i64 num;
+        for (i = 0; i < df->size; i++) {
+            if (!dv_parse_long(df->data[i], df->lengths[i], &num)) {
+                FRT_RAISE(FRT_ARG_ERROR, "Field :%s needs integer values for its "
+                          "numeric doc values", rb_id2name(fi->name));
+            }
+        }
+    }
+}
+
+static void dvw_add_doc_field(FrtDocValuesWriter *dvw, FrtFieldInfo *fi,
+                              FrtDocField *df, int doc_num)
+{
+    const FrtDocValuesType type = bits_doc_values_type(fi->bits);
+    int i;
+    for (i = 0; i < df->size; i++) {
+        if (FRT_DOC_VALUES_NUMERIC == type) {
+            frt_i64 num;
+            dv_parse_long(df->data[i], df->lengths[i], &num);
+            dvw_add_num(dvw, fi->number, doc_num, num);
+        } else {
+            dvw_add_str(dvw, fi->number, type, doc_num, df->data[i],
+                        df->lengths[i]);
+        }
+    }
+}
+
+/* add the values of +dv+'s document +doc_num+ to document +new_doc_num+ */
+static void dvw_add_dv(FrtDocValuesWriter *dvw, int field_num, FrtDocValues *dv,
+                       int doc_num, int new_doc_num)
+{
+    const int *ords;
+    int i, cnt;
+    switch (dv->type) {
+        case FRT_DOC_VALUES_NUMERIC:
+            if (frt_dv_has_value(dv, doc_num)) {
+                dvw_add_num(dvw, field_num, new_doc_num,
+                            frt_dv_get_long(dv, doc_num));
+            }
+            break;
+        case FRT_DOC_VALUES_SORTED:
+            if ((i = frt_dv_get_ord(dv, doc_num)) >= 0) {
+                dvw_add_str(dvw, field_num, dv->type, new_doc_num,
+                            dv->ords[i], (int)strlen(dv->ords[i]));
+            }
+            break;
+        case FRT_DOC_VALUES_SORTED_SET:
+            cnt = frt_dv_get_ords(dv, doc_num, &ords);
+            for (i = 0; i < cnt; i++) {
+                dvw_add_str(dvw, field_num, dv->type, new_doc_num,
+                            dv->ords[ords[i]], (int)strlen(dv->ords[ords[i]]));
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/****************************************************************************
+ *
+ * FrtStoredBlockWriter
+ *
+ ****************************************************************************/
+
+struct FrtStoredBlockWriter {
+    FrtOutStream *fdb_out;
+    frt_uchar    *buf;          /* the values of the block being filled */
+    int          len;
+    int          capa;
+    char         *dict;         /* the end of the first block */
+    int          dict_len;
+    LZ4_stream_t *lz4;
+};
+
+static FrtStoredBlockWriter *sbw_new(FrtOutStream *fdb_out)
+{
+    FrtStoredBlockWriter *sbw = FRT_ALLOC_AND_ZERO(FrtStoredBlockWriter);
+    sbw->fdb_out = fdb_out;
+    sbw->capa = FRT_STORED_FIELDS_BLOCK_SIZE * 2;
+    sbw->buf = FRT_ALLOC_N(frt_uchar, sbw->capa);
+    return sbw;
+}
+
+/* add +len+ bytes to the block and return where they go */
+static frt_uchar *sbw_reserve(FrtStoredBlockWriter *sbw, int len)
+{
+    frt_uchar *bytes;
+    if (sbw->len + len > sbw->capa) {
+        do {
+            sbw->capa <<= 1;
+        } while (sbw->len + len > sbw->capa);
+        FRT_REALLOC_N(sbw->buf, frt_uchar, sbw->capa);
+    }
+    bytes = sbw->buf + sbw->len;
+    sbw->len += len;
+    return bytes;
+}
+
+/* write the address of the block being filled and +offset+, where the
+ * values of the document start in it, to the document's header */
+static void sbw_write_ptr(FrtStoredBlockWriter *sbw, FrtOutStream *fdt_out,
+                          int offset)
+{
+    frt_os_write_voff_t(fdt_out, frt_os_pos(sbw->fdb_out));
+    frt_os_write_vint(fdt_out, offset);
+}
+
+static void sbw_flush(FrtStoredBlockWriter *sbw)
+{
+    const int bound = LZ4_compressBound(sbw->len);
+    char *comp;
+    int comp_len;
+
+    if (0 == sbw->len) {
+        return;
+    }
+    comp = FRT_ALLOC_N(char, bound);
+    if (NULL == sbw->dict) {
+        comp_len = LZ4_compress_default((char *)sbw->buf, comp, sbw->len, bound);
+        sbw->dict_len = FRT_MIN(sbw->len, STORED_BLOCK_DICT_SIZE);
+        sbw->dict = FRT_ALLOC_N(char, sbw->dict_len);
+        memcpy(sbw->dict, sbw->buf + sbw->len - sbw->dict_len, sbw->dict_len);
+        sbw->lz4 = LZ4_createStream();
+    } else {
+        LZ4_loadDict(sbw->lz4, sbw->dict, sbw->dict_len);
+        comp_len = LZ4_compress_fast_continue(sbw->lz4, (char *)sbw->buf, comp,
+                                              sbw->len, bound, 1);
+    }
+    if (comp_len <= 0) {
+        free(comp);
+        comp_raise();
+    }
+    frt_os_write_vint(sbw->fdb_out, sbw->len);
+    frt_os_write_vint(sbw->fdb_out, comp_len);
+    frt_os_write_bytes(sbw->fdb_out, (frt_uchar *)comp, comp_len);
+    free(comp);
+    sbw->len = 0;
+}
+
+/* a document was added, start a new block if this one is full */
+static void sbw_end_doc(FrtStoredBlockWriter *sbw)
+{
+    if (sbw->len >= FRT_STORED_FIELDS_BLOCK_SIZE) {
+        sbw_flush(sbw);
+    }
+}
+
+/* flush the last block and close the .fdb file */
+static void sbw_close(FrtStoredBlockWriter *sbw)
+{
+    sbw_flush(sbw);
+    frt_os_close(sbw->fdb_out);
+    if (sbw->lz4) {
+        LZ4_freeStream(sbw->lz4);
+    }
+    free(sbw->dict);
+    free(sbw->buf);
+    free(sbw);
+}
+
+/* open the .fdb file of +segment+. The file is created empty for plain
+ * segments as compound files expect all of their files to exist */
+static FrtStoredBlockWriter *sbw_open(FrtStore *store, const char *segment,
+                                      FrtStoredFieldsFormat format)
+{
+    char file_name[FRT_SEGMENT_NAME_MAX_LENGTH];
+    sprintf(file_name, "%s.fdb", segment);
+    if (FRT_STORED_FIELDS_FORMAT_BLOCK == format) {
+        FrtOutStream *fdb_out = store->new_output(store, file_name);
+        frt_os_set_buffer_size(fdb_out, FRT_SEQUENTIAL_BUFFER_SIZE);
+        return sbw_new(fdb_out);
+    }
+    store->touch(store, file_name);
+    return NULL;
+}
+
+/****************************************************************************
+ *
+ * FrtFieldsWriter
+ *
+ ****************************************************************************/
+
+FrtFieldsWriter *frt_fw_open(FrtStore *store, const char *segment, FrtFieldInfos *fis, FrtStoredFieldsFormat format) {
+    FrtFieldsWriter *fw = FRT_ALLOC(FrtFieldsWriter);
+    char file_name[FRT_SEGMENT_NAME_MAX_LENGTH];
+    size_t segment_len = strlen(segment);
 
     memcpy(file_name, segment, segment_len);
 
     strcpy(file_name + segment_len, ".fdt");
     fw->fdt_out = store->new_output(store, file_name);
+    frt_os_set_buffer_size(fw->fdt_out, FRT_SEQUENTIAL_BUFFER_SIZE);
 
     strcpy(file_name + segment_len, ".fdx");
     fw->fdx_out = store->new_output(store, file_name);
 
+    strcpy(file_name + segment_len, ".dvd");
+    fw->dvd_out = store->new_output(store, file_name);
+
     fw->buffer = frt_ram_new_buffer();
+    fw->sbw = sbw_open(store, segment, format);
 
     fw->fis = fis;
     fw->tv_fields = frt_ary_new_type_capa(FrtTVField, FRT_TV_FIELD_INIT_CAPA);
+    fw->dvw = dvw_new();
+    fw->doc_num = 0;
 
     return fw;
 }
 
 void frt_fw_close(FrtFieldsWriter *fw) {
+    dvw_write(fw->dvw, fw->dvd_out, fw->doc_num);
+    dvw_destroy(fw->dvw);
+    frt_os_close(fw->dvd_out);
     frt_os_close(fw->fdt_out);
     frt_os_close(fw->fdx_out);
+    if (fw->sbw) {
+        sbw_close(fw->sbw);
+    }
     frt_ram_destroy_buffer(fw->buffer);
     frt_ary_free(fw->tv_fields);
     free(fw);
@@ -1893,13 +3331,20 @@ void frt_fw_add_doc(FrtFieldsWriter *fw, FrtDocument *doc) {
     FrtFieldInfo *fi;
     FrtCompressionType compression;
     FrtOutStream *fdt_out = fw->fdt_out, *fdx_out = fw->fdx_out;
+    FrtStoredBlockWriter *sbw = fw->sbw;
+    const int block_offset = sbw ? sbw->len : 0;
     const int doc_size = doc->size;
 
     for (i = 0; i < doc_size; i++) {
         df = doc->fields[i];
-        if (bits_is_stored(frt_fis_get_or_add_field(fw->fis, df->name)->bits)) {
+        fi = frt_fis_get_or_add_field(fw->fis, df->name);
+        if (bits_is_stored(fi->bits)) {
             stored_cnt++;
         }
+        /* check the doc values before anything of the document is written */
+        if (bits_doc_values_type(fi->bits)) {
+            dv_check_doc_field(fi, df);
+        }
     }
 
     fw->start_ptr = frt_os_pos(fdt_out);
@@ -1916,7 +3361,19 @@ void frt_fw_add_doc(FrtFieldsWriter *fw, FrtDocument *doc) {
             frt_os_write_vint(fdt_out, fi->number);
             frt_os_write_vint(fdt_out, df_size);
 
-            if (bits_is_compressed(fi->bits)) {
+            if (sbw) {
+                /* the whole block is compressed so the field's own
+                 * compression is ignored, see FrtStoredFieldsFormat */
+                for (j = 0; j < df_size; j++) {
+                    const int length = df->lengths[j];
+                    frt_uchar *bytes = sbw_reserve(sbw, length + 1);
+                    frt_os_write_vint(fdt_out, length);
+                    frt_os_write_vint(fdt_out, rb_enc_to_index(df->encodings[j]));
+                    frt_os_write_vint(fdt_out, FRT_COMPRESSION_NONE);
+                    memcpy(bytes, df->data[j], length);
+                    bytes[length] = ' ';
+                }
+            } else if (bits_is_compressed(fi->bits)) {
                 compression = frt_fi_get_compression(fi);
                 for (j = 0; j < df_size; j++) {
                     const int length = df->lengths[j];
@@ -1938,7 +3395,23 @@ void frt_fw_add_doc(FrtFieldsWriter *fw, FrtDocument *doc) {
             }
         }
     }
-    frt_ramo_write_to(fw->buffer, fdt_out);
+    if (sbw) {
+        if (stored_cnt > 0) {
+            sbw_write_ptr(sbw, fdt_out, block_offset);
+        }
+        sbw_end_doc(sbw);
+    } else {
+        frt_ramo_write_to(fw->buffer, fdt_out);
+    }
+
+    for (i = 0; i < doc_size; i++) {
+        df = doc->fields[i];
+        fi = frt_fis_get_field(fw->fis, df->name);
+        if (bits_doc_values_type(fi->bits)) {
+            dvw_add_doc_field(fw->dvw, fi, df, fw->doc_num);
+        }
+    }
+    fw->doc_num++;
 }
 
 void frt_fw_write_tv_index(FrtFieldsWriter *fw) {
@@ -2061,31 +3534,29 @@ static char *te_skip_to(FrtTermEnum *te, const char *term)
 
 static void sti_destroy(FrtSegmentTermIndex *sti)
 {
-    if (sti->index_terms) {
-        int i;
-        const int sti_index_cnt = sti->index_cnt;
-        for (i = 0; i < sti_index_cnt; i++) {
-            free(sti->index_terms[i]);
-        }
-        free(sti->index_terms);
-        free(sti->index_term_lens);
+    if (sti->index_fst) {
+        frt_fst_destroy(sti->index_fst);
         free(sti->index_term_infos);
         free(sti->index_ptrs);
     }
     free(sti);
 }
 
+/*
+ * The index terms are kept in an FrtFst which maps each of them to its
+ * offset in the index. Only the term infos and pointers, which the FrtFst
+ * can't share between terms, are kept in arrays.
+ */
 static void sti_ensure_index_is_read(FrtSegmentTermIndex *sti, FrtTermEnum *index_te) {
-    if (NULL == sti->index_terms) {
+    if (NULL == sti->index_fst) {
         int i;
         int index_cnt = sti->index_cnt;
         frt_off_t index_ptr = 0;
+        FrtFstBuilder *fstb = frt_fstb_new();
         ste_reset(index_te);
         frt_is_seek(STE(index_te)->is, sti->index_ptr);
         STE(index_te)->size = sti->index_cnt;
 
-        sti->index_terms = FRT_ALLOC_N(char *, index_cnt);
-        sti->index_term_lens = FRT_ALLOC_N(int, index_cnt);
         sti->index_term_infos = FRT_ALLOC_N(FrtTermInfo, index_cnt);
         sti->index_ptrs = FRT_ALLOC_N(off_t, index_cnt);
 
@@ -2095,44 +3566,21 @@ static void sti_ensure_index_is_read(FrtSegmentTermIndex *sti, FrtTermEnum *inde
                 FRT_RAISE(FRT_INDEX_ERROR, "index term enum read too many terms");
             }
 #endif
-            sti->index_terms[i] = frt_te_get_term(index_te);
-            sti->index_term_lens[i] = index_te->curr_term_len;
+            frt_fstb_add(fstb, index_te->curr_term, index_te->curr_term_len);
             sti->index_term_infos[i] = index_te->curr_ti;
             index_ptr += frt_is_read_voff_t(STE(index_te)->is);
             sti->index_ptrs[i] = index_ptr;
         }
+        sti->index_fst = frt_fstb_finish(fstb);
     }
 }
 
-static int sti_get_index_offset(FrtSegmentTermIndex *sti, const char *term)
-{
-    int lo = 0;
-    int hi = sti->index_cnt - 1;
-    int mid, delta;
-    char **index_terms = sti->index_terms;
-
-    while (hi >= lo) {
-        mid = (lo + hi) >> 1;
-        delta = strcmp(term, index_terms[mid]);
-        if (delta < 0) {
-            hi = mid - 1;
-        }
-        else if (delta > 0) {
-            lo = mid + 1;
-        }
-        else {
-            return mid;
-        }
-    }
-    return hi;
-}
-
-/****************************************************************************
- * SegmentFieldIndex
- ****************************************************************************/
+/****************************************************************************
+ * SegmentFieldIndex
+ ****************************************************************************/
 
 #define SFI_ENSURE_INDEX_IS_READ(sfi, sti) do {\
-    if (NULL == sti->index_terms) {\
+    if (NULL == sti->index_fst) {\
         frt_mutex_lock(&sfi->mutex);\
         sti_ensure_index_is_read(sti, sfi->index_te);\
         frt_mutex_unlock(&sfi->mutex);\
@@ -2238,14 +3686,10 @@ static FrtTermEnum *ste_set_field(FrtTermEnum *te, int field_num) {
     return te;
 }
 
+/* the current term must already be set to the index term at +idx_offset+ */
 static void frt_ste_index_seek(FrtTermEnum *te, FrtSegmentTermIndex *sti, int idx_offset) {
-    int term_len = sti->index_term_lens[idx_offset];
     frt_is_seek(STE(te)->is, sti->index_ptrs[idx_offset]);
     STE(te)->pos = STE(te)->sfi->index_interval * idx_offset - 1;
-    memcpy(te->curr_term,
-           sti->index_terms[idx_offset],
-           term_len + 1);
-    te->curr_term_len = term_len;
     te->curr_ti = sti->index_term_infos[idx_offset];
 }
 
@@ -2253,22 +3697,26 @@ static char *ste_scan_to(FrtTermEnum *te, const char *term) {
     FrtSegmentFieldIndex *sfi = STE(te)->sfi;
     FrtSegmentTermIndex *sti = (FrtSegmentTermIndex *)frt_h_get_int(sfi->field_dict, te->field_num);
     if (sti && sti->size > 0) {
+        char index_term[FRT_MAX_WORD_SIZE + 1];
+        int index_term_len, idx_offset;
         SFI_ENSURE_INDEX_IS_READ(sfi, sti);
         if (term[0] == '\0') {
+            /* the first index term is always the empty string */
+            te->curr_term[0] = '\0';
+            te->curr_term_len = 0;
             frt_ste_index_seek(te, sti, 0);
-            return ste_next(te);;
-        }
-        /* if current term is less than seek term */
-        if (STE(te)->pos < STE(te)->size && strcmp(te->curr_term, term) <= 0) {
-            int enum_offset = (int)(STE(te)->pos / sfi->index_interval) + 1;
-            /* if we are at the end of the index or before the next index
-             * ptr then a simple scan suffices */
-            if (sti->index_cnt == enum_offset ||
-                strcmp(term, sti->index_terms[enum_offset]) < 0) {
-                return te_skip_to(te, term);
-            }
-        }
-        frt_ste_index_seek(te, sti, sti_get_index_offset(sti, term));
+            return ste_next(te);
+        }
+        idx_offset = frt_fst_floor(sti->index_fst, term, index_term, &index_term_len);
+        /* if current term is less than seek term and the seek term is before
+         * the next index term then a simple scan suffices */
+        if (STE(te)->pos < STE(te)->size && strcmp(te->curr_term, term) <= 0
+            && idx_offset <= (int)(STE(te)->pos / sfi->index_interval)) {
+            return te_skip_to(te, term);
+        }
+        memcpy(te->curr_term, index_term, index_term_len + 1);
+        te->curr_term_len = index_term_len;
+        frt_ste_index_seek(te, sti, idx_offset);
         return te_skip_to(te, term);
     }
     return NULL;
@@ -2308,6 +3756,8 @@ static char *frt_ste_get_term(FrtTermEnum *te, int pos)
         if ((pos < ste->pos) || pos > (1 + ste->pos / idx_int) * idx_int) {
             FrtSegmentTermIndex *sti = (FrtSegmentTermIndex *)frt_h_get_int(ste->sfi->field_dict, te->field_num);
             SFI_ENSURE_INDEX_IS_READ(ste->sfi, sti);
+            te->curr_term_len = frt_fst_get_term(sti->index_fst, pos / idx_int,
+                                                 te->curr_term);
             frt_ste_index_seek(te, sti, pos / idx_int);
         }
         while (ste->pos < pos) {
@@ -2562,6 +4012,7 @@ FrtTermInfosReader *frt_tir_open(FrtStore *store, FrtSegmentFieldIndex *sfi, con
     tir->thread_te = 0;
     frt_thread_key_create(&tir->thread_te, NULL);
     tir->te_bucket = frt_ary_new();
+    frt_mutex_init(&tir->mutex, NULL);
     tir->field_num = -1;
     return tir;
 }
@@ -2571,7 +4022,10 @@ static FrtTermEnum *tir_enum(FrtTermInfosReader *tir) {
     if (NULL == (te = (FrtTermEnum *)frt_thread_getspecific(tir->thread_te))) {
         te = frt_ste_clone(tir->orig_te);
         ste_set_field(te, tir->field_num);
+        /* the bucket is shared by all threads, only the key is per thread */
+        frt_mutex_lock(&tir->mutex);
         frt_ary_push(tir->te_bucket, te);
+        frt_mutex_unlock(&tir->mutex);
         frt_thread_setspecific(tir->thread_te, te);
     }
     return te;
@@ -2624,6 +4078,7 @@ void frt_tir_close(FrtTermInfosReader *tir) {
     frt_ary_destroy(tir->te_bucket, (frt_free_ft)&frt_ste_close);
     frt_ste_close(tir->orig_te);
     frt_thread_key_delete(tir->thread_te);
+    frt_mutex_destroy(&tir->mutex);
     free(tir);
 }
 
@@ -2661,6 +4116,7 @@ FrtTermInfosWriter *frt_tiw_open(FrtStore *store, const char *segment, int index
     tiw->tix_writer = frt_tw_new(store, file_name);
     strcpy(file_name + segment_len, ".tis");
     tiw->tis_writer = frt_tw_new(store, file_name);
+    frt_os_set_buffer_size(tiw->tis_writer->os, FRT_SEQUENTIAL_BUFFER_SIZE);
     strcpy(file_name + segment_len, ".tfx");
     tiw->tfx_out = store->new_output(store, file_name);
     frt_os_write_u32(tiw->tfx_out, 0); /* make space for field_count */
@@ -2766,6 +4222,94 @@ void frt_tiw_close(FrtTermInfosWriter *tiw) {
     free(tiw);
 }
 
+/****************************************************************************
+ *
+ * Block postings
+ *
+ * With FRT_POSTINGS_FORMAT_BLOCK the postings of a term are written to the
+ * .frq file in blocks of FRT_POSTINGS_BLOCK_SIZE documents. A block holds the
+ * number of bits used per doc delta in a byte followed by the packed doc
+ * deltas, then the number of bits per frequency - 1 followed by the packed
+ * frequencies. The documents left over at the end of a term are written as
+ * vints just like FRT_POSTINGS_FORMAT_VINT, and there is a skip entry at the
+ * start of every block after the first.
+ *
+ * The positions of each block of documents, or of the documents left over,
+ * are written to the .prx file the same way, as packed blocks of
+ * FRT_POSTINGS_BLOCK_SIZE position deltas followed by the deltas left over as
+ * vints. The reader knows how many positions to expect from the sum of the
+ * frequencies it just decoded, and each skip entry's .prx pointer lands on
+ * the start of a block of positions.
+ *
+ ****************************************************************************/
+
+#define BLOCK_BYTES(bits) ((bits) * FRT_POSTINGS_BLOCK_SIZE / 8)
+
+static int block_bits_needed(const int *values)
+{
+    frt_u32 all_bits = 0;
+    int bits = 0;
+    int i;
+    for (i = 0; i < FRT_POSTINGS_BLOCK_SIZE; i++) {
+        all_bits |= (frt_u32)values[i];
+    }
+    for (; all_bits; all_bits >>= 1) {
+        bits++;
+    }
+    return bits;
+}
+
+static void block_write(FrtOutStream *os, const int *values)
+{
+    frt_uchar buf[BLOCK_BYTES(32) + 8];
+    const int bits = block_bits_needed(values);
+    int i;
+
+    frt_os_write_byte(os, (frt_uchar)bits);
+    if (0 == bits) {
+        return;
+    }
+    memset(buf, 0, sizeof(buf));
+    for (i = 0; i < FRT_POSTINGS_BLOCK_SIZE; i++) {
+        const int bit_pos = i * bits;
+        frt_uchar *b = buf + (bit_pos >> 3);
+        frt_u64 v = (frt_u64)(frt_u32)values[i] << (bit_pos & 7);
+        for (; v; v >>= 8) {
+            *b++ |= (frt_uchar)v;
+        }
+    }
+    frt_os_write_bytes(os, buf, BLOCK_BYTES(bits));
+}
+
+static void block_read(FrtInStream *is, int *values)
+{
+    frt_uchar buf[BLOCK_BYTES(32) + 8];
+    const int bits = frt_is_read_byte(is);
+    frt_u64 mask;
+    int i;
+
+    if (0 == bits) {
+        memset(values, 0, FRT_POSTINGS_BLOCK_SIZE * sizeof(int));
+        return;
+    }
+    if (bits > 32) {
+        FRT_RAISE(FRT_IO_ERROR, "corrupt postings block, %d bits per value",
+                  bits);
+    }
+    frt_is_read_bytes(is, buf, BLOCK_BYTES(bits));
+    memset(buf + BLOCK_BYTES(bits), 0, 8);
+    mask = ((frt_u64)1 << bits) - 1;
+    /* each value is independent of the others so this loop vectorizes */
+    for (i = 0; i < FRT_POSTINGS_BLOCK_SIZE; i++) {
+        const int bit_pos = i * bits;
+        const frt_uchar *b = buf + (bit_pos >> 3);
+        const frt_u64 v = (frt_u64)b[0] | ((frt_u64)b[1] << 8)
+                        | ((frt_u64)b[2] << 16) | ((frt_u64)b[3] << 24)
+                        | ((frt_u64)b[4] << 32);
+        values[i] = (int)((v >> (bit_pos & 7)) & mask);
+    }
+}
+
 /****************************************************************************
  *
  * TermDocEnum
@@ -2795,11 +4339,19 @@ static void stde_seek_ti(FrtSegmentTermDocEnum *stde, FrtTermInfo *ti) {
         stde->doc_num = 0;
         stde->skip_doc = 0;
         stde->skip_count = 0;
-        stde->num_skips = stde->doc_freq / stde->skip_interval;
+        if (stde->skip_levels) {
+            stde->num_skips = (stde->doc_freq - 1) / stde->skip_interval;
+        } else {
+            stde->num_skips = stde->block_docs
+                ? (stde->doc_freq - 1) / FRT_POSTINGS_BLOCK_SIZE
+                : stde->doc_freq / stde->skip_interval;
+        }
+        stde->block_pos = stde->block_size = 0;
         stde->frq_ptr = ti->frq_ptr;
         stde->prx_ptr = ti->prx_ptr;
         stde->skip_ptr = ti->frq_ptr + ti->skip_offset;
         frt_is_seek(stde->frq_in, ti->frq_ptr);
+        stde->impact_read = -1;
         stde->have_skipped = false;
     }
 }
@@ -2947,6 +4499,351 @@ static bool stde_skip_to(FrtTermDocEnum *tde, int target_doc_num) {
     return true;
 }
 
+/* load the next block of documents, or whatever is left of the term's
+ * documents if there isn't a full block left */
+static void stbe_read_block(FrtSegmentTermDocEnum *stde)
+{
+    int *docs = stde->block_docs;
+    int *freqs = stde->block_freqs;
+    int doc_num = stde->doc_num;
+    const int remaining = stde->doc_freq - stde->count;
+    int i;
+
+    if (remaining >= FRT_POSTINGS_BLOCK_SIZE) {
+        block_read(stde->frq_in, docs);
+        block_read(stde->frq_in, freqs);
+        for (i = 0; i < FRT_POSTINGS_BLOCK_SIZE; i++) {
+            doc_num += docs[i];
+            docs[i] = doc_num;
+            freqs[i]++;
+        }
+        stde->block_size = FRT_POSTINGS_BLOCK_SIZE;
+    } else {
+        for (i = 0; i < remaining; i++) {
+            const int doc_code = frt_is_read_vint(stde->frq_in);
+            doc_num += doc_code >> 1;
+            docs[i] = doc_num;
+            freqs[i] = (0 != (doc_code & 1))
+                ? 1 : (int)frt_is_read_vint(stde->frq_in);
+        }
+        stde->block_size = remaining;
+    }
+    stde->block_pos = 0;
+
+    /* a TermPosEnum expects the positions of the whole block next */
+    if (NULL != stde->prx_buf) {
+        int prx_left = 0;
+        for (i = 0; i < stde->block_size; i++) {
+            prx_left += freqs[i];
+        }
+        stde->prx_left = prx_left;
+        stde->prx_buf_pos = stde->prx_buf_size = 0;
+    }
+}
+
+static bool stbe_next(FrtTermDocEnum *tde) {
+    FrtSegmentTermDocEnum *stde = STDE(tde);
+
+    while (true) {
+        if (stde->count >= stde->doc_freq) {
+            return false;
+        }
+        if (stde->block_pos >= stde->block_size) {
+            stbe_read_block(stde);
+        }
+        stde->doc_num = stde->block_docs[stde->block_pos];
+        stde->freq = stde->block_freqs[stde->block_pos];
+        stde->block_pos++;
+        stde->count++;
+
+        if (NULL == stde->deleted_docs || 0 == frt_bv_get(stde->deleted_docs, stde->doc_num)) {
+            break; /* We found an undeleted doc so return */
+        }
+
+        stde->skip_prox(stde);
+    }
+    return true;
+}
+
+static int stbe_read(FrtTermDocEnum *tde, int *docs, int *freqs, int req_num) {
+    FrtSegmentTermDocEnum *stde = STDE(tde);
+    int i = 0;
+
+    while (i < req_num && stde->count < stde->doc_freq) {
+        if (stde->block_pos >= stde->block_size) {
+            stbe_read_block(stde);
+        }
+        stde->doc_num = stde->block_docs[stde->block_pos];
+        stde->freq = stde->block_freqs[stde->block_pos];
+        stde->block_pos++;
+        stde->count++;
+
+        if (NULL == stde->deleted_docs
+            || 0 == frt_bv_get(stde->deleted_docs, stde->doc_num)) {
+            docs[i] = stde->doc_num;
+            freqs[i] = stde->freq;
+            i++;
+        }
+    }
+    return i;
+}
+
+static bool stbe_skip_to(FrtTermDocEnum *tde, int target_doc_num) {
+    FrtSegmentTermDocEnum *stde = STDE(tde);
+
+    /* only look at the skip data if the target is past the current block */
+    if (stde->num_skips > 0 && target_doc_num > stde->doc_num
+        && (stde->block_pos >= stde->block_size
+            || target_doc_num > stde->block_docs[stde->block_size - 1])) {
+        int skip_blocks = 0;
+        int skip_doc = 0;
+        frt_off_t frq_ptr = 0;
+        frt_off_t prx_ptr = 0;
+
+        if (NULL == stde->skip_in) {
+            stde->skip_in = frt_is_clone(stde->frq_in);/* lazily clone */
+        }
+
+        if (!stde->have_skipped) {                 /* lazily seek skip stream */
+            frt_is_seek(stde->skip_in, stde->skip_ptr);
+            stde->have_skipped = true;
+        }
+
+        /* skip entry n points to the start of block n + 1. Find the last
+         * entry ahead of us whose previous block ends before the target */
+        while (true) {
+            if (stde->skip_count * FRT_POSTINGS_BLOCK_SIZE > stde->count) {
+                if (stde->skip_doc >= target_doc_num) {
+                    break;
+                }
+                skip_blocks = stde->skip_count;
+                skip_doc = stde->skip_doc;
+                frq_ptr = stde->frq_ptr;
+                prx_ptr = stde->prx_ptr;
+            }
+
+            if (stde->skip_count >= stde->num_skips) {
+                break;
+            }
+
+            stde->skip_doc += frt_is_read_vint(stde->skip_in);
+            stde->frq_ptr  += frt_is_read_vint(stde->skip_in);
+            stde->prx_ptr  += frt_is_read_vint(stde->skip_in);
+            stde->skip_count++;
+        }
+
+        if (skip_blocks > 0) {
+            frt_is_seek(stde->frq_in, frq_ptr);
+            stde->seek_prox(stde, prx_ptr);
+
+            stde->doc_num = skip_doc;
+            stde->count = skip_blocks * FRT_POSTINGS_BLOCK_SIZE;
+            stde->block_pos = stde->block_size = 0;
+        }
+    }
+
+    /* done skipping, now just scan */
+    do {
+        if (!tde->next(tde)) {
+            return false;
+        }
+    } while (target_doc_num > stde->doc_num);
+    return true;
+}
+
+/*
+ * Multi-level skip data
+ *
+ * Segments with multi_level_skips have a skip entry after every
+ * skip_interval documents of a term, pointing at the start of the next
+ * document (or block of documents), on level 0. Every FRT_SKIP_MULTIPLIER-th
+ * entry of a level is also added to the level above together with a pointer
+ * to the entry below it, up to FRT_MAX_SKIP_LEVELS levels. The levels are
+ * written from the top down, each but level 0 preceded by its length, so
+ * skip_to can move along the top level and drop down a level whenever the
+ * next entry would overshoot the target.
+ *
+ * With skip_impacts the skip data starts with the highest freq of the term
+ * and each level 0 entry ends with the highest freq of the documents it
+ * skips over, for max_freq.
+ */
+static void stde_load_skip_levels(FrtSegmentTermDocEnum *stde)
+{
+    FrtSkipLevel *levels = stde->skip_levels;
+    frt_off_t pos = stde->skip_ptr;
+    int entries = stde->num_skips;
+    int num_levels = 0;
+    int i;
+
+    for (; entries > 0 && num_levels < FRT_MAX_SKIP_LEVELS;
+         entries /= FRT_SKIP_MULTIPLIER) {
+        levels[num_levels++].entries = entries;
+    }
+    stde->num_skip_levels = num_levels;
+
+    for (i = num_levels - 1; i >= 0; i--) {
+        FrtSkipLevel *level = &levels[i];
+        if (NULL == level->is) {
+            level->is = frt_is_clone(stde->frq_in);
+        }
+        frt_is_seek(level->is, pos);
+        if (i == num_levels - 1 && stde->skip_impacts) {
+            stde->term_max_freq = frt_is_read_vint(level->is);
+        }
+        if (i > 0) {
+            const frt_off_t length = frt_is_read_voff_t(level->is);
+            pos = frt_is_pos(level->is) + length;
+        }
+        level->start = frt_is_pos(level->is);
+        level->doc = 0;
+        level->frq_ptr = stde->frq_ptr;
+        level->prx_ptr = stde->prx_ptr;
+        level->child_ptr = 0;
+        level->read = 0;
+    }
+}
+
+static bool stde_multi_level_skip_to(FrtTermDocEnum *tde, int target_doc_num)
+{
+    FrtSegmentTermDocEnum *stde = STDE(tde);
+
+    /* only look at the skip data if the target is past the current block.
+     * block_size is always 0 for FRT_POSTINGS_FORMAT_VINT */
+    if (stde->num_skips > 0 && target_doc_num > stde->doc_num
+        && (stde->block_pos >= stde->block_size
+            || target_doc_num > stde->block_docs[stde->block_size - 1])) {
+        FrtSkipLevel *levels = stde->skip_levels;
+        int count = stde->count;
+        int doc = stde->doc_num;
+        frt_off_t frq_ptr = 0;
+        frt_off_t prx_ptr = 0;
+        frt_off_t child_ptr = 0;
+        int interval = stde->skip_interval;
+        int i;
+
+        if (!stde->have_skipped) {
+            stde_load_skip_levels(stde);
+            stde->have_skipped = true;
+        }
+        for (i = 1; i < stde->num_skip_levels; i++) {
+            interval *= FRT_SKIP_MULTIPLIER;
+        }
+
+        for (i = stde->num_skip_levels - 1; i >= 0;
+             i--, interval /= FRT_SKIP_MULTIPLIER) {
+            FrtSkipLevel *level = &levels[i];
+
+            /* drop down to the entry found on the level above */
+            if (level->read * interval < count && child_ptr > 0) {
+                frt_is_seek(level->is, child_ptr);
+                level->read = count / interval;
+                level->doc = doc;
+                level->frq_ptr = frq_ptr;
+                level->prx_ptr = prx_ptr;
+                if (i > 0) {
+                    level->child_ptr = frt_is_read_voff_t(level->is)
+                                     + levels[i - 1].start;
+                }
+            }
+
+            /* move along this level while the entries are before the
+             * target. An entry which overshot on an earlier call is kept */
+            while (true) {
+                if (level->read * interval > count) {
+                    if (level->doc >= target_doc_num) {
+                        break;
+                    }
+                    count = level->read * interval;
+                    doc = level->doc;
+                    frq_ptr = level->frq_ptr;
+                    prx_ptr = level->prx_ptr;
+                }
+                if (level->read >= level->entries) {
+                    break;
+                }
+                level->doc     += frt_is_read_vint(level->is);
+                level->frq_ptr += frt_is_read_vint(level->is);
+                level->prx_ptr += frt_is_read_vint(level->is);
+                if (i > 0) {
+                    level->child_ptr = frt_is_read_voff_t(level->is)
+                                     + levels[i - 1].start;
+                }
+                else if (stde->skip_impacts) {
+                    frt_is_read_vint(level->is);  /* max freq */
+                }
+                level->read++;
+            }
+            child_ptr = (level->read * interval == count) ? level->child_ptr : 0;
+        }
+
+        if (count > stde->count) {
+            frt_is_seek(stde->frq_in, frq_ptr);
+            stde->seek_prox(stde, prx_ptr);
+
+            stde->doc_num = doc;
+            stde->count = count;
+            stde->block_pos = stde->block_size = 0;
+        }
+    }
+
+    /* done skipping, now just scan */
+    do {
+        if (!tde->next(tde)) {
+            return false;
+        }
+    } while (target_doc_num > stde->doc_num);
+    return true;
+}
+
+/* level 0 of the skip data is read with its own stream so finding the
+ * highest freqs ahead doesn't get in the way of skip_to */
+static int stde_max_freq(FrtTermDocEnum *tde, int doc_num, int *up_to)
+{
+    FrtSegmentTermDocEnum *stde = STDE(tde);
+
+    *up_to = INT_MAX;
+    if (0 == stde->doc_freq) {
+        return 0;
+    }
+    if (0 == stde->num_skips) {
+        return -1;  /* too few documents for skip data */
+    }
+    if (!stde->have_skipped) {
+        stde_load_skip_levels(stde);
+        stde->have_skipped = true;
+    }
+    if (doc_num < 0) {
+        return stde->term_max_freq;
+    }
+    if (stde->impact_read < 0) {
+        if (NULL == stde->impact_in) {
+            stde->impact_in = frt_is_clone(stde->frq_in);
+        }
+        frt_is_seek(stde->impact_in, stde->skip_levels[0].start);
+        stde->impact_read = 0;
+        stde->impact_doc = 0;
+    }
+
+    /* entry n covers the documents after entry n - 1 up to its own doc */
+    while (0 == stde->impact_read || stde->impact_doc < doc_num) {
+        if (stde->impact_read >= stde->num_skips) {
+            return stde->term_max_freq;
+        }
+        stde->impact_doc += frt_is_read_vint(stde->impact_in);
+        frt_is_read_vint(stde->impact_in);
+        frt_is_read_vint(stde->impact_in);
+        stde->impact_freq = frt_is_read_vint(stde->impact_in);
+        stde->impact_read++;
+    }
+    *up_to = stde->impact_doc;
+    return stde->impact_freq;
+}
+
+/* move to the next document without touching the positions */
+static bool stde_next_doc(FrtTermDocEnum *tde) {
+    return STDE(tde)->block_docs ? stbe_next(tde) : stde_next(tde);
+}
+
 static void stde_close(FrtTermDocEnum *tde) {
     frt_is_close(STDE(tde)->frq_in);
 
@@ -2954,6 +4851,21 @@ static void stde_close(FrtTermDocEnum *tde) {
         frt_is_close(STDE(tde)->skip_in);
     }
 
+    if (NULL != STDE(tde)->impact_in) {
+        frt_is_close(STDE(tde)->impact_in);
+    }
+
+    if (NULL != STDE(tde)->skip_levels) {
+        int i;
+        for (i = 0; i < FRT_MAX_SKIP_LEVELS; i++) {
+            if (NULL != STDE(tde)->skip_levels[i].is) {
+                frt_is_close(STDE(tde)->skip_levels[i].is);
+            }
+        }
+        free(STDE(tde)->skip_levels);
+    }
+
+    free(STDE(tde)->block_docs);
     free(tde);
 }
 
@@ -2967,7 +4879,7 @@ static void stde_seek_prox(FrtSegmentTermDocEnum *stde, frt_off_t prx_ptr) {
 }
 
 
-FrtTermDocEnum *frt_stde_new(FrtTermInfosReader *tir, FrtInStream *frq_in, FrtBitVector *deleted_docs, int skip_interval) {
+FrtTermDocEnum *frt_stde_new(FrtTermInfosReader *tir, FrtInStream *frq_in, FrtBitVector *deleted_docs, int skip_interval, FrtPostingsFormat postings_format, bool multi_level_skips, bool skip_impacts) {
     FrtSegmentTermDocEnum *stde = FRT_ALLOC_AND_ZERO(FrtSegmentTermDocEnum);
     FrtTermDocEnum *tde         = (FrtTermDocEnum *)stde;
 
@@ -2992,6 +4904,22 @@ FrtTermDocEnum *frt_stde_new(FrtTermInfosReader *tir, FrtInStream *frq_in, FrtBi
     stde->deleted_docs       = deleted_docs;
     stde->skip_interval      = skip_interval;
 
+    if (FRT_POSTINGS_FORMAT_BLOCK == postings_format) {
+        tde->next            = &stbe_next;
+        tde->read            = &stbe_read;
+        tde->skip_to         = &stbe_skip_to;
+        stde->block_docs     = FRT_ALLOC_N(int, 2 * FRT_POSTINGS_BLOCK_SIZE);
+        stde->block_freqs    = stde->block_docs + FRT_POSTINGS_BLOCK_SIZE;
+    }
+    if (multi_level_skips) {
+        tde->skip_to         = &stde_multi_level_skip_to;
+        stde->skip_levels    = FRT_ALLOC_AND_ZERO_N(FrtSkipLevel, FRT_MAX_SKIP_LEVELS);
+        if (skip_impacts) {
+            tde->max_freq    = &stde_max_freq;
+            stde->skip_impacts = true;
+        }
+    }
+
     return tde;
 }
 
@@ -3005,6 +4933,8 @@ static void stpe_seek_ti(FrtSegmentTermDocEnum *stde, FrtTermInfo *ti) {
     } else {
         stde_seek_ti(stde, ti);
         frt_is_seek(stde->prx_in, ti->prx_ptr);
+        stde->prx_cnt = 0;
+        stde->prx_left = stde->prx_buf_pos = stde->prx_buf_size = 0;
     }
 }
 
@@ -3020,7 +4950,7 @@ static bool stpe_next(FrtTermDocEnum *tde) {
     frt_is_skip_vints(stde->prx_in, stde->prx_cnt);
 
     /* if super */
-    if (stde_next(tde)) {
+    if (stde_next_doc(tde)) {
         stde->prx_cnt = stde->freq;
         stde->position = 0;
         return true;
@@ -3049,6 +4979,7 @@ static void stpe_close(FrtTermDocEnum *tde)
 {
     frt_is_close(STDE(tde)->prx_in);
     STDE(tde)->prx_in = NULL;
+    free(STDE(tde)->prx_buf);
     stde_close(tde);
 }
 
@@ -3063,42 +4994,147 @@ static void stpe_seek_prox(FrtSegmentTermDocEnum *stde, frt_off_t prx_ptr)
     stde->prx_cnt = 0;
 }
 
-FrtTermDocEnum *frt_stpe_new(FrtTermInfosReader *tir,
-                      FrtInStream *frq_in,
-                      FrtInStream *prx_in,
-                      FrtBitVector *del_docs,
-                      int skip_interval)
+/* load the next position deltas of the current block of documents */
+static void stbpe_read_positions(FrtSegmentTermDocEnum *stde)
 {
-    FrtTermDocEnum *tde         = frt_stde_new(tir, frq_in, del_docs, skip_interval);
-    FrtSegmentTermDocEnum *stde = STDE(tde);
-
-    /* TermDocEnum methods */
-    tde->seek                = &stpe_seek;
-    tde->next                = &stpe_next;
-    tde->read                = &stpe_read;
-    tde->next_position       = &stpe_next_position;
-    tde->close               = &stpe_close;
-
-    /* SegmentTermDocEnum methods */
-    stde->skip_prox          = &stpe_skip_prox;
-    stde->seek_prox          = &stpe_seek_prox;
+    if (stde->prx_left >= FRT_POSTINGS_BLOCK_SIZE) {
+        block_read(stde->prx_in, stde->prx_buf);
+        stde->prx_buf_size = FRT_POSTINGS_BLOCK_SIZE;
+    } else {
+        int i;
+        if (0 == stde->prx_left) {
+            FRT_RAISE(FRT_IO_ERROR, "corrupt postings, positions past the "
+                      "end of the block");
+        }
+        for (i = 0; i < stde->prx_left; i++) {
+            stde->prx_buf[i] = (int)frt_is_read_vint(stde->prx_in);
+        }
+        stde->prx_buf_size = stde->prx_left;
+    }
+    stde->prx_left -= stde->prx_buf_size;
+    stde->prx_buf_pos = 0;
+}
 
-    /* Attributes */
-    stde->prx_in             = frt_is_clone(prx_in);
-    stde->prx_cnt            = 0;
-    stde->position           = 0;
+static inline int stbpe_read_delta(FrtSegmentTermDocEnum *stde)
+{
+    if (stde->prx_buf_pos >= stde->prx_buf_size) {
+        stbpe_read_positions(stde);
+    }
+    return stde->prx_buf[stde->prx_buf_pos++];
+}
 
-    return tde;
+/* skip +cnt+ position deltas, stepping over whole packed blocks without
+ * decoding them */
+static void stbpe_skip_deltas(FrtSegmentTermDocEnum *stde, int cnt)
+{
+    while (cnt > 0) {
+        const int avail = stde->prx_buf_size - stde->prx_buf_pos;
+        if (avail > 0) {
+            const int skip = avail < cnt ? avail : cnt;
+            stde->prx_buf_pos += skip;
+            cnt -= skip;
+        } else if (cnt >= FRT_POSTINGS_BLOCK_SIZE
+                   && stde->prx_left >= FRT_POSTINGS_BLOCK_SIZE) {
+            const int bits = frt_is_read_byte(stde->prx_in);
+            frt_is_seek(stde->prx_in,
+                        frt_is_pos(stde->prx_in) + BLOCK_BYTES(bits));
+            stde->prx_left -= FRT_POSTINGS_BLOCK_SIZE;
+            cnt -= FRT_POSTINGS_BLOCK_SIZE;
+        } else {
+            stbpe_read_positions(stde);
+        }
+    }
 }
 
-/****************************************************************************
- * MultiTermDocEnum
- ****************************************************************************/
+/* read the next position delta whatever the postings format */
+static int stpe_read_delta(FrtSegmentTermDocEnum *stde)
+{
+    return stde->prx_buf ? stbpe_read_delta(stde)
+                         : (int)frt_is_read_vint(stde->prx_in);
+}
 
-#define MTDE(tde) ((MultiTermDocEnum *)(tde))
+static bool stbpe_next(FrtTermDocEnum *tde) {
+    FrtSegmentTermDocEnum *stde = STDE(tde);
+    stbpe_skip_deltas(stde, stde->prx_cnt);
 
-typedef struct MultiTermDocEnum
-{
+    if (stbe_next(tde)) {
+        stde->prx_cnt = stde->freq;
+        stde->position = 0;
+        return true;
+    } else {
+        stde->prx_cnt = stde->position = 0;
+        return false;
+    }
+}
+
+static int stbpe_next_position(FrtTermDocEnum *tde)
+{
+    FrtSegmentTermDocEnum *stde = STDE(tde);
+    return (stde->prx_cnt-- > 0) ? stde->position += stbpe_read_delta(stde)
+                                 : -1;
+}
+
+static void stbpe_skip_prox(FrtSegmentTermDocEnum *stde)
+{
+    stbpe_skip_deltas(stde, stde->freq);
+}
+
+static void stbpe_seek_prox(FrtSegmentTermDocEnum *stde, frt_off_t prx_ptr)
+{
+    frt_is_seek(stde->prx_in, prx_ptr);
+    stde->prx_cnt = 0;
+    stde->prx_left = stde->prx_buf_pos = stde->prx_buf_size = 0;
+}
+
+FrtTermDocEnum *frt_stpe_new(FrtTermInfosReader *tir,
+                      FrtInStream *frq_in,
+                      FrtInStream *prx_in,
+                      FrtBitVector *del_docs,
+                      int skip_interval,
+                      FrtPostingsFormat postings_format,
+                      bool multi_level_skips,
+                      bool skip_impacts)
+{
+    FrtTermDocEnum *tde         = frt_stde_new(tir, frq_in, del_docs, skip_interval,
+                                               postings_format, multi_level_skips,
+                                               skip_impacts);
+    FrtSegmentTermDocEnum *stde = STDE(tde);
+
+    /* TermDocEnum methods */
+    tde->seek                = &stpe_seek;
+    tde->next                = &stpe_next;
+    tde->read                = &stpe_read;
+    tde->next_position       = &stpe_next_position;
+    tde->close               = &stpe_close;
+
+    /* SegmentTermDocEnum methods */
+    stde->skip_prox          = &stpe_skip_prox;
+    stde->seek_prox          = &stpe_seek_prox;
+
+    /* Attributes */
+    stde->prx_in             = frt_is_clone(prx_in);
+    stde->prx_cnt            = 0;
+    stde->position           = 0;
+
+    if (FRT_POSTINGS_FORMAT_BLOCK == postings_format) {
+        tde->next            = &stbpe_next;
+        tde->next_position   = &stbpe_next_position;
+        stde->skip_prox      = &stbpe_skip_prox;
+        stde->seek_prox      = &stbpe_seek_prox;
+        stde->prx_buf        = FRT_ALLOC_N(int, FRT_POSTINGS_BLOCK_SIZE);
+    }
+
+    return tde;
+}
+
+/****************************************************************************
+ * MultiTermDocEnum
+ ****************************************************************************/
+
+#define MTDE(tde) ((MultiTermDocEnum *)(tde))
+
+typedef struct MultiTermDocEnum
+{
     FrtTermDocEnum tde;
     int *starts;
     int base;
@@ -3239,6 +5275,58 @@ static bool mtde_skip_to(FrtTermDocEnum *tde, int target_doc_num)
     return false;
 }
 
+/* the bound of the segment holding +doc_num+, or 0 up to the next segment
+ * with the term if it doesn't have it */
+static int mtde_max_freq(FrtTermDocEnum *tde, int doc_num, int *up_to)
+{
+    MultiTermDocEnum *mtde = MTDE(tde);
+    FrtTermDocEnum *sub_tde;
+    int i = 0;
+    int max_freq, sub_up_to;
+
+    if (doc_num < 0) {
+        /* the highest of the segments with the term */
+        int seg_max_freq;
+        max_freq = 0;
+        *up_to = INT_MAX;
+        for (i = 0; i < mtde->ir_cnt; i++) {
+            if (!mtde->state[i]) {
+                continue;
+            }
+            sub_tde = mtde->irs_tde[i];
+            if (NULL == sub_tde->max_freq
+                || 0 > (seg_max_freq = sub_tde->max_freq(sub_tde, -1, &sub_up_to))) {
+                return -1;
+            }
+            if (seg_max_freq > max_freq) max_freq = seg_max_freq;
+        }
+        return max_freq;
+    }
+    if (doc_num >= mtde->starts[mtde->ir_cnt]) {
+        *up_to = INT_MAX;   /* past the last document */
+        return 0;
+    }
+    while (i < mtde->ir_cnt - 1 && doc_num >= mtde->starts[i + 1]) {
+        i++;
+    }
+    if (!mtde->state[i]) {
+        for (i++; i < mtde->ir_cnt && !mtde->state[i]; i++) {
+        }
+        *up_to = (i < mtde->ir_cnt) ? mtde->starts[i] - 1 : INT_MAX;
+        return 0;
+    }
+    sub_tde = mtde->irs_tde[i];
+    if (NULL == sub_tde->max_freq) {
+        *up_to = mtde->starts[i + 1] - 1;
+        return -1;
+    }
+    max_freq = sub_tde->max_freq(sub_tde, doc_num - mtde->starts[i], &sub_up_to);
+    *up_to = (sub_up_to < mtde->starts[i + 1] - mtde->starts[i])
+        ? mtde->starts[i] + sub_up_to
+        : mtde->starts[i + 1] - 1;
+    return max_freq;
+}
+
 static void mtde_close(FrtTermDocEnum *tde)
 {
     MultiTermDocEnum *mtde = MTDE(tde);
@@ -3266,6 +5354,7 @@ static FrtTermDocEnum *mtxe_new(FrtMultiReader *mr)
     tde->next               = &mtde_next;
     tde->read               = &mtde_read;
     tde->skip_to            = &mtde_skip_to;
+    tde->max_freq           = &mtde_max_freq;
     tde->close              = &mtde_close;
 
     mtde->state             = FRT_ALLOC_AND_ZERO_N(char, mr->r_cnt);
@@ -3770,8 +5859,9 @@ static void ir_acquire_write_lock(FrtIndexReader *ir)
     }
 }
 
+/* ir->type is left alone here, it is set by the SegmentReader and MultiReader
+ * initializers */
 static FrtIndexReader *ir_setup(FrtIndexReader *ir, FrtStore *store, FrtSegmentInfos *sis, FrtFieldInfos *fis, int is_owner) {
-    ir->type = FRT_INDEX_READER;
     frt_mutex_init(&ir->mutex, NULL);
     frt_mutex_init(&ir->field_index_mutex, NULL);
 
@@ -3780,6 +5870,11 @@ static FrtIndexReader *ir_setup(FrtIndexReader *ir, FrtStore *store, FrtSegmentI
         FRT_REF(store);
     }
     ir->sis     = sis;
+    if (sis && !is_owner) {
+        /* the SegmentReaders of a MultiReader may outlive it when they are
+         * shared with a reopened reader */
+        FRT_REF(sis);
+    }
     ir->fis     = fis;
     ir->ref_cnt = 1;
     ir->rir     = Qnil;
@@ -3805,12 +5900,25 @@ int frt_ir_doc_freq(FrtIndexReader *ir, ID field, const char *term) {
     }
 }
 
+/* the norm set is cached with the norms, on the core of a shared reader */
+static void ir_clear_norm_set(FrtIndexReader *ir, int field_num)
+{
+    FrtIndexReader *core = frt_ir_core(ir);
+    if (core != ir) frt_mutex_lock(&core->mutex);
+    if (core->norm_sets) frt_h_del_int(core->norm_sets, field_num);
+    if (core != ir) frt_mutex_unlock(&core->mutex);
+}
+
 static void ir_set_norm_i(FrtIndexReader *ir, int doc_num, int field_num, frt_uchar val) {
     frt_mutex_lock(&ir->mutex);
-    ir->acquire_write_lock(ir);
-    ir->set_norm_i(ir, doc_num, field_num, val);
-    ir->has_changes = true;
-    frt_mutex_unlock(&ir->mutex);
+    FRT_TRY
+        ir->acquire_write_lock(ir);
+        ir->set_norm_i(ir, doc_num, field_num, val);
+        ir_clear_norm_set(ir, field_num);
+        ir->has_changes = true;
+    FRT_XFINALLY
+        frt_mutex_unlock(&ir->mutex);
+    FRT_XENDTRY
 }
 
 void frt_ir_set_norm(FrtIndexReader *ir, int doc_num, ID field, frt_uchar val) {
@@ -3840,6 +5948,50 @@ frt_uchar *frt_ir_get_norms(FrtIndexReader *ir, ID field) {
     return frt_ir_get_norms_i(ir, field_num);
 }
 
+/*
+ * Fill +set+, FRT_NORM_SET_SIZE words, with a bit for each norm byte used by
+ * the documents in +field+. It is worked out the first time it is asked for
+ * and kept until a norm of the field changes, so scorers can bound the norms
+ * of a field without scanning them every time.
+ */
+void frt_ir_get_norm_set(FrtIndexReader *ir, ID field, frt_u32 *set)
+{
+    const int field_num = frt_fis_get_field_num(ir->fis, field);
+    frt_u32 *cached = NULL;
+
+    ir = frt_ir_core(ir);
+    frt_mutex_lock(&ir->mutex);
+    if (ir->norm_sets) {
+        cached = (frt_u32 *)frt_h_get_int(ir->norm_sets, field_num);
+    }
+    if (cached) {
+        memcpy(set, cached, FRT_NORM_SET_SIZE * sizeof(frt_u32));
+    }
+    frt_mutex_unlock(&ir->mutex);
+
+    if (NULL == cached) {
+        /* the norms are read outside of the lock as the SegmentReader takes
+         * it itself */
+        const frt_uchar *norms = frt_ir_get_norms_i(ir, field_num);
+        const int max_doc = ir->max_doc(ir);
+        int i;
+        memset(set, 0, FRT_NORM_SET_SIZE * sizeof(frt_u32));
+        for (i = 0; i < max_doc; i++) {
+            set[norms[i] >> 5] |= 1U << (norms[i] & 31);
+        }
+        frt_mutex_lock(&ir->mutex);
+        if (NULL == ir->norm_sets) {
+            ir->norm_sets = frt_h_new_int(&free);
+        }
+        if (NULL == frt_h_get_int(ir->norm_sets, field_num)) {
+            cached = FRT_ALLOC_N(frt_u32, FRT_NORM_SET_SIZE);
+            memcpy(cached, set, FRT_NORM_SET_SIZE * sizeof(frt_u32));
+            frt_h_set_int(ir->norm_sets, field_num, cached);
+        }
+        frt_mutex_unlock(&ir->mutex);
+    }
+}
+
 frt_uchar *frt_ir_get_norms_into(FrtIndexReader *ir, ID field, frt_uchar *buf) {
     int field_num = frt_fis_get_field_num(ir->fis, field);
     if (field_num >= 0) {
@@ -3854,20 +6006,26 @@ frt_uchar *frt_ir_get_norms_into(FrtIndexReader *ir, ID field, frt_uchar *buf) {
 void frt_ir_undelete_all(FrtIndexReader *ir)
 {
     frt_mutex_lock(&ir->mutex);
-    ir->acquire_write_lock(ir);
-    ir->undelete_all_i(ir);
-    ir->has_changes = true;
-    frt_mutex_unlock(&ir->mutex);
+    FRT_TRY
+        ir->acquire_write_lock(ir);
+        ir->undelete_all_i(ir);
+        ir->has_changes = true;
+    FRT_XFINALLY
+        frt_mutex_unlock(&ir->mutex);
+    FRT_XENDTRY
 }
 
 void frt_ir_delete_doc(FrtIndexReader *ir, int doc_num)
 {
     if (doc_num >= 0 && doc_num < ir->max_doc(ir)) {
         frt_mutex_lock(&ir->mutex);
-        ir->acquire_write_lock(ir);
-        ir->delete_doc_i(ir, doc_num);
-        ir->has_changes = true;
-        frt_mutex_unlock(&ir->mutex);
+        FRT_TRY
+            ir->acquire_write_lock(ir);
+            ir->delete_doc_i(ir, doc_num);
+            ir->has_changes = true;
+        FRT_XFINALLY
+            frt_mutex_unlock(&ir->mutex);
+        FRT_XENDTRY
     }
 }
 
@@ -3928,6 +6086,11 @@ static void ir_commit_i(FrtIndexReader *ir)
              * FrtSegmentReaders: */
             ir->set_deleter_i(ir, frt_deleter_new(ir->sis, ir->store));
         }
+        else if (ir->is_owner && NULL != ir->deleter) {
+            /* the FrtSegmentReaders may be shared with a reader reopened from
+             * or to this one which set its own deleter on them */
+            ir->set_deleter_i(ir, ir->deleter);
+        }
         if (ir->is_owner) {
             char curr_seg_fn[FRT_MAX_FILE_PATH];
             frt_mutex_lock(&ir->store->mutex);
@@ -3973,11 +6136,13 @@ void frt_ir_close(FrtIndexReader *ir) {
         ir_commit_i(ir);
         ir->close_i(ir);
         if (ir->store) frt_store_close(ir->store);
-        if (ir->is_owner && ir->sis) frt_sis_destroy(ir->sis);
+        if (ir->sis) frt_sis_destroy(ir->sis);
         if (ir->cache) frt_h_destroy(ir->cache);
         if (ir->field_index_cache) frt_h_destroy(ir->field_index_cache);
+        if (ir->norm_sets) frt_h_destroy(ir->norm_sets);
         if (ir->deleter && ir->is_owner) frt_deleter_destroy(ir->deleter);
         free(ir->fake_norms);
+        if (ir->stored_cache) frt_sc_deref(ir->stored_cache);
 
         frt_mutex_destroy(&ir->field_index_mutex);
         frt_mutex_unlock(&ir->mutex);
@@ -4059,12 +6224,18 @@ static void norm_rewrite(Norm *norm, FrtStore *store, FrtDeleter *dlr,
 #define IR(ir) ((FrtIndexReader *)(ir))
 #define SR(ir) ((FrtSegmentReader *)(ir))
 #define SR_SIZE(ir) (SR(ir)->fr->size)
+/* the SegmentReader owning the files, norms and doc values of +ir+. Its mutex
+ * guards them for all the readers sharing them */
+#define SR_CORE(ir) (SR(ir)->core ? SR(ir)->core : SR(ir))
+#define SR_MUTEX(ir) (&IR(SR_CORE(ir))->mutex)
 
 static FrtFieldsReader *sr_fr(FrtSegmentReader *sr) {
     FrtFieldsReader *fr;
     if (NULL == (fr = (FrtFieldsReader *)frt_thread_getspecific(sr->thread_fr))) {
         fr = frt_fr_clone(sr->fr);
+        frt_mutex_lock(SR_MUTEX(sr));
         frt_ary_push(sr->fr_bucket, fr);
+        frt_mutex_unlock(SR_MUTEX(sr));
         frt_thread_setspecific(sr->thread_fr, fr);
     }
     return fr;
@@ -4114,9 +6285,24 @@ static void sr_set_norm_i(FrtIndexReader *ir, int doc_num, int field_num, frt_uc
     }
 }
 
+static FrtBitVector *bv_copy(FrtBitVector *bv)
+{
+    FrtBitVector *copy = frt_bv_new_capa(bv->capa << 5);
+    memcpy(copy->bits, bv->bits, bv->capa * sizeof(frt_u32));
+    copy->size = bv->size;
+    copy->count = bv->count;
+    copy->extends_as_ones = bv->extends_as_ones;
+    return copy;
+}
+
 static void sr_delete_doc_i(FrtIndexReader *ir, int doc_num) {
     if (NULL == SR(ir)->deleted_docs) {
         SR(ir)->deleted_docs = frt_bv_new();
+    } else if (SR(ir)->deleted_docs->ref_cnt > 1) {
+        /* still shared with the reader this one was reopened from or to */
+        FrtBitVector *deleted_docs = bv_copy(SR(ir)->deleted_docs);
+        frt_bv_destroy(SR(ir)->deleted_docs);
+        SR(ir)->deleted_docs = deleted_docs;
     }
 
     SR(ir)->deleted_docs_dirty = true;
@@ -4200,6 +6386,8 @@ static void sr_commit_i(FrtIndexReader *ir)
             bv_write(SR(ir)->deleted_docs, ir->store, tmp_file_name);
             SR(ir)->deleted_docs_dirty = false;
         }
+        /* a generation may be reused after undelete_all */
+        si->del_cnt_gen = -1;
     }
     if (SR(ir)->norms_dirty) { /* re-write norms */
         int i;
@@ -4222,6 +6410,14 @@ static void sr_commit_i(FrtIndexReader *ir)
 static void sr_close_i(FrtIndexReader *ir) {
     FrtSegmentReader *sr = SR(ir);
 
+    if (sr->core) {
+        /* only the deletions are this reader's own */
+        if (sr->deleted_docs) frt_bv_destroy(sr->deleted_docs);
+        frt_si_close(sr->si);
+        frt_fis_deref(ir->fis);
+        frt_ir_close(IR(sr->core));
+        return;
+    }
     if (sr->fr)           frt_fr_close(sr->fr);
     if (sr->tir)          frt_tir_close(sr->tir);
     if (sr->sfi)          frt_sfi_close(sr->sfi);
@@ -4229,11 +6425,14 @@ static void sr_close_i(FrtIndexReader *ir) {
     if (sr->prx_in)       frt_is_close(sr->prx_in);
     if (sr->norms)        frt_h_destroy(sr->norms);
     if (sr->deleted_docs) frt_bv_destroy(sr->deleted_docs);
+    if (sr->doc_values)   frt_h_destroy(sr->doc_values);
     if (sr->cfs_store)    frt_store_close(sr->cfs_store);
     if (sr->fr_bucket) {
         frt_thread_key_delete(sr->thread_fr);
         frt_ary_destroy(sr->fr_bucket, (frt_free_ft)&frt_fr_close);
     }
+    frt_si_close(sr->si);
+    frt_fis_deref(ir->fis);
 }
 
 static int sr_num_docs(FrtIndexReader *ir)
@@ -4257,44 +6456,62 @@ static int sr_max_doc(FrtIndexReader *ir)
 static FrtDocument *sr_get_doc(FrtIndexReader *ir, int doc_num)
 {
     FrtDocument *doc;
-    frt_mutex_lock(&ir->mutex);
+    frt_mutex_lock(SR_MUTEX(ir));
     if (sr_is_deleted_i(SR(ir), doc_num)) {
-        frt_mutex_unlock(&ir->mutex);
+        frt_mutex_unlock(SR_MUTEX(ir));
         FRT_RAISE(FRT_STATE_ERROR, "Document %d has already been deleted", doc_num);
     }
     doc = frt_fr_get_doc(SR(ir)->fr, doc_num);
-    frt_mutex_unlock(&ir->mutex);
+    frt_mutex_unlock(SR_MUTEX(ir));
     return doc;
 }
 
 static FrtLazyDoc *sr_get_lazy_doc(FrtIndexReader *ir, int doc_num)
 {
     FrtLazyDoc *lazy_doc;
-    frt_mutex_lock(&ir->mutex);
+    frt_mutex_lock(SR_MUTEX(ir));
     if (sr_is_deleted_i(SR(ir), doc_num)) {
-        frt_mutex_unlock(&ir->mutex);
+        frt_mutex_unlock(SR_MUTEX(ir));
         FRT_RAISE(FRT_STATE_ERROR, "Document %d has already been deleted", doc_num);
     }
     lazy_doc = frt_fr_get_lazy_doc(SR(ir)->fr, doc_num);
-    frt_mutex_unlock(&ir->mutex);
+    frt_mutex_unlock(SR_MUTEX(ir));
     return lazy_doc;
 }
 
+static void sr_get_docs(FrtIndexReader *ir, const int *doc_nums, int cnt,
+                        const ID *fields, int field_cnt, FrtDocument **docs)
+{
+    int i;
+    frt_mutex_lock(SR_MUTEX(ir));
+    for (i = 0; i < cnt; i++) {
+        if (sr_is_deleted_i(SR(ir), doc_nums[i])) {
+            frt_mutex_unlock(SR_MUTEX(ir));
+            FRT_RAISE(FRT_STATE_ERROR, "Document %d has already been deleted", doc_nums[i]);
+        }
+    }
+    FRT_TRY
+        frt_fr_get_docs(SR(ir)->fr, doc_nums, cnt, fields, field_cnt, docs);
+    FRT_XFINALLY
+        frt_mutex_unlock(SR_MUTEX(ir));
+    FRT_XENDTRY
+}
+
 static frt_uchar *sr_get_norms(FrtIndexReader *ir, int field_num)
 {
     frt_uchar *norms;
-    frt_mutex_lock(&ir->mutex);
+    frt_mutex_lock(SR_MUTEX(ir));
     norms = sr_get_norms_i(SR(ir), field_num);
-    frt_mutex_unlock(&ir->mutex);
+    frt_mutex_unlock(SR_MUTEX(ir));
     return norms;
 }
 
 static frt_uchar *sr_get_norms_into(FrtIndexReader *ir, int field_num,
                               frt_uchar *buf)
 {
-    frt_mutex_lock(&ir->mutex);
+    frt_mutex_lock(SR_MUTEX(ir));
     sr_get_norms_into_i(SR(ir), field_num, buf);
-    frt_mutex_unlock(&ir->mutex);
+    frt_mutex_unlock(SR_MUTEX(ir));
     return buf;
 }
 
@@ -4323,14 +6540,18 @@ static int sr_doc_freq(FrtIndexReader *ir, int field_num, const char *term)
 static FrtTermDocEnum *sr_term_docs(FrtIndexReader *ir)
 {
     return frt_stde_new(SR(ir)->tir, SR(ir)->frq_in, SR(ir)->deleted_docs,
-                    STE(SR(ir)->tir->orig_te)->skip_interval);
+                    STE(SR(ir)->tir->orig_te)->skip_interval,
+                    SR(ir)->si->postings_format, SR(ir)->si->multi_level_skips,
+                    SR(ir)->si->skip_impacts);
 }
 
 static FrtTermDocEnum *sr_term_positions(FrtIndexReader *ir)
 {
     FrtSegmentReader *sr = SR(ir);
     return frt_stpe_new(sr->tir, sr->frq_in, sr->prx_in, sr->deleted_docs,
-                    STE(sr->tir->orig_te)->skip_interval);
+                    STE(sr->tir->orig_te)->skip_interval,
+                    sr->si->postings_format, sr->si->multi_level_skips,
+                    sr->si->skip_impacts);
 }
 
 static FrtTermVector *sr_term_vector(FrtIndexReader *ir, int doc_num, ID field) {
@@ -4388,17 +6609,13 @@ static void sr_open_norms(FrtIndexReader *ir, FrtStore *cfs_store)
     SR(ir)->norms_dirty = false;
 }
 
-static FrtIndexReader *sr_setup_i(FrtSegmentReader *sr)
+static void sr_set_methods_i(FrtIndexReader *ir)
 {
-    FrtStore *volatile store = sr->si->store;
-    FrtIndexReader *ir = IR(sr);
-    char file_name[FRT_SEGMENT_NAME_MAX_LENGTH];
-    char *sr_segment = sr->si->name;
-
     ir->num_docs            = &sr_num_docs;
     ir->max_doc             = &sr_max_doc;
     ir->get_doc             = &sr_get_doc;
     ir->get_lazy_doc        = &sr_get_lazy_doc;
+    ir->get_docs            = &sr_get_docs;
     ir->get_norms           = &sr_get_norms;
     ir->get_norms_into      = &sr_get_norms_into;
     ir->terms               = &sr_terms;
@@ -4420,6 +6637,16 @@ static FrtIndexReader *sr_setup_i(FrtSegmentReader *sr)
     ir->close_i             = &sr_close_i;
 
     ir->type                = FRT_SEGMENT_READER;
+}
+
+static FrtIndexReader *sr_setup_i(FrtSegmentReader *sr)
+{
+    FrtStore *volatile store = sr->si->store;
+    FrtIndexReader *ir = IR(sr);
+    char file_name[FRT_SEGMENT_NAME_MAX_LENGTH];
+    char *sr_segment = sr->si->name;
+
+    sr_set_methods_i(ir);
 
     sr->thread_fr   = 0;
     sr->cfs_store   = NULL;
@@ -4431,7 +6658,8 @@ static FrtIndexReader *sr_setup_i(FrtSegmentReader *sr)
             store = sr->cfs_store;
         }
 
-        sr->fr = frt_fr_open(store, sr_segment, ir->fis);
+        sr->fr = frt_fr_open(store, sr_segment, ir->fis,
+                             sr->si->stored_fields_format);
         sr->sfi = frt_sfi_open(store, sr_segment);
         sr->tir = frt_tir_open(store, sr->sfi, sr_segment);
 
@@ -4454,25 +6682,117 @@ static FrtIndexReader *sr_setup_i(FrtSegmentReader *sr)
             sr->fr_bucket = frt_ary_new();
         }
     FRT_XCATCHALL
-        ir->sis = NULL;
+        /* the SegmentInfos of an owner are left to the caller */
+        if (ir->is_owner) ir->sis = NULL;
         frt_ir_close(ir);
     FRT_XENDTRY
 
     return ir;
 }
 
+/*
+ * The doc values column of +field+, read from the segment the first time it
+ * is asked for. Segments without values for the field get an empty column.
+ * Returns NULL if +field+ isn't a doc values field.
+ */
+FrtDocValues *frt_sr_get_doc_values(FrtIndexReader *ir, ID field)
+{
+    FrtSegmentReader *sr;
+    FrtFieldInfo *fi = frt_fis_get_field(ir->fis, field);
+    FrtDocValues *volatile dv = NULL;
+    FrtInStream *volatile is = NULL;
+    FrtStore *store;
+    char file_name[FRT_SEGMENT_NAME_MAX_LENGTH];
+
+    if (FRT_SEGMENT_READER != ir->type || NULL == fi
+        || !bits_doc_values_type(fi->bits)) {
+        return NULL;
+    }
+    sr = SR_CORE(ir);
+    store = sr->cfs_store ? sr->cfs_store : sr->si->store;
+    frt_mutex_lock(&IR(sr)->mutex);
+    FRT_TRY
+        if (NULL == sr->doc_values) {
+            sr->doc_values = frt_h_new_int((frt_free_ft)&dv_destroy);
+        }
+        dv = (FrtDocValues *)frt_h_get_int(sr->doc_values, fi->number);
+        if (NULL == dv) {
+            sprintf(file_name, "%s.dvd", sr->si->name);
+            if (store->exists(store, file_name)) {
+                is = store->open_input(store, file_name);
+                dv = dv_read(is, fi->number);
+            }
+            if (NULL == dv) {
+                dv = dv_new(bits_doc_values_type(fi->bits), sr->fr->size);
+            }
+            frt_h_set_int(sr->doc_values, fi->number, dv);
+        }
+    FRT_XFINALLY
+        if (is) frt_is_close(is);
+        frt_mutex_unlock(&IR(sr)->mutex);
+    FRT_XENDTRY
+    return dv;
+}
+
+/*
+ * The reader to cache per segment data like filter bits and field indexes on.
+ * A SegmentReader shared with a reopened reader only differs from its core in
+ * the documents deleted since, and deleted documents never match anyway, so
+ * both can use the data cached on the core.
+ */
+FrtIndexReader *frt_ir_core(FrtIndexReader *ir)
+{
+    return FRT_SEGMENT_READER == ir->type ? IR(SR_CORE(ir)) : ir;
+}
+
 FrtSegmentReader *frt_sr_alloc(void) {
     return FRT_ALLOC_AND_ZERO(FrtSegmentReader);
 }
 
+/* The SegmentReader keeps its own references to the SegmentInfo and the
+ * FieldInfos so it can be shared with a reopened reader, see frt_ir_reopen */
 static FrtIndexReader *sr_open(FrtSegmentInfos *sis, FrtFieldInfos *fis, int si_num, bool is_owner, FrtSegmentReader *sr) {
     if (sr == NULL)
         sr = frt_sr_alloc();
     sr->si = sis->segs[si_num];
+    FRT_REF(sr->si);
+    FRT_REF(fis);
     ir_setup(IR(sr), sr->si->store, sis, fis, is_owner);
     return sr_setup_i(sr);
 }
 
+/* A SegmentReader for a reader reopened from the one +orig+ belongs to. It
+ * reads through the files, norms and doc values of +orig+, which is kept open
+ * until all readers sharing them are closed. The deletions start out shared
+ * too and are copied the first time either reader changes them */
+static FrtIndexReader *sr_open_shared(FrtSegmentReader *orig, FrtSegmentInfos *sis, FrtFieldInfos *fis)
+{
+    FrtSegmentReader *core = SR_CORE(orig);
+    FrtSegmentReader *sr = frt_sr_alloc();
+    FrtIndexReader *ir = IR(sr);
+
+    sr->si = orig->si;
+    FRT_REF(sr->si);
+    FRT_REF(fis);
+    ir_setup(ir, sr->si->store, sis, fis, false);
+    sr_set_methods_i(ir);
+
+    FRT_REF(IR(core));
+    sr->core         = core;
+    sr->fr           = core->fr;
+    sr->sfi          = core->sfi;
+    sr->tir          = core->tir;
+    sr->frq_in       = core->frq_in;
+    sr->prx_in       = core->prx_in;
+    sr->norms        = core->norms;
+    sr->cfs_store    = core->cfs_store;
+    sr->thread_fr    = core->thread_fr;
+    sr->fr_bucket    = core->fr_bucket;
+    sr->deleted_docs = orig->deleted_docs;
+    if (sr->deleted_docs) FRT_REF(sr->deleted_docs);
+    return ir;
+}
+
 /****************************************************************************
  * MultiReader
  ****************************************************************************/
@@ -4544,6 +6864,54 @@ static FrtLazyDoc *mr_get_lazy_doc(FrtIndexReader *ir, int doc_num)
     return reader->get_lazy_doc(reader, doc_num - MR(ir)->starts[i]);
 }
 
+/* split the documents up between the sub-readers so each of them can read
+ * its documents in one go */
+static void mr_get_docs(FrtIndexReader *ir, const int *doc_nums, int cnt,
+                        const ID *fields, int field_cnt, FrtDocument **docs)
+{
+    int i, j;
+    FrtMultiReader *mr = MR(ir);
+    int *readers = FRT_ALLOC_N(int, cnt);
+    int *sub_doc_nums = FRT_ALLOC_N(int, cnt);
+    int *indexes = FRT_ALLOC_N(int, cnt);
+    FrtDocument **sub_docs = FRT_ALLOC_N(FrtDocument *, cnt);
+    volatile bool success = false;
+
+    for (i = 0; i < cnt; i++) {
+        readers[i] = mr_reader_index_i(mr, doc_nums[i]);
+    }
+    memset(docs, 0, cnt * sizeof(FrtDocument *));
+    FRT_TRY
+        for (j = 0; j < mr->r_cnt; j++) {
+            int sub_cnt = 0;
+            for (i = 0; i < cnt; i++) {
+                if (readers[i] == j) {
+                    sub_doc_nums[sub_cnt] = doc_nums[i] - mr->starts[j];
+                    indexes[sub_cnt++] = i;
+                }
+            }
+            if (sub_cnt > 0) {
+                FrtIndexReader *reader = mr->sub_readers[j];
+                reader->get_docs(reader, sub_doc_nums, sub_cnt, fields,
+                                 field_cnt, sub_docs);
+                for (i = 0; i < sub_cnt; i++) {
+                    docs[indexes[i]] = sub_docs[i];
+                }
+            }
+        }
+        success = true;
+    FRT_XFINALLY
+        if (!success) {
+            /* the reader which raised has already freed its own */
+            frt_docs_destroy(docs, cnt);
+        }
+        free(readers);
+        free(sub_doc_nums);
+        free(indexes);
+        free(sub_docs);
+    FRT_XENDTRY
+}
+
 int frt_mr_get_field_num(FrtMultiReader *mr, int ir_num, int f_num)
 {
     if (mr->field_num_map) {
@@ -4711,6 +7079,10 @@ static bool mr_is_latest_i(FrtIndexReader *ir)
 {
     int i;
     const int mr_reader_cnt = MR(ir)->r_cnt;
+    if (NULL != ir->sis) {
+        /* the sub readers are the index's segments */
+        return (frt_sis_read_current_version(ir->store) == ir->sis->version);
+    }
     for (i = 0; i < mr_reader_cnt; i++) {
         if (!frt_ir_is_latest(MR(ir)->sub_readers[i])) {
             return false;
@@ -4774,6 +7146,7 @@ FrtMultiReader *frt_mr_init(FrtMultiReader *mr, FrtIndexReader **sub_readers, co
     ir->max_doc             = &mr_max_doc;
     ir->get_doc             = &mr_get_doc;
     ir->get_lazy_doc        = &mr_get_lazy_doc;
+    ir->get_docs            = &mr_get_docs;
     ir->get_norms           = &mr_get_norms;
     ir->get_norms_into      = &mr_get_norms_into;
     ir->terms               = &mr_terms;
@@ -4873,38 +7246,44 @@ FrtIndexReader *frt_mr_open(FrtIndexReader *ir, FrtIndexReader **sub_readers, co
  * IndexReader
  ****************************************************************************/
 
+/* open a reader on the segments in sis. The reader takes ownership of sis */
+static FrtIndexReader *ir_open_sis(FrtStore *store, FrtSegmentInfos *sis, FrtIndexReader *ir)
+{
+    FrtFieldInfos *fis = sis->fis;
+    if (sis->size == 1) {
+        ir = sr_open(sis, fis, 0, true, (FrtSegmentReader *)ir);
+    }  else {
+        volatile int i;
+        FrtIndexReader **readers = FRT_ALLOC_AND_ZERO_N(FrtIndexReader *, sis->size);
+        int num_segments = sis->size;
+        FRT_TRY
+            for (i = num_segments - 1; i >= 0; i--) {
+                readers[i] = sr_open(sis, fis, i, false, NULL);
+                FRT_DEREF(readers[i]);
+            }
+        FRT_XCATCHALL
+            for (i++; i < num_segments; i++) {
+                if (readers[i]) {
+                    FRT_REF(readers[i]);
+                    frt_ir_close(readers[i]);
+                }
+            }
+            free(readers);
+        FRT_XENDTRY
+        ir = frt_mr_open_i(store, sis, fis, readers, sis->size, ir);
+    }
+    return ir;
+}
+
 static void ir_open_i(FrtStore *store, FindSegmentsFile *fsf, FrtIndexReader *ir) {
     volatile bool success = false;
     FrtSegmentInfos *volatile sis = NULL;
     FRT_TRY
     do {
-        FrtFieldInfos *fis;
         frt_mutex_lock(&store->mutex);
         frt_sis_read_i(store, fsf, NULL);
         sis = fsf->ret.sis;
-        fis = sis->fis;
-        if (sis->size == 1) {
-            ir = sr_open(sis, fis, 0, true, (FrtSegmentReader *)ir);
-        }  else {
-            volatile int i;
-            FrtIndexReader **readers = FRT_ALLOC_AND_ZERO_N(FrtIndexReader *, sis->size);
-            int num_segments = sis->size;
-            FRT_TRY
-                for (i = num_segments - 1; i >= 0; i--) {
-                    readers[i] = sr_open(sis, fis, i, false, NULL);
-                    FRT_DEREF(readers[i]);
-                }
-            FRT_XCATCHALL
-                for (i++; i < num_segments; i++) {
-                    if (readers[i]) {
-                        FRT_REF(readers[i]);
-                        frt_ir_close(readers[i]);
-                    }
-                }
-                free(readers);
-            FRT_XENDTRY
-            ir = frt_mr_open_i(store, sis, fis, readers, sis->size, ir);
-        }
+        ir = ir_open_sis(store, sis, ir);
         fsf->ret.ir = ir;
         success = true;
     } while (0);
@@ -4930,30 +7309,187 @@ FrtIndexReader *frt_ir_open(FrtIndexReader *ir, FrtStore *store) {
     return fsf.ret.ir;
 }
 
-/****************************************************************************
- *
- * Occurence
- *
- ****************************************************************************/
-
-static FrtOccurence *occ_new(FrtMemoryPool *mp, int pos)
+static bool si_is_unchanged(FrtSegmentInfo *si, FrtSegmentInfo *other)
 {
-    FrtOccurence *occ = FRT_MP_ALLOC(mp, FrtOccurence);
-    occ->pos = pos;
-    occ->next = NULL;
-    return occ;
+    return si->store == other->store
+        && si->doc_cnt == other->doc_cnt
+        && si->del_gen == other->del_gen
+        && si->use_compound_file == other->use_compound_file
+        && si->norm_gens_size == other->norm_gens_size
+        && (0 == si->norm_gens_size
+            || 0 == memcmp(si->norm_gens, other->norm_gens, si->norm_gens_size * sizeof(int)))
+        && 0 == strcmp(si->name, other->name);
 }
 
-/****************************************************************************
- *
- * Posting
- *
- ****************************************************************************/
+/* find the SegmentReader of old_ir which reads exactly the segment si */
+static FrtIndexReader *ir_find_unchanged_sr(FrtIndexReader *old_ir, FrtSegmentInfo *si)
+{
+    int i;
+    if (FRT_MULTI_READER == old_ir->type) {
+        for (i = MR(old_ir)->r_cnt - 1; i >= 0; i--) {
+            FrtIndexReader *reader = MR(old_ir)->sub_readers[i];
+            if (FRT_SEGMENT_READER == reader->type
+                && si_is_unchanged(SR(reader)->si, si)) {
+                return reader;
+            }
+        }
+    }
+    /* a single SegmentReader owns the SegmentInfos so it can't be shared */
+    return NULL;
+}
 
-FrtPosting *frt_p_new(FrtMemoryPool *mp, int doc_num, int pos)
+/* open a reader on the segments in sis sharing the SegmentReaders of the
+ * segments which haven't changed with old_ir. The reader takes ownership
+ * of sis */
+static FrtIndexReader *ir_reopen_sis(FrtStore *store, FrtSegmentInfos *sis, FrtIndexReader *old_ir)
 {
-    FrtPosting *p = FRT_MP_ALLOC(mp, FrtPosting);
-    p->doc_num = doc_num;
+    volatile int i;
+    FrtFieldInfos *fis = sis->fis;
+    const int num_segments = sis->size;
+    FrtIndexReader **readers = FRT_ALLOC_AND_ZERO_N(FrtIndexReader *, num_segments);
+    FRT_TRY
+        for (i = num_segments - 1; i >= 0; i--) {
+            if (NULL == ir_find_unchanged_sr(old_ir, sis->segs[i])) {
+                readers[i] = sr_open(sis, fis, i, false, NULL);
+                FRT_DEREF(readers[i]);
+            }
+        }
+    FRT_XCATCHALL
+        for (i++; i < num_segments; i++) {
+            if (readers[i]) {
+                FRT_REF(readers[i]);
+                frt_ir_close(readers[i]);
+            }
+        }
+        free(readers);
+    FRT_XENDTRY
+    /* nothing can fail from here on so the unchanged readers can be shared.
+     * The new SegmentInfos gets their SegmentInfo, that way deletions
+     * committed through either reader end up in both SegmentInfos */
+    for (i = 0; i < num_segments; i++) {
+        if (NULL == readers[i]) {
+            FrtIndexReader *reader = ir_find_unchanged_sr(old_ir, sis->segs[i]);
+            FRT_REF(SR(reader)->si);
+            frt_si_close(sis->segs[i]);
+            sis->segs[i] = SR(reader)->si;
+            readers[i] = sr_open_shared(SR(reader), sis, fis);
+            FRT_DEREF(readers[i]);
+        }
+    }
+    return frt_mr_open_i(store, sis, fis, readers, num_segments, NULL);
+}
+
+static void ir_reopen_i(FrtStore *store, FindSegmentsFile *fsf, FrtIndexReader *old_ir) {
+    volatile bool success = false;
+    FrtSegmentInfos *volatile sis = NULL;
+    FRT_TRY
+        frt_mutex_lock(&store->mutex);
+        frt_sis_read_i(store, fsf, NULL);
+        sis = fsf->ret.sis;
+        fsf->ret.ir = ir_reopen_sis(store, sis, old_ir);
+        success = true;
+    FRT_XFINALLY
+        if (!success && sis) {
+            frt_sis_destroy(sis);
+        }
+        frt_mutex_unlock(&store->mutex);
+    FRT_XENDTRY
+}
+
+/* Attach +sc+ to +ir+ and all of its segments, replacing the cache attached
+ * before. NULL detaches it. Readers returned by frt_ir_reopen keep the cache
+ * of the reader they were reopened from */
+void frt_ir_set_stored_cache(FrtIndexReader *ir, FrtStoredCache *sc)
+{
+    frt_mutex_lock(&ir->mutex);
+    if (sc) FRT_REF(sc);
+    if (ir->stored_cache) frt_sc_deref(ir->stored_cache);
+    ir->stored_cache = sc;
+    if (FRT_SEGMENT_READER == ir->type) {
+        frt_fr_set_stored_cache(SR(ir)->fr, sc);
+    }
+    frt_mutex_unlock(&ir->mutex);
+    if (FRT_MULTI_READER == ir->type) {
+        int i;
+        for (i = 0; i < MR(ir)->r_cnt; i++) {
+            frt_ir_set_stored_cache(MR(ir)->sub_readers[i], sc);
+        }
+    }
+}
+
+/**
+ * Reopen the reader if the index has changed since it was opened. Returns
+ * +ir+ itself if it is still the latest version. Otherwise a new reader is
+ * returned which shares the SegmentReaders of all unchanged segments with
+ * +ir+ so that only new and changed segments need to be read. Uncommitted
+ * changes of +ir+ are committed first. +ir+ must still be closed when a new
+ * reader is returned.
+ */
+FrtIndexReader *frt_ir_reopen(FrtIndexReader *ir)
+{
+    FrtIndexReader *new_ir;
+    frt_ir_commit(ir);
+    if (frt_ir_is_latest(ir)) {
+        return ir;
+    }
+    if (NULL == ir->sis) {
+        /* a MultiReader on several indexes, reopen each one of them */
+        volatile int i;
+        const int r_cnt = MR(ir)->r_cnt;
+        FrtIndexReader **readers = FRT_ALLOC_AND_ZERO_N(FrtIndexReader *, r_cnt);
+        FRT_TRY
+            for (i = 0; i < r_cnt; i++) {
+                FrtIndexReader *reader = MR(ir)->sub_readers[i];
+                readers[i] = frt_ir_reopen(reader);
+                if (readers[i] != reader) {
+                    FRT_DEREF(readers[i]);
+                }
+            }
+        FRT_XCATCHALL
+            for (i--; i >= 0; i--) {
+                if (readers[i] != MR(ir)->sub_readers[i]) {
+                    FRT_REF(readers[i]);
+                    frt_ir_close(readers[i]);
+                }
+            }
+            free(readers);
+        FRT_XENDTRY
+        new_ir = frt_mr_open(NULL, readers, r_cnt);
+    } else {
+        FindSegmentsFile fsf;
+        sis_find_segments_file(ir->store, &fsf, &ir_reopen_i, ir);
+        new_ir = fsf.ret.ir;
+    }
+    if (ir->stored_cache) {
+        frt_ir_set_stored_cache(new_ir, ir->stored_cache);
+    }
+    return new_ir;
+}
+
+/****************************************************************************
+ *
+ * Occurence
+ *
+ ****************************************************************************/
+
+static FrtOccurence *occ_new(FrtMemoryPool *mp, int pos)
+{
+    FrtOccurence *occ = FRT_MP_ALLOC(mp, FrtOccurence);
+    occ->pos = pos;
+    occ->next = NULL;
+    return occ;
+}
+
+/****************************************************************************
+ *
+ * Posting
+ *
+ ****************************************************************************/
+
+FrtPosting *frt_p_new(FrtMemoryPool *mp, int doc_num, int pos)
+{
+    FrtPosting *p = FRT_MP_ALLOC(mp, FrtPosting);
+    p->doc_num = doc_num;
     p->first_occ = occ_new(mp, pos);
     p->freq = 1;
     p->next = NULL;
@@ -5032,72 +7568,295 @@ static void fld_inv_destroy(FrtFieldInverter *fld_inv)
 
 typedef struct SkipBuffer
 {
-    FrtOutStream *buf;
+    FrtOutStream *bufs[FRT_MAX_SKIP_LEVELS];
     FrtOutStream *frq_out;
     FrtOutStream *prx_out;
-    int last_doc;
-    frt_off_t last_frq_ptr;
-    frt_off_t last_prx_ptr;
+    int num_levels;
+    int entry_cnt;
+    frt_off_t term_frq_ptr;
+    frt_off_t term_prx_ptr;
+    int last_doc[FRT_MAX_SKIP_LEVELS];
+    frt_off_t last_frq_ptr[FRT_MAX_SKIP_LEVELS];
+    frt_off_t last_prx_ptr[FRT_MAX_SKIP_LEVELS];
 } SkipBuffer;
 
 static void skip_buf_reset(SkipBuffer *skip_buf)
 {
-    frt_ramo_reset(skip_buf->buf);
-    skip_buf->last_doc = 0;
-    skip_buf->last_frq_ptr = frt_os_pos(skip_buf->frq_out);
-    skip_buf->last_prx_ptr = frt_os_pos(skip_buf->prx_out);
+    int i;
+    for (i = 0; i < skip_buf->num_levels; i++) {
+        frt_ramo_reset(skip_buf->bufs[i]);
+    }
+    skip_buf->num_levels = 0;
+    skip_buf->entry_cnt = 0;
+    skip_buf->term_frq_ptr = frt_os_pos(skip_buf->frq_out);
+    skip_buf->term_prx_ptr = frt_os_pos(skip_buf->prx_out);
 }
 
 static SkipBuffer *skip_buf_new(FrtOutStream *frq_out, FrtOutStream *prx_out)
 {
-    SkipBuffer *skip_buf = FRT_ALLOC(SkipBuffer);
-    skip_buf->buf = frt_ram_new_buffer();
+    SkipBuffer *skip_buf = FRT_ALLOC_AND_ZERO(SkipBuffer);
     skip_buf->frq_out = frq_out;
     skip_buf->prx_out = prx_out;
     return skip_buf;
 }
 
-static void skip_buf_add(SkipBuffer *skip_buf, int doc)
+/* add a skip entry to level 0, and to every level above it that is due an
+ * entry, pointing at the next document to be written. +max_freq+ is the
+ * highest freq of the documents since the last entry. See
+ * stde_multi_level_skip_to for how the levels are read */
+static void skip_buf_add(SkipBuffer *skip_buf, int doc, int max_freq)
 {
     frt_off_t frq_ptr = frt_os_pos(skip_buf->frq_out);
     frt_off_t prx_ptr = frt_os_pos(skip_buf->prx_out);
+    frt_off_t child_ptr = 0;
+    int n = ++skip_buf->entry_cnt;
+    int level;
+
+    for (level = 0; level < FRT_MAX_SKIP_LEVELS; level++) {
+        FrtOutStream *buf;
+        frt_off_t entry_end;
+        if (level == skip_buf->num_levels) {
+            if (NULL == skip_buf->bufs[level]) {
+                skip_buf->bufs[level] = frt_ram_new_buffer();
+            }
+            skip_buf->last_doc[level] = 0;
+            skip_buf->last_frq_ptr[level] = skip_buf->term_frq_ptr;
+            skip_buf->last_prx_ptr[level] = skip_buf->term_prx_ptr;
+            skip_buf->num_levels++;
+        }
+        buf = skip_buf->bufs[level];
+
+        frt_os_write_vint(buf, doc - skip_buf->last_doc[level]);
+        frt_os_write_vint(buf, frq_ptr - skip_buf->last_frq_ptr[level]);
+        frt_os_write_vint(buf, prx_ptr - skip_buf->last_prx_ptr[level]);
+        if (level == 0) {
+            frt_os_write_vint(buf, max_freq);
+        }
+        entry_end = frt_os_pos(buf);
+        if (level > 0) {
+            frt_os_write_voff_t(buf, child_ptr);
+        }
+        child_ptr = entry_end;
 
-    frt_os_write_vint(skip_buf->buf, doc - skip_buf->last_doc);
-    frt_os_write_vint(skip_buf->buf, frq_ptr - skip_buf->last_frq_ptr);
-    frt_os_write_vint(skip_buf->buf, prx_ptr - skip_buf->last_prx_ptr);
+        skip_buf->last_doc[level] = doc;
+        skip_buf->last_frq_ptr[level] = frq_ptr;
+        skip_buf->last_prx_ptr[level] = prx_ptr;
 
-    skip_buf->last_doc = doc;
-    skip_buf->last_frq_ptr = frq_ptr;
-    skip_buf->last_prx_ptr = prx_ptr;
+        if (0 != (n % FRT_SKIP_MULTIPLIER)) {
+            break;
+        }
+        n /= FRT_SKIP_MULTIPLIER;
+    }
 }
 
-static frt_off_t skip_buf_write(SkipBuffer *skip_buf)
+/* write the skip data of the term, if it has any, starting with the highest
+ * freq of its documents */
+static frt_off_t skip_buf_write(SkipBuffer *skip_buf, int max_freq)
 {
-  frt_off_t skip_ptr = frt_os_pos(skip_buf->frq_out);
-  frt_ramo_write_to(skip_buf->buf, skip_buf->frq_out);
-  return skip_ptr;
+    frt_off_t skip_ptr = frt_os_pos(skip_buf->frq_out);
+    int i;
+    if (skip_buf->num_levels > 0) {
+        frt_os_write_vint(skip_buf->frq_out, max_freq);
+    }
+    for (i = skip_buf->num_levels - 1; i >= 0; i--) {
+        if (i > 0) {
+            frt_os_write_voff_t(skip_buf->frq_out, frt_os_pos(skip_buf->bufs[i]));
+        }
+        frt_ramo_write_to(skip_buf->bufs[i], skip_buf->frq_out);
+    }
+    return skip_ptr;
 }
 
 static void skip_buf_destroy(SkipBuffer *skip_buf)
 {
-    frt_ram_destroy_buffer(skip_buf->buf);
+    int i;
+    for (i = 0; i < FRT_MAX_SKIP_LEVELS; i++) {
+        if (NULL != skip_buf->bufs[i]) {
+            frt_ram_destroy_buffer(skip_buf->bufs[i]);
+        }
+    }
     free(skip_buf);
 }
 
+/****************************************************************************
+ *
+ * PostingsWriter
+ *
+ * Writes the documents and frequencies of each term to the .frq file and its
+ * positions to the .prx file in the segment's postings format, adding the
+ * skip entries as it goes.
+ *
+ ****************************************************************************/
+
+typedef struct PostingsWriter
+{
+    FrtOutStream *frq_out;
+    FrtOutStream *prx_out;
+    SkipBuffer *skip_buf;
+    FrtPostingsFormat postings_format;
+    int skip_interval;
+    int doc_freq;
+    int last_doc;
+    int max_freq;
+    int skip_max_freq;          /* highest freq since the last skip entry */
+    int block_size;
+    int block_deltas[FRT_POSTINGS_BLOCK_SIZE];
+    int block_freqs[FRT_POSTINGS_BLOCK_SIZE];
+    int prx_size;
+    int prx_deltas[FRT_POSTINGS_BLOCK_SIZE];
+} PostingsWriter;
+
+/* with block postings skip entries can only point at the start of a block */
+static int pw_skip_interval(FrtPostingsFormat postings_format, int skip_interval)
+{
+    return FRT_POSTINGS_FORMAT_BLOCK == postings_format
+        ? FRT_POSTINGS_BLOCK_SIZE : skip_interval;
+}
+
+static PostingsWriter *pw_new(FrtOutStream *frq_out, FrtOutStream *prx_out,
+                              FrtPostingsFormat postings_format,
+                              int skip_interval)
+{
+    PostingsWriter *pw = FRT_ALLOC(PostingsWriter);
+    pw->frq_out = frq_out;
+    pw->prx_out = prx_out;
+    pw->skip_buf = skip_buf_new(frq_out, prx_out);
+    pw->postings_format = postings_format;
+    pw->skip_interval = skip_interval;
+    return pw;
+}
+
+static void pw_start_term(PostingsWriter *pw)
+{
+    pw->doc_freq = 0;
+    pw->last_doc = 0;
+    pw->max_freq = 0;
+    pw->skip_max_freq = 0;
+    pw->block_size = 0;
+    pw->prx_size = 0;
+    skip_buf_reset(pw->skip_buf);
+}
+
+static void pw_write_doc_code(FrtOutStream *frq_out, int doc_delta, int freq)
+{
+    const int doc_code = doc_delta << 1;    /* use low bit to flag freq=1 */
+    if (freq == 1) {
+        frt_os_write_vint(frq_out, doc_code | 1); /* doc & freq=1 */
+    }
+    else {
+        frt_os_write_vint(frq_out, doc_code);     /* write doc */
+        frt_os_write_vint(frq_out, freq);         /* write freqency in doc */
+    }
+}
+
+/* write the position deltas of the last block of documents which didn't
+ * fill a block of their own */
+static void pw_flush_positions(PostingsWriter *pw)
+{
+    int i;
+    for (i = 0; i < pw->prx_size; i++) {
+        frt_os_write_vint(pw->prx_out, pw->prx_deltas[i]);
+    }
+    pw->prx_size = 0;
+}
+
+/* add a document to the current term. This must be called before the
+ * document's positions are added with pw_add_position */
+static void pw_add(PostingsWriter *pw, int doc, int freq)
+{
+    pw->doc_freq++;
+    /* a skip entry after every skip_interval documents. Block postings have
+     * a skip_interval of FRT_POSTINGS_BLOCK_SIZE so this is where a new
+     * block starts, and with it a new block of positions */
+    if (pw->doc_freq > 1 && 0 == ((pw->doc_freq - 1) % pw->skip_interval)) {
+        pw_flush_positions(pw);
+        skip_buf_add(pw->skip_buf, pw->last_doc, pw->skip_max_freq);
+        pw->skip_max_freq = 0;
+    }
+    if (freq > pw->skip_max_freq) {
+        pw->skip_max_freq = freq;
+        if (freq > pw->max_freq) pw->max_freq = freq;
+    }
+    if (FRT_POSTINGS_FORMAT_BLOCK == pw->postings_format) {
+        pw->block_deltas[pw->block_size] = doc - pw->last_doc;
+        pw->block_freqs[pw->block_size] = freq - 1;
+        pw->last_doc = doc;
+        if (++pw->block_size == FRT_POSTINGS_BLOCK_SIZE) {
+            block_write(pw->frq_out, pw->block_deltas);
+            block_write(pw->frq_out, pw->block_freqs);
+            pw->block_size = 0;
+        }
+    } else {
+        pw_write_doc_code(pw->frq_out, doc - pw->last_doc, freq);
+        pw->last_doc = doc;
+    }
+}
+
+/* add the next position delta of the current document */
+static void pw_add_position(PostingsWriter *pw, int delta)
+{
+    if (FRT_POSTINGS_FORMAT_BLOCK == pw->postings_format) {
+        pw->prx_deltas[pw->prx_size] = delta;
+        if (++pw->prx_size == FRT_POSTINGS_BLOCK_SIZE) {
+            block_write(pw->prx_out, pw->prx_deltas);
+            pw->prx_size = 0;
+        }
+    } else {
+        frt_os_write_vint(pw->prx_out, delta);
+    }
+}
+
+/* finish off the current term and return the pointer to its skip data */
+static frt_off_t pw_finish_term(PostingsWriter *pw)
+{
+    int i;
+    for (i = 0; i < pw->block_size; i++) {
+        pw_write_doc_code(pw->frq_out, pw->block_deltas[i],
+                          pw->block_freqs[i] + 1);
+    }
+    pw->block_size = 0;
+    pw_flush_positions(pw);
+    return skip_buf_write(pw->skip_buf, pw->max_freq);
+}
+
+static void pw_destroy(PostingsWriter *pw)
+{
+    skip_buf_destroy(pw->skip_buf);
+    free(pw);
+}
+
 /****************************************************************************
  *
  * FrtDocWriter
  *
  ****************************************************************************/
 
-static void dw_write_norms(FrtDocWriter *dw, FrtFieldInverter *fld_inv)
+static void fields_copy_doc(FrtInStream *fdt_in, FrtInStream *fdx_in,
+                            FrtStoredBlockReader *sbr, int doc, int max_doc,
+                            FrtOutStream *fdt_out, FrtOutStream *fdx_out,
+                            FrtStoredBlockWriter *sbw);
+
+/* write the norms of the buffered documents, moving each to its place in
+ * the segment given by +doc_map+ if it isn't NULL */
+static void dw_write_norms(FrtDocWriter *dw, FrtFieldInverter *fld_inv,
+                           const int *doc_map)
 {
     char file_name[FRT_SEGMENT_NAME_MAX_LENGTH];
     FrtOutStream *norms_out;
     frt_si_advance_norm_gen(dw->si, fld_inv->fi->number);
     si_norm_file_name(dw->si, file_name, fld_inv->fi->number);
     norms_out = dw->store->new_output(dw->store, file_name);
-    frt_os_write_bytes(norms_out, fld_inv->norms, dw->doc_num);
+    if (doc_map) {
+        frt_uchar *norms = FRT_ALLOC_N(frt_uchar, dw->doc_num);
+        int i;
+        for (i = 0; i < dw->doc_num; i++) {
+            norms[doc_map[i]] = fld_inv->norms[i];
+        }
+        frt_os_write_bytes(norms_out, norms, dw->doc_num);
+        free(norms);
+    } else {
+        frt_os_write_bytes(norms_out, fld_inv->norms, dw->doc_num);
+    }
     frt_os_close(norms_out);
 }
 
@@ -5125,149 +7884,446 @@ static FrtPostingList **dw_sort_postings(FrtHash *plists_ht)
 static void dw_flush_streams(FrtDocWriter *dw)
 {
     frt_mp_reset(dw->mp);
-    frt_fw_close(dw->fw);
-    dw->fw = NULL;
+    if (dw->fw) {
+        frt_fw_close(dw->fw);
+        dw->fw = NULL;
+    }
     frt_h_clear(dw->fields);
-    dw->doc_num = 0;
 }
 
-static void dw_flush(FrtDocWriter *dw)
+/*
+ * With an index sort the documents are written to the segment in sort order
+ * rather than in the order they are added. The postings and norms are held
+ * in memory until the segment is flushed but the stored fields are written
+ * as each document is added, so they go to scratch files named after the
+ * segment and are copied into the segment in sort order by dw_sort_docs.
+ */
+static FrtFieldsWriter *dw_fw_open(FrtDocWriter *dw, FrtSegmentInfo *si)
 {
-    int i, j, last_doc, doc_code, doc_freq, last_pos, posting_count;
-    int skip_interval = dw->skip_interval;
-    FrtFieldInfos *fis = dw->fis;
-    const int fields_count = fis->size;
-    FrtFieldInverter *fld_inv;
-    FrtFieldInfo *fi;
-    FrtPostingList **pls, *pl;
-    FrtPosting *p;
-    FrtOccurence *occ;
-    FrtStore *store = dw->store;
-    FrtTermInfosWriter *tiw = frt_tiw_open(store, dw->si->name, dw->index_interval, skip_interval);
-    FrtTermInfo ti;
-    char file_name[FRT_SEGMENT_NAME_MAX_LENGTH];
-    FrtOutStream *frq_out, *prx_out;
-    SkipBuffer *skip_buf;
-
-    sprintf(file_name, "%s.frq", dw->si->name);
-    frq_out = store->new_output(store, file_name);
-    sprintf(file_name, "%s.prx", dw->si->name);
-    prx_out = store->new_output(store, file_name);
-    skip_buf = skip_buf_new(frq_out, prx_out);
-
-    for (i = 0; i < fields_count; i++) {
-        fi = fis->fields[i];
-        if (!bits_is_indexed(fi->bits) || NULL ==
-            (fld_inv = (FrtFieldInverter*)frt_h_get_int(dw->fields, fi->number))) {
-            continue;
-        }
-        if (!bits_omit_norms(fi->bits)) {
-            dw_write_norms(dw, fld_inv);
-        }
-
-        pls = dw_sort_postings(fld_inv->plists);
-        frt_tiw_start_field(tiw, fi->number);
-        posting_count = fld_inv->plists->size;
-        for (j = 0; j < posting_count; j++) {
-            pl = pls[j];
-            ti.frq_ptr = frt_os_pos(frq_out);
-            ti.prx_ptr = frt_os_pos(prx_out);
-            last_doc = 0;
-            doc_freq = 0;
-            skip_buf_reset(skip_buf);
-            for (p = pl->first; NULL != p; p = p->next) {
-                doc_freq++;
-                if (0 == (doc_freq % dw->skip_interval)) {
-                    skip_buf_add(skip_buf, last_doc);
-                }
-
-                doc_code = (p->doc_num - last_doc) << 1;
-                last_doc = p->doc_num;
-
-                if (p->freq == 1) {
-                    frt_os_write_vint(frq_out, 1|doc_code);
-                }
-                else {
-                    frt_os_write_vint(frq_out, doc_code);
-                    frt_os_write_vint(frq_out, p->freq);
-                }
-
-                last_pos = 0;
-                for (occ = p->first_occ; NULL != occ; occ = occ->next) {
-                    frt_os_write_vint(prx_out, occ->pos - last_pos);
-                    last_pos = occ->pos;
-                }
-            }
-            ti.skip_offset = skip_buf_write(skip_buf) - ti.frq_ptr;
-            ti.doc_freq = doc_freq;
-            frt_tiw_add(tiw, pl->term, pl->term_len, &ti);
-        }
+    char segment[FRT_SEGMENT_NAME_MAX_LENGTH];
+    if (NULL == dw->index_sort) {
+        return frt_fw_open(dw->store, si->name, dw->fis,
+                           si->stored_fields_format);
     }
-    frt_os_close(prx_out);
-    frt_os_close(frq_out);
-    frt_tiw_close(tiw);
-    skip_buf_destroy(skip_buf);
-    dw_flush_streams(dw);
+    sprintf(segment, "%s_u", si->name);
+    return frt_fw_open(dw->store, segment, dw->fis, si->stored_fields_format);
 }
 
-FrtDocWriter *frt_dw_open(FrtIndexWriter *iw, FrtSegmentInfo *si)
+static char *dw_scratch_file_name(FrtDocWriter *dw, char *buf, const char *ext)
 {
-    FrtStore *store = iw->store;
-    FrtMemoryPool *mp = frt_mp_new_capa(iw->config.chunk_size,
-        iw->config.max_buffer_memory/iw->config.chunk_size);
-
-    FrtDocWriter *dw = FRT_ALLOC(FrtDocWriter);
-
-    dw->mp          = mp;
-    dw->analyzer    = iw->analyzer;
-    dw->fis         = iw->fis;
-    dw->store       = store;
-    FRT_REF(store);
-    dw->fw          = frt_fw_open(store, si->name, iw->fis);
-    dw->si          = si;
-
-    dw->curr_plists = frt_h_new_str(NULL, NULL);
-    dw->fields      = frt_h_new_int((frt_free_ft)fld_inv_destroy);
-    dw->doc_num     = 0;
-
-    dw->index_interval      = iw->config.index_interval;
-    dw->skip_interval       = iw->config.skip_interval;
-    dw->max_field_length    = iw->config.max_field_length;
-    dw->max_buffered_docs   = iw->config.max_buffered_docs;
+    sprintf(buf, "%s_u.%s", dw->si->name, ext);
+    return buf;
+}
 
-    dw->offsets             = FRT_ALLOC_AND_ZERO_N(FrtOffset, DW_OFFSET_INIT_CAPA);
-    dw->offsets_size        = 0;
-    dw->offsets_capa        = DW_OFFSET_INIT_CAPA;
+/* a FrtTermDocEnum over the buffered postings of a term, only good for
+ * FrtFieldIndexClass#handle_term which just calls next and doc_num */
+typedef struct PostingsDocEnum {
+    FrtTermDocEnum tde;
+    FrtPosting *next;
+    int doc_num;
+} PostingsDocEnum;
 
-    dw->similarity          = iw->similarity;
-    return dw;
+static bool pde_next(FrtTermDocEnum *tde)
+{
+    PostingsDocEnum *pde = (PostingsDocEnum *)tde;
+    if (NULL == pde->next) {
+        return false;
+    }
+    pde->doc_num = pde->next->doc_num;
+    pde->next = pde->next->next;
+    return true;
 }
 
-void frt_dw_new_segment(FrtDocWriter *dw, FrtSegmentInfo *si)
+static int pde_doc_num(FrtTermDocEnum *tde)
 {
-    dw->fw = frt_fw_open(dw->store, si->name, dw->fis);
-    dw->si = si;
+    return ((PostingsDocEnum *)tde)->doc_num;
 }
 
-void frt_dw_close(FrtDocWriter *dw)
+static void dw_field_index_destroy(FrtFieldIndex *field_index)
 {
-    if (dw->doc_num) {
-        dw_flush(dw);
+    if (field_index->index) {
+        field_index->klass->destroy_index(field_index->index);
     }
-    if (dw->fw) {
-        frt_fw_close(dw->fw);
+    if (field_index->dv_index) {
+        dv_destroy(field_index->dv_index->dvs[0]);
+        free(field_index->dv_index->dvs);
+        free(field_index->dv_index->starts);
+        free(field_index->dv_index);
     }
-    frt_store_close(dw->store);
-    frt_h_destroy(dw->curr_plists);
-    frt_h_destroy(dw->fields);
-    frt_mp_destroy(dw->mp);
-    free(dw->offsets);
-    free(dw);
+    free(field_index);
 }
 
-FrtFieldInverter *frt_dw_get_fld_inv(FrtDocWriter *dw, FrtFieldInfo *fi)
+/*
+ * The field index of sort field +sf+ over the buffered documents, NULL if
+ * the field isn't known yet. Like frt_field_index_get does for a segment it
+ * is read from the field's doc values in +dvd_in+ if it has them or else
+ * built from the field's postings, +field_pls+ holding the sorted postings of
+ * each field. The index sort only holds fields with a fixed type, see
+ * index_sort_clone.
+ */
+static FrtFieldIndex *dw_get_field_index(FrtDocWriter *dw, FrtSortField *sf,
+                                         FrtPostingList ***field_pls,
+                                         FrtInStream *dvd_in)
 {
-    FrtFieldInverter *fld_inv = (FrtFieldInverter*)frt_h_get_int(dw->fields, fi->number);
+    FrtFieldInfo *fi = frt_fis_get_field(dw->fis, sf->field);
+    FrtFieldInverter *fld_inv;
+    FrtFieldIndex *self;
+    FrtDocValues *dv = NULL;
+    FrtPostingList **pls;
+    int i, pl_cnt = 0;
+
+    if (NULL == fi) {
+        return NULL;
+    }
+    pls = field_pls[fi->number];
+    if (pls && NULL != (fld_inv = (FrtFieldInverter *)
+                        frt_h_get_int(dw->fields, fi->number))) {
+        pl_cnt = fld_inv->plists->size;
+    }
+
+    self = FRT_ALLOC_AND_ZERO(FrtFieldIndex);
+    self->field = sf->field;
+    self->klass = sf->field_index_class;
+    if (self->klass->uses_doc_values && bits_doc_values_type(fi->bits)
+        && NULL != (dv = dv_read(dvd_in, fi->number))
+        && self->klass->uses_doc_values(dv->type)) {
+        FrtDocValuesIndex *dvi = FRT_ALLOC(FrtDocValuesIndex);
+        dvi->size = 1;
+        dvi->starts = FRT_ALLOC_N(int, 2);
+        dvi->starts[0] = 0;
+        dvi->starts[1] = dw->doc_num;
+        dvi->dvs = FRT_ALLOC_N(FrtDocValues *, 1);
+        dvi->dvs[0] = dv;
+        self->dv_index = dvi;
+    } else {
+        PostingsDocEnum pde;
+        memset(&pde, 0, sizeof(PostingsDocEnum));
+        pde.tde.next = &pde_next;
+        pde.tde.doc_num = &pde_doc_num;
+        if (dv) {
+            dv_destroy(dv);
+        }
+        self->index = self->klass->create_index(dw->doc_num);
+        for (i = 0; i < pl_cnt; i++) {
+            pde.next = pls[i]->first;
+            self->klass->handle_term(self->index, &pde.tde, pls[i]->term);
+        }
+    }
+    return self;
+}
+
+/* rewrite the doc values in the scratch file +dvd_in+ in sort order */
+static void dw_sort_doc_values(FrtDocWriter *dw, FrtInStream *dvd_in,
+                               const int *doc_map)
+{
+    FrtDocValuesWriter *dvw = dvw_new();
+    FrtFieldInfos *fis = dw->fis;
+    char file_name[FRT_SEGMENT_NAME_MAX_LENGTH];
+    FrtOutStream *dvd_out;
+    int i, j;
+
+    for (i = 0; i < fis->size; i++) {
+        FrtDocValues *dv;
+        if (!bits_doc_values_type(fis->fields[i]->bits)
+            || NULL == (dv = dv_read(dvd_in, i))) {
+            continue;
+        }
+        for (j = 0; j < dw->doc_num; j++) {
+            dvw_add_dv(dvw, i, dv, j, doc_map[j]);
+        }
+        dv_destroy(dv);
+    }
+    sprintf(file_name, "%s.dvd", dw->si->name);
+    dvd_out = dw->store->new_output(dw->store, file_name);
+    dvw_write(dvw, dvd_out, dw->doc_num);
+    frt_os_close(dvd_out);
+    dvw_destroy(dvw);
+}
+
+/* copy the stored fields from the scratch files in sort order */
+static void dw_sort_fields(FrtDocWriter *dw, const int *sorted_docs)
+{
+    FrtStore *store = dw->store;
+    char *name = dw->si->name;
+    const FrtStoredFieldsFormat format = dw->si->stored_fields_format;
+    char file_name[FRT_SEGMENT_NAME_MAX_LENGTH];
+    FrtInStream *fdt_in, *fdx_in;
+    FrtOutStream *fdt_out, *fdx_out;
+    FrtStoredBlockReader *sbr = NULL;
+    FrtStoredBlockWriter *sbw;
+    int i;
+
+    fdt_in = store->open_input(store, dw_scratch_file_name(dw, file_name, "fdt"));
+    fdx_in = store->open_input(store, dw_scratch_file_name(dw, file_name, "fdx"));
+    if (FRT_STORED_FIELDS_FORMAT_BLOCK == format) {
+        sbr = sbr_open(store, dw_scratch_file_name(dw, file_name, "fdb"));
+    }
+
+    sbw = sbw_open(store, name, format);
+    sprintf(file_name, "%s.fdt", name);
+    fdt_out = store->new_output(store, file_name);
+    frt_os_set_buffer_size(fdt_out, FRT_SEQUENTIAL_BUFFER_SIZE);
+    sprintf(file_name, "%s.fdx", name);
+    fdx_out = store->new_output(store, file_name);
+
+    for (i = 0; i < dw->doc_num; i++) {
+        fields_copy_doc(fdt_in, fdx_in, sbr, sorted_docs[i], dw->doc_num,
+                        fdt_out, fdx_out, sbw);
+    }
+
+    if (sbw) {
+        sbw_close(sbw);
+    }
+    frt_os_close(fdt_out);
+    frt_os_close(fdx_out);
+    if (sbr) {
+        sbr_close(sbr);
+    }
+    frt_is_close(fdt_in);
+    frt_is_close(fdx_in);
+}
+
+static void dw_remove_scratch_files(FrtDocWriter *dw)
+{
+    static const char *extensions[] = { "fdt", "fdx", "fdb", "dvd" };
+    FrtStore *store = dw->store;
+    char file_name[FRT_SEGMENT_NAME_MAX_LENGTH];
+    int i;
+    for (i = 0; i < FRT_NELEMS(extensions); i++) {
+        dw_scratch_file_name(dw, file_name, extensions[i]);
+        if (store->exists(store, file_name)) {
+            store->remove(store, file_name);
+        }
+    }
+}
+
+/*
+ * Work out the order of the buffered documents under the index sort and
+ * write their stored fields and doc values to the segment in that order.
+ * +field_pls+ holds the sorted postings of each field. +doc_map+ is set to
+ * map the number each document was added under to its number in the segment.
+ */
+static void dw_sort_docs(FrtDocWriter *dw, FrtPostingList ***field_pls,
+                         int *doc_map)
+{
+    FrtStore *store = dw->store;
+    FrtSort *index_sort = dw->index_sort;
+    FrtSort *sort = frt_sort_new();
+    FrtFieldIndex **field_indexes = FRT_ALLOC_AND_ZERO_N(FrtFieldIndex *,
+                                                         index_sort->size);
+    FrtInStream *volatile dvd_in = NULL;
+    const int doc_cnt = dw->doc_num;
+    int *sorted_docs = FRT_ALLOC_N(int, doc_cnt);
+    char file_name[FRT_SEGMENT_NAME_MAX_LENGTH];
+    int i;
+
+    frt_fw_close(dw->fw);
+    dw->fw = NULL;
+    for (i = 0; i < doc_cnt; i++) {
+        sorted_docs[i] = i;
+    }
+
+    /* a field which isn't in the index yet is equal for all documents */
+    sort->destroy_all = false;
+    FRT_TRY
+        dvd_in = store->open_input(store, dw_scratch_file_name(dw, file_name, "dvd"));
+        for (i = 0; i < index_sort->size; i++) {
+            FrtSortField *sf = index_sort->sort_fields[i];
+            if (NULL != (field_indexes[sort->size] =
+                         dw_get_field_index(dw, sf, field_pls, dvd_in))) {
+                frt_sort_add_sort_field(sort, sf);
+            }
+        }
+        if (sort->size > 0) {
+            frt_fshq_sort_docs_by(sort, field_indexes, sorted_docs, doc_cnt);
+        }
+        for (i = 0; i < doc_cnt; i++) {
+            doc_map[sorted_docs[i]] = i;
+        }
+        dw_sort_fields(dw, sorted_docs);
+        dw_sort_doc_values(dw, dvd_in, doc_map);
+    FRT_XFINALLY
+        if (dvd_in) frt_is_close(dvd_in);
+        for (i = 0; i < index_sort->size; i++) {
+            if (field_indexes[i]) dw_field_index_destroy(field_indexes[i]);
+        }
+        free(field_indexes);
+        free(sorted_docs);
+        frt_sort_destroy(sort);
+        dw_remove_scratch_files(dw);
+    FRT_XENDTRY
+}
+
+/* add posting +p+ of the current term and its positions */
+static void dw_write_posting(PostingsWriter *pw, FrtPosting *p)
+{
+    FrtOccurence *occ;
+    int last_pos = 0;
+    pw_add(pw, p->doc_num, p->freq);
+    for (occ = p->first_occ; NULL != occ; occ = occ->next) {
+        pw_add_position(pw, occ->pos - last_pos);
+        last_pos = occ->pos;
+    }
+}
+
+static int p_doc_num_cmp(const void *p1, const void *p2)
+{
+    return (*(FrtPosting **)p1)->doc_num - (*(FrtPosting **)p2)->doc_num;
+}
+
+static void dw_flush(FrtDocWriter *dw)
+{
+    int i, j, k, posting_count;
+    FrtPostingsFormat postings_format = dw->si->postings_format;
+    int skip_interval = pw_skip_interval(postings_format, dw->skip_interval);
+    FrtFieldInfos *fis = dw->fis;
+    const int fields_count = fis->size;
+    FrtFieldInverter *fld_inv;
+    FrtFieldInfo *fi;
+    FrtPostingList ***field_pls = FRT_ALLOC_AND_ZERO_N(FrtPostingList **,
+                                                       fields_count);
+    FrtPostingList **pls, *pl;
+    FrtPosting *p;
+    FrtPosting **postings = NULL;
+    int *doc_map = NULL;
+    FrtStore *store = dw->store;
+    FrtTermInfosWriter *tiw;
+    FrtTermInfo ti;
+    char file_name[FRT_SEGMENT_NAME_MAX_LENGTH];
+    FrtOutStream *frq_out, *prx_out;
+    PostingsWriter *pw;
+
+    /* an index sort reads the values of its fields from the sorted postings
+     * so they are all sorted before anything is written */
+    for (i = 0; i < fields_count; i++) {
+        fi = fis->fields[i];
+        if (bits_is_indexed(fi->bits) && NULL !=
+            (fld_inv = (FrtFieldInverter*)frt_h_get_int(dw->fields, fi->number))) {
+            field_pls[fi->number] = dw_sort_postings(fld_inv->plists);
+        }
+    }
+    if (dw->index_sort) {
+        doc_map = FRT_ALLOC_N(int, dw->doc_num);
+        dw_sort_docs(dw, field_pls, doc_map);
+        dw->si->index_sort = index_sort_clone(dw->index_sort);
+        postings = FRT_ALLOC_N(FrtPosting *, dw->doc_num);
+    }
+
+    tiw = frt_tiw_open(store, dw->si->name, dw->index_interval, skip_interval);
+    sprintf(file_name, "%s.frq", dw->si->name);
+    frq_out = store->new_output(store, file_name);
+    frt_os_set_buffer_size(frq_out, FRT_SEQUENTIAL_BUFFER_SIZE);
+    sprintf(file_name, "%s.prx", dw->si->name);
+    prx_out = store->new_output(store, file_name);
+    frt_os_set_buffer_size(prx_out, FRT_SEQUENTIAL_BUFFER_SIZE);
+    pw = pw_new(frq_out, prx_out, postings_format, skip_interval);
+
+    for (i = 0; i < fields_count; i++) {
+        fi = fis->fields[i];
+        if (NULL == (pls = field_pls[fi->number])) {
+            continue;
+        }
+        fld_inv = (FrtFieldInverter*)frt_h_get_int(dw->fields, fi->number);
+        if (!bits_omit_norms(fi->bits)) {
+            dw_write_norms(dw, fld_inv, doc_map);
+        }
+
+        frt_tiw_start_field(tiw, fi->number);
+        posting_count = fld_inv->plists->size;
+        for (j = 0; j < posting_count; j++) {
+            pl = pls[j];
+            ti.frq_ptr = frt_os_pos(frq_out);
+            ti.prx_ptr = frt_os_pos(prx_out);
+            pw_start_term(pw);
+            if (doc_map) {
+                int cnt = 0;
+                for (p = pl->first; NULL != p; p = p->next) {
+                    p->doc_num = doc_map[p->doc_num];
+                    postings[cnt++] = p;
+                }
+                qsort(postings, cnt, sizeof(FrtPosting *), &p_doc_num_cmp);
+                for (k = 0; k < cnt; k++) {
+                    dw_write_posting(pw, postings[k]);
+                }
+            } else {
+                for (p = pl->first; NULL != p; p = p->next) {
+                    dw_write_posting(pw, p);
+                }
+            }
+            ti.skip_offset = pw_finish_term(pw) - ti.frq_ptr;
+            ti.doc_freq = pw->doc_freq;
+            frt_tiw_add(tiw, pl->term, pl->term_len, &ti);
+        }
+    }
+    frt_os_close(prx_out);
+    frt_os_close(frq_out);
+    frt_tiw_close(tiw);
+    pw_destroy(pw);
+    free(postings);
+    free(doc_map);
+    free(field_pls);
+    dw_flush_streams(dw);
+}
+
+FrtDocWriter *frt_dw_open(FrtIndexWriter *iw, FrtSegmentInfo *si)
+{
+    FrtStore *store = iw->store;
+    FrtMemoryPool *mp = frt_mp_new_capa(iw->config.chunk_size,
+        iw->config.max_buffer_memory/iw->config.chunk_size);
+
+    FrtDocWriter *dw = FRT_ALLOC(FrtDocWriter);
+
+    dw->mp          = mp;
+    dw->analyzer    = iw->analyzer;
+    dw->fis         = iw->fis;
+    dw->store       = store;
+    FRT_REF(store);
+    dw->index_sort  = iw->config.index_sort;
+    dw->fw          = dw_fw_open(dw, si);
+    dw->si          = si;
+
+    dw->curr_plists = frt_h_new_str(NULL, NULL);
+    dw->fields      = frt_h_new_int((frt_free_ft)fld_inv_destroy);
+    dw->doc_num     = 0;
+
+    dw->index_interval      = iw->config.index_interval;
+    dw->skip_interval       = iw->config.skip_interval;
+    dw->max_field_length    = iw->config.max_field_length;
+    dw->max_buffered_docs   = iw->config.max_buffered_docs;
+
+    dw->offsets             = FRT_ALLOC_AND_ZERO_N(FrtOffset, DW_OFFSET_INIT_CAPA);
+    dw->offsets_size        = 0;
+    dw->offsets_capa        = DW_OFFSET_INIT_CAPA;
+
+    dw->similarity          = iw->similarity;
+    return dw;
+}
+
+void frt_dw_new_segment(FrtDocWriter *dw, FrtSegmentInfo *si)
+{
+    dw->fw = dw_fw_open(dw, si);
+    dw->si = si;
+}
+
+void frt_dw_close(FrtDocWriter *dw)
+{
+    if (dw->doc_num) {
+        dw_flush(dw);
+    }
+    if (dw->fw) {
+        frt_fw_close(dw->fw);
+    }
+    frt_store_close(dw->store);
+    frt_h_destroy(dw->curr_plists);
+    frt_h_destroy(dw->fields);
+    frt_mp_destroy(dw->mp);
+    free(dw->offsets);
+    free(dw);
+}
+
+FrtFieldInverter *frt_dw_get_fld_inv(FrtDocWriter *dw, FrtFieldInfo *fi)
+{
+    FrtFieldInverter *fld_inv = (FrtFieldInverter*)frt_h_get_int(dw->fields, fi->number);
 
     if (!fld_inv) {
         fld_inv = fld_inv_new(dw, fi);
@@ -5321,6 +8377,23 @@ static void dw_add_offsets(FrtDocWriter *dw, int pos, frt_off_t start, frt_off_t
     dw->offsets_size = pos + 1;
 }
 
+typedef struct DwEconvArgs {
+    rb_encoding *encoding;
+    const unsigned char *sp;
+    const unsigned char *s_end;
+    unsigned char *dp;
+    unsigned char *d_end;
+} DwEconvArgs;
+
+static void *dw_econv_to_utf8_i(void *arg) {
+    DwEconvArgs *ea = (DwEconvArgs *)arg;
+    rb_econv_t *ec = rb_econv_open(rb_enc_name(ea->encoding), "UTF-8", RUBY_ECONV_INVALID_REPLACE);
+    assert(ec != NULL);
+    rb_econv_convert(ec, &ea->sp, ea->s_end, &ea->dp, ea->d_end, 0);
+    rb_econv_close(ec);
+    return NULL;
+}
+
 FrtHash *frt_dw_invert_field(FrtDocWriter *dw, FrtFieldInverter *fld_inv, FrtDocField *df) {
     FrtMemoryPool *mp = dw->mp;
     FrtAnalyzer *a = dw->analyzer;
@@ -5380,13 +8453,15 @@ FrtHash *frt_dw_invert_field(FrtDocWriter *dw, FrtFieldInverter *fld_inv, FrtDoc
                 data_ptr = (char *)memcpy(buf, df->data[i], len);
                 buf[len] = '\0';
             } else if (df->encodings[i] != utf8_encoding) {
-                const unsigned char *sp = (unsigned char *)df->data[i];
-                unsigned char *dp = (unsigned char *)&buf;
-                rb_econv_t *ec = rb_econv_open(rb_enc_name(df->encodings[i]), "UTF-8", RUBY_ECONV_INVALID_REPLACE);
-                assert(ec != NULL);
-                rb_econv_convert(ec, &sp, (unsigned char *)df->data[i] + len, &dp, (unsigned char *)&buf + FRT_MAX_WORD_SIZE - 1, 0);
-                rb_econv_close(ec);
-                len = dp - (unsigned char *)&buf;
+                DwEconvArgs ea;
+                ea.encoding = df->encodings[i];
+                ea.sp = (unsigned char *)df->data[i];
+                ea.s_end = (unsigned char *)df->data[i] + len;
+                ea.dp = (unsigned char *)&buf;
+                ea.d_end = (unsigned char *)&buf + FRT_MAX_WORD_SIZE - 1;
+                /* the converter may have to be loaded by ruby */
+                frt_thread_call_with_gvl(&dw_econv_to_utf8_i, &ea);
+                len = ea.dp - (unsigned char *)&buf;
                 buf[len] = '\0';
                 data_ptr = buf;
             }
@@ -5536,12 +8611,16 @@ static void smi_load_term_input(SegmentMergeInfo *smi)
     FrtInStream *is = store->open_input(store, file_name);
     FRT_DEREF(is);
     smi->te = TE(frt_ste_new(is, smi->sfi));
+    /* merges read the postings from front to back */
     sprintf(file_name, "%s.frq", segment);
     smi->frq_in = store->open_input(store, file_name);
+    frt_is_set_buffer_size(smi->frq_in, FRT_SEQUENTIAL_BUFFER_SIZE);
     sprintf(file_name, "%s.prx", segment);
     smi->prx_in = store->open_input(store, file_name);
+    frt_is_set_buffer_size(smi->prx_in, FRT_SEQUENTIAL_BUFFER_SIZE);
     smi->tde = frt_stpe_new(NULL, smi->frq_in, smi->prx_in, smi->deleted_docs,
-                        STE(smi->te)->skip_interval);
+                        STE(smi->te)->skip_interval, smi->si->postings_format,
+                        smi->si->multi_level_skips, smi->si->skip_impacts);
 }
 
 static void smi_close_term_input(SegmentMergeInfo *smi)
@@ -5561,8 +8640,8 @@ static void smi_destroy(SegmentMergeInfo *smi)
     frt_store_close(smi->orig_store);
     if (smi->deleted_docs) {
         frt_bv_destroy(smi->deleted_docs);
-        free(smi->doc_map);
     }
+    free(smi->doc_map);
     free(smi);
 }
 
@@ -5575,6 +8654,13 @@ static char *smi_next(SegmentMergeInfo *smi)
  * SegmentMerger
  ****************************************************************************/
 
+/* a document of a term being merged into a sorted segment */
+typedef struct SortedPosting {
+    int doc;
+    int freq;
+    int prx_start;
+} SortedPosting;
+
 typedef struct SegmentMerger {
     FrtTermInfo ti;
     FrtStore *store;
@@ -5589,11 +8675,52 @@ typedef struct SegmentMerger {
     int term_buf_ptr;
     int term_buf_size;
     FrtPriorityQueue *queue;
-    SkipBuffer *skip_buf;
+    PostingsWriter *pw;
     FrtOutStream *frq_out;
     FrtOutStream *prx_out;
+    int max_bytes_per_sec;
+    frt_off_t bytes_written;
+    frt_off_t next_throttle_check;
+    double start_time;
+    FrtSort *sort;
+    int *sorted_docs;
+    int *seg_starts;
+    SortedPosting *postings;
+    int postings_capa;
+    int *positions;
+    int positions_capa;
 } SegmentMerger;
 
+static double sm_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+/* how often, in bytes written, a merge checks its rate and interruption */
+#define SM_THROTTLE_CHECK_BYTES 65536
+
+/* sleep whenever the merge is writing faster than max_bytes_per_sec so that
+ * background merges don't starve searches and flushes of I/O */
+static void sm_throttle(SegmentMerger *sm, frt_off_t bytes_written)
+{
+    if (bytes_written < sm->next_throttle_check) {
+        return;
+    }
+    sm->next_throttle_check = bytes_written + SM_THROTTLE_CHECK_BYTES;
+    if (frt_thread_interrupted()) {
+        FRT_RAISE(FRT_STATE_ERROR, "merge of segment %s interrupted", sm->si->name);
+    }
+    if (sm->max_bytes_per_sec > 0) {
+        double ahead = (double)bytes_written / sm->max_bytes_per_sec
+                     - (sm_now() - sm->start_time);
+        if (ahead > 0.001) {
+            frt_micro_sleep((int)(ahead * 1000000.0));
+        }
+    }
+}
+
 static SegmentMerger *sm_create(FrtIndexWriter *iw, FrtSegmentInfo *si, FrtSegmentInfo **seg_infos, const int seg_cnt)
 {
     int i;
@@ -5610,6 +8737,7 @@ static SegmentMerger *sm_create(FrtIndexWriter *iw, FrtSegmentInfo *si, FrtSegme
     }
     sm->seg_cnt = seg_cnt;
     sm->config = &iw->config;
+    sm->sort = iw->config.index_sort;
     return sm;
 }
 
@@ -5622,39 +8750,302 @@ static void sm_destroy(SegmentMerger *sm)
     }
     frt_store_close(sm->store);
     free(sm->smis);
+    free(sm->sorted_docs);
+    free(sm->seg_starts);
+    free(sm->postings);
+    free(sm->positions);
     free(sm);
 }
 
-static void sm_merge_fields(SegmentMerger *sm)
+/* the index of the segment holding +doc+ of the reader over all segments */
+static int sm_seg_for(SegmentMerger *sm, int doc)
 {
-    int i, j;
-    frt_off_t start, end = 0;
-    char file_name[FRT_SEGMENT_NAME_MAX_LENGTH];
-    FrtOutStream *fdt_out, *fdx_out;
-    FrtStore *store = sm->store;
+    int lo = 0, hi = sm->seg_cnt - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) >> 1;
+        if (sm->seg_starts[mid] <= doc) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+/*
+ * With an index sort the merged segment holds the documents in sort order
+ * rather than one segment after the other. The order is worked out on a
+ * reader over the segments being merged and each smi's doc_map is replaced
+ * by a map from its documents straight to their number in the new segment.
+ */
+static void sm_sort_docs(SegmentMerger *sm)
+{
+    FrtSegmentInfos *sis = frt_sis_new(sm->fis);
+    FrtIndexReader *volatile ir = NULL;
+    FrtSort *sort = frt_sort_new();
     const int seg_cnt = sm->seg_cnt;
+    int i, j, k = 0;
 
-    sprintf(file_name, "%s.fdt", sm->si->name);
-    fdt_out = store->new_output(store, file_name);
+    sm->seg_starts = FRT_ALLOC_N(int, seg_cnt + 1);
+    sm->sorted_docs = FRT_ALLOC_N(int, sm->doc_cnt + 1);
+    sm->seg_starts[0] = 0;
+    for (i = 0; i < seg_cnt; i++) {
+        SegmentMergeInfo *smi = sm->smis[i];
+        FRT_REF(smi->si);
+        frt_sis_add_si(sis, smi->si);
+        for (j = 0; j < smi->max_doc; j++) {
+            if (!smi->deleted_docs || !frt_bv_get(smi->deleted_docs, j)) {
+                sm->sorted_docs[k++] = sm->seg_starts[i] + j;
+            }
+        }
+        sm->seg_starts[i + 1] = sm->seg_starts[i] + smi->max_doc;
+    }
 
-    sprintf(file_name, "%s.fdx", sm->si->name);
-    fdx_out = store->new_output(store, file_name);
+    /* a field which isn't in the index yet is equal for all documents */
+    sort->destroy_all = false;
+    for (i = 0; i < sm->sort->size; i++) {
+        FrtSortField *sf = sm->sort->sort_fields[i];
+        if (frt_fis_get_field(sm->fis, sf->field)) {
+            frt_sort_add_sort_field(sort, sf);
+        }
+    }
+
+    FRT_TRY
+        ir = ir_open_sis(sm->store, sis, NULL);
+        if (sort->size > 0) {
+            frt_fshq_sort_docs(sort, ir, sm->sorted_docs, k);
+        }
+    FRT_XFINALLY
+        if (ir) {
+            frt_ir_close(ir);
+        } else {
+            frt_sis_destroy(sis);
+        }
+        frt_sort_destroy(sort);
+    FRT_XENDTRY
 
     for (i = 0; i < seg_cnt; i++) {
         SegmentMergeInfo *smi = sm->smis[i];
-        const int max_doc = smi->max_doc;
-        FrtInStream *fdt_in, *fdx_in;
-        char *segment = smi->si->name;
-        store = smi->store;
-        sprintf(file_name, "%s.fdt", segment);
-        fdt_in = store->open_input(store, file_name);
-        sprintf(file_name, "%s.fdx", segment);
-        fdx_in = store->open_input(store, file_name);
-
-        if (max_doc > 0) {
-            end = (off_t)frt_is_read_u64(fdx_in);
+        if (NULL == smi->doc_map) {
+            smi->doc_map = FRT_ALLOC_N(int, smi->max_doc + 1);
         }
-        for (j = 0; j < max_doc; j++) {
+        for (j = 0; j < smi->max_doc; j++) {
+            smi->doc_map[j] = -1;
+        }
+        smi->base = 0;
+    }
+    for (k = 0; k < sm->doc_cnt; k++) {
+        const int doc = sm->sorted_docs[k];
+        i = sm_seg_for(sm, doc);
+        sm->smis[i]->doc_map[doc - sm->seg_starts[i]] = k;
+    }
+}
+
+/* open the blocks of a merged segment, NULL if it is a plain segment */
+static FrtStoredBlockReader *sm_open_blocks(SegmentMergeInfo *smi)
+{
+    char file_name[FRT_SEGMENT_NAME_MAX_LENGTH];
+    if (FRT_STORED_FIELDS_FORMAT_BLOCK != smi->si->stored_fields_format) {
+        return NULL;
+    }
+    sprintf(file_name, "%s.fdb", smi->si->name);
+    return sbr_open(smi->store, file_name);
+}
+
+/* Copy the document between +start+ and +end+ of +fdt_in+ when the bytes
+ * can't be copied as they are because its values are in blocks on either
+ * side. The header and the term vectors are copied and the values are moved
+ * between the .fdt file and the blocks as needed. Values going into blocks
+ * are decompressed as the whole block is compressed, like frt_fw_add_doc
+ * writes them. +sbr+ and +sbw+ are NULL for plain segments */
+static void sm_copy_doc_fields(FrtInStream *fdt_in, FrtStoredBlockReader *sbr,
+                               frt_off_t start, frt_off_t end,
+                               frt_u32 tv_idx_offset, FrtOutStream *fdt_out,
+                               FrtStoredBlockWriter *sbw, FrtOutStream *fdx_out)
+{
+    int i, j, data_len = 0;
+    const frt_off_t doc_start_ptr = frt_os_pos(fdt_out);
+    const int block_offset = sbw ? sbw->len : 0;
+    frt_off_t headers_start, value_ptr, tv_start, out_tv_start;
+    FrtInStream *values_in = fdt_in;
+    int stored_cnt;
+
+    frt_os_write_u64(fdx_out, doc_start_ptr);
+    frt_is_seek(fdt_in, start);
+    stored_cnt = frt_is_read_vint(fdt_in);
+    frt_os_write_vint(fdt_out, stored_cnt);
+
+    /* find the values which follow the headers */
+    headers_start = frt_is_pos(fdt_in);
+    for (i = 0; i < stored_cnt; i++) {
+        int df_size;
+        frt_is_read_vint(fdt_in); /* field_num */
+        df_size = frt_is_read_vint(fdt_in);
+        for (j = 0; j < df_size; j++) {
+            /* Each field has one ' ' byte so add 1 */
+            data_len += frt_is_read_vint(fdt_in) + 1; /* length */
+            frt_is_read_vint(fdt_in); /* encoding */
+            frt_is_read_vint(fdt_in); /* compression */
+        }
+    }
+    tv_start = value_ptr = frt_is_pos(fdt_in);
+    if (stored_cnt > 0 && sbr) {
+        const frt_off_t block_ptr = frt_is_read_voff_t(fdt_in);
+        const int offset = frt_is_read_vint(fdt_in);
+        tv_start = frt_is_pos(fdt_in);
+        values_in = sbr_get_block(sbr, block_ptr, NULL, NULL);
+        value_ptr = offset;
+    } else {
+        tv_start += data_len;
+    }
+
+    frt_is_seek(fdt_in, headers_start);
+    for (i = 0; i < stored_cnt; i++) {
+        const int field_num = frt_is_read_vint(fdt_in);
+        const int df_size = frt_is_read_vint(fdt_in);
+        frt_os_write_vint(fdt_out, field_num);
+        frt_os_write_vint(fdt_out, df_size);
+        for (j = 0; j < df_size; j++) {
+            int flen = frt_is_read_vint(fdt_in); /* length */
+            const int fenc = frt_is_read_vint(fdt_in); /* encoding */
+            int fcmp = frt_is_read_vint(fdt_in); /* compression */
+            if (sbw) {
+                const frt_off_t header_ptr = frt_is_pos(fdt_in);
+                frt_is_seek(values_in, value_ptr);
+                if (FRT_COMPRESSION_NONE != fcmp) {
+                    char *text = is_read_compressed_bytes(values_in, flen + 1,
+                                                          &flen, fcmp);
+                    frt_uchar *bytes = sbw_reserve(sbw, flen + 1);
+                    memcpy(bytes, text, flen);
+                    bytes[flen] = ' ';
+                    free(text);
+                    fcmp = FRT_COMPRESSION_NONE;
+                } else {
+                    frt_is_read_bytes(values_in, sbw_reserve(sbw, flen + 1),
+                                      flen + 1);
+                }
+                value_ptr = frt_is_pos(values_in);
+                frt_is_seek(fdt_in, header_ptr);
+            }
+            frt_os_write_vint(fdt_out, flen);
+            frt_os_write_vint(fdt_out, fenc);
+            frt_os_write_vint(fdt_out, fcmp);
+        }
+    }
+    if (stored_cnt > 0) {
+        if (sbw) {
+            sbw_write_ptr(sbw, fdt_out, block_offset);
+        } else {
+            frt_is_seek(values_in, value_ptr);
+            frt_is2os_copy_bytes(values_in, fdt_out, data_len);
+        }
+    }
+
+    /* the term vectors follow the values, their index moves with them */
+    frt_is_seek(fdt_in, tv_start);
+    out_tv_start = frt_os_pos(fdt_out);
+    frt_is2os_copy_bytes(fdt_in, fdt_out, (int)(end - tv_start));
+    frt_os_write_u32(fdx_out, (frt_u32)(tv_idx_offset - (tv_start - start)
+                                        + (out_tv_start - doc_start_ptr)));
+    if (sbw) {
+        sbw_end_doc(sbw);
+    }
+}
+
+/* copy the stored fields of document +doc+ of the +max_doc+ documents in
+ * +fdt_in+ and +fdx_in+ to the end of +fdt_out+ and +fdx_out+. +sbr+ is NULL
+ * unless the values are in blocks */
+static void fields_copy_doc(FrtInStream *fdt_in, FrtInStream *fdx_in,
+                            FrtStoredBlockReader *sbr, int doc, int max_doc,
+                            FrtOutStream *fdt_out, FrtOutStream *fdx_out,
+                            FrtStoredBlockWriter *sbw)
+{
+    frt_off_t start, end;
+    frt_u32 tv_idx_offset;
+
+    frt_is_seek(fdx_in, (frt_off_t)doc * FIELDS_IDX_PTR_SIZE);
+    start = (frt_off_t)frt_is_read_u64(fdx_in);
+    tv_idx_offset = frt_is_read_u32(fdx_in);
+    if (doc == max_doc - 1) {
+        end = frt_is_length(fdt_in);
+    } else {
+        end = (frt_off_t)frt_is_read_u64(fdx_in);
+    }
+    if (sbr || sbw) {
+        sm_copy_doc_fields(fdt_in, sbr, start, end, tv_idx_offset,
+                           fdt_out, sbw, fdx_out);
+    } else {
+        frt_os_write_u64(fdx_out, frt_os_pos(fdt_out));
+        frt_os_write_u32(fdx_out, tv_idx_offset);
+        frt_is_seek(fdt_in, start);
+        frt_is2os_copy_bytes(fdt_in, fdt_out, end - start);
+    }
+}
+
+/* copy the stored fields of each document in the merged segment's order */
+static void sm_merge_sorted_fields(SegmentMerger *sm, FrtOutStream *fdt_out,
+                                   FrtOutStream *fdx_out,
+                                   FrtStoredBlockWriter *sbw)
+{
+    int i, k;
+    char file_name[FRT_SEGMENT_NAME_MAX_LENGTH];
+    const int seg_cnt = sm->seg_cnt;
+    FrtInStream **fdt_ins = FRT_ALLOC_N(FrtInStream *, seg_cnt);
+    FrtInStream **fdx_ins = FRT_ALLOC_N(FrtInStream *, seg_cnt);
+    FrtStoredBlockReader **sbrs = FRT_ALLOC_N(FrtStoredBlockReader *, seg_cnt);
+
+    for (i = 0; i < seg_cnt; i++) {
+        FrtStore *store = sm->smis[i]->store;
+        char *segment = sm->smis[i]->si->name;
+        sprintf(file_name, "%s.fdt", segment);
+        fdt_ins[i] = store->open_input(store, file_name);
+        sprintf(file_name, "%s.fdx", segment);
+        fdx_ins[i] = store->open_input(store, file_name);
+        sbrs[i] = sm_open_blocks(sm->smis[i]);
+    }
+    for (k = 0; k < sm->doc_cnt; k++) {
+        const int seg = sm_seg_for(sm, sm->sorted_docs[k]);
+        const int doc = sm->sorted_docs[k] - sm->seg_starts[seg];
+        fields_copy_doc(fdt_ins[seg], fdx_ins[seg], sbrs[seg], doc,
+                        sm->smis[seg]->max_doc, fdt_out, fdx_out, sbw);
+        sm_throttle(sm, frt_os_pos(fdt_out));
+    }
+    for (i = 0; i < seg_cnt; i++) {
+        frt_is_close(fdt_ins[i]);
+        frt_is_close(fdx_ins[i]);
+        if (sbrs[i]) sbr_close(sbrs[i]);
+    }
+    free(fdt_ins);
+    free(fdx_ins);
+    free(sbrs);
+}
+
+/* copy the stored fields of each segment in turn, skipping deleted docs */
+static void sm_copy_fields(SegmentMerger *sm, FrtOutStream *fdt_out,
+                           FrtOutStream *fdx_out, FrtStoredBlockWriter *sbw)
+{
+    int i, j;
+    frt_off_t start, end = 0;
+    char file_name[FRT_SEGMENT_NAME_MAX_LENGTH];
+    const int seg_cnt = sm->seg_cnt;
+
+    for (i = 0; i < seg_cnt; i++) {
+        SegmentMergeInfo *smi = sm->smis[i];
+        const int max_doc = smi->max_doc;
+        FrtInStream *fdt_in, *fdx_in;
+        FrtStoredBlockReader *sbr = sm_open_blocks(smi);
+        char *segment = smi->si->name;
+        FrtStore *store = smi->store;
+        sprintf(file_name, "%s.fdt", segment);
+        fdt_in = store->open_input(store, file_name);
+        frt_is_set_buffer_size(fdt_in, FRT_SEQUENTIAL_BUFFER_SIZE);
+        sprintf(file_name, "%s.fdx", segment);
+        fdx_in = store->open_input(store, file_name);
+
+        if (max_doc > 0) {
+            end = (off_t)frt_is_read_u64(fdx_in);
+        }
+        for (j = 0; j < max_doc; j++) {
             frt_u32 tv_idx_offset = frt_is_read_u32(fdx_in);
             start = end;
             if (j == max_doc - 1) {
@@ -5664,15 +9055,93 @@ static void sm_merge_fields(SegmentMerger *sm)
                 end = (off_t)frt_is_read_u64(fdx_in);
             }
             /* skip deleted docs */
-            if (!smi->deleted_docs || !frt_bv_get(smi->deleted_docs, j)) {
+            if (smi->deleted_docs && frt_bv_get(smi->deleted_docs, j)) {
+                continue;
+            }
+            if (sbr || sbw) {
+                sm_copy_doc_fields(fdt_in, sbr, start, end, tv_idx_offset,
+                                   fdt_out, sbw, fdx_out);
+            } else {
                 frt_os_write_u64(fdx_out, frt_os_pos(fdt_out));
                 frt_os_write_u32(fdx_out, tv_idx_offset);
                 frt_is_seek(fdt_in, start);
                 frt_is2os_copy_bytes(fdt_in, fdt_out, end - start);
             }
+            sm_throttle(sm, frt_os_pos(fdt_out));
         }
         frt_is_close(fdt_in);
         frt_is_close(fdx_in);
+        if (sbr) sbr_close(sbr);
+    }
+}
+
+/* rewrite the doc values of the merged documents under their new numbers */
+static void sm_merge_doc_values(SegmentMerger *sm)
+{
+    FrtDocValuesWriter *dvw = dvw_new();
+    FrtFieldInfos *fis = sm->fis;
+    char file_name[FRT_SEGMENT_NAME_MAX_LENGTH];
+    FrtOutStream *dvd_out;
+    int i, j, k;
+
+    for (i = 0; i < sm->seg_cnt; i++) {
+        SegmentMergeInfo *smi = sm->smis[i];
+        FrtInStream *dvd_in;
+        sprintf(file_name, "%s.dvd", smi->si->name);
+        if (!smi->store->exists(smi->store, file_name)) {
+            continue;
+        }
+        dvd_in = smi->store->open_input(smi->store, file_name);
+        for (j = 0; j < fis->size; j++) {
+            FrtDocValues *dv;
+            if (!bits_doc_values_type(fis->fields[j]->bits)
+                || NULL == (dv = dv_read(dvd_in, j))) {
+                continue;
+            }
+            for (k = 0; k < smi->max_doc; k++) {
+                const int doc_num = smi->doc_map ? smi->doc_map[k] : k;
+                if (doc_num >= 0) {
+                    dvw_add_dv(dvw, j, dv, k, smi->base + doc_num);
+                }
+            }
+            dv_destroy(dv);
+        }
+        frt_is_close(dvd_in);
+    }
+
+    sprintf(file_name, "%s.dvd", sm->si->name);
+    dvd_out = sm->store->new_output(sm->store, file_name);
+    dvw_write(dvw, dvd_out, sm->doc_cnt);
+    sm->bytes_written += frt_os_pos(dvd_out);
+    frt_os_close(dvd_out);
+    dvw_destroy(dvw);
+}
+
+static void sm_merge_fields(SegmentMerger *sm)
+{
+    char file_name[FRT_SEGMENT_NAME_MAX_LENGTH];
+    FrtOutStream *fdt_out, *fdx_out;
+    FrtStoredBlockWriter *sbw;
+    FrtStore *store = sm->store;
+
+    sbw = sbw_open(store, sm->si->name, sm->si->stored_fields_format);
+    sprintf(file_name, "%s.fdt", sm->si->name);
+    fdt_out = store->new_output(store, file_name);
+    frt_os_set_buffer_size(fdt_out, FRT_SEQUENTIAL_BUFFER_SIZE);
+
+    sprintf(file_name, "%s.fdx", sm->si->name);
+    fdx_out = store->new_output(store, file_name);
+
+    if (sm->sort) {
+        sm_merge_sorted_fields(sm, fdt_out, fdx_out, sbw);
+    } else {
+        sm_copy_fields(sm, fdt_out, fdx_out, sbw);
+    }
+    sm->bytes_written = frt_os_pos(fdt_out) + frt_os_pos(fdx_out);
+    if (sbw) {
+        sbw_flush(sbw);
+        sm->bytes_written += frt_os_pos(sbw->fdb_out);
+        sbw_close(sbw);
     }
     frt_os_close(fdt_out);
     frt_os_close(fdx_out);
@@ -5682,14 +9151,12 @@ static int sm_append_postings(SegmentMerger *sm, SegmentMergeInfo **matches,
                               const int match_size)
 {
     int i;
-    int last_doc = 0, base, doc, doc_code, freq;
-    int skip_interval = sm->config->skip_interval;
+    int base, doc, freq;
     int *doc_map = NULL;
-    int df = 0;            /* number of docs w/ term */
     FrtTermDocEnum *tde;
     SegmentMergeInfo *smi;
-    SkipBuffer *skip_buf = sm->skip_buf;
-    skip_buf_reset(skip_buf);
+    PostingsWriter *pw = sm->pw;
+    pw_start_term(pw);
 
     for (i = 0; i < match_size; i++) {
         smi = matches[i];
@@ -5698,38 +9165,85 @@ static int sm_append_postings(SegmentMerger *sm, SegmentMergeInfo **matches,
         tde = smi->tde;
         stpe_seek_ti(STDE(tde), &smi->te->curr_ti);
 
-        /* since we are using copy_bytes below to copy the proximities we use
-         * stde_next rather than stpe_next here */
-        while (stde_next(tde)) {
+        /* since we are copying the proximities below we use stde_next
+         * rather than stpe_next here */
+        while (stde_next_doc(tde)) {
             doc = stde_doc_num(tde);
             if (NULL != doc_map) {
                 doc = doc_map[doc]; /* work around deletions */
             }
             doc += base;          /* convert to merged space */
-            assert(doc == 0 || doc > last_doc);
+            assert(doc == 0 || doc > pw->last_doc);
 
-            df++;
-            if (0 == (df % skip_interval)) {
-                skip_buf_add(skip_buf, last_doc);
+            freq = stde_freq(tde);
+            pw_add(pw, doc, freq);
+
+            /* copy position deltas, straight across between vint segments */
+            if (NULL == STDE(tde)->prx_buf
+                && FRT_POSTINGS_FORMAT_VINT == pw->postings_format) {
+                frt_is2os_copy_vints(STDE(tde)->prx_in, sm->prx_out, freq);
+            } else {
+                int j;
+                for (j = 0; j < freq; j++) {
+                    pw_add_position(pw, stpe_read_delta(STDE(tde)));
+                }
             }
+        }
+    }
+    return pw->doc_freq;
+}
 
-            doc_code = (doc - last_doc) << 1;    /* use low bit to flag freq=1 */
-            last_doc = doc;
+static int sorted_posting_cmp(const void *p1, const void *p2)
+{
+    return ((SortedPosting *)p1)->doc - ((SortedPosting *)p2)->doc;
+}
 
-            freq = stde_freq(tde);
-            if (freq == 1) {
-                frt_os_write_vint(sm->frq_out, doc_code | 1); /* doc & freq=1 */
+/* the documents of a sorted segment don't come out of the merged segments in
+ * order so the postings of each term are gathered and sorted first */
+static int sm_append_sorted_postings(SegmentMerger *sm,
+                                     SegmentMergeInfo **matches,
+                                     const int match_size)
+{
+    int i, j, cnt = 0, prx_cnt = 0;
+    PostingsWriter *pw = sm->pw;
+    pw_start_term(pw);
+
+    for (i = 0; i < match_size; i++) {
+        SegmentMergeInfo *smi = matches[i];
+        FrtTermDocEnum *tde = smi->tde;
+        stpe_seek_ti(STDE(tde), &smi->te->curr_ti);
+
+        while (stde_next_doc(tde)) {
+            const int freq = stde_freq(tde);
+            SortedPosting *sp;
+            if (cnt >= sm->postings_capa) {
+                sm->postings_capa = sm->postings_capa ? sm->postings_capa << 1 : 64;
+                FRT_REALLOC_N(sm->postings, SortedPosting, sm->postings_capa);
             }
-            else {
-                frt_os_write_vint(sm->frq_out, doc_code); /* write doc */
-                frt_os_write_vint(sm->frq_out, freq);     /* write freqency in doc */
+            while (prx_cnt + freq > sm->positions_capa) {
+                sm->positions_capa = sm->positions_capa ? sm->positions_capa << 1 : 256;
+                FRT_REALLOC_N(sm->positions, int, sm->positions_capa);
+            }
+            sp = &sm->postings[cnt++];
+            sp->doc = smi->doc_map[stde_doc_num(tde)];
+            sp->freq = freq;
+            sp->prx_start = prx_cnt;
+            for (j = 0; j < freq; j++) {
+                sm->positions[prx_cnt++] = stpe_read_delta(STDE(tde));
             }
+        }
+    }
 
-            /* copy position deltas */
-            frt_is2os_copy_vints(STDE(tde)->prx_in, sm->prx_out, freq);
+    qsort(sm->postings, cnt, sizeof(SortedPosting), &sorted_posting_cmp);
+    for (i = 0; i < cnt; i++) {
+        SortedPosting *sp = &sm->postings[i];
+        int *positions = sm->positions + sp->prx_start;
+        pw_add(pw, sp->doc, sp->freq);
+        for (j = 0; j < sp->freq; j++) {
+            pw_add_position(pw, positions[j]);
         }
     }
-    return df;
+    return pw->doc_freq;
 }
 
 static char *sm_cache_term(SegmentMerger *sm, char *term, int term_len)
@@ -5748,9 +9262,11 @@ static void sm_merge_term_info(SegmentMerger *sm, SegmentMergeInfo **matches,
     frt_off_t frq_ptr = frt_os_pos(sm->frq_out);
     frt_off_t prx_ptr = frt_os_pos(sm->prx_out);
 
-    int df = sm_append_postings(sm, matches, match_size); /* append posting data */
+    int df = sm->sort /* append posting data */
+           ? sm_append_sorted_postings(sm, matches, match_size)
+           : sm_append_postings(sm, matches, match_size);
 
-    frt_off_t skip_ptr = skip_buf_write(sm->skip_buf);
+    frt_off_t skip_ptr = pw_finish_term(sm->pw);
 
     if (df > 0) {
         /* add an entry to the dictionary with ptrs to prox and freq files */
@@ -5800,6 +9316,8 @@ static void sm_merge_term_infos(SegmentMerger *sm)
             }
 
             sm_merge_term_info(sm, matches, match_size);/* add new FrtTermInfo */
+            sm_throttle(sm, sm->bytes_written + frt_os_pos(sm->frq_out)
+                            + frt_os_pos(sm->prx_out));
 
             while (match_size > 0) {
                 match_size--;
@@ -5819,15 +9337,21 @@ static void sm_merge_term_infos(SegmentMerger *sm)
 static void sm_merge_terms(SegmentMerger *sm)
 {
     char file_name[FRT_SEGMENT_NAME_MAX_LENGTH];
+    int skip_interval;
 
     sprintf(file_name, "%s.frq", sm->si->name);
     sm->frq_out = sm->store->new_output(sm->store, file_name);
+    frt_os_set_buffer_size(sm->frq_out, FRT_SEQUENTIAL_BUFFER_SIZE);
     sprintf(file_name, "%s.prx", sm->si->name);
     sm->prx_out = sm->store->new_output(sm->store, file_name);
+    frt_os_set_buffer_size(sm->prx_out, FRT_SEQUENTIAL_BUFFER_SIZE);
 
+    skip_interval = pw_skip_interval(sm->si->postings_format,
+                                     sm->config->skip_interval);
     sm->tiw = frt_tiw_open(sm->store, sm->si->name, sm->config->index_interval,
-                       sm->config->skip_interval);
-    sm->skip_buf = skip_buf_new(sm->frq_out, sm->prx_out);
+                       skip_interval);
+    sm->pw = pw_new(sm->frq_out, sm->prx_out, sm->si->postings_format,
+                    skip_interval);
 
     /* terms_buf_ptr holds a buffer of terms since the FrtTermInfosWriter needs
      * to keep the last index_interval terms so that it can compare the last
@@ -5845,10 +9369,35 @@ static void sm_merge_terms(SegmentMerger *sm)
     frt_os_close(sm->prx_out);
     frt_tiw_close(sm->tiw);
     frt_pq_destroy(sm->queue);
-    skip_buf_destroy(sm->skip_buf);
+    pw_destroy(sm->pw);
     free(sm->term_buf);
 }
 
+/* read the norms of +field_num+ into +norms+ in the sorted segment's order */
+static void sm_sort_norms(SegmentMerger *sm, int field_num, frt_uchar *norms)
+{
+    char file_name[FRT_SEGMENT_NAME_MAX_LENGTH];
+    int j, k;
+
+    memset(norms, 0, sm->doc_cnt);
+    for (j = 0; j < sm->seg_cnt; j++) {
+        SegmentMergeInfo *smi = sm->smis[j];
+        FrtSegmentInfo *si = smi->si;
+        if (si_norm_file_name(si, file_name, field_num)) {
+            FrtStore *store = (si->use_compound_file && si->norm_gens[field_num])
+                              ? smi->orig_store : smi->store;
+            FrtInStream *is = store->open_input(store, file_name);
+            for (k = 0; k < smi->max_doc; k++) {
+                frt_uchar byte = frt_is_read_byte(is);
+                if (smi->doc_map[k] >= 0) {
+                    norms[smi->doc_map[k]] = byte;
+                }
+            }
+            frt_is_close(is);
+        }
+    }
+}
+
 static void sm_merge_norms(SegmentMerger *sm)
 {
     FrtSegmentInfo *si;
@@ -5861,6 +9410,10 @@ static void sm_merge_norms(SegmentMerger *sm)
     char file_name[FRT_SEGMENT_NAME_MAX_LENGTH];
     SegmentMergeInfo *smi;
     const int seg_cnt = sm->seg_cnt;
+    frt_uchar *norms = NULL;
+    if (sm->sort) {
+        norms = FRT_ALLOC_N(frt_uchar, sm->doc_cnt + 1);
+    }
     for (i = sm->fis->size - 1; i >= 0; i--) {
         fi = sm->fis->fields[i];
         if (bits_has_norms(fi->bits))  {
@@ -5868,6 +9421,12 @@ static void sm_merge_norms(SegmentMerger *sm)
             frt_si_advance_norm_gen(si, i);
             si_norm_file_name(si, file_name, i);
             os = sm->store->new_output(sm->store, file_name);
+            if (norms) {
+                sm_sort_norms(sm, i, norms);
+                frt_os_write_bytes(os, norms, sm->doc_cnt);
+                frt_os_close(os);
+                continue;
+            }
             for (j = 0; j < seg_cnt; j++) {
                 smi = sm->smis[j];
                 si = smi->si;
@@ -5900,202 +9459,955 @@ static void sm_merge_norms(SegmentMerger *sm)
             frt_os_close(os);
         }
     }
+    free(norms);
 }
 
 static int sm_merge(SegmentMerger *sm)
 {
+    sm->start_time = sm_now();
+    if (sm->sort) {
+        sm_sort_docs(sm);
+        sm->si->index_sort = index_sort_clone(sm->sort);
+    }
     sm_merge_fields(sm);
+    sm_merge_doc_values(sm);
     sm_merge_terms(sm);
     sm_merge_norms(sm);
     return sm->doc_cnt;
 }
 
 
-/****************************************************************************
- * IndexWriter
- ****************************************************************************/
-
-/* prepare an index ready for writing */
-void frt_index_create(FrtStore *store, FrtFieldInfos *fis)
+/****************************************************************************
+ * IndexWriter
+ ****************************************************************************/
+
+/* prepare an index ready for writing */
+void frt_index_create(FrtStore *store, FrtFieldInfos *fis)
+{
+    FrtSegmentInfos *sis = frt_sis_new(fis);
+    store->clear_all(store);
+    /* the segment names start over so forget what was cached of the old
+     * segments */
+    frt_store_new_generation(store);
+    frt_sis_write(sis, store, NULL);
+    frt_sis_destroy(sis);
+}
+
+bool frt_index_is_locked(FrtStore *store) {
+    FrtLock *write_lock = frt_open_lock(store, FRT_WRITE_LOCK_NAME);
+    bool is_locked = write_lock->is_locked(write_lock);
+    frt_close_lock(write_lock);
+    return is_locked;
+}
+
+int frt_iw_doc_count(FrtIndexWriter *iw)
+{
+    int i, doc_cnt = 0;
+    frt_mutex_lock(&iw->mutex);
+    for (i = iw->sis->size - 1; i >= 0; i--) {
+        doc_cnt += iw->sis->segs[i]->doc_cnt;
+    }
+    for (i = iw->dw_cnt - 1; i >= 0; i--) {
+        doc_cnt += iw->dws[i]->doc_num;
+    }
+    frt_mutex_unlock(&iw->mutex);
+    return doc_cnt;
+}
+
+static void iw_create_compound_file(FrtStore *store, FrtFieldInfos *fis, FrtSegmentInfo *si, char *cfs_file_name, FrtDeleter *dlr) {
+    int i;
+    FrtCompoundWriter *cw;
+    char file_name[FRT_SEGMENT_NAME_MAX_LENGTH];
+    char *ext;
+    int seg_len = strlen(si->name);
+
+    memcpy(file_name, si->name, seg_len);
+    file_name[seg_len] = '.';
+    ext = file_name + seg_len + 1;
+
+    cw = frt_open_cw(store, cfs_file_name);
+    for (i = 0; i < FRT_NELEMS(COMPOUND_EXTENSIONS); i++) {
+        memcpy(ext, COMPOUND_EXTENSIONS[i], 4);
+        frt_cw_add_file(cw, file_name);
+    }
+
+    /* Field norm file_names */
+    for (i = fis->size - 1; i >= 0; i--) {
+        if (bits_has_norms(fis->fields[i]->bits) && si_norm_file_name(si, file_name, i)) {
+            frt_cw_add_file(cw, file_name);
+        }
+    }
+
+    /* Perform the merge */
+    frt_cw_close(cw, dlr);
+}
+
+/* A DocWriter's segment is only added to the SegmentInfos when it is
+ * flushed so the segment names are handed out here. iw->mutex must be held */
+static FrtSegmentInfo *iw_new_segment_info(FrtIndexWriter *iw)
+{
+    FrtSegmentInfo *si = frt_si_new(new_segment(iw->sis->counter++), 0, iw->store);
+    si->postings_format = iw->config.postings_format;
+    si->stored_fields_format = iw->config.stored_fields_format;
+    return si;
+}
+
+/****************************************************************************
+ * MergePolicy
+ ****************************************************************************/
+
+/* The files of a segment don't change once it has been written, only its
+ * compound file may be created later, so the size is cached until then */
+frt_off_t frt_si_size_in_bytes(FrtSegmentInfo *si)
+{
+    int i;
+    frt_off_t size = 0;
+    FrtStore *store = si->store;
+    char file_name[FRT_SEGMENT_NAME_MAX_LENGTH];
+    size_t seg_len = strlen(si->name);
+    char *ext;
+
+    if (si->size_in_bytes >= 0 && si->size_is_cfs == si->use_compound_file) {
+        return si->size_in_bytes;
+    }
+
+    memcpy(file_name, si->name, seg_len);
+    file_name[seg_len] = '.';
+    ext = file_name + seg_len + 1;
+
+    if (si->use_compound_file) {
+        memcpy(ext, "cfs", 4);
+        size = store->length(store, file_name);
+    } else {
+        for (i = 0; i < FRT_NELEMS(COMPOUND_EXTENSIONS); i++) {
+            memcpy(ext, COMPOUND_EXTENSIONS[i], 4);
+            if (store->exists(store, file_name)) {
+                size += store->length(store, file_name);
+            }
+        }
+    }
+    si->size_in_bytes = size;
+    si->size_is_cfs = si->use_compound_file;
+    return size;
+}
+
+/* Every change to the deletions writes a new generation of the .del file so
+ * the count is cached for the generation it was read from */
+int frt_si_del_cnt(FrtSegmentInfo *si)
+{
+    int del_cnt = 0;
+    if (si->del_gen < 0) {
+        return 0;
+    }
+    if (si->del_cnt_gen != si->del_gen) {
+        char file_name[FRT_SEGMENT_NAME_MAX_LENGTH];
+        FrtBitVector *bv = bv_read(si->store,
+            frt_fn_for_generation(file_name, si->name, "del", si->del_gen));
+        del_cnt = bv->count;
+        frt_bv_destroy(bv);
+        si->del_cnt = del_cnt;
+        si->del_cnt_gen = si->del_gen;
+    }
+    return si->del_cnt;
+}
+
+static void mp_destroy(FrtMergePolicy *mp)
+{
+    free(mp);
+}
+
+/*
+ * The log doc merge policy merges the newest segments as soon as
+ * merge_factor segments with roughly the same number of documents have
+ * accumulated.
+ */
+static bool ldmp_find_merge(FrtMergePolicy *mp, FrtSegmentInfos *sis,
+                            const FrtConfig *config, int *min_seg, int *max_seg)
+{
+    int target_merge_docs = config->merge_factor;
+    int min_segment, merge_docs;
+    FrtSegmentInfo *si;
+    (void)mp;
+
+    while (target_merge_docs > 0
+           && target_merge_docs <= config->max_merge_docs) {
+        /* find segments smaller than current target size which aren't
+         * already being merged */
+        min_segment = sis->size - 1;
+        merge_docs = 0;
+        while (min_segment >= 0) {
+            si = sis->segs[min_segment];
+            if (si->doc_cnt >= target_merge_docs || si->is_merging) {
+                break;
+            }
+            merge_docs += si->doc_cnt;
+            min_segment--;
+        }
+
+        if (merge_docs >= target_merge_docs) { /* found a merge to do */
+            *min_seg = min_segment + 1;
+            *max_seg = sis->size;
+            return true;
+        }
+        else if (min_segment <= 0) {
+            break;
+        }
+
+        /* don't rely on signed overflow to end the loop */
+        if (target_merge_docs > config->max_merge_docs / config->merge_factor) {
+            break;
+        }
+        target_merge_docs *= config->merge_factor;
+    }
+    return false;
+}
+
+FrtMergePolicy *frt_log_doc_merge_policy_new(void)
+{
+    FrtMergePolicy *mp = FRT_ALLOC(FrtMergePolicy);
+    mp->find_merge = &ldmp_find_merge;
+    mp->destroy = &mp_destroy;
+    return mp;
+}
+
+/*
+ * The tiered merge policy goes by the size of the segments on disk rather
+ * than by their document counts. Each tier may hold merge_factor segments,
+ * each tier's segments being merge_factor times as large as those of the
+ * tier below. Once the index holds more segments than that, the run of up
+ * to merge_factor adjacent segments with the lowest score is merged. Runs
+ * of evenly sized segments score better than skewed runs, as do runs with
+ * many deleted documents. Merged segments never grow beyond
+ * max_merged_segment_bytes. When nothing else needs merging, the segment
+ * with the highest share of deleted documents above deletes_pct_allowed is
+ * rewritten on its own to reclaim the space.
+ *
+ * Only adjacent segments are merged so document numbers keep their order.
+ */
+static bool tmp_find_merge(FrtMergePolicy *mp, FrtSegmentInfos *sis,
+                           const FrtConfig *config, int *min_seg, int *max_seg)
+{
+    int i, j;
+    const int seg_cnt = sis->size;
+    const int merge_factor = config->merge_factor > 1 ? config->merge_factor : 2;
+    const frt_off_t max_bytes = config->max_merged_segment_bytes;
+    frt_off_t *bytes, *live_bytes;
+    frt_off_t total_bytes = 0, level_bytes = -1, bytes_left;
+    double *del_ratios;
+    double best_score = 0.0;
+    int eligible_cnt = 0, allowed_cnt = 0;
+    bool found = false;
+    (void)mp;
+
+    if (seg_cnt < 1) {
+        return false;
+    }
+    bytes = FRT_ALLOC_N(frt_off_t, seg_cnt);
+    live_bytes = FRT_ALLOC_N(frt_off_t, seg_cnt);
+    del_ratios = FRT_ALLOC_N(double, seg_cnt);
+
+    for (i = 0; i < seg_cnt; i++) {
+        FrtSegmentInfo *si = sis->segs[i];
+        bytes[i] = frt_si_size_in_bytes(si);
+        del_ratios[i] = si->doc_cnt > 0
+            ? (double)frt_si_del_cnt(si) / (double)si->doc_cnt : 0.0;
+        live_bytes[i] = (frt_off_t)((double)bytes[i] * (1.0 - del_ratios[i]));
+        /* segments of more than half the maximum size won't be merged with
+         * others again so they don't count against the budget */
+        if (!si->is_merging && live_bytes[i] <= max_bytes / 2) {
+            total_bytes += live_bytes[i];
+            eligible_cnt++;
+            if (level_bytes < 0 || live_bytes[i] < level_bytes) {
+                level_bytes = live_bytes[i];
+            }
+        }
+    }
+
+    /* work out how many segments the index is allowed to have */
+    if (level_bytes < FRT_TIERED_FLOOR_SEGMENT_BYTES) {
+        level_bytes = FRT_TIERED_FLOOR_SEGMENT_BYTES;
+    }
+    bytes_left = total_bytes;
+    while (true) {
+        double level_seg_cnt = (double)bytes_left / (double)level_bytes;
+        if (level_seg_cnt < merge_factor) {
+            allowed_cnt += (int)ceil(level_seg_cnt);
+            break;
+        }
+        allowed_cnt += merge_factor;
+        bytes_left -= merge_factor * level_bytes;
+        level_bytes *= merge_factor;
+    }
+
+    if (eligible_cnt > allowed_cnt) {
+        for (i = 0; i < seg_cnt; i++) {
+            frt_off_t merge_bytes = 0, raw_bytes = 0;
+            frt_off_t floored_bytes = 0, largest = 0;
+            for (j = i; j < seg_cnt && j < i + merge_factor; j++) {
+                const frt_off_t floored =
+                    live_bytes[j] > FRT_TIERED_FLOOR_SEGMENT_BYTES
+                    ? live_bytes[j] : FRT_TIERED_FLOOR_SEGMENT_BYTES;
+                if (sis->segs[j]->is_merging || live_bytes[j] > max_bytes / 2
+                    || merge_bytes + live_bytes[j] > max_bytes) {
+                    break;
+                }
+                merge_bytes += live_bytes[j];
+                raw_bytes += bytes[j];
+                floored_bytes += floored;
+                if (floored > largest) {
+                    largest = floored;
+                }
+                if (j > i) {
+                    const double skew = (double)largest / (double)floored_bytes;
+                    const double live_ratio = raw_bytes > 0
+                        ? (double)merge_bytes / (double)raw_bytes : 1.0;
+                    const double score = skew * pow((double)merge_bytes, 0.05)
+                                       * live_ratio * live_ratio;
+                    if (!found || score < best_score) {
+                        found = true;
+                        best_score = score;
+                        *min_seg = i;
+                        *max_seg = j + 1;
+                    }
+                }
+            }
+        }
+    }
+
+    if (!found && config->deletes_pct_allowed < 100) {
+        /* reclaim the space taken up by deleted documents */
+        double max_del_ratio = (double)config->deletes_pct_allowed / 100.0;
+        for (i = 0; i < seg_cnt; i++) {
+            if (!sis->segs[i]->is_merging && del_ratios[i] > max_del_ratio
+                && live_bytes[i] <= max_bytes) {
+                found = true;
+                max_del_ratio = del_ratios[i];
+                *min_seg = i;
+                *max_seg = i + 1;
+            }
+        }
+    }
+
+    free(bytes);
+    free(live_bytes);
+    free(del_ratios);
+    return found;
+}
+
+FrtMergePolicy *frt_tiered_merge_policy_new(void)
+{
+    FrtMergePolicy *mp = FRT_ALLOC(FrtMergePolicy);
+    mp->find_merge = &tmp_find_merge;
+    mp->destroy = &mp_destroy;
+    return mp;
+}
+
+FrtMergePolicy *frt_merge_policy_new(FrtMergePolicyType type)
+{
+    switch (type) {
+        case FRT_MERGE_POLICY_TIERED:
+            return frt_tiered_merge_policy_new();
+        default:
+            return frt_log_doc_merge_policy_new();
+    }
+}
+
+/****************************************************************************
+ * MergeScheduler
+ ****************************************************************************/
+
+typedef struct SegmentMerge {
+    FrtSegmentInfo **segs;
+    int seg_cnt;
+    FrtSegmentInfo *si;
+    struct SegmentMerge *next;
+} SegmentMerge;
+
+/* Merges are either run by the thread that triggered them or, when
+ * max_merge_threads is set, queued up for a pool of background threads so
+ * that adding a document never has to wait for a cascade of merges. All
+ * fields are guarded by iw->mutex. */
+struct FrtMergeScheduler {
+    frt_thread_t *threads;
+    int thread_cnt;
+    int idle_cnt;
+    int running;
+    bool closing;
+    SegmentMerge *pending;
+    SegmentMerge *pending_last;
+    frt_cond_t cond;
+    int ex_code;
+    char ex_msg[FRT_XMSG_BUFFER_FINAL_SIZE];
+};
+
+static FrtMergeScheduler *ms_new(void)
+{
+    FrtMergeScheduler *ms = FRT_ALLOC_AND_ZERO(FrtMergeScheduler);
+    frt_cond_init(&ms->cond, NULL);
+    return ms;
+}
+
+static void ms_destroy(FrtMergeScheduler *ms)
+{
+    frt_cond_destroy(&ms->cond);
+    free(ms->threads);
+    free(ms);
+}
+
+/* iw->mutex must be held */
+static SegmentMerge *iw_merge_new(FrtIndexWriter *iw, const int min_seg, const int max_seg)
+{
+    int i;
+    SegmentMerge *merge = FRT_ALLOC(SegmentMerge);
+    merge->seg_cnt = max_seg - min_seg;
+    merge->segs = FRT_ALLOC_N(FrtSegmentInfo *, merge->seg_cnt);
+    for (i = 0; i < merge->seg_cnt; i++) {
+        FrtSegmentInfo *si = iw->sis->segs[min_seg + i];
+        si->is_merging = true;
+        FRT_REF(si);
+        merge->segs[i] = si;
+    }
+    merge->si = iw_new_segment_info(iw);
+    merge->next = NULL;
+    return merge;
+}
+
+/* iw->mutex must be held */
+static void merge_destroy(SegmentMerge *merge)
+{
+    int i;
+    for (i = 0; i < merge->seg_cnt; i++) {
+        merge->segs[i]->is_merging = false;
+        frt_si_close(merge->segs[i]);
+    }
+    if (merge->si) {
+        frt_si_close(merge->si);
+    }
+    free(merge->segs);
+    free(merge);
+}
+
+/* Write the merged segment. Only the new segment's files are written so this
+ * doesn't need iw->mutex as long as the merged segments aren't modified */
+static void iw_run_merge(FrtIndexWriter *iw, SegmentMerge *merge, int max_bytes_per_sec)
+{
+    /* the deleter only deletes the new segment's files so it doesn't need
+     * the SegmentInfos, which may change while the merge runs */
+    FrtDeleter *dlr = frt_deleter_new(NULL, iw->store);
+    SegmentMerger *volatile sm = NULL;
+    FRT_TRY
+        sm = sm_create(iw, merge->si, merge->segs, merge->seg_cnt);
+        sm->max_bytes_per_sec = max_bytes_per_sec;
+        merge->si->doc_cnt = sm_merge(sm);
+        sm_destroy(sm);
+        sm = NULL;
+        if (iw->config.use_compound_file) {
+            char cfs_name[FRT_SEGMENT_NAME_MAX_LENGTH];
+            sprintf(cfs_name, "%s.cfs", merge->si->name);
+            iw_create_compound_file(iw->store, iw->fis, merge->si, cfs_name, dlr);
+            merge->si->use_compound_file = true;
+        }
+        deleter_commit_pending_deletions(dlr);
+    FRT_XCATCHALL
+        /* clean up whatever was written of the new segment */
+        if (sm) {
+            sm_destroy(sm);
+        }
+        si_delete_files(merge->si, iw->fis, dlr);
+        merge->si->use_compound_file = false;
+        si_delete_files(merge->si, iw->fis, dlr);
+        deleter_commit_pending_deletions(dlr);
+        frt_deleter_destroy(dlr);
+    FRT_XENDTRY
+    frt_deleter_destroy(dlr);
+}
+
+/* replace the merged segments with the new one. iw->mutex must be held */
+static void iw_commit_merge(FrtIndexWriter *iw, SegmentMerge *merge)
+{
+    int i, min_seg;
+    FrtSegmentInfos *sis = iw->sis;
+
+    for (min_seg = 0; min_seg < sis->size; min_seg++) {
+        if (sis->segs[min_seg] == merge->segs[0]) {
+            break;
+        }
+    }
+    if (min_seg + merge->seg_cnt > sis->size) {
+        FRT_RAISE(FRT_STATE_ERROR, "merged segment %s is no longer in the index",
+                  merge->segs[0]->name);
+    }
+
+    frt_mutex_lock(&iw->store->mutex);
+    /* delete merged segments */
+    for (i = 0; i < merge->seg_cnt; i++) {
+        si_delete_files(merge->segs[i], iw->fis, iw->deleter);
+    }
+    frt_sis_del_from_to(sis, min_seg, min_seg + merge->seg_cnt);
+    sis_insert_si(sis, merge->si, min_seg);
+    merge->si = NULL;
+
+    frt_sis_write(sis, iw->store, iw->deleter);
+    deleter_commit_pending_deletions(iw->deleter);
+    frt_mutex_unlock(&iw->store->mutex);
+}
+
+/* Run +merge+ on the calling thread. iw->mutex is released while the merged
+ * segment is written and the merge counts as running meanwhile, so commits
+ * and deletions wait for it like for a background merge. iw->mutex must be
+ * held */
+static void iw_run_merge_here(FrtIndexWriter *iw, SegmentMerge *merge)
+{
+    FrtMergeScheduler *ms = iw->merge_scheduler;
+    volatile bool merged = false;
+    ms->running++;
+    frt_mutex_unlock(&iw->mutex);
+    FRT_TRY
+        iw_run_merge(iw, merge, 0);
+        merged = true;
+    FRT_XFINALLY
+        frt_mutex_lock(&iw->mutex);
+        ms->running--;
+        frt_cond_broadcast(&ms->cond);
+        if (!merged) merge_destroy(merge);
+    FRT_XENDTRY
+    FRT_TRY
+        iw_commit_merge(iw, merge);
+    FRT_XFINALLY
+        merge_destroy(merge);
+    FRT_XENDTRY
+}
+
+static void iw_merge_segments(FrtIndexWriter *iw, const int min_seg, const int max_seg)
+{
+    iw_run_merge_here(iw, iw_merge_new(iw, min_seg, max_seg));
+}
+
+static void iw_merge_segments_from(FrtIndexWriter *iw, int min_segment)
+{
+    iw_merge_segments(iw, min_segment, iw->sis->size);
+}
+
+static void iw_maybe_merge_segments(FrtIndexWriter *iw);
+
+static void *iw_merge_thread_run(void *arg)
+{
+    FrtIndexWriter *iw = (FrtIndexWriter *)arg;
+    FrtMergeScheduler *ms = iw->merge_scheduler;
+
+    frt_mutex_lock(&iw->mutex);
+    while (true) {
+        SegmentMerge *volatile merge;
+        volatile int ex_code = 0;
+        char ex_msg[FRT_XMSG_BUFFER_FINAL_SIZE];
+
+        while (NULL == ms->pending && !ms->closing) {
+            ms->idle_cnt++;
+            frt_cond_wait(&ms->cond, &iw->mutex);
+            ms->idle_cnt--;
+        }
+        if (NULL == (merge = ms->pending)) {
+            break;
+        }
+        if (NULL == (ms->pending = merge->next)) {
+            ms->pending_last = NULL;
+        }
+        ms->running++;
+        frt_mutex_unlock(&iw->mutex);
+
+        FRT_TRY
+            iw_run_merge(iw, merge, iw->config.max_merge_bytes_per_sec);
+        FRT_XCATCHALL
+            ex_code = xcontext.excode;
+            snprintf(ex_msg, FRT_XMSG_BUFFER_FINAL_SIZE, "%s", xcontext.msg ? xcontext.msg : "");
+            FRT_HANDLED();
+        FRT_XENDTRY
+
+        frt_mutex_lock(&iw->mutex);
+        if (0 == ex_code) {
+            FRT_TRY
+                iw_commit_merge(iw, merge);
+                iw_maybe_merge_segments(iw);
+            FRT_XCATCHALL
+                ex_code = xcontext.excode;
+                snprintf(ex_msg, FRT_XMSG_BUFFER_FINAL_SIZE, "%s", xcontext.msg ? xcontext.msg : "");
+                FRT_HANDLED();
+            FRT_XENDTRY
+        }
+        /* the error is raised by the next commit, only keep the first one */
+        if (0 != ex_code && 0 == ms->ex_code) {
+            ms->ex_code = ex_code;
+            memcpy(ms->ex_msg, ex_msg, FRT_XMSG_BUFFER_FINAL_SIZE);
+        }
+        merge_destroy(merge);
+        ms->running--;
+        frt_cond_broadcast(&ms->cond);
+    }
+    frt_mutex_unlock(&iw->mutex);
+    return NULL;
+}
+
+/* iw->mutex must be held */
+static void iw_schedule_merge(FrtIndexWriter *iw, const int min_seg, const int max_seg)
+{
+    FrtMergeScheduler *ms = iw->merge_scheduler;
+    SegmentMerge *merge;
+
+    if (iw->config.max_merge_threads <= 0 || ms->closing) {
+        iw_merge_segments(iw, min_seg, max_seg);
+        return;
+    }
+
+    merge = iw_merge_new(iw, min_seg, max_seg);
+    if (ms->pending_last) {
+        ms->pending_last->next = merge;
+    } else {
+        ms->pending = merge;
+    }
+    ms->pending_last = merge;
+
+    if (0 == ms->idle_cnt && ms->thread_cnt < iw->config.max_merge_threads) {
+        FRT_REALLOC_N(ms->threads, frt_thread_t, ms->thread_cnt + 1);
+        if (0 == frt_thread_create(&ms->threads[ms->thread_cnt], &iw_merge_thread_run, iw)) {
+            ms->thread_cnt++;
+        } else if (0 == ms->thread_cnt) {
+            /* couldn't start a merge thread so merge right here */
+            ms->pending = ms->pending_last = NULL;
+            iw_run_merge_here(iw, merge);
+            return;
+        }
+    }
+    frt_cond_broadcast(&ms->cond);
+}
+
+/* wait for all queued and running merges to finish. iw->mutex must be held */
+static void iw_wait_for_merges(FrtIndexWriter *iw)
+{
+    FrtMergeScheduler *ms = iw->merge_scheduler;
+    while (NULL != ms->pending || ms->running > 0) {
+        frt_cond_wait(&ms->cond, &iw->mutex);
+    }
+}
+
+/* raise the error of a failed background merge. iw->mutex must not be held */
+static void iw_raise_merge_error(FrtIndexWriter *iw)
 {
-    FrtSegmentInfos *sis = frt_sis_new(fis);
-    store->clear_all(store);
-    frt_sis_write(sis, store, NULL);
-    frt_sis_destroy(sis);
+    FrtMergeScheduler *ms = iw->merge_scheduler;
+    char ex_msg[FRT_XMSG_BUFFER_FINAL_SIZE];
+    int ex_code;
+    frt_mutex_lock(&iw->mutex);
+    if (0 != (ex_code = ms->ex_code)) {
+        memcpy(ex_msg, ms->ex_msg, FRT_XMSG_BUFFER_FINAL_SIZE);
+        ms->ex_code = 0;
+    }
+    frt_mutex_unlock(&iw->mutex);
+    if (0 != ex_code) {
+        FRT_RAISE(ex_code, "background merge failed: %s", ex_msg);
+    }
 }
 
-bool frt_index_is_locked(FrtStore *store) {
-    FrtLock *write_lock = frt_open_lock(store, FRT_WRITE_LOCK_NAME);
-    bool is_locked = write_lock->is_locked(write_lock);
-    frt_close_lock(write_lock);
-    return is_locked;
+static void iw_maybe_merge_segments(FrtIndexWriter *iw)
+{
+    int min_seg, max_seg;
+    FrtMergePolicy *mp = iw->merge_policy;
+    while (mp->find_merge(mp, iw->sis, &iw->config, &min_seg, &max_seg)) {
+        iw_schedule_merge(iw, min_seg, max_seg);
+    }
 }
 
-int frt_iw_doc_count(FrtIndexWriter *iw)
+void frt_iw_set_merge_policy(FrtIndexWriter *iw, FrtMergePolicy *mp)
 {
-    int i, doc_cnt = 0;
     frt_mutex_lock(&iw->mutex);
-    for (i = iw->sis->size - 1; i >= 0; i--) {
-        doc_cnt += iw->sis->segs[i]->doc_cnt;
-    }
-    if (iw->dw) {
-        doc_cnt += iw->dw->doc_num;
+    if (iw->merge_policy) {
+        iw->merge_policy->destroy(iw->merge_policy);
     }
+    iw->merge_policy = mp;
     frt_mutex_unlock(&iw->mutex);
-    return doc_cnt;
 }
 
-static void iw_create_compound_file(FrtStore *store, FrtFieldInfos *fis, FrtSegmentInfo *si, char *cfs_file_name, FrtDeleter *dlr) {
-    int i;
-    FrtCompoundWriter *cw;
-    char file_name[FRT_SEGMENT_NAME_MAX_LENGTH];
-    char *ext;
-    int seg_len = strlen(si->name);
-
-    memcpy(file_name, si->name, seg_len);
-    file_name[seg_len] = '.';
-    ext = file_name + seg_len + 1;
-
-    cw = frt_open_cw(store, cfs_file_name);
-    for (i = 0; i < FRT_NELEMS(COMPOUND_EXTENSIONS); i++) {
-        memcpy(ext, COMPOUND_EXTENSIONS[i], 4);
-        frt_cw_add_file(cw, file_name);
+/* wait until all DocWriters have been returned. No DocWriters are handed out
+ * while we are waiting. iw->mutex must be held */
+static void iw_wait_for_doc_writers(FrtIndexWriter *iw)
+{
+    iw->dw_waiting++;
+    while (iw->idle_dw_cnt < iw->dw_cnt) {
+        frt_cond_wait(&iw->dw_cond, &iw->mutex);
     }
+    iw->dw_waiting--;
+    /* let the threads waiting in iw_checkout_doc_writer carry on once we
+     * release the mutex */
+    frt_cond_broadcast(&iw->dw_cond);
+}
 
-    /* Field norm file_names */
-    for (i = fis->size - 1; i >= 0; i--) {
-        if (bits_has_norms(fis->fields[i]->bits) && si_norm_file_name(si, file_name, i)) {
-            frt_cw_add_file(cw, file_name);
+static FrtDocWriter *iw_checkout_doc_writer(FrtIndexWriter *iw)
+{
+    FrtDocWriter *dw;
+    const int max_dws = iw->config.max_doc_writers > 1 ? iw->config.max_doc_writers : 1;
+    while (iw->dw_waiting > 0 || (0 == iw->idle_dw_cnt && iw->dw_cnt >= max_dws)) {
+        frt_cond_wait(&iw->dw_cond, &iw->mutex);
+    }
+    if (iw->idle_dw_cnt > 0) {
+        dw = iw->idle_dws[--iw->idle_dw_cnt];
+        if (NULL == dw->fw) {
+            frt_dw_new_segment(dw, iw_new_segment_info(iw));
         }
     }
-
-    /* Perform the merge */
-    frt_cw_close(cw, dlr);
+    else {
+        if (iw->dw_cnt >= iw->dw_capa) {
+            iw->dw_capa = iw->dw_capa ? iw->dw_capa << 1 : 4;
+            FRT_REALLOC_N(iw->dws, FrtDocWriter *, iw->dw_capa);
+            FRT_REALLOC_N(iw->idle_dws, FrtDocWriter *, iw->dw_capa);
+        }
+        dw = frt_dw_open(iw, iw_new_segment_info(iw));
+        iw->dws[iw->dw_cnt++] = dw;
+    }
+    /* the analyzer may have been replaced since the DocWriter was opened */
+    dw->analyzer = iw->analyzer;
+    return dw;
 }
 
-static void iw_commit_compound_file(FrtIndexWriter *iw, FrtSegmentInfo *si)
+static void iw_checkin_doc_writer(FrtIndexWriter *iw, FrtDocWriter *dw)
 {
-    char cfs_name[FRT_SEGMENT_NAME_MAX_LENGTH];
-    sprintf(cfs_name, "%s.cfs", si->name);
-
-    iw_create_compound_file(iw->store, iw->fis, si, cfs_name, iw->deleter);
+    if (NULL == dw->fw) {
+        /* the segment was flushed but couldn't be added to the index */
+        dw->doc_num = 0;
+    }
+    iw->idle_dws[iw->idle_dw_cnt++] = dw;
+    frt_cond_broadcast(&iw->dw_cond);
 }
 
-static void iw_merge_segments(FrtIndexWriter *iw, const int min_seg, const int max_seg) {
+/* The FieldInfos are shared by all DocWriters and merges so new fields may
+ * only be added while none of them is running. iw->mutex must be held */
+static void iw_add_doc_fields(FrtIndexWriter *iw, FrtDocument *doc)
+{
     int i;
-    FrtSegmentInfos *sis = iw->sis;
-    FrtSegmentInfo *si = frt_sis_new_segment(sis, 0, iw->store);
-
-    SegmentMerger *merger = sm_create(iw, si, &sis->segs[min_seg], max_seg - min_seg);
-
-    /* This is where all the action happens. */
-    si->doc_cnt = sm_merge(merger);
-
-    frt_mutex_lock(&iw->store->mutex);
-    /* delete merged segments */
-    for (i = min_seg; i < max_seg; i++) {
-        si_delete_files(sis->segs[i], iw->fis, iw->deleter);
-    }
-
-    frt_sis_del_from_to(sis, min_seg, max_seg);
-
-    if (iw->config.use_compound_file) {
-        iw_commit_compound_file(iw, si);
-        si->use_compound_file = true;
+    const int doc_size = doc->size;
+    for (i = 0; i < doc_size; i++) {
+        if (NULL == frt_fis_get_field(iw->fis, doc->fields[i]->name)) {
+            iw_wait_for_doc_writers(iw);
+            iw_wait_for_merges(iw);
+            for (; i < doc_size; i++) {
+                frt_fis_get_or_add_field(iw->fis, doc->fields[i]->name);
+            }
+        }
     }
-
-    frt_sis_write(sis, iw->store, iw->deleter);
-    deleter_commit_pending_deletions(iw->deleter);
-
-    frt_mutex_unlock(&iw->store->mutex);
-
-    sm_destroy(merger);
 }
 
-static void iw_merge_segments_from(FrtIndexWriter *iw, int min_segment)
+/* write the DocWriter's buffered documents to its segment. This only touches
+ * the DocWriter's own data so it can be done without holding iw->mutex while
+ * the DocWriter is checked out. dw->doc_num keeps counting the documents
+ * until the segment is added to the index */
+static FrtSegmentInfo *iw_flush_doc_writer(FrtDocWriter *dw)
 {
-    iw_merge_segments(iw, min_segment, iw->sis->size);
+    FrtSegmentInfo *si = dw->si;
+    si->doc_cnt = dw->doc_num;
+    dw_flush(dw);
+    dw->si = NULL;
+    return si;
 }
 
-static void iw_maybe_merge_segments(FrtIndexWriter *iw)
+/* Get a flushed segment ready to be added to the index, packing it into a
+ * compound file. Only the segment's own files are written so this is done
+ * without holding iw->mutex and the other DocWriters can carry on meanwhile.
+ * If an error is raised the segment is deleted */
+static FrtSegmentInfo *iw_prepare_segment(FrtIndexWriter *iw, FrtSegmentInfo *si)
 {
-    int target_merge_docs = iw->config.merge_factor;
-    int min_segment, merge_docs;
-    FrtSegmentInfo *si;
-
-    while (target_merge_docs > 0
-           && target_merge_docs <= iw->config.max_merge_docs) {
-        /* find segments smaller than current target size */
-        min_segment = iw->sis->size - 1;
-        merge_docs = 0;
-        while (min_segment >= 0) {
-            si = iw->sis->segs[min_segment];
-            if (si->doc_cnt >= target_merge_docs) {
-                break;
-            }
-            merge_docs += si->doc_cnt;
-            min_segment--;
+    FrtDeleter *dlr = frt_deleter_new(NULL, iw->store);
+    FRT_TRY
+        if (iw->config.use_compound_file) {
+            char cfs_name[FRT_SEGMENT_NAME_MAX_LENGTH];
+            sprintf(cfs_name, "%s.cfs", si->name);
+            iw_create_compound_file(iw->store, iw->fis, si, cfs_name, dlr);
+            si->use_compound_file = true;
         }
+        deleter_commit_pending_deletions(dlr);
+    FRT_XCATCHALL
+        si_delete_files(si, iw->fis, dlr);
+        si->use_compound_file = !si->use_compound_file;
+        si_delete_files(si, iw->fis, dlr);
+        deleter_commit_pending_deletions(dlr);
+        frt_si_close(si);
+        frt_deleter_destroy(dlr);
+    FRT_XENDTRY
+    frt_deleter_destroy(dlr);
+    return si;
+}
 
-        if (merge_docs >= target_merge_docs) { /* found a merge to do */
-            iw_merge_segments_from(iw, min_segment + 1);
-        }
-        else if (min_segment <= 0) {
-            break;
-        }
+/* Flush +dw+ and prepare its segment. iw->mutex must be held and is released
+ * while the segment is written */
+static FrtSegmentInfo *iw_flush_unlocked(FrtIndexWriter *iw, FrtDocWriter *dw)
+{
+    FrtSegmentInfo *volatile si = NULL;
+    frt_mutex_unlock(&iw->mutex);
+    FRT_TRY
+        si = iw_prepare_segment(iw, iw_flush_doc_writer(dw));
+    FRT_XFINALLY
+        frt_mutex_lock(&iw->mutex);
+    FRT_XENDTRY
+    return si;
+}
 
-        target_merge_docs *= iw->config.merge_factor;
-    }
+/* add the prepared segment of +dw+ to the SegmentInfos without writing the
+ * segments file. iw->mutex must be held */
+static void iw_add_flushed_segment(FrtIndexWriter *iw, FrtDocWriter *dw, FrtSegmentInfo *si)
+{
+    frt_sis_add_si(iw->sis, si);
+    /* the documents are counted by the SegmentInfos from now on */
+    dw->doc_num = 0;
+    iw->sis_dirty = true;
 }
 
-static void iw_flush_ram_segment(FrtIndexWriter *iw)
+/* commit the segments file and the fields file. iw->mutex must be held */
+static void iw_write_sis(FrtIndexWriter *iw)
 {
-    FrtSegmentInfos *sis = iw->sis;
-    FrtSegmentInfo *si;
-    si = sis->segs[sis->size - 1];
-    si->doc_cnt = iw->dw->doc_num;
-    dw_flush(iw->dw);
     frt_mutex_lock(&iw->store->mutex);
-    if (iw->config.use_compound_file) {
-        iw_commit_compound_file(iw, si);
-        si->use_compound_file = true;
-    }
-    /* commit the segments file and the fields file */
     frt_sis_write(iw->sis, iw->store, iw->deleter);
     deleter_commit_pending_deletions(iw->deleter);
     frt_mutex_unlock(&iw->store->mutex);
+    iw->sis_dirty = false;
+}
+
+/* add the prepared segment of +dw+ to the index. iw->mutex must be held */
+static void iw_commit_segment(FrtIndexWriter *iw, FrtDocWriter *dw, FrtSegmentInfo *si)
+{
+    iw_add_flushed_segment(iw, dw, si);
+    iw_write_sis(iw);
     iw_maybe_merge_segments(iw);
 }
 
 void frt_iw_add_doc(FrtIndexWriter *iw, FrtDocument *doc)
 {
+    FrtDocWriter *volatile dw;
+    FrtSegmentInfo *volatile si = NULL;
+
     frt_mutex_lock(&iw->mutex);
-    if (NULL == iw->dw) {
-        iw->dw = frt_dw_open(iw, frt_sis_new_segment(iw->sis, 0, iw->store));
-    }
-    else if (NULL == iw->dw->fw) {
-        frt_dw_new_segment(iw->dw, frt_sis_new_segment(iw->sis, 0, iw->store));
-    }
-    frt_dw_add_doc(iw->dw, doc);
-    if (frt_mp_used(iw->dw->mp) > iw->config.max_buffer_memory
-        || iw->dw->doc_num >= iw->config.max_buffered_docs) {
-        iw_flush_ram_segment(iw);
-    }
+    iw_add_doc_fields(iw, doc);
+    dw = iw_checkout_doc_writer(iw);
     frt_mutex_unlock(&iw->mutex);
+
+    /* analysis and flushing happen outside of the mutex so documents can be
+     * added by several threads at once, each one using its own DocWriter */
+    FRT_TRY
+        frt_dw_add_doc(dw, doc);
+        if (frt_mp_used(dw->mp) > iw->config.max_buffer_memory
+            || dw->doc_num >= iw->config.max_buffered_docs) {
+            si = iw_prepare_segment(iw, iw_flush_doc_writer(dw));
+        }
+    FRT_XCATCHALL
+        /* the analyzer may raise, don't keep the DocWriter checked out */
+        frt_mutex_lock(&iw->mutex);
+        iw_checkin_doc_writer(iw, dw);
+        frt_mutex_unlock(&iw->mutex);
+    FRT_XENDTRY
+
+    frt_mutex_lock(&iw->mutex);
+    FRT_TRY
+        if (si) {
+            iw_commit_segment(iw, dw, si);
+        }
+    FRT_XFINALLY
+        iw_checkin_doc_writer(iw, dw);
+        frt_mutex_unlock(&iw->mutex);
+    FRT_XENDTRY
+}
+
+/* Flush the documents buffered by all DocWriters. The DocWriters with
+ * buffered documents are checked out so that iw->mutex can be released while
+ * their segments are written. Unless +commit+ is set the segments are only
+ * added to iw->sis and neither written to the segments file nor merged.
+ * iw->mutex must be held */
+static void iw_flush_i(FrtIndexWriter *iw, bool commit)
+{
+    int i = 0, dw_cnt = 0;
+    FrtDocWriter **dws;
+    iw_wait_for_doc_writers(iw);
+    dws = FRT_ALLOC_N(FrtDocWriter *, iw->idle_dw_cnt + 1);
+    while (i < iw->idle_dw_cnt) {
+        if (iw->idle_dws[i]->doc_num > 0) {
+            dws[dw_cnt++] = iw->idle_dws[i];
+            iw->idle_dws[i] = iw->idle_dws[--iw->idle_dw_cnt];
+        } else {
+            i++;
+        }
+    }
+    FRT_TRY
+        for (i = 0; i < dw_cnt; i++) {
+            FrtSegmentInfo *si = iw_flush_unlocked(iw, dws[i]);
+            if (commit) {
+                iw_commit_segment(iw, dws[i], si);
+            } else {
+                iw_add_flushed_segment(iw, dws[i], si);
+            }
+        }
+    FRT_XFINALLY
+        for (i = 0; i < dw_cnt; i++) {
+            iw_checkin_doc_writer(iw, dws[i]);
+        }
+        free(dws);
+    FRT_XENDTRY
 }
 
+/* flush the buffered documents and write the segments added by
+ * frt_iw_get_reader. iw->mutex must be held */
 static void iw_commit_i(FrtIndexWriter *iw)
 {
-    if (iw->dw && iw->dw->doc_num > 0) {
-        iw_flush_ram_segment(iw);
+    iw_flush_i(iw, true);
+    if (iw->sis_dirty) {
+        iw_write_sis(iw);
     }
 }
 
 void frt_iw_commit(FrtIndexWriter *iw)
 {
     frt_mutex_lock(&iw->mutex);
-    iw_commit_i(iw);
+    FRT_TRY
+        iw_commit_i(iw);
+    FRT_XFINALLY
+        frt_mutex_unlock(&iw->mutex);
+    FRT_XENDTRY
+    iw_raise_merge_error(iw);
+}
+
+/* Open a reader on everything added to the IndexWriter so far. The buffered
+ * documents are flushed to new segments but these are neither committed nor
+ * merged, the reader works on an in-memory copy of the writer's SegmentInfos
+ * so it isn't affected by later changes. It can't be used to delete documents
+ * while the IndexWriter holds the write lock. */
+FrtIndexReader *frt_iw_get_reader(FrtIndexWriter *iw, FrtIndexReader *ir)
+{
+    FrtSegmentInfos *volatile sis = NULL;
+    FrtIndexReader *volatile reader = NULL;
+    frt_mutex_lock(&iw->mutex);
+    FRT_TRY
+        iw_flush_i(iw, false);
+        if (iw->sis_dirty) {
+            /* frt_iw_reader_is_latest tells the readers apart by version */
+            iw->sis->version++;
+        }
+        sis = sis_clone(iw->sis);
+        reader = ir_open_sis(iw->store, sis, ir);
+    FRT_XFINALLY
+        if (NULL == reader && sis) frt_sis_destroy(sis);
+        frt_mutex_unlock(&iw->mutex);
+    FRT_XENDTRY
+    return reader;
+}
+
+/* The reader is out of date if anything has been added to or deleted from
+ * the index since it was opened */
+bool frt_iw_reader_is_latest(FrtIndexWriter *iw, FrtIndexReader *ir)
+{
+    int i;
+    bool is_latest;
+    frt_mutex_lock(&iw->mutex);
+    is_latest = (NULL != ir->sis && ir->sis->version == iw->sis->version);
+    for (i = 0; is_latest && i < iw->dw_cnt; i++) {
+        if (iw->dws[i]->doc_num > 0) {
+            is_latest = false;
+        }
+    }
     frt_mutex_unlock(&iw->mutex);
+    return is_latest;
 }
 
 void frt_iw_delete_term(FrtIndexWriter *iw, ID field, const char *term) {
@@ -6103,31 +10415,36 @@ void frt_iw_delete_term(FrtIndexWriter *iw, ID field, const char *term) {
     if (field_num >= 0) {
         int i;
         frt_mutex_lock(&iw->mutex);
-        iw_commit_i(iw);
-        do {
-            FrtSegmentInfos *sis = iw->sis;
-            const int seg_cnt = sis->size;
-            bool did_delete = false;
-            for (i = 0; i < seg_cnt; i++) {
-                FrtIndexReader *ir = sr_open(sis, iw->fis, i, false, NULL);
-                FrtTermDocEnum *tde = ir->term_docs(ir);
-                ir->deleter = iw->deleter;
-                stde_seek(tde, field_num, term);
-                while (tde->next(tde)) {
-                    did_delete = true;
-                    sr_delete_doc_i(ir, STDE(tde)->doc_num);
+        FRT_TRY
+            iw_commit_i(iw);
+            /* deletions would be lost on segments which are being merged */
+            iw_wait_for_merges(iw);
+            do {
+                FrtSegmentInfos *sis = iw->sis;
+                const int seg_cnt = sis->size;
+                bool did_delete = false;
+                for (i = 0; i < seg_cnt; i++) {
+                    FrtIndexReader *ir = sr_open(sis, iw->fis, i, false, NULL);
+                    FrtTermDocEnum *tde = ir->term_docs(ir);
+                    ir->deleter = iw->deleter;
+                    stde_seek(tde, field_num, term);
+                    while (tde->next(tde)) {
+                        did_delete = true;
+                        sr_delete_doc_i(ir, STDE(tde)->doc_num);
+                    }
+                    tde_destroy(tde);
+                    sr_commit_i(ir);
+                    frt_ir_close(ir);
                 }
-                tde_destroy(tde);
-                sr_commit_i(ir);
-                frt_ir_close(ir);
-            }
-            if (did_delete) {
-                frt_mutex_lock(&iw->store->mutex);
-                frt_sis_write(iw->sis, iw->store, iw->deleter);
-                frt_mutex_unlock(&iw->store->mutex);
-            }
-        } while (0);
-        frt_mutex_unlock(&iw->mutex);
+                if (did_delete) {
+                    frt_mutex_lock(&iw->store->mutex);
+                    frt_sis_write(iw->sis, iw->store, iw->deleter);
+                    frt_mutex_unlock(&iw->store->mutex);
+                }
+            } while (0);
+        FRT_XFINALLY
+            frt_mutex_unlock(&iw->mutex);
+        FRT_XENDTRY
     }
 }
 
@@ -6136,35 +10453,40 @@ void frt_iw_delete_terms(FrtIndexWriter *iw, ID field, char **terms, const int t
     if (field_num >= 0) {
         int i;
         frt_mutex_lock(&iw->mutex);
-        iw_commit_i(iw);
-        do {
-            FrtSegmentInfos *sis = iw->sis;
-            const int seg_cnt = sis->size;
-            bool did_delete = false;
-            for (i = 0; i < seg_cnt; i++) {
-                FrtIndexReader *ir = sr_open(sis, iw->fis, i, false, NULL);
-                FrtTermDocEnum *tde = ir->term_docs(ir);
-                int j;
-                for (j = 0 ; j < term_cnt; j++) {
-                    const char *term = terms[j];
-                    ir->deleter = iw->deleter;
-                    stde_seek(tde, field_num, term);
-                    while (tde->next(tde)) {
-                        did_delete = true;
-                        sr_delete_doc_i(ir, STDE(tde)->doc_num);
+        FRT_TRY
+            iw_commit_i(iw);
+            /* deletions would be lost on segments which are being merged */
+            iw_wait_for_merges(iw);
+            do {
+                FrtSegmentInfos *sis = iw->sis;
+                const int seg_cnt = sis->size;
+                bool did_delete = false;
+                for (i = 0; i < seg_cnt; i++) {
+                    FrtIndexReader *ir = sr_open(sis, iw->fis, i, false, NULL);
+                    FrtTermDocEnum *tde = ir->term_docs(ir);
+                    int j;
+                    for (j = 0 ; j < term_cnt; j++) {
+                        const char *term = terms[j];
+                        ir->deleter = iw->deleter;
+                        stde_seek(tde, field_num, term);
+                        while (tde->next(tde)) {
+                            did_delete = true;
+                            sr_delete_doc_i(ir, STDE(tde)->doc_num);
+                        }
                     }
+                    tde_destroy(tde);
+                    sr_commit_i(ir);
+                    frt_ir_close(ir);
                 }
-                tde_destroy(tde);
-                sr_commit_i(ir);
-                frt_ir_close(ir);
-            }
-            if (did_delete) {
-                frt_mutex_lock(&iw->store->mutex);
-                frt_sis_write(iw->sis, iw->store, iw->deleter);
-                frt_mutex_unlock(&iw->store->mutex);
-            }
-        } while (0);
-        frt_mutex_unlock(&iw->mutex);
+                if (did_delete) {
+                    frt_mutex_lock(&iw->store->mutex);
+                    frt_sis_write(iw->sis, iw->store, iw->deleter);
+                    frt_mutex_unlock(&iw->store->mutex);
+                }
+            } while (0);
+        FRT_XFINALLY
+            frt_mutex_unlock(&iw->mutex);
+        FRT_XENDTRY
     }
 }
 
@@ -6172,6 +10494,7 @@ static void iw_optimize_i(FrtIndexWriter *iw)
 {
     int min_segment;
     iw_commit_i(iw);
+    iw_wait_for_merges(iw);
     while (iw->sis->size > 1
            || (iw->sis->size == 1
                && (frt_si_has_deletions(iw->sis->segs[0])
@@ -6181,27 +10504,56 @@ static void iw_optimize_i(FrtIndexWriter *iw)
                            || frt_si_has_separate_norms(iw->sis->segs[0])))))) {
         min_segment = iw->sis->size - iw->config.merge_factor;
         iw_merge_segments_from(iw, min_segment < 0 ? 0 : min_segment);
+        /* segments flushed while merging may be merging themselves */
+        iw_wait_for_merges(iw);
     }
 }
 
 void frt_iw_optimize(FrtIndexWriter *iw)
 {
     frt_mutex_lock(&iw->mutex);
-    iw_optimize_i(iw);
-    frt_mutex_unlock(&iw->mutex);
+    FRT_TRY
+        iw_optimize_i(iw);
+    FRT_XFINALLY
+        frt_mutex_unlock(&iw->mutex);
+    FRT_XENDTRY
+    iw_raise_merge_error(iw);
 }
 
 void frt_iw_close(FrtIndexWriter *iw)
 {
+    int i;
+    FrtMergeScheduler *ms = iw->merge_scheduler;
     frt_mutex_lock(&iw->mutex);
     iw_commit_i(iw);
-    if (iw->dw) {
-        frt_dw_close(iw->dw);
+    iw_wait_for_merges(iw);
+    ms->closing = true;
+    frt_cond_broadcast(&ms->cond);
+    frt_mutex_unlock(&iw->mutex);
+    for (i = 0; i < ms->thread_cnt; i++) {
+        frt_thread_join(ms->threads[i]);
+    }
+    frt_mutex_lock(&iw->mutex);
+    for (i = 0; i < iw->dw_cnt; i++) {
+        FrtDocWriter *dw = iw->dws[i];
+        FrtSegmentInfo *si = dw->si;
+        frt_dw_close(dw);
+        if (si) {
+            /* the segment was started but never flushed */
+            si_delete_files(si, iw->fis, iw->deleter);
+            frt_si_close(si);
+        }
     }
+    if (iw->dw_cnt > 0) {
+        deleter_commit_pending_deletions(iw->deleter);
+    }
+    free(iw->dws);
+    free(iw->idle_dws);
     frt_a_deref(iw->analyzer);
     frt_sis_destroy(iw->sis);
     frt_fis_deref(iw->fis);
     frt_sim_destroy(iw->similarity);
+    if (iw->config.index_sort) frt_sort_destroy(iw->config.index_sort);
     iw->write_lock->release(iw->write_lock);
     frt_close_lock(iw->write_lock);
     iw->write_lock = NULL;
@@ -6209,6 +10561,9 @@ void frt_iw_close(FrtIndexWriter *iw)
     frt_deleter_destroy(iw->deleter);
     frt_mutex_unlock(&iw->mutex);
     frt_mutex_destroy(&iw->mutex);
+    frt_cond_destroy(&iw->dw_cond);
+    ms_destroy(ms);
+    iw->merge_policy->destroy(iw->merge_policy);
     free(iw);
 }
 
@@ -6217,17 +10572,24 @@ FrtIndexWriter *frt_iw_alloc(void) {
 }
 
 FrtIndexWriter *frt_iw_open(FrtIndexWriter *iw, FrtStore *store, FrtAnalyzer *volatile analyzer, const FrtConfig *config) {
+    FrtSort *volatile index_sort;
     if (iw == NULL)
         iw = frt_iw_alloc();
     frt_mutex_init(&iw->mutex, NULL);
+    frt_cond_init(&iw->dw_cond, NULL);
     iw->store = store;
     FRT_REF(store);
     if (!config) {
         config = &frt_default_config;
     }
     iw->config = *config;
+    index_sort = config->index_sort;
+    iw->config.index_sort = NULL;
 
     FRT_TRY
+        if (index_sort) {
+            iw->config.index_sort = index_sort_clone(index_sort);
+        }
         iw->write_lock = frt_open_lock(store, FRT_WRITE_LOCK_NAME);
         if (!iw->write_lock->obtain(iw->write_lock)) {
             FRT_RAISE(FRT_LOCK_ERROR, "Couldn't obtain write lock when opening IndexWriter");
@@ -6244,6 +10606,7 @@ FrtIndexWriter *frt_iw_open(FrtIndexWriter *iw, FrtStore *store, FrtAnalyzer *vo
             iw->write_lock = NULL;
         }
         if (iw->sis) frt_sis_destroy(iw->sis);
+        if (iw->config.index_sort) frt_sort_destroy(iw->config.index_sort);
         if (analyzer) frt_a_deref((FrtAnalyzer *)analyzer);
         free(iw);
     FRT_XENDTRY
@@ -6254,6 +10617,8 @@ FrtIndexWriter *frt_iw_open(FrtIndexWriter *iw, FrtStore *store, FrtAnalyzer *vo
 
     iw->deleter = frt_deleter_new(iw->sis, store);
     deleter_delete_deletable_files(iw->deleter);
+    iw->merge_scheduler = ms_new();
+    iw->merge_policy = frt_merge_policy_new(iw->config.merge_policy);
 
     return iw;
 }
@@ -6271,11 +10636,13 @@ static void iw_cp_fields(FrtIndexWriter *iw, FrtSegmentReader *sr, const char *s
 
     sprintf(file_name, "%s.fdt", segment);
     fdt_out = store_out->new_output(store_out, file_name);
+    frt_os_set_buffer_size(fdt_out, FRT_SEQUENTIAL_BUFFER_SIZE);
     sprintf(file_name, "%s.fdx", segment);
     fdx_out = store_out->new_output(store_out, file_name);
 
     sprintf(file_name, "%s.fdt", sr_segment);
     fdt_in = store_in->open_input(store_in, file_name);
+    frt_is_set_buffer_size(fdt_in, FRT_SEQUENTIAL_BUFFER_SIZE);
     sprintf(file_name, "%s.fdx", sr_segment);
     fdx_in = store_in->open_input(store_in, file_name);
 
@@ -6290,6 +10657,30 @@ static void iw_cp_fields(FrtIndexWriter *iw, FrtSegmentReader *sr, const char *s
         frt_is_close(del_in);
     }
 
+    /* the blocks are copied as they are so the documents' block addresses
+     * stay valid. Segments written before there were blocks have no .fdb */
+    sprintf(file_name, "%s.fdb", sr_segment);
+    if (store_in->exists(store_in, file_name)) {
+        frt_off_t remainder;
+        FrtOutStream *fdb_out;
+        FrtInStream *fdb_in = store_in->open_input(store_in, file_name);
+        frt_is_set_buffer_size(fdb_in, FRT_SEQUENTIAL_BUFFER_SIZE);
+        sprintf(file_name, "%s.fdb", segment);
+        fdb_out = store_out->new_output(store_out, file_name);
+        frt_os_set_buffer_size(fdb_out, FRT_SEQUENTIAL_BUFFER_SIZE);
+        remainder = frt_is_length(fdb_in);
+        while (remainder > 0) {
+            const int len = (int)FRT_MIN(remainder, FRT_SEQUENTIAL_BUFFER_SIZE);
+            frt_is2os_copy_bytes(fdb_in, fdb_out, len);
+            remainder -= len;
+        }
+        frt_os_close(fdb_out);
+        frt_is_close(fdb_in);
+    } else {
+        sprintf(file_name, "%s.fdb", segment);
+        store_out->touch(store_out, file_name);
+    }
+
     if (map) {
         int i;
         const int max_doc = sr_max_doc(IR(sr));
@@ -6320,7 +10711,15 @@ static void iw_cp_fields(FrtIndexWriter *iw, FrtSegmentReader *sr, const char *s
                     data_len += flen + 1;
                 }
             }
-            frt_is2os_copy_bytes(fdt_in, fdt_out, data_len);
+            if (FRT_STORED_FIELDS_FORMAT_BLOCK == sr->si->stored_fields_format) {
+                if (field_cnt > 0) {
+                    /* block address and offset */
+                    frt_os_write_voff_t(fdt_out, frt_is_read_voff_t(fdt_in));
+                    frt_os_write_vint(fdt_out, frt_is_read_vint(fdt_in));
+                }
+            } else {
+                frt_is2os_copy_bytes(fdt_in, fdt_out, data_len);
+            }
 
             /* Write TermVectors */
             /* write TVs up to TV index */
@@ -6367,8 +10766,10 @@ static void iw_cp_terms(FrtIndexWriter *iw, FrtSegmentReader *sr,
 
     sprintf(file_name, "%s.tis", segment);
     tis_out = store_out->new_output(store_out, file_name);
+    frt_os_set_buffer_size(tis_out, FRT_SEQUENTIAL_BUFFER_SIZE);
     sprintf(file_name, "%s.tis", sr_segment);
     tis_in = store_in->open_input(store_in, file_name);
+    frt_is_set_buffer_size(tis_in, FRT_SEQUENTIAL_BUFFER_SIZE);
 
     sprintf(file_name, "%s.tfx", segment);
     tfx_out = store_out->new_output(store_out, file_name);
@@ -6377,13 +10778,17 @@ static void iw_cp_terms(FrtIndexWriter *iw, FrtSegmentReader *sr,
 
     sprintf(file_name, "%s.frq", segment);
     frq_out = store_out->new_output(store_out, file_name);
+    frt_os_set_buffer_size(frq_out, FRT_SEQUENTIAL_BUFFER_SIZE);
     sprintf(file_name, "%s.frq", sr_segment);
     frq_in = store_in->open_input(store_in, file_name);
+    frt_is_set_buffer_size(frq_in, FRT_SEQUENTIAL_BUFFER_SIZE);
 
     sprintf(file_name, "%s.prx", segment);
     prx_out = store_out->new_output(store_out, file_name);
+    frt_os_set_buffer_size(prx_out, FRT_SEQUENTIAL_BUFFER_SIZE);
     sprintf(file_name, "%s.prx", sr_segment);
     prx_in = store_in->open_input(store_in, file_name);
+    frt_is_set_buffer_size(prx_in, FRT_SEQUENTIAL_BUFFER_SIZE);
 
     if (map) {
         int field_cnt = frt_is_read_u32(tfx_in);
@@ -6450,6 +10855,43 @@ static void iw_cp_norms(FrtIndexWriter *iw, FrtSegmentReader *sr,
     }
 }
 
+static void iw_cp_doc_values(FrtIndexWriter *iw, FrtSegmentReader *sr,
+                             const char *segment, int *map)
+{
+    char file_name[FRT_SEGMENT_NAME_MAX_LENGTH];
+    FrtStore *store_in = sr->cfs_store ? sr->cfs_store : sr->ir.store;
+    FrtStore *store_out = iw->store;
+    FrtOutStream *dvd_out;
+    FrtInStream *dvd_in;
+    int i, field_cnt;
+
+    sprintf(file_name, "%s.dvd", segment);
+    dvd_out = store_out->new_output(store_out, file_name);
+    sprintf(file_name, "%s.dvd", sr->si->name);
+    if (!store_in->exists(store_in, file_name)) {
+        /* written before doc values were added */
+        frt_os_write_vint(dvd_out, sr_max_doc(IR(sr)));
+        frt_os_write_vint(dvd_out, 0);
+        frt_os_close(dvd_out);
+        return;
+    }
+    dvd_in = store_in->open_input(store_in, file_name);
+    frt_os_write_vint(dvd_out, frt_is_read_vint(dvd_in));
+    field_cnt = frt_is_read_vint(dvd_in);
+    frt_os_write_vint(dvd_out, field_cnt);
+    for (i = 0; i < field_cnt; i++) {
+        const int field_num = frt_is_read_vint(dvd_in);
+        const frt_uchar type = frt_is_read_byte(dvd_in);
+        const frt_u64 length = frt_is_read_u64(dvd_in);
+        frt_os_write_vint(dvd_out, map ? map[field_num] : field_num);
+        frt_os_write_byte(dvd_out, type);
+        frt_os_write_u64(dvd_out, length);
+        frt_is2os_copy_bytes(dvd_in, dvd_out, (int)length);
+    }
+    frt_is_close(dvd_in);
+    frt_os_close(dvd_out);
+}
+
 static void iw_cp_map_files(FrtIndexWriter *iw, FrtSegmentReader *sr, FrtSegmentInfo *si) {
     int i;
     FrtFieldInfos *from_fis = IR(sr)->fis;
@@ -6462,6 +10904,7 @@ static void iw_cp_map_files(FrtIndexWriter *iw, FrtSegmentReader *sr, FrtSegment
     }
 
     iw_cp_fields(iw, sr, si->name, field_map);
+    iw_cp_doc_values(iw, sr, si->name, field_map);
     iw_cp_terms( iw, sr, si->name, field_map);
     iw_cp_norms( iw, sr, si,       field_map);
 
@@ -6470,6 +10913,7 @@ static void iw_cp_map_files(FrtIndexWriter *iw, FrtSegmentReader *sr, FrtSegment
 
 static void iw_cp_files(FrtIndexWriter *iw, FrtSegmentReader *sr, FrtSegmentInfo *si) {
     iw_cp_fields(iw, sr, si->name, NULL);
+    iw_cp_doc_values(iw, sr, si->name, NULL);
     iw_cp_terms( iw, sr, si->name, NULL);
     iw_cp_norms( iw, sr, si,       NULL);
 }
@@ -6484,6 +10928,11 @@ static void iw_add_segment(FrtIndexWriter *iw, FrtSegmentReader *sr)
     bool must_map_fields = false;
 
     si->doc_cnt = IR(sr)->max_doc(IR(sr));
+    /* the postings are copied as they are */
+    si->postings_format = sr->si->postings_format;
+    si->multi_level_skips = sr->si->multi_level_skips;
+    si->skip_impacts = sr->si->skip_impacts;
+    si->stored_fields_format = sr->si->stored_fields_format;
     /* Merge FrtFieldInfos */
     for (j = 0; j < fis_size; j++) {
         FrtFieldInfo *fi = sub_fis->fields[j];
@@ -6525,18 +10974,21 @@ void frt_iw_add_readers(FrtIndexWriter *iw, FrtIndexReader **readers, const int
 {
     int i;
     frt_mutex_lock(&iw->mutex);
-    iw_optimize_i(iw);
+    FRT_TRY
+        iw_optimize_i(iw);
 
-    for (i = 0; i < r_cnt; i++) {
-        iw_add_segments(iw, readers[i]);
-    }
+        for (i = 0; i < r_cnt; i++) {
+            iw_add_segments(iw, readers[i]);
+        }
 
-    frt_mutex_lock(&iw->store->mutex);
+        frt_mutex_lock(&iw->store->mutex);
 
-    /* commit the segments file and the fields file */
-    frt_sis_write(iw->sis, iw->store, iw->deleter);
-    frt_mutex_unlock(&iw->store->mutex);
+        /* commit the segments file and the fields file */
+        frt_sis_write(iw->sis, iw->store, iw->deleter);
+        frt_mutex_unlock(&iw->store->mutex);
 
-    iw_optimize_i(iw);
-    frt_mutex_unlock(&iw->mutex);
+        iw_optimize_i(iw);
+    FRT_XFINALLY
+        frt_mutex_unlock(&iw->mutex);
+    FRT_XENDTRY
 }
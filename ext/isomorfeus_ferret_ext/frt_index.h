@@ -11,11 +11,13 @@
 #include "frt_similarity.h"
 #include "frt_bitvector.h"
 #include "frt_priorityqueue.h"
+#include "frt_fst.h"
 
 typedef struct FrtIndexReader FrtIndexReader;
 typedef struct FrtSegmentReader FrtSegmentReader;
 typedef struct FrtMultiReader FrtMultiReader;
 typedef struct FrtDeleter FrtDeleter;
+struct FrtSort;
 
 /****************************************************************************
  *
@@ -23,6 +25,36 @@ typedef struct FrtDeleter FrtDeleter;
  *
  ****************************************************************************/
 
+typedef enum {
+    FRT_MERGE_POLICY_LOG_DOC = 0,
+    FRT_MERGE_POLICY_TIERED = 1
+} FrtMergePolicyType;
+
+/* How the document numbers and frequencies of a term are stored in the .frq
+ * file and its positions in the .prx file. VINT writes a variable length int
+ * per value, BLOCK packs the documents and positions in blocks of
+ * FRT_POSTINGS_BLOCK_SIZE with a fixed number of bits per value so that they
+ * can be decoded a block at a time. */
+typedef enum {
+    FRT_POSTINGS_FORMAT_VINT = 0,
+    FRT_POSTINGS_FORMAT_BLOCK = 1
+} FrtPostingsFormat;
+
+/* How the stored fields of the documents are written. PLAIN writes the values
+ * of each document to the .fdt file, compressing each value on its own if its
+ * field asks for it. BLOCK gathers the values of consecutive documents into
+ * LZ4 compressed blocks of about FRT_STORED_FIELDS_BLOCK_SIZE bytes in the
+ * .fdb file. All blocks but the first use the first one as their dictionary
+ * so even small blocks find the values which repeat across the segment. The
+ * compression of each field is ignored by BLOCK, its values are written
+ * uncompressed into the block. */
+typedef enum {
+    FRT_STORED_FIELDS_FORMAT_PLAIN = 0,
+    FRT_STORED_FIELDS_FORMAT_BLOCK = 1
+} FrtStoredFieldsFormat;
+
+#define FRT_STORED_FIELDS_BLOCK_SIZE 16384
+
 typedef struct FrtConfig {
     int chunk_size;
     int max_buffer_memory;
@@ -33,6 +65,18 @@ typedef struct FrtConfig {
     int max_merge_docs;
     int max_field_length;
     bool use_compound_file;
+    int max_doc_writers;
+    int max_merge_threads;
+    int max_merge_bytes_per_sec;
+    FrtMergePolicyType merge_policy;
+    frt_off_t max_merged_segment_bytes;
+    int deletes_pct_allowed;
+    FrtPostingsFormat postings_format;
+    FrtStoredFieldsFormat stored_fields_format;
+    /* keep the documents of each segment in this order so that searches
+     * sorted the same way can stop early. NULL keeps them in the order they
+     * were added */
+    struct FrtSort *index_sort;
 } FrtConfig;
 
 extern const FrtConfig frt_default_config;
@@ -74,6 +118,18 @@ extern FrtHash *frt_co_hash_create();
 #define FRT_FI_COMPRESSION_BROTLI_BM 0x100
 #define FRT_FI_COMPRESSION_BZ2_BM    0x200
 #define FRT_FI_COMPRESSION_LZ4_BM    0x400
+/* two bits holding the FrtDocValuesType of the field */
+#define FRT_FI_DOC_VALUES_NUMERIC_BM    0x0800
+#define FRT_FI_DOC_VALUES_SORTED_BM     0x1000
+#define FRT_FI_DOC_VALUES_SORTED_SET_BM 0x1800
+#define FRT_FI_DOC_VALUES_BM            0x1800
+
+typedef enum {
+    FRT_DOC_VALUES_NONE = 0,
+    FRT_DOC_VALUES_NUMERIC = 1,    /* a 64 bit integer per document */
+    FRT_DOC_VALUES_SORTED = 2,     /* a string per document */
+    FRT_DOC_VALUES_SORTED_SET = 3  /* any number of strings per document */
+} FrtDocValuesType;
 
 typedef struct FrtFieldInfo {
     ID           name;
@@ -101,6 +157,8 @@ extern void frt_fi_deref(FrtFieldInfo *fi);
 #define bits_store_term_vector(bits)    ((bits & FRT_FI_STORE_TERM_VECTOR_BM) != 0)
 #define bits_store_positions(bits)      ((bits & FRT_FI_STORE_POSITIONS_BM) != 0)
 #define bits_store_offsets(bits)        ((bits & FRT_FI_STORE_OFFSETS_BM) != 0)
+#define bits_doc_values_type(bits)\
+    ((FrtDocValuesType)((bits & FRT_FI_DOC_VALUES_BM) >> 11))
 #define bits_has_norms(bits)\
     ((bits & (FRT_FI_OMIT_NORMS_BM|FRT_FI_IS_INDEXED_BM)) == FRT_FI_IS_INDEXED_BM)
 
@@ -152,6 +210,19 @@ typedef struct FrtSegmentInfo {
     int         *norm_gens;
     int         norm_gens_size;
     bool        use_compound_file;
+    bool        is_merging;
+    FrtPostingsFormat postings_format;
+    FrtStoredFieldsFormat stored_fields_format;
+    bool        multi_level_skips;
+    bool        skip_impacts;
+    struct FrtSort *index_sort; /* NULL unless the documents are sorted */
+    /* cached by frt_si_size_in_bytes for the use_compound_file state in
+     * size_is_cfs, -1 if unknown */
+    frt_off_t   size_in_bytes;
+    bool        size_is_cfs;
+    /* cached by frt_si_del_cnt for the deletion generation del_cnt_gen */
+    int         del_cnt;
+    int         del_cnt_gen;
 } FrtSegmentInfo;
 
 extern FrtSegmentInfo *frt_si_new(char *name, int doc_cnt, FrtStore *store);
@@ -176,6 +247,7 @@ typedef struct FrtSegmentInfos {
     FrtSegmentInfo **segs;
     int size;
     int capa;
+    _Atomic unsigned int ref_cnt;
 } FrtSegmentInfos;
 
 extern char *frt_fn_for_generation(char *buf, const char *base, const char *ext, frt_i64 gen);
@@ -246,8 +318,7 @@ typedef struct FrtSegmentTermIndex {
     frt_off_t       ptr;
     int         index_cnt;
     int         size;
-    char        **index_terms;
-    int         *index_term_lens;
+    FrtFst      *index_fst;     /* index terms mapped to their index offset */
     FrtTermInfo *index_term_infos;
     frt_off_t       *index_ptrs;
 } FrtSegmentTermIndex;
@@ -296,6 +367,7 @@ extern FrtTermEnum *frt_mte_new(FrtMultiReader *mr, int field_num, const char *t
 typedef struct FrtTermInfosReader {
     frt_thread_key_t thread_te;
     void             **te_bucket;
+    frt_mutex_t      mutex;
     FrtTermEnum      *orig_te;
     int              field_num;
 } FrtTermInfosReader;
@@ -314,6 +386,9 @@ extern void frt_tir_close(FrtTermInfosReader *tir);
 
 #define FRT_INDEX_INTERVAL 128
 #define FRT_SKIP_INTERVAL 16
+#define FRT_POSTINGS_BLOCK_SIZE 128
+#define FRT_SKIP_MULTIPLIER 8
+#define FRT_MAX_SKIP_LEVELS 10
 
 typedef struct FrtTermWriter {
     int          counter;
@@ -354,11 +429,30 @@ struct FrtTermDocEnum {
     int  (*read)(FrtTermDocEnum *tde, int *docs, int *freqs, int req_num);
     bool (*skip_to)(FrtTermDocEnum *tde, int target);
     int  (*next_position)(FrtTermDocEnum *tde);
+    /* optional, may be NULL. Returns the highest freq of the documents from
+     * +doc_num+ up to and including *+up_to+, which it sets, without moving
+     * the enum, or -1 if it doesn't know. +doc_num+ must not go backwards,
+     * except that a negative +doc_num+ asks for the highest freq of all the
+     * documents and can be passed at any time */
+    int  (*max_freq)(FrtTermDocEnum *tde, int doc_num, int *up_to);
     void (*close)(FrtTermDocEnum *tde);
 };
 
 /* * FrtSegmentTermDocEnum * */
 
+/* read position in one level of a term's multi-level skip data. Level n has
+ * an entry every skip_interval * FRT_SKIP_MULTIPLIER^n documents */
+typedef struct FrtSkipLevel {
+    FrtInStream *is;
+    frt_off_t   start;
+    frt_off_t   frq_ptr;
+    frt_off_t   prx_ptr;
+    frt_off_t   child_ptr;
+    int         doc;
+    int         read;
+    int         entries;
+} FrtSkipLevel;
+
 typedef struct FrtSegmentTermDocEnum FrtSegmentTermDocEnum;
 struct FrtSegmentTermDocEnum {
     FrtTermDocEnum tde;
@@ -382,16 +476,36 @@ struct FrtSegmentTermDocEnum {
     frt_off_t frq_ptr;
     frt_off_t prx_ptr;
     frt_off_t skip_ptr;
+    int *block_docs;         /* decoded block, FRT_POSTINGS_FORMAT_BLOCK only */
+    int *block_freqs;
+    int block_pos;
+    int block_size;
+    int *prx_buf;            /* decoded position deltas, block postings only */
+    int prx_buf_pos;
+    int prx_buf_size;
+    int prx_left;            /* positions of the block not yet in prx_buf */
+    FrtSkipLevel *skip_levels; /* multi-level skip data only */
+    int num_skip_levels;
+    FrtInStream *impact_in;  /* reads the freqs of skip level 0 for max_freq */
+    int impact_read;
+    int impact_doc;
+    int impact_freq;
+    int term_max_freq;
+    bool skip_impacts : 1;
     bool have_skipped : 1;
 };
 
 extern FrtTermDocEnum *frt_stde_new(FrtTermInfosReader *tir, FrtInStream *frq_in,
-                             FrtBitVector *deleted_docs, int skip_interval);
+                             FrtBitVector *deleted_docs, int skip_interval,
+                             FrtPostingsFormat postings_format,
+                             bool multi_level_skips, bool skip_impacts);
 
 /* * FrtSegmentTermDocEnum * */
 extern FrtTermDocEnum *frt_stpe_new(FrtTermInfosReader *tir, FrtInStream *frq_in,
                              FrtInStream *prx_in, FrtBitVector *deleted_docs,
-                             int skip_interval);
+                             int skip_interval,
+                             FrtPostingsFormat postings_format,
+                             bool multi_level_skips, bool skip_impacts);
 
 /****************************************************************************
  * MultipleTermDocPosEnum
@@ -498,6 +612,34 @@ extern int frt_tv_get_term_index(FrtTermVector *tv, const char *term);
 extern int frt_tv_scan_to_term_index(FrtTermVector *tv, const char *term);
 extern FrtTVTerm *frt_tv_get_tv_term(FrtTermVector *tv, const char *term);
 
+/****************************************************************************
+ *
+ * FrtStoredCache
+ *
+ ****************************************************************************/
+
+/* A bounded LRU cache of decompressed stored field data. It keeps the values
+ * of compressed fields and the blocks of FRT_STORED_FIELDS_FORMAT_BLOCK
+ * segments so documents which are loaded again and again, like the top hits
+ * of popular searches, are only decompressed once. One cache can be shared
+ * by any number of IndexReaders and threads. */
+typedef struct FrtStoredCache FrtStoredCache;
+
+/* Tells the segments apart in a FrtStoredCache. The store generation stands
+ * for the store the segment is in and the index created in it, see
+ * FrtStore.generation */
+typedef struct FrtStoredCacheKey {
+    frt_u64 store_gen;
+    char    *segment;
+} FrtStoredCacheKey;
+
+extern FrtStoredCache *frt_sc_new(frt_off_t max_bytes);
+extern void frt_sc_deref(FrtStoredCache *sc);
+extern frt_u64 frt_sc_hits(FrtStoredCache *sc);
+extern frt_u64 frt_sc_misses(FrtStoredCache *sc);
+extern frt_off_t frt_sc_bytes(FrtStoredCache *sc);
+extern frt_off_t frt_sc_max_bytes(FrtStoredCache *sc);
+
 /****************************************************************************
  *
  * FrtLazyDoc
@@ -527,6 +669,11 @@ typedef struct FrtLazyDocField {
 
 extern char *frt_lazy_df_get_data(FrtLazyDocField *self, int i);
 extern void frt_lazy_df_get_bytes(FrtLazyDocField *self, char *buf, int start, int len);
+/* Get a pointer to value +i+ right where the document is read from, when the
+ * value is stored uncompressed in memory mapped or decompressed data, or
+ * NULL. The value is not NUL terminated and it stays valid as long as
+ * self->doc->fields_in or a clone of it is open */
+extern const char *frt_lazy_df_peek_data(FrtLazyDocField *self, int i);
 
 /* * * FrtLazyDoc * * */
 struct FrtLazyDoc {
@@ -534,6 +681,9 @@ struct FrtLazyDoc {
     int             size;
     FrtLazyDocField **fields;
     FrtInStream     *fields_in;
+    FrtStoredCache  *cache;
+    FrtStoredCacheKey cache_key;
+    frt_off_t       cache_block; /* the block fields_in is, if it is one */
     bool            loaded;
 };
 
@@ -546,18 +696,30 @@ extern FrtLazyDocField *frt_lazy_doc_get(FrtLazyDoc *self, ID field);
  *
  ****************************************************************************/
 
+typedef struct FrtStoredBlockReader FrtStoredBlockReader;
+
 typedef struct FrtFieldsReader {
     int           size;
     FrtFieldInfos *fis;
     FrtStore      *store;
     FrtInStream   *fdx_in;
     FrtInStream   *fdt_in;
+    FrtStoredBlockReader *sbr; /* NULL unless the values are in blocks */
+    FrtStoredCache *cache;     /* NULL unless a cache is attached */
+    FrtStoredCacheKey cache_key;
 } FrtFieldsReader;
 
-extern FrtFieldsReader *frt_fr_open(FrtStore *store, const char *segment, FrtFieldInfos *fis);
+extern FrtFieldsReader *frt_fr_open(FrtStore *store, const char *segment, FrtFieldInfos *fis, FrtStoredFieldsFormat format);
 extern FrtFieldsReader *frt_fr_clone(FrtFieldsReader *orig);
 extern void frt_fr_close(FrtFieldsReader *fr);
+extern void frt_fr_set_stored_cache(FrtFieldsReader *fr, FrtStoredCache *sc);
 extern FrtDocument *frt_fr_get_doc(FrtFieldsReader *fr, int doc_num);
+/* Read the documents +doc_nums+ into +docs+, in the same order. The
+ * documents are read in the order they are stored in and documents close to
+ * each other are read at once. Only the +field_cnt+ +fields+ are read unless
+ * +fields+ is NULL. If an error is raised none of the documents are left in
+ * +docs+ */
+extern void frt_fr_get_docs(FrtFieldsReader *fr, const int *doc_nums, int cnt, const ID *fields, int field_cnt, FrtDocument **docs);
 extern FrtLazyDoc *frt_fr_get_lazy_doc(FrtFieldsReader *fr, int doc_num);
 extern FrtHash *frt_fr_get_tv(FrtFieldsReader *fr, int doc_num);
 extern FrtTermVector *frt_fr_get_field_tv(FrtFieldsReader *fr, int doc_num, int field_num);
@@ -568,16 +730,23 @@ extern FrtTermVector *frt_fr_get_field_tv(FrtFieldsReader *fr, int doc_num, int
  *
  ****************************************************************************/
 
+typedef struct FrtDocValuesWriter FrtDocValuesWriter;
+typedef struct FrtStoredBlockWriter FrtStoredBlockWriter;
+
 typedef struct FrtFieldsWriter {
     FrtFieldInfos *fis;
     FrtOutStream  *fdt_out;
     FrtOutStream  *fdx_out;
+    FrtOutStream  *dvd_out;
     FrtOutStream  *buffer;
+    FrtStoredBlockWriter *sbw; /* NULL unless the values go into blocks */
     FrtTVField    *tv_fields;
     frt_off_t         start_ptr;
+    FrtDocValuesWriter *dvw;
+    int           doc_num;
 } FrtFieldsWriter;
 
-extern FrtFieldsWriter *frt_fw_open(FrtStore *store, const char *segment, FrtFieldInfos *fis);
+extern FrtFieldsWriter *frt_fw_open(FrtStore *store, const char *segment, FrtFieldInfos *fis, FrtStoredFieldsFormat format);
 extern void frt_fw_close(FrtFieldsWriter *fw);
 extern void frt_fw_add_doc(FrtFieldsWriter *fw, FrtDocument *doc);
 extern void frt_fw_add_postings(FrtFieldsWriter *fw,
@@ -588,6 +757,39 @@ extern void frt_fw_add_postings(FrtFieldsWriter *fw,
                             int offset_count);
 extern void frt_fw_write_tv_index(FrtFieldsWriter *fw);
 
+/****************************************************************************
+ *
+ * FrtDocValues
+ *
+ ****************************************************************************/
+
+/*
+ * The column of a doc values field in one segment. Each document's value is
+ * packed into +width+ bytes, 0 meaning that the document has no value. For
+ * numeric fields the packed number is value - min + 1, for sorted fields it
+ * is the ord of the value + 1 where the ords index the sorted distinct
+ * values. A sorted set document has the ords set_ords[set_starts[doc]] up to
+ * set_ords[set_starts[doc + 1]] in ascending order. When the segment is
+ * memory mapped +packed+ points into the mapping, +is+ keeping it alive.
+ */
+typedef struct FrtDocValues {
+    FrtDocValuesType type;
+    int         size;
+    int         width;
+    const frt_uchar *packed;
+    FrtInStream *is;
+    frt_i64     min;
+    int         ord_cnt;
+    char        **ords;
+    int         *set_starts;
+    int         *set_ords;
+} FrtDocValues;
+
+extern bool frt_dv_has_value(FrtDocValues *dv, int doc_num);
+extern frt_i64 frt_dv_get_long(FrtDocValues *dv, int doc_num);
+extern int frt_dv_get_ord(FrtDocValues *dv, int doc_num);
+extern int frt_dv_get_ords(FrtDocValues *dv, int doc_num, const int **ords);
+
 /****************************************************************************
  *
  * FrtDeleter
@@ -631,6 +833,7 @@ struct FrtIndexReader {
     int             (*max_doc)(FrtIndexReader *ir);
     FrtDocument     *(*get_doc)(FrtIndexReader *ir, int doc_num);
     FrtLazyDoc      *(*get_lazy_doc)(FrtIndexReader *ir, int doc_num);
+    void            (*get_docs)(FrtIndexReader *ir, const int *doc_nums, int cnt, const ID *fields, int field_cnt, FrtDocument **docs);
     frt_uchar       *(*get_norms)(FrtIndexReader *ir, int field_num);
     frt_uchar       *(*get_norms_into)(FrtIndexReader *ir, int field_num, frt_uchar *buf);
     FrtTermEnum     *(*terms)(FrtIndexReader *ir, int field_num);
@@ -659,7 +862,9 @@ struct FrtIndexReader {
     FrtHash         *cache;
     FrtHash         *field_index_cache;
     frt_mutex_t     field_index_mutex;
+    FrtHash         *norm_sets;
     frt_uchar       *fake_norms;
+    FrtStoredCache  *stored_cache;
     frt_mutex_t     mutex;
     bool            has_changes : 1;
     bool            is_stale    : 1;
@@ -668,6 +873,8 @@ struct FrtIndexReader {
 };
 
 extern FrtIndexReader *frt_ir_open(FrtIndexReader *ir, FrtStore *store);
+extern FrtIndexReader *frt_ir_reopen(FrtIndexReader *ir);
+extern void frt_ir_set_stored_cache(FrtIndexReader *ir, FrtStoredCache *sc);
 extern void frt_ir_close(FrtIndexReader *ir);
 extern void frt_ir_commit(FrtIndexReader *ir);
 extern void frt_ir_delete_doc(FrtIndexReader *ir, int doc_num);
@@ -677,6 +884,8 @@ extern void frt_ir_set_norm(FrtIndexReader *ir, int doc_num, ID field, frt_uchar
 extern frt_uchar *frt_ir_get_norms_i(FrtIndexReader *ir, int field_num);
 extern frt_uchar *frt_ir_get_norms(FrtIndexReader *ir, ID field);
 extern frt_uchar *frt_ir_get_norms_into(FrtIndexReader *ir, ID field, frt_uchar *buf);
+#define FRT_NORM_SET_SIZE (256 / 32)
+extern void frt_ir_get_norm_set(FrtIndexReader *ir, ID field, frt_u32 *set);
 extern FrtDocument *frt_ir_get_doc_with_term(FrtIndexReader *ir, ID field, const char *term);
 extern FrtTermEnum *frt_ir_terms(FrtIndexReader *ir, ID field);
 extern FrtTermEnum *frt_ir_terms_from(FrtIndexReader *ir, ID field, const char *t);
@@ -684,6 +893,7 @@ extern FrtTermDocEnum *ir_term_docs_for(FrtIndexReader *ir, ID field, const char
 extern FrtTermDocEnum *frt_ir_term_positions_for(FrtIndexReader *ir, ID field, const char *t);
 extern void frt_ir_add_cache(FrtIndexReader *ir);
 extern bool frt_ir_is_latest(FrtIndexReader *ir);
+extern FrtIndexReader *frt_ir_core(FrtIndexReader *ir);
 
 /****************************************************************************
  * FrtSegmentReader
@@ -703,12 +913,16 @@ struct FrtSegmentReader {
     void                 **fr_bucket;
     FrtHash              *norms;
     FrtStore             *cfs_store;
+    FrtHash              *doc_values;
+    /* the SegmentReader whose files this one shares, see sr_open_shared */
+    FrtSegmentReader     *core;
     bool                 deleted_docs_dirty : 1;
     bool                 undelete_all : 1;
     bool                 norms_dirty : 1;
 };
 
 extern FrtSegmentReader *frt_sr_alloc();
+extern FrtDocValues *frt_sr_get_doc_values(FrtIndexReader *ir, ID field);
 
 /****************************************************************************
  * FrtMultiReader
@@ -754,6 +968,7 @@ typedef struct FrtFieldInverter {
 
 #define DW_OFFSET_INIT_CAPA 512
 typedef struct FrtIndexWriter FrtIndexWriter;
+typedef struct FrtMergeScheduler FrtMergeScheduler;
 
 typedef struct FrtDocWriter {
     FrtStore        *store;
@@ -768,11 +983,13 @@ typedef struct FrtDocWriter {
     FrtOffset       *offsets;
     int offsets_size;
     int offsets_capa;
-    int doc_num;
+    /* the buffered documents, read by the IndexWriter while adding */
+    _Atomic int doc_num;
     int index_interval;
     int skip_interval;
     int max_field_length;
     int max_buffered_docs;
+    struct FrtSort *index_sort; /* NULL unless the documents are sorted */
 } FrtDocWriter;
 
 extern FrtDocWriter *frt_dw_open(FrtIndexWriter *is, FrtSegmentInfo *si);
@@ -784,6 +1001,32 @@ extern FrtHash *frt_dw_invert_field(FrtDocWriter *dw, FrtFieldInverter *fld_inv,
 extern FrtFieldInverter *frt_dw_get_fld_inv(FrtDocWriter *dw, FrtFieldInfo *fi);
 extern void frt_dw_reset_postings(FrtHash *postings);
 
+/****************************************************************************
+ *
+ * FrtMergePolicy
+ *
+ ****************************************************************************/
+
+/* segments smaller than this are treated as being this size by the tiered
+ * merge policy so that lots of tiny segments get merged eagerly */
+#define FRT_TIERED_FLOOR_SEGMENT_BYTES 0x200000
+
+typedef struct FrtMergePolicy FrtMergePolicy;
+struct FrtMergePolicy {
+    /* Find a run of segments worth merging. Segments which are already being
+     * merged (si->is_merging) must not be chosen. Sets [*min_seg, *max_seg)
+     * and returns true if a merge was found. */
+    bool (*find_merge)(FrtMergePolicy *mp, FrtSegmentInfos *sis,
+                       const FrtConfig *config, int *min_seg, int *max_seg);
+    void (*destroy)(FrtMergePolicy *mp);
+};
+
+extern FrtMergePolicy *frt_log_doc_merge_policy_new(void);
+extern FrtMergePolicy *frt_tiered_merge_policy_new(void);
+extern FrtMergePolicy *frt_merge_policy_new(FrtMergePolicyType type);
+extern frt_off_t frt_si_size_in_bytes(FrtSegmentInfo *si);
+extern int frt_si_del_cnt(FrtSegmentInfo *si);
+
 /****************************************************************************
  *
  * FrtIndexWriter
@@ -796,8 +1039,20 @@ struct FrtIndexWriter {
     FrtStore        *store;
     FrtAnalyzer     *analyzer;
     FrtSegmentInfos *sis;
+    /* segments have been added to sis for a reader but not committed */
+    bool            sis_dirty;
     FrtFieldInfos   *fis;
-    FrtDocWriter    *dw;
+    /* each indexing thread checks out its own DocWriter which flushes to its
+     * own segment. dws holds all of them, idle_dws the ones not in use */
+    FrtDocWriter    **dws;
+    FrtDocWriter    **idle_dws;
+    int             dw_cnt;
+    int             idle_dw_cnt;
+    int             dw_capa;
+    int             dw_waiting;
+    frt_cond_t      dw_cond;
+    FrtMergeScheduler *merge_scheduler;
+    FrtMergePolicy  *merge_policy;
     FrtSimilarity   *similarity;
     FrtLock         *write_lock;
     FrtDeleter      *deleter;
@@ -815,6 +1070,9 @@ extern int frt_iw_doc_count(FrtIndexWriter *iw);
 extern void frt_iw_commit(FrtIndexWriter *iw);
 extern void frt_iw_optimize(FrtIndexWriter *iw);
 extern void frt_iw_add_readers(FrtIndexWriter *iw, FrtIndexReader **readers, const int r_cnt);
+extern FrtIndexReader *frt_iw_get_reader(FrtIndexWriter *iw, FrtIndexReader *ir);
+extern bool frt_iw_reader_is_latest(FrtIndexWriter *iw, FrtIndexReader *ir);
+extern void frt_iw_set_merge_policy(FrtIndexWriter *iw, FrtMergePolicy *mp);
 
 /****************************************************************************
  *
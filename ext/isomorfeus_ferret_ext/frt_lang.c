@@ -6,6 +6,7 @@
 #include "frt_lang.h"
 #include "frt_except.h"
 #include "frt_global.h"
+#include "frt_threading.h"
 
 /* emalloc: malloc and report if error */
 void *frt_emalloc(size_t size)
@@ -44,7 +45,11 @@ void *frt_erealloc(void *ptr, size_t size)
 }
 
 void frt_micro_sleep(const int micro_seconds) {
-    rb_thread_wait_for(rb_time_interval(rb_float_new((double)micro_seconds/1000000.0)));
+    if (frt_thread_has_gvl()) {
+        rb_thread_wait_for(rb_time_interval(rb_float_new((double)micro_seconds/1000000.0)));
+    } else {
+        usleep(micro_seconds);
+    }
 }
 
 /* void frt_micro_sleep(const int micro_seconds)
@@ -1,4 +1,5 @@
 #include <string.h>
+#include <float.h>
 #include "frt_search.h"
 #include "frt_array.h"
 
@@ -55,6 +56,13 @@ typedef struct DisjunctionSumScorer {
     int             ss_cnt;
     FrtPriorityQueue  *scorer_queue;
     Coordinator    *coordinator;
+    /* dynamic pruning, see dssc_set_min_score */
+    float           min_score;
+    FrtScorer       **live;
+    float           *bounds;
+    int             live_cnt;
+    int             non_essential_cnt;
+    int             window_end;
 } DisjunctionSumScorer;
 
 static float dssc_score(FrtScorer *self) {
@@ -123,7 +131,191 @@ static bool dssc_advance_after_current(FrtScorer *self) {
     }
 }
 
+/*
+ * Dynamic pruning
+ *
+ * Once the searcher has a full queue of hits it passes on the lowest score
+ * in it and the scorer switches from the scorer_queue to the MaxScore
+ * algorithm. The documents are scored in windows within which every
+ * sub-scorer has a bound on its scores. The sub-scorers with the lowest
+ * bounds whose bounds add up to less than min_score are non-essential: a
+ * document matching only those can't make it into the hits so only the
+ * documents of the essential sub-scorers are visited. The non-essential
+ * sub-scorers are only moved to a document while the bounds say it can
+ * still get to min_score. Windows where even all bounds together fall short
+ * are skipped whole.
+ */
+static void dssc_remove_live(DisjunctionSumScorer *dssc, int i)
+{
+    dssc->live_cnt--;
+    memmove(dssc->live + i, dssc->live + i + 1,
+            (dssc->live_cnt - i) * sizeof(FrtScorer *));
+    memmove(dssc->bounds + i, dssc->bounds + i + 1,
+            (dssc->live_cnt - i) * sizeof(float));
+    dssc->window_end = -1; /* the window has to be worked out again */
+}
+
+/* work out the window starting at +target+, sorting the live sub-scorers by
+ * their bounds, lowest first, and replacing the bounds with their running
+ * sums. Returns the start of the first window with a chance of a hit, or -1
+ * if there is none */
+static int dssc_next_window(DisjunctionSumScorer *dssc, int target)
+{
+    FrtScorer **live = dssc->live;
+    float *bounds = dssc->bounds;
+    int i, j;
+
+    while (true) {
+        float sum = 0.0f;
+        dssc->window_end = INT_MAX;
+        dssc->non_essential_cnt = 0;
+        for (i = 0; i < dssc->live_cnt; i++) {
+            FrtScorer *sub = live[i];
+            int up_to = INT_MAX;
+            float bound = sub->max_score ? sub->max_score(sub, target, &up_to)
+                                         : FLT_MAX;
+            if (up_to < dssc->window_end) dssc->window_end = up_to;
+            for (j = i; j > 0 && bounds[j - 1] > bound; j--) {
+                bounds[j] = bounds[j - 1];
+                live[j] = live[j - 1];
+            }
+            bounds[j] = bound;
+            live[j] = sub;
+        }
+        for (i = 0; i < dssc->live_cnt; i++) {
+            sum = bounds[i] += sum;
+            if (sum < dssc->min_score) {
+                dssc->non_essential_cnt = i + 1;
+            }
+        }
+        if (dssc->non_essential_cnt < dssc->live_cnt) {
+            return target;
+        }
+        if (dssc->window_end == INT_MAX) {
+            return -1;
+        }
+        target = dssc->window_end + 1;
+    }
+}
+
+static bool dssc_prune_to(FrtScorer *self, int target)
+{
+    DisjunctionSumScorer *dssc = DSSc(self);
+    FrtScorer **live = dssc->live;
+
+    while (dssc->live_cnt > 0) {
+        int i, doc = INT_MAX;
+        float score = 0.0f;
+        bool removed = false;
+
+        if (target > dssc->window_end) {
+            if (0 > (target = dssc_next_window(dssc, target))) {
+                return false;
+            }
+        }
+
+        /* bring the essential sub-scorers up to the target. The first of
+         * their documents is the next candidate */
+        for (i = dssc->non_essential_cnt; i < dssc->live_cnt; i++) {
+            FrtScorer *sub = live[i];
+            if (sub->doc < target && !sub->skip_to(sub, target)) {
+                dssc_remove_live(dssc, i);
+                removed = true;
+                break;
+            }
+            if (sub->doc < doc) doc = sub->doc;
+        }
+        if (removed) continue;
+        if (doc > dssc->window_end) {
+            target = dssc->window_end + 1;
+            continue;
+        }
+
+        dssc->num_matches = 0;
+        for (i = dssc->non_essential_cnt; i < dssc->live_cnt; i++) {
+            if (live[i]->doc == doc) {
+                score += live[i]->score(live[i]);
+                dssc->num_matches++;
+            }
+        }
+        /* bounds[i] is now the bound of the non-essential sub-scorers up to
+         * and including i */
+        for (i = dssc->non_essential_cnt - 1; i >= 0; i--) {
+            FrtScorer *sub = live[i];
+            if (score + dssc->bounds[i] < dssc->min_score) {
+                break;
+            }
+            if (sub->doc < doc && !sub->skip_to(sub, doc)) {
+                dssc_remove_live(dssc, i);
+                removed = true;
+                continue;
+            }
+            if (sub->doc == doc) {
+                score += sub->score(sub);
+                dssc->num_matches++;
+            }
+        }
+        if (i < 0) {
+            self->doc = doc;
+            dssc->cum_score = score;
+            return true;
+        }
+        target = doc + 1;
+    }
+    return false;
+}
+
+/* the sum of the bounds of the sub-scorers up to the first of their up_tos.
+ * rossc_set_min_score only asks for the bound of all the documents so this
+ * doesn't get in the way of the bounds dssc_next_window works through */
+static float dssc_max_score(FrtScorer *self, int doc_num, int *up_to)
+{
+    DisjunctionSumScorer *dssc = DSSc(self);
+    float sum = 0.0f;
+    int i;
+
+    *up_to = INT_MAX;
+    for (i = 0; i < dssc->ss_cnt; i++) {
+        FrtScorer *sub = dssc->sub_scorers[i];
+        int sub_up_to = INT_MAX;
+        const float bound = sub->max_score(sub, doc_num, &sub_up_to);
+        if (bound >= FLT_MAX) {
+            return FLT_MAX;
+        }
+        sum += bound;
+        if (sub_up_to < *up_to) *up_to = sub_up_to;
+    }
+    return sum;
+}
+
+static bool dssc_set_min_score(FrtScorer *self, float min_score)
+{
+    DisjunctionSumScorer *dssc = DSSc(self);
+    int i;
+
+    if (NULL == dssc->live) {
+        if (NULL == dssc->scorer_queue) {
+            dssc_init_scorer_queue(dssc);
+        }
+        /* the scorers left in the queue are all after the current doc */
+        dssc->live = FRT_ALLOC_N(FrtScorer *, dssc->ss_cnt);
+        dssc->bounds = FRT_ALLOC_N(float, dssc->ss_cnt);
+        dssc->live_cnt = dssc->scorer_queue->size;
+        for (i = 0; i < dssc->live_cnt; i++) {
+            dssc->live[i] = (FrtScorer *)dssc->scorer_queue->heap[i + 1];
+        }
+        dssc->window_end = -1;
+    }
+    /* leave room for rounding as the scores may be added up in a different
+     * order to the bounds */
+    dssc->min_score = min_score * (1.0f - 1e-5f);
+    return true;
+}
+
 static bool dssc_next(FrtScorer *self) {
+    if (DSSc(self)->live) {
+        return dssc_prune_to(self, self->doc + 1);
+    }
     if (DSSc(self)->scorer_queue == NULL) {
         dssc_init_scorer_queue(DSSc(self));
     }
@@ -145,12 +337,15 @@ static bool dssc_skip_to(FrtScorer *self, int doc_num) {
         scorer_queue = dssc->scorer_queue;
     }
 
-    if (scorer_queue->size < dssc->min_num_matches) {
-        return false;
-    }
     if (doc_num <= self->doc) {
         doc_num = self->doc + 1;
     }
+    if (dssc->live) {
+        return dssc_prune_to(self, doc_num);
+    }
+    if (scorer_queue->size < dssc->min_num_matches) {
+        return false;
+    }
     while (true) {
         FrtScorer *top = (FrtScorer *)frt_pq_top(scorer_queue);
         if (top->doc >= doc_num) {
@@ -192,6 +387,8 @@ static void dssc_destroy(FrtScorer *self)
     if (dssc->scorer_queue) {
         frt_pq_destroy(dssc->scorer_queue);
     }
+    free(dssc->live);
+    free(dssc->bounds);
     frt_scorer_destroy_i(self);
 }
 
@@ -230,6 +427,22 @@ static FrtScorer *disjunction_sum_scorer_new(FrtScorer **sub_scorers, int ss_cnt
     self->explain = &dssc_explain;
     self->destroy = &dssc_destroy;
 
+    /* pruning needs bounds and every document to come from one sub-scorer */
+    if (1 == min_num_matches) {
+        int i, bound_cnt = 0;
+        for (i = 0; i < ss_cnt; i++) {
+            if (NULL != sub_scorers[i]->max_score) {
+                bound_cnt++;
+            }
+        }
+        if (bound_cnt > 0) {
+            self->set_min_score = &dssc_set_min_score;
+        }
+        if (bound_cnt == ss_cnt) {
+            self->max_score = &dssc_max_score;
+        }
+    }
+
     return self;
 }
 
@@ -498,6 +711,18 @@ static FrtExplanation *smsc_explain(FrtScorer *self, int doc_num)
     return scorer->explain(scorer, doc_num);
 }
 
+static float smsc_max_score(FrtScorer *self, int doc_num, int *up_to)
+{
+    FrtScorer *scorer = SMSc(self)->scorer;
+    return scorer->max_score(scorer, doc_num, up_to);
+}
+
+static bool smsc_set_min_score(FrtScorer *self, float min_score)
+{
+    FrtScorer *scorer = SMSc(self)->scorer;
+    return scorer->set_min_score(scorer, min_score);
+}
+
 static void smsc_destroy(FrtScorer *self)
 {
     FrtScorer *scorer = SMSc(self)->scorer;
@@ -517,6 +742,12 @@ static FrtScorer *single_match_scorer_new(Coordinator *coordinator,
     self->skip_to           = &smsc_skip_to;
     self->explain           = &smsc_explain;
     self->destroy           = &smsc_destroy;
+    if (NULL != scorer->max_score) {
+        self->max_score     = &smsc_max_score;
+    }
+    if (NULL != scorer->set_min_score) {
+        self->set_min_score = &smsc_set_min_score;
+    }
     return self;
 }
 
@@ -607,6 +838,27 @@ static void rossc_destroy(FrtScorer *self)
 }
 
 
+/* a document can only compete if its required score reaches min_score less
+ * the most the optional scorer could add to it */
+static bool rossc_set_min_score(FrtScorer *self, float min_score)
+{
+    FrtScorer *req_scorer = ROSSc(self)->req_scorer;
+    FrtScorer *opt_scorer = ROSSc(self)->opt_scorer;
+    float opt_bound = 0.0f;
+
+    if (NULL != opt_scorer) {
+        int up_to;
+        if (NULL == opt_scorer->max_score
+            || FLT_MAX <= (opt_bound = opt_scorer->max_score(opt_scorer, -1,
+                                                              &up_to))) {
+            return false;
+        }
+    }
+    /* leave room for rounding as the scores are added up differently */
+    return req_scorer->set_min_score(req_scorer, min_score * (1.0f - 1e-5f)
+                                                 - opt_bound * (1.0f + 1e-5f));
+}
+
 static FrtScorer *req_opt_sum_scorer_new(FrtScorer *req_scorer, FrtScorer *opt_scorer)
 {
     FrtScorer *self = frt_scorer_new(ReqOptSumScorer, NULL);
@@ -620,6 +872,9 @@ static FrtScorer *req_opt_sum_scorer_new(FrtScorer *req_scorer, FrtScorer *opt_s
     self->skip_to = &rossc_skip_to;
     self->explain = &rossc_explain;
     self->destroy = &rossc_destroy;
+    if (NULL != req_scorer->set_min_score) {
+        self->set_min_score = &rossc_set_min_score;
+    }
 
     return self;
 }
@@ -767,6 +1022,13 @@ static void rxsc_destroy(FrtScorer *self)
     frt_scorer_destroy_i(self);
 }
 
+/* excluding documents can't raise the score of the others */
+static bool rxsc_set_min_score(FrtScorer *self, float min_score)
+{
+    FrtScorer *req_scorer = RXSc(self)->req_scorer;
+    return req_scorer->set_min_score(req_scorer, min_score);
+}
+
 static FrtScorer *req_excl_scorer_new(FrtScorer *req_scorer, FrtScorer *excl_scorer)
 {
     FrtScorer *self            = frt_scorer_new(ReqExclScorer, NULL);
@@ -779,6 +1041,9 @@ static FrtScorer *req_excl_scorer_new(FrtScorer *req_scorer, FrtScorer *excl_sco
     self->skip_to           = &rxsc_skip_to;
     self->explain           = &rxsc_explain;
     self->destroy           = &rxsc_destroy;
+    if (NULL != req_scorer->set_min_score) {
+        self->set_min_score = &rxsc_set_min_score;
+    }
 
     return self;
 }
@@ -1022,6 +1287,30 @@ static bool bsc_skip_to(FrtScorer *self, int doc_num)
     }
 }
 
+/* the sum of the sub-scores is scaled by the coord factor so the threshold
+ * for the sum is min_score divided by the highest of the factors */
+static bool bsc_set_min_score(FrtScorer *self, float min_score)
+{
+    BooleanScorer *bsc = BSc(self);
+    FrtScorer *cnt_sum_sc = bsc->counting_sum_scorer;
+    Coordinator *coord = bsc->coordinator;
+    float max_coord_factor = 0.0f;
+    int i;
+
+    if (NULL == cnt_sum_sc || NULL == cnt_sum_sc->set_min_score) {
+        return false;
+    }
+    for (i = 0; i <= coord->max_coord; i++) {
+        if (coord->coord_factors[i] > max_coord_factor) {
+            max_coord_factor = coord->coord_factors[i];
+        }
+    }
+    if (max_coord_factor > 0.0f) {
+        return cnt_sum_sc->set_min_score(cnt_sum_sc, min_score / max_coord_factor);
+    }
+    return false;
+}
+
 static void bsc_destroy(FrtScorer *self)
 {
     BooleanScorer *bsc = BSc(self);
@@ -1070,6 +1359,7 @@ static FrtScorer *bsc_new(FrtSimilarity *similarity)
     self->skip_to   = &bsc_skip_to;
     self->explain   = &bsc_explain;
     self->destroy   = &bsc_destroy;
+    self->set_min_score = &bsc_set_min_score;
     return self;
 }
 
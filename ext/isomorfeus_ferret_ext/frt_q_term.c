@@ -1,5 +1,7 @@
 #include "frt_global.h"
 #include <string.h>
+#include <float.h>
+#include <limits.h>
 #include "frt_search.h"
 
 // #undef close
@@ -27,6 +29,11 @@ typedef struct TermScorer {
     FrtWeight      *weight;
     FrtTermDocEnum *tde;
     frt_uchar      *norms;
+    FrtIndexReader *ir;
+    ID             field;
+    float          max_norm;
+    float          min_score;
+    int            window_end;
     float          weight_value;
 } TermScorer;
 
@@ -87,6 +94,72 @@ static bool tsc_skip_to(FrtScorer *self, int doc_num) {
     }
 }
 
+/* the highest norm of any document. Only looked for once it is needed. The
+ * reader keeps the set of norm bytes used so the norms aren't scanned again */
+static float tsc_max_norm(TermScorer *ts) {
+    frt_u32 seen[FRT_NORM_SET_SIZE];
+    float max_norm = 0.0f;
+    int i;
+
+    frt_ir_get_norm_set(ts->ir, ts->field, seen);
+    for (i = 0; i < 256; i++) {
+        if (seen[i >> 5] & (1U << (i & 31))) {
+            float norm = frt_sim_decode_norm(ts->super.similarity, (frt_uchar)i);
+            if (norm > max_norm) max_norm = norm;
+        }
+    }
+    return max_norm;
+}
+
+/* the scores are worked out just as tsc_score does so the bound can't fall
+ * short through rounding. This relies on tf never going down as the freq
+ * goes up */
+static float tsc_max_score(FrtScorer *self, int doc_num, int *up_to) {
+    TermScorer *ts = TSc(self);
+    int max_freq = ts->tde->max_freq(ts->tde, doc_num, up_to);
+
+    if (max_freq < 0 || ts->weight_value < 0.0f) {
+        return FLT_MAX;
+    }
+    if (ts->max_norm < 0.0f) {
+        ts->max_norm = tsc_max_norm(ts);
+    }
+    return frt_sim_tf(self->similarity, (float)max_freq) * ts->weight_value
+        * ts->max_norm;
+}
+
+/* move on from the current document until it is in a block whose bound
+ * reaches min_score. Those blocks are found with the skip data so the
+ * documents in between are never read */
+static bool tsc_competitive(FrtScorer *self) {
+    TermScorer *ts = TSc(self);
+
+    while (self->doc > ts->window_end) {
+        int up_to;
+        if (tsc_max_score(self, self->doc, &up_to) >= ts->min_score) {
+            ts->window_end = up_to;
+        } else if (INT_MAX == up_to || !tsc_skip_to(self, up_to + 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool tsc_next_competitive(FrtScorer *self) {
+    return tsc_next(self) && tsc_competitive(self);
+}
+
+static bool tsc_skip_to_competitive(FrtScorer *self, int doc_num) {
+    return tsc_skip_to(self, doc_num) && tsc_competitive(self);
+}
+
+static bool tsc_set_min_score(FrtScorer *self, float min_score) {
+    TSc(self)->min_score = min_score;
+    self->next      = &tsc_next_competitive;
+    self->skip_to   = &tsc_skip_to_competitive;
+    return true;
+}
+
 static FrtExplanation *tsc_explain(FrtScorer *self, int doc_num) {
     TermScorer *ts = TSc(self);
     FrtQuery *query = ts->weight->get_query(ts->weight);
@@ -106,12 +179,17 @@ static void tsc_destroy(FrtScorer *self) {
     frt_scorer_destroy_i(self);
 }
 
-static FrtScorer *tsc_new(FrtWeight *weight, FrtTermDocEnum *tde, frt_uchar *norms) {
+static FrtScorer *tsc_new(FrtWeight *weight, FrtTermDocEnum *tde, frt_uchar *norms,
+                          FrtIndexReader *ir, ID field) {
     int i;
     FrtScorer *self            = frt_scorer_new(TermScorer, weight->similarity);
     TSc(self)->weight       = weight;
     TSc(self)->tde          = tde;
     TSc(self)->norms        = norms;
+    TSc(self)->ir           = ir;
+    TSc(self)->field        = field;
+    TSc(self)->max_norm     = -1.0f;
+    TSc(self)->window_end   = -1;
     TSc(self)->weight_value = weight->value;
 
     for (i = 0; i < SCORE_CACHE_SIZE; i++) {
@@ -124,6 +202,10 @@ static FrtScorer *tsc_new(FrtWeight *weight, FrtTermDocEnum *tde, frt_uchar *nor
     self->skip_to           = &tsc_skip_to;
     self->explain           = &tsc_explain;
     self->destroy           = &tsc_destroy;
+    if (NULL != tde->max_freq) {
+        self->max_score     = &tsc_max_score;
+        self->set_min_score = &tsc_set_min_score;
+    }
     return self;
 }
 
@@ -139,7 +221,7 @@ static FrtScorer *tw_scorer(FrtWeight *self, FrtIndexReader *ir) {
     /* ir_term_docs_for should always return a TermDocEnum */
     assert(NULL != tde);
 
-    return tsc_new(self, tde, frt_ir_get_norms(ir, tq->field));
+    return tsc_new(self, tde, frt_ir_get_norms(ir, tq->field), ir, tq->field);
 }
 
 static FrtExplanation *tw_explain(FrtWeight *self, FrtIndexReader *ir, int doc_num) {
@@ -32,14 +32,24 @@ static void rf_close(void *p) {
     }
 }
 
+/* The directory Hash is guarded by store->mutex_i as segments may be
+ * written by several DocWriters at the same time. */
 static void ram_touch(FrtStore *store, const char *filename) {
+    frt_mutex_lock(&store->mutex_i);
     if (frt_h_get(store->dir.ht, filename) == NULL) {
-        frt_h_set(store->dir.ht, filename, rf_new(filename));
+        /* the file owns the key, +filename+ may not outlive it */
+        FrtRAMFile *rf = rf_new(filename);
+        frt_h_set(store->dir.ht, rf->name, rf);
     }
+    frt_mutex_unlock(&store->mutex_i);
 }
 
 static int ram_exists(FrtStore *store, const char *filename) {
-    if (frt_h_get(store->dir.ht, filename) != NULL) {
+    FrtRAMFile *rf;
+    frt_mutex_lock(&store->mutex_i);
+    rf = (FrtRAMFile *)frt_h_get(store->dir.ht, filename);
+    frt_mutex_unlock(&store->mutex_i);
+    if (rf != NULL) {
         return true;
     } else {
         return false;
@@ -47,7 +57,10 @@ static int ram_exists(FrtStore *store, const char *filename) {
 }
 
 static int ram_remove(FrtStore *store, const char *filename) {
-    FrtRAMFile *rf = (FrtRAMFile *)frt_h_rem(store->dir.ht, filename, false);
+    FrtRAMFile *rf;
+    frt_mutex_lock(&store->mutex_i);
+    rf = (FrtRAMFile *)frt_h_rem(store->dir.ht, filename, false);
+    frt_mutex_unlock(&store->mutex_i);
     if (rf != NULL) {
         rf_close(rf);
         return true;
@@ -57,10 +70,13 @@ static int ram_remove(FrtStore *store, const char *filename) {
 }
 
 static void ram_rename(FrtStore *store, const char *from, const char *to) {
-    FrtRAMFile *rf = (FrtRAMFile *)frt_h_rem(store->dir.ht, from, false);
+    FrtRAMFile *rf;
     FrtRAMFile *tmp;
 
+    frt_mutex_lock(&store->mutex_i);
+    rf = (FrtRAMFile *)frt_h_rem(store->dir.ht, from, false);
     if (rf == NULL) {
+        frt_mutex_unlock(&store->mutex_i);
         FRT_RAISE(FRT_IO_ERROR, "couldn't rename \"%s\" to \"%s\". \"%s\""
               " doesn't exist", from, to, from);
     }
@@ -76,6 +92,7 @@ static void ram_rename(FrtStore *store, const char *from, const char *to) {
     }
 
     frt_h_set(store->dir.ht, rf->name, rf);
+    frt_mutex_unlock(&store->mutex_i);
 }
 
 static int ram_count(FrtStore *store) {
@@ -137,7 +154,10 @@ static void ram_clear_all(FrtStore *store) {
 }
 
 static frt_off_t ram_length(FrtStore *store, const char *filename) {
-    FrtRAMFile *rf = (FrtRAMFile *)frt_h_get(store->dir.ht, filename);
+    FrtRAMFile *rf;
+    frt_mutex_lock(&store->mutex_i);
+    rf = (FrtRAMFile *)frt_h_get(store->dir.ht, filename);
+    frt_mutex_unlock(&store->mutex_i);
     if (rf != NULL) {
         return rf->len;
     } else {
@@ -145,32 +165,29 @@ static frt_off_t ram_length(FrtStore *store, const char *filename) {
     }
 }
 
+/* the stream's buffer may be larger than the file's chunks so +src+ can
+ * span any number of them */
 static void ramo_flush_i(FrtOutStream *os, const frt_uchar *src, int len) {
-    if (len == 0) { return; }
     frt_uchar *buffer;
     FrtRAMFile *rf = os->file.rf;
     int buffer_number, buffer_offset, bytes_in_buffer, bytes_to_copy;
-    int src_offset;
+    int src_offset = 0;
     frt_off_t pointer = os->pointer;
 
-    buffer_number = (int)(pointer / FRT_BUFFER_SIZE);
-    buffer_offset = pointer % FRT_BUFFER_SIZE;
-    bytes_in_buffer = FRT_BUFFER_SIZE - buffer_offset;
-    bytes_to_copy = bytes_in_buffer < len ? bytes_in_buffer : len;
-
-    rf_extend_if_necessary(rf, buffer_number);
-
-    buffer = rf->buffers[buffer_number];
-    memcpy(buffer + buffer_offset, src, bytes_to_copy);
+    while (src_offset < len) {
+        buffer_number = (int)(pointer / FRT_BUFFER_SIZE);
+        buffer_offset = pointer % FRT_BUFFER_SIZE;
+        bytes_in_buffer = FRT_BUFFER_SIZE - buffer_offset;
+        bytes_to_copy = len - src_offset;
+        if (bytes_to_copy > bytes_in_buffer) {
+            bytes_to_copy = bytes_in_buffer;
+        }
 
-    if (bytes_to_copy < len) {
-        src_offset = bytes_to_copy;
-        bytes_to_copy = len - bytes_to_copy;
-        buffer_number += 1;
         rf_extend_if_necessary(rf, buffer_number);
         buffer = rf->buffers[buffer_number];
-
-        memcpy(buffer, src + src_offset, bytes_to_copy);
+        memcpy(buffer + buffer_offset, src + src_offset, bytes_to_copy);
+        src_offset += bytes_to_copy;
+        pointer += bytes_to_copy;
     }
     os->pointer += len;
 
@@ -224,18 +241,22 @@ FrtOutStream *frt_ram_new_buffer(void) {
 
 void frt_ram_destroy_buffer(FrtOutStream *os) {
     rf_close(os->file.rf);
+    free(os->buf.buf);
     free(os);
 }
 
 static FrtOutStream *ram_new_output(FrtStore *store, const char *filename) {
-    FrtRAMFile *rf = (FrtRAMFile *)frt_h_get(store->dir.ht, filename);
+    FrtRAMFile *rf;
     FrtOutStream *os = frt_os_new();
 
+    frt_mutex_lock(&store->mutex_i);
+    rf = (FrtRAMFile *)frt_h_get(store->dir.ht, filename);
     if (rf == NULL) {
         rf = rf_new(filename);
         frt_h_set(store->dir.ht, rf->name, rf);
     }
     FRT_REF(rf);
+    frt_mutex_unlock(&store->mutex_i);
     os->pointer = 0;
     os->file.rf = rf;
     os->m = &RAM_OUT_STREAM_METHODS;
@@ -292,13 +313,17 @@ static const struct FrtInStreamMethods RAM_IN_STREAM_METHODS = {
 };
 
 static FrtInStream *ram_open_input(FrtStore *store, const char *filename) {
-    FrtRAMFile *rf = (FrtRAMFile *)frt_h_get(store->dir.ht, filename);
+    FrtRAMFile *rf;
     FrtInStream *is = NULL;
 
+    frt_mutex_lock(&store->mutex_i);
+    rf = (FrtRAMFile *)frt_h_get(store->dir.ht, filename);
     if (rf == NULL) {
+        frt_mutex_unlock(&store->mutex_i);
         FRT_RAISE(FRT_FILE_NOT_FOUND_ERROR, "tried to open \"%s\" but it doesn't exist", filename);
     }
     FRT_REF(rf);
+    frt_mutex_unlock(&store->mutex_i);
     is = frt_is_new();
     is->f->file.rf = rf;
     is->f->ref_cnt = 1;
@@ -1,5 +1,6 @@
 #include <string.h>
 #include <limits.h>
+#include <time.h>
 #include "frt_search.h"
 #include "frt_array.h"
 
@@ -181,6 +182,7 @@ FrtTopDocs *frt_td_new(int total_hits, int size, FrtHit **hits, float max_score)
     td->size = size;
     td->hits = hits;
     td->max_score = max_score;
+    td->total_hits_exact = true;
     return td;
 }
 
@@ -199,8 +201,8 @@ char *frt_td_to_s(FrtTopDocs *td)
 {
     int i;
     FrtHit *hit;
-    char *buffer = frt_strfmt("%d hits sorted by <score, doc_num>\n",
-                          td->total_hits);
+    char *buffer = frt_strfmt("%d%s hits sorted by <score, doc_num>\n",
+                          td->total_hits, td->total_hits_exact ? "" : "+");
     for (i = 0; i < td->size; i++) {
         hit = td->hits[i];
         frt_estrcat(buffer, frt_strfmt("\t%d:%f\n", hit->doc, hit->score));
@@ -941,6 +943,224 @@ static FrtSimilarity *sea_get_similarity(FrtSearcher *self)
     return self->similarity;
 }
 
+/***************************************************************************
+ *
+ * Parallel search tasks
+ *
+ ***************************************************************************/
+
+/*
+ * The tasks are run by a pool of threads shared by all searchers. The pool
+ * starts without threads and grows to the largest number of helper threads a
+ * search has asked for, up to SEA_POOL_MAX_THREADS. The threads are never
+ * stopped, they wait for the next search once they are done.
+ */
+#define SEA_POOL_MAX_THREADS 64
+/* how often, in ms, a searching thread waiting for the pool checks whether
+ * it has been interrupted */
+#define SEA_POOL_WAIT_MS 10
+
+typedef struct ParallelTasks {
+    void        (*run)(void *task);
+    char        *tasks;
+    size_t      task_size;
+    int         task_cnt;
+    /* the fields below are guarded by the pool's mutex */
+    int         next_task;
+    int         running;
+    bool        queued;
+    frt_cond_t  done_cond;
+    struct ParallelTasks *next;
+    /* the tasks the searching thread was running itself, if any */
+    struct ParallelTasks *parent;
+    /* set once a task has raised or the search was interrupted so the tasks
+     * still running stop early */
+    volatile bool stop;
+    int         ex_code;
+    char        ex_msg[FRT_XMSG_BUFFER_FINAL_SIZE];
+} ParallelTasks;
+
+static struct {
+    frt_mutex_t   mutex;
+    frt_cond_t    cond;
+    ParallelTasks *queue;
+    int           thread_cnt;
+} sea_pool = { FRT_MUTEX_INITIALIZER, FRT_COND_INITIALIZER, NULL, 0 };
+
+/* the tasks the current thread is running */
+static _Thread_local ParallelTasks *curr_tasks = NULL;
+
+/* the threads don't survive a fork, the child starts with an empty pool */
+static void sea_pool_atfork_child(void)
+{
+    frt_mutex_init(&sea_pool.mutex, NULL);
+    frt_cond_init(&sea_pool.cond, NULL);
+    sea_pool.queue = NULL;
+    sea_pool.thread_cnt = 0;
+}
+
+static void sea_pool_atfork_init(void)
+{
+    pthread_atfork(NULL, NULL, &sea_pool_atfork_child);
+}
+
+static void pt_dequeue(ParallelTasks *pt)
+{
+    ParallelTasks **p = &sea_pool.queue;
+    if (!pt->queued) return;
+    while (*p != pt) p = &(*p)->next;
+    *p = pt->next;
+    pt->queued = false;
+}
+
+/*
+ * Return true if the search run by the current thread should stop, either
+ * because the searching thread has been interrupted or because another one
+ * of the tasks it is part of has raised.
+ */
+static bool sea_interrupted(void)
+{
+    ParallelTasks *pt;
+    if (frt_thread_interrupted()) {
+        return true;
+    }
+    for (pt = curr_tasks; pt; pt = pt->parent) {
+        if (pt->stop) return true;
+    }
+    return false;
+}
+
+/* run the tasks of +pt+ until none are left. sea_pool.mutex must be held */
+static void pt_run(ParallelTasks *pt)
+{
+    ParallelTasks *prev_tasks = curr_tasks;
+    curr_tasks = pt;
+    while (pt->next_task < pt->task_cnt) {
+        int i = pt->next_task++;
+        if (pt->next_task >= pt->task_cnt) {
+            pt_dequeue(pt);
+        }
+        pt->running++;
+        frt_mutex_unlock(&sea_pool.mutex);
+        FRT_TRY
+            pt->run(pt->tasks + i * pt->task_size);
+        FRT_XCATCHALL
+            frt_mutex_lock(&sea_pool.mutex);
+            if (0 == pt->ex_code) {
+                pt->ex_code = xcontext.excode;
+                snprintf(pt->ex_msg, FRT_XMSG_BUFFER_FINAL_SIZE, "%s",
+                         xcontext.msg ? xcontext.msg : "");
+            }
+            /* don't start on any more tasks */
+            pt->stop = true;
+            pt->next_task = pt->task_cnt;
+            pt_dequeue(pt);
+            frt_mutex_unlock(&sea_pool.mutex);
+            FRT_HANDLED();
+        FRT_XENDTRY
+        frt_mutex_lock(&sea_pool.mutex);
+        if (0 == --pt->running && pt->next_task >= pt->task_cnt) {
+            frt_cond_signal(&pt->done_cond);
+        }
+    }
+    curr_tasks = prev_tasks;
+}
+
+static void *sea_pool_thread(void *arg)
+{
+    (void)arg;
+    frt_mutex_lock(&sea_pool.mutex);
+    while (true) {
+        while (NULL == sea_pool.queue) {
+            frt_cond_wait(&sea_pool.cond, &sea_pool.mutex);
+        }
+        pt_run(sea_pool.queue);
+    }
+    return NULL;
+}
+
+/* start threads until the pool has +thread_cnt+ of them. sea_pool.mutex must
+ * be held */
+static void sea_pool_grow(int thread_cnt)
+{
+    static frt_thread_once_t atfork_once = FRT_THREAD_ONCE_INIT;
+    if (thread_cnt > SEA_POOL_MAX_THREADS) {
+        thread_cnt = SEA_POOL_MAX_THREADS;
+    }
+    while (sea_pool.thread_cnt < thread_cnt) {
+        frt_thread_t thread;
+        frt_thread_once(&atfork_once, &sea_pool_atfork_init);
+        /* if a thread can't be started its tasks are picked up by the others */
+        if (0 != frt_thread_create(&thread, &sea_pool_thread, NULL)) {
+            break;
+        }
+        frt_thread_detach(thread);
+        sea_pool.thread_cnt++;
+    }
+}
+
+/*
+ * Call +run+ on each of the +task_cnt+ tasks in the +tasks+ array using up
+ * to +max_threads+ threads, the calling thread being one of them and the
+ * others coming from the pool. Returns 0 once all tasks are done, or the code
+ * of the first error raised by a task in which case its message is copied
+ * to +ex_msg+. Tasks run in other threads can't call back into ruby, they
+ * should check sea_interrupted() now and then.
+ */
+static int sea_run_parallel(void (*run)(void *task), void *tasks,
+                            size_t task_size, int task_cnt, int max_threads,
+                            char *ex_msg)
+{
+    ParallelTasks pt;
+    int helper_cnt = (max_threads < task_cnt ? max_threads : task_cnt) - 1;
+
+    pt.run = run;
+    pt.tasks = (char *)tasks;
+    pt.task_size = task_size;
+    pt.task_cnt = task_cnt;
+    pt.next_task = 0;
+    pt.running = 0;
+    pt.queued = false;
+    pt.next = NULL;
+    pt.parent = curr_tasks;
+    pt.stop = false;
+    pt.ex_code = 0;
+    frt_cond_init(&pt.done_cond, NULL);
+
+    frt_mutex_lock(&sea_pool.mutex);
+    if (helper_cnt > 0) {
+        ParallelTasks **p = &sea_pool.queue;
+        sea_pool_grow(helper_cnt);
+        while (*p) p = &(*p)->next;
+        *p = &pt;
+        pt.queued = true;
+        frt_cond_broadcast(&sea_pool.cond);
+    }
+    pt_run(&pt);
+    /* wait for the tasks taken by the pool, passing on an interrupt */
+    while (pt.running > 0) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += SEA_POOL_WAIT_MS * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        frt_cond_timedwait(&pt.done_cond, &sea_pool.mutex, &ts);
+        if (!pt.stop && sea_interrupted()) {
+            pt.stop = true;
+        }
+    }
+    pt_dequeue(&pt);
+    frt_mutex_unlock(&sea_pool.mutex);
+    frt_cond_destroy(&pt.done_cond);
+
+    if (pt.ex_code) {
+        memcpy(ex_msg, pt.ex_msg, FRT_XMSG_BUFFER_FINAL_SIZE);
+    }
+    return pt.ex_code;
+}
+
 /***************************************************************************
  *
  * IndexSearcher
@@ -949,6 +1169,9 @@ static FrtSimilarity *sea_get_similarity(FrtSearcher *self)
 
 #define ISEA(searcher) ((FrtIndexSearcher *)(searcher))
 
+/* how often, in matches, a search checks whether it has been interrupted */
+#define SEA_INTERRUPT_CHECK_MASK 0xfff
+
 int frt_isea_doc_freq(FrtSearcher *self, ID field, const char *term) {
     return frt_ir_doc_freq(ISEA(self)->ir, field, term);
 }
@@ -965,6 +1188,13 @@ static FrtLazyDoc *isea_get_lazy_doc(FrtSearcher *self, int doc_num)
     return ir->get_lazy_doc(ir, doc_num);
 }
 
+static void isea_get_docs(FrtSearcher *self, const int *doc_nums, int cnt,
+                          const ID *fields, int field_cnt, FrtDocument **docs)
+{
+    FrtIndexReader *ir = ISEA(self)->ir;
+    ir->get_docs(ir, doc_nums, cnt, fields, field_cnt, docs);
+}
+
 static int isea_max_doc(FrtSearcher *self)
 {
     FrtIndexReader *ir = ISEA(self)->ir;
@@ -978,6 +1208,338 @@ static int isea_max_doc(FrtSearcher *self)
           post_filter->filter_func(scorer->doc, scorer->score(scorer),\
                                    searcher, post_filter->arg))))
 
+/*
+ * Dynamic pruning
+ *
+ * Once total_hits_threshold hits have been counted and the hit queue is
+ * full, the lowest score in the queue is passed on to the scorer so that it
+ * can skip the documents which can't beat it. This is only done when the
+ * hits are sorted by score and there is no post filter to change the
+ * scores. When the hits are sorted by document number instead, none of the
+ * documents still to come can make it into a full queue so the search stops
+ * there. Either way total_hits is then only a lower bound.
+ */
+static bool sea_can_prune(FrtScorer *scorer, FrtSort *sort,
+                          FrtPostFilter *post_filter, int total_hits_threshold)
+{
+    return total_hits_threshold < INT_MAX && NULL == sort
+        && NULL == post_filter && NULL != scorer->set_min_score;
+}
+
+static bool sea_can_stop_early(FrtSort *sort, int total_hits_threshold)
+{
+    return total_hits_threshold < INT_MAX && NULL != sort && sort->size > 0
+        && FRT_SORT_TYPE_DOC == sort->sort_fields[0]->type
+        && !sort->sort_fields[0]->reverse;
+}
+
+/*
+ * Index sort
+ *
+ * The documents of a segment written with an index sort are in sort order so
+ * when the hits are sorted by a prefix of that sort the first hits found in a
+ * segment are its best ones. Once the hit queue's worth of hits has been
+ * collected from a segment the rest of it is skipped. Like the other early
+ * stops this only starts once total_hits_threshold hits have been counted.
+ */
+static bool sea_can_skip_segments(FrtSort *sort, int total_hits_threshold)
+{
+    return total_hits_threshold < INT_MAX && NULL != sort && sort->size > 0;
+}
+
+static bool sea_sort_matches_index_sort(FrtSort *sort, FrtSort *index_sort)
+{
+    int i;
+    for (i = 0; i < sort->size; i++) {
+        FrtSortField *sf = sort->sort_fields[i];
+        FrtSortField *isf;
+        if (FRT_SORT_TYPE_DOC == sf->type && !sf->reverse) {
+            return true; /* ties are broken by document number anyway */
+        }
+        if (i >= index_sort->size) {
+            return false;
+        }
+        isf = index_sort->sort_fields[i];
+        if (sf->field != isf->field || sf->type != isf->type
+            || sf->reverse != isf->reverse) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* returns true if the segment of +ir+ holding +doc+ is sorted by +sort+ and
+ * sets *+end+ to the first document after that segment */
+static bool sea_segment_sorted(FrtIndexReader *ir, FrtSort *sort, int doc,
+                               int *end)
+{
+    if (FRT_SEGMENT_READER == ir->type) {
+        FrtSort *index_sort = ((FrtSegmentReader *)ir)->si->index_sort;
+        *end = ir->max_doc(ir);
+        return index_sort && sea_sort_matches_index_sort(sort, index_sort);
+    }
+    if (FRT_MULTI_READER == ir->type) {
+        FrtMultiReader *mr = (FrtMultiReader *)ir;
+        int lo = 0, hi = mr->r_cnt - 1;
+        bool sorted;
+        if (hi < 0) {
+            *end = mr->max_doc;
+            return false;
+        }
+        while (lo < hi) {
+            int mid = (lo + hi + 1) >> 1;
+            if (mr->starts[mid] <= doc) {
+                lo = mid;
+            } else {
+                hi = mid - 1;
+            }
+        }
+        sorted = sea_segment_sorted(mr->sub_readers[lo], sort,
+                                    doc - mr->starts[lo], end);
+        *end += mr->starts[lo];
+        return sorted;
+    }
+    *end = ir->max_doc(ir);
+    return false;
+}
+
+/* returns true if the scorer may skip documents with the new minimum */
+static bool sea_raise_min_score(FrtScorer *scorer, FrtPriorityQueue *hq,
+                                float *min_score)
+{
+    float score = ((FrtHit *)frt_pq_top(hq))->score;
+    if (score > *min_score) {
+        *min_score = score;
+        return scorer->set_min_score(scorer, score);
+    }
+    return false;
+}
+
+/*
+ * Segment-parallel search
+ *
+ * When the IndexSearcher's max_threads is greater than 1 and its reader has
+ * several segments, the segments are split into up to max_threads ranges of
+ * roughly the same number of documents. Each range is scored in its own
+ * thread, the searching thread taking one of them, and each thread collects
+ * into its own hit queue. The queues are merged once all ranges have been
+ * scored.
+ *
+ * The scorers are created by the searching thread, one for each segment, so
+ * the filters of ConstantScoreQuery and FilteredQuery, which only take the
+ * filters written in C, are evaluated and cached per segment. The search
+ * filter is evaluated on the whole reader, so ruby filters work too, and the
+ * hits carry index-wide doc numbers for it and for the sort field indexes.
+ */
+typedef struct SegmentCollector {
+    FrtScorer        **scorers;
+    FrtPriorityQueue *hq;
+    FrtBitVector     *bits;
+    FrtMultiReader   *mr;
+    FrtSort          *sort;
+    void             (*hq_insert)(FrtPriorityQueue *pq, FrtHit *hit);
+    int              first_seg;
+    int              seg_cnt;
+    int              total_hits;
+    int              total_hits_threshold;
+    float            max_score;
+    bool             stop_early;
+    bool             skip_segments;
+    bool             total_hits_exact;
+} SegmentCollector;
+
+static void sc_collect(void *task)
+{
+    SegmentCollector *sc = (SegmentCollector *)task;
+    FrtBitVector *bits = sc->bits;
+    float min_score = 0.0f;
+    int checked = 0;
+    int i;
+    FrtHit hit;
+
+    for (i = 0; i < sc->seg_cnt; i++) {
+        FrtScorer *scorer = sc->scorers[i];
+        const int seg = sc->first_seg + i;
+        const int base = sc->mr->starts[seg];
+        int seg_end, seg_hits = 0;
+        bool prune, seg_sorted;
+        if (NULL == scorer) {
+            continue;
+        }
+        prune = sea_can_prune(scorer, sc->sort, NULL, sc->total_hits_threshold);
+        seg_sorted = sc->skip_segments
+            && sea_segment_sorted(sc->mr->sub_readers[seg], sc->sort, 0, &seg_end);
+        /* carry the minimum score over from the previous segments */
+        if (prune && min_score > 0.0f && scorer->set_min_score(scorer, min_score)) {
+            sc->total_hits_exact = false;
+        }
+        while (scorer->next(scorer)) {
+            float score;
+            if (0 == (++checked & SEA_INTERRUPT_CHECK_MASK) && sea_interrupted()) {
+                FRT_RAISE(FRT_STATE_ERROR, "search interrupted");
+            }
+            hit.doc = base + scorer->doc;
+            if (bits && !frt_bv_get(bits, hit.doc)) continue;
+            score = scorer->score(scorer);
+            sc->total_hits++;
+            if (score > sc->max_score) sc->max_score = score;
+            hit.score = score;
+            sc->hq_insert(sc->hq, &hit);
+            if (sc->total_hits >= sc->total_hits_threshold
+                && sc->hq->size == sc->hq->capa) {
+                if (sc->stop_early) {
+                    sc->total_hits_exact = false;
+                    return;
+                }
+                if (prune && sea_raise_min_score(scorer, sc->hq, &min_score)) {
+                    sc->total_hits_exact = false;
+                }
+            }
+            if (seg_sorted && ++seg_hits >= sc->hq->capa
+                && sc->total_hits >= sc->total_hits_threshold) {
+                /* the rest of the segment sorts after the hits taken from it */
+                sc->total_hits_exact = false;
+                break;
+            }
+        }
+    }
+}
+
+static void sc_destroy(SegmentCollector *sc,
+                       void (*hq_destroy)(FrtPriorityQueue *self))
+{
+    int i;
+    for (i = 0; i < sc->seg_cnt; i++) {
+        if (sc->scorers[i]) sc->scorers[i]->destroy(sc->scorers[i]);
+    }
+    free(sc->scorers);
+    if (sc->hq) hq_destroy(sc->hq);
+}
+
+/*
+ * Split the segments of +mr+ into at most +thread_cnt+ ranges and create the
+ * scorers and hit queue for each one. The first range collects into +hq+.
+ * Returns the number of ranges. If an error is raised the ranges set up so
+ * far are destroyed, apart from +hq+.
+ */
+static int sc_setup_ranges(SegmentCollector *collectors, int thread_cnt,
+                           FrtWeight *weight, FrtMultiReader *mr,
+                           FrtBitVector *bits, FrtSort *sort,
+                           int total_hits_threshold,
+                           FrtPriorityQueue *hq,
+                           void (*hq_insert)(FrtPriorityQueue *pq, FrtHit *hit),
+                           void (*hq_destroy)(FrtPriorityQueue *self))
+{
+    volatile int range_cnt = 0;
+    int seg = 0;
+    int i;
+
+    FRT_TRY
+        /* each range takes whole segments until it holds its share of the
+         * documents left to hand out */
+        for (i = 0; i < thread_cnt && seg < mr->r_cnt; i++) {
+            SegmentCollector *sc = &collectors[range_cnt++];
+            const int start = mr->starts[seg];
+            const int share = (mr->max_doc - start) / (thread_cnt - i);
+            sc->first_seg = seg;
+            do {
+                seg++;
+            } while (seg < mr->r_cnt && mr->starts[seg] - start < share);
+            if (i == thread_cnt - 1) {
+                seg = mr->r_cnt;
+            }
+            sc->scorers = FRT_ALLOC_AND_ZERO_N(FrtScorer *, seg - sc->first_seg);
+            for (; sc->seg_cnt < seg - sc->first_seg; sc->seg_cnt++) {
+                sc->scorers[sc->seg_cnt] =
+                    weight->scorer(weight, mr->sub_readers[sc->first_seg + sc->seg_cnt]);
+            }
+            sc->bits = bits;
+            sc->hq_insert = hq_insert;
+            sc->total_hits_threshold = total_hits_threshold;
+            sc->stop_early = sea_can_stop_early(sort, total_hits_threshold);
+            sc->skip_segments = sea_can_skip_segments(sort, total_hits_threshold);
+            sc->mr = mr;
+            sc->sort = sort;
+            sc->total_hits_exact = true;
+            sc->hq = (range_cnt == 1) ? hq : sort
+                ? frt_fshq_pq_new(hq->capa, sort, (FrtIndexReader *)mr)
+                : frt_pq_new(hq->capa, (frt_lt_ft)&hit_lt, &free);
+        }
+    FRT_XCATCHALL
+        for (i = 0; i < range_cnt; i++) {
+            /* +hq+ is left to the caller */
+            if (0 == i) collectors[i].hq = NULL;
+            sc_destroy(&collectors[i], hq_destroy);
+        }
+    FRT_XENDTRY
+    return range_cnt;
+}
+
+/*
+ * Score the segments of the IndexSearcher's MultiReader in parallel and
+ * merge the hits into +hq+. Returns the total number of hits. *+exact+ is
+ * cleared if any range stopped counting them. +hq+ is destroyed if an error
+ * is raised.
+ */
+static int isea_search_segments(FrtSearcher *self, FrtWeight *weight,
+                                FrtBitVector *bits, FrtSort *sort,
+                                int total_hits_threshold,
+                                FrtPriorityQueue *hq,
+                                void (*hq_insert)(FrtPriorityQueue *pq, FrtHit *hit),
+                                void (*hq_destroy)(FrtPriorityQueue *self),
+                                float *max_score, bool *exact)
+{
+    FrtMultiReader *mr = (FrtMultiReader *)ISEA(self)->ir;
+    FrtHit *(*hq_pop)(FrtPriorityQueue *pq) = sort ? &frt_fshq_pq_pop : &hit_pq_pop;
+    SegmentCollector *volatile collectors;
+    char ex_msg[FRT_XMSG_BUFFER_FINAL_SIZE];
+    int thread_cnt = ISEA(self)->max_threads;
+    volatile int range_cnt = 0;
+    int ex_code;
+    int total_hits;
+    int i;
+
+    if (thread_cnt > mr->r_cnt) {
+        thread_cnt = mr->r_cnt;
+    }
+    collectors = FRT_ALLOC_AND_ZERO_N(SegmentCollector, thread_cnt);
+    FRT_TRY
+        range_cnt = sc_setup_ranges(collectors, thread_cnt, weight, mr, bits,
+                                    sort, total_hits_threshold, hq, hq_insert,
+                                    hq_destroy);
+    FRT_XCATCHALL
+        free(collectors);
+        hq_destroy(hq);
+    FRT_XENDTRY
+    ex_code = sea_run_parallel(&sc_collect, collectors, sizeof(SegmentCollector),
+                               range_cnt, range_cnt, ex_msg);
+
+    total_hits = 0;
+    for (i = 0; i < range_cnt; i++) {
+        SegmentCollector *sc = &collectors[i];
+        if (i > 0) {
+            FrtHit *hit;
+            while (NULL != (hit = hq_pop(sc->hq))) {
+                hq_insert(hq, hit);
+                free(hit);
+            }
+        } else {
+            sc->hq = NULL;
+        }
+        sc_destroy(sc, hq_destroy);
+        total_hits += sc->total_hits;
+        if (sc->max_score > *max_score) *max_score = sc->max_score;
+        if (!sc->total_hits_exact) *exact = false;
+    }
+    free(collectors);
+
+    if (ex_code) {
+        hq_destroy(hq);
+        FRT_RAISE(ex_code, "%s", ex_msg);
+    }
+    return total_hits;
+}
+
 static FrtTopDocs *isea_search_w(FrtSearcher *self,
                               FrtWeight *weight,
                               int first_doc,
@@ -985,7 +1547,8 @@ static FrtTopDocs *isea_search_w(FrtSearcher *self,
                               FrtFilter *filter,
                               FrtSort *sort,
                               FrtPostFilter *post_filter,
-                              bool load_fields)
+                              bool load_fields,
+                              int total_hits_threshold)
 {
     int max_size = num_docs + (num_docs == INT_MAX ? 0 : first_doc);
     int i;
@@ -999,8 +1562,15 @@ static FrtTopDocs *isea_search_w(FrtSearcher *self,
 
     FrtScorer *scorer;
     FrtHit hit;
+    FrtTopDocs *td;
+    bool prune, stop_early, skip_segments;
+    bool seg_sorted = false;
+    bool exact = true;
+    bool interrupted = false;
+    int seg_end = 0, seg_hits = 0, skip_doc = 0, checked = 0;
 
     float max_score = 0.0f;
+    float min_score = 0.0f;
     float score = 0.0f;
     float filter_factor = 1.0f;
 
@@ -1024,13 +1594,42 @@ static FrtTopDocs *isea_search_w(FrtSearcher *self,
         hq_pop = &hit_pq_pop;
     }
 
+    if (ISEA(self)->max_threads > 1 && !post_filter
+        && ISEA(self)->ir->type == FRT_MULTI_READER
+        && ISEA(self)->ir->sis != NULL
+        && ((FrtMultiReader *)ISEA(self)->ir)->r_cnt > 1) {
+        /* post filters may call back into ruby which can't be done from the
+         * search threads so they are always run sequentially */
+        total_hits = isea_search_segments(self, weight, bits, sort,
+                                          total_hits_threshold, hq,
+                                          hq_insert, hq_destroy, &max_score,
+                                          &exact);
+        goto collect;
+    }
+
     scorer = weight->scorer(weight, ISEA(self)->ir);
     if (!scorer || 0 == ISEA(self)->ir->num_docs(ISEA(self)->ir)) {
         if (scorer) scorer->destroy(scorer);
+        hq_destroy(hq);
         return frt_td_new(0, 0, NULL, 0.0);
     }
 
-    while (scorer->next(scorer)) {
+    prune = sea_can_prune(scorer, sort, post_filter, total_hits_threshold);
+    stop_early = sea_can_stop_early(sort, total_hits_threshold);
+    skip_segments = sea_can_skip_segments(sort, total_hits_threshold);
+    while (skip_doc > 0 ? scorer->skip_to(scorer, skip_doc)
+                        : scorer->next(scorer)) {
+        skip_doc = 0;
+        if (0 == (++checked & SEA_INTERRUPT_CHECK_MASK)
+            && sea_interrupted()) {
+            interrupted = true;
+            break;
+        }
+        if (skip_segments && scorer->doc >= seg_end) {
+            seg_sorted = sea_segment_sorted(ISEA(self)->ir, sort, scorer->doc,
+                                            &seg_end);
+            seg_hits = 0;
+        }
         if (bits && !frt_bv_get(bits, scorer->doc)) continue;
         score = scorer->score(scorer);
         if (post_filter &&
@@ -1045,8 +1644,28 @@ static FrtTopDocs *isea_search_w(FrtSearcher *self,
         if (score > max_score) max_score = score;
         hit.doc = scorer->doc; hit.score = score;
         hq_insert(hq, &hit);
+        if (seg_sorted && ++seg_hits >= hq->capa
+            && total_hits >= total_hits_threshold) {
+            /* the rest of the segment sorts after the hits taken from it */
+            exact = false;
+            skip_doc = seg_end;
+        }
+        if (total_hits >= total_hits_threshold && hq->size == hq->capa) {
+            if (stop_early) {
+                exact = false;
+                break;
+            }
+            if (prune && sea_raise_min_score(scorer, hq, &min_score)) {
+                exact = false;
+            }
+        }
     }
     scorer->destroy(scorer);
+    if (interrupted) {
+        hq_destroy(hq);
+        FRT_RAISE(FRT_STATE_ERROR, "search interrupted");
+    }
+collect:
     if (hq->size > first_doc) {
         if ((hq->size - first_doc) < num_docs) {
             num_docs = hq->size - first_doc;
@@ -1059,7 +1678,9 @@ static FrtTopDocs *isea_search_w(FrtSearcher *self,
         num_docs = 0;
     }
     hq_destroy(hq);
-    return frt_td_new(total_hits, num_docs, score_docs, max_score);
+    td = frt_td_new(total_hits, num_docs, score_docs, max_score);
+    td->total_hits_exact = exact;
+    return td;
 }
 
 static FrtTopDocs *isea_search(FrtSearcher *self,
@@ -1069,11 +1690,13 @@ static FrtTopDocs *isea_search(FrtSearcher *self,
                             FrtFilter *filter,
                             FrtSort *sort,
                             FrtPostFilter *post_filter,
-                            bool load_fields)
+                            bool load_fields,
+                            int total_hits_threshold)
 {
     FrtTopDocs *td;
     FrtWeight *weight = frt_q_weight(query, self);
-    td = isea_search_w(self, weight, first_doc, num_docs, filter, sort, post_filter, load_fields);
+    td = isea_search_w(self, weight, first_doc, num_docs, filter, sort,
+                       post_filter, load_fields, total_hits_threshold);
     weight->destroy(weight);
     return td;
 }
@@ -1194,12 +1817,14 @@ FrtSearcher *frt_isea_alloc(void) {
 
 FrtSearcher *frt_isea_init(FrtSearcher *self, FrtIndexReader *ir) {
     ISEA(self)->ir          = ir;
+    ISEA(self)->max_threads = 1;
     FRT_REF(ir);
     self->ref_cnt           = 1;
     self->similarity        = frt_sim_create_default();
     self->doc_freq          = &frt_isea_doc_freq;
     self->get_doc           = &isea_get_doc;
     self->get_lazy_doc      = &isea_get_lazy_doc;
+    self->get_docs          = &isea_get_docs;
     self->max_doc           = &isea_max_doc;
     self->create_weight     = &sea_create_weight;
     self->search            = &isea_search;
@@ -1253,6 +1878,15 @@ static FrtDocument *cdfsea_get_doc(FrtSearcher *self, int doc_num)
     return NULL;
 }
 
+static void cdfsea_get_docs(FrtSearcher *self, const int *doc_nums, int cnt,
+                            const ID *fields, int field_cnt,
+                            FrtDocument **docs)
+{
+    (void)self; (void)doc_nums; (void)cnt; (void)fields; (void)field_cnt;
+    (void)docs;
+    FRT_RAISE(FRT_UNSUPPORTED_ERROR, "%s", FRT_UNSUPPORTED_ERROR_MSG);
+}
+
 static int cdfsea_max_doc(FrtSearcher *self)
 {
     (void)self;
@@ -1267,19 +1901,21 @@ static FrtWeight *cdfsea_create_weight(FrtSearcher *self, FrtQuery *query)
 }
 
 static FrtTopDocs *cdfsea_search_w(FrtSearcher *self, FrtWeight *w, int fd, int nd,
-                                FrtFilter *f, FrtSort *s, FrtPostFilter *pf, bool load)
+                                FrtFilter *f, FrtSort *s, FrtPostFilter *pf, bool load,
+                                int thresh)
 {
     (void)self; (void)w; (void)fd; (void)nd;
-    (void)f; (void)s; (void)pf; (void)load;
+    (void)f; (void)s; (void)pf; (void)load; (void)thresh;
     FRT_RAISE(FRT_UNSUPPORTED_ERROR, "%s", FRT_UNSUPPORTED_ERROR_MSG);
     return NULL;
 }
 
 static FrtTopDocs *cdfsea_search(FrtSearcher *self, FrtQuery *q, int fd, int nd,
-                              FrtFilter *f, FrtSort *s, FrtPostFilter *pf, bool load)
+                              FrtFilter *f, FrtSort *s, FrtPostFilter *pf, bool load,
+                              int thresh)
 {
     (void)self; (void)q; (void)fd; (void)nd;
-    (void)f; (void)s; (void)pf; (void)load;
+    (void)f; (void)s; (void)pf; (void)load; (void)thresh;
     FRT_RAISE(FRT_UNSUPPORTED_ERROR, "%s", FRT_UNSUPPORTED_ERROR_MSG);
     return NULL;
 }
@@ -1350,6 +1986,7 @@ static FrtSearcher *cdfsea_new(FrtHash *df_map, int max_doc)
     self->similarity        = frt_sim_create_default();
     self->doc_freq          = &cdfsea_doc_freq;
     self->get_doc           = &cdfsea_get_doc;
+    self->get_docs          = &cdfsea_get_docs;
     self->max_doc           = &cdfsea_max_doc;
     self->create_weight     = &cdfsea_create_weight;
     self->search            = &cdfsea_search;
@@ -1427,6 +2064,52 @@ static FrtLazyDoc *msea_get_lazy_doc(FrtSearcher *self, int doc_num)
     return s->get_lazy_doc(s, doc_num - msea->starts[i]);
 }
 
+static void msea_get_docs(FrtSearcher *self, const int *doc_nums, int cnt,
+                          const ID *fields, int field_cnt, FrtDocument **docs)
+{
+    int i, j;
+    FrtMultiSearcher *msea = MSEA(self);
+    int *searchers = FRT_ALLOC_N(int, cnt);
+    int *sub_doc_nums = FRT_ALLOC_N(int, cnt);
+    int *indexes = FRT_ALLOC_N(int, cnt);
+    FrtDocument **sub_docs = FRT_ALLOC_N(FrtDocument *, cnt);
+    volatile bool success = false;
+
+    for (i = 0; i < cnt; i++) {
+        searchers[i] = msea_get_searcher_index(self, doc_nums[i]);
+    }
+    memset(docs, 0, cnt * sizeof(FrtDocument *));
+    FRT_TRY
+        for (j = 0; j < msea->s_cnt; j++) {
+            int sub_cnt = 0;
+            for (i = 0; i < cnt; i++) {
+                if (searchers[i] == j) {
+                    sub_doc_nums[sub_cnt] = doc_nums[i] - msea->starts[j];
+                    indexes[sub_cnt++] = i;
+                }
+            }
+            if (sub_cnt > 0) {
+                FrtSearcher *s = msea->searchers[j];
+                s->get_docs(s, sub_doc_nums, sub_cnt, fields, field_cnt,
+                            sub_docs);
+                for (i = 0; i < sub_cnt; i++) {
+                    docs[indexes[i]] = sub_docs[i];
+                }
+            }
+        }
+        success = true;
+    FRT_XFINALLY
+        if (!success) {
+            /* the searcher which raised has already freed its own */
+            frt_docs_destroy(docs, cnt);
+        }
+        free(searchers);
+        free(sub_doc_nums);
+        free(indexes);
+        free(sub_docs);
+    FRT_XENDTRY
+}
+
 static int msea_max_doc(FrtSearcher *self)
 {
     return MSEA(self)->max_doc;
@@ -1491,6 +2174,125 @@ static void msea_search_each_i(FrtSearcher *self, int doc_num, float score, void
     mse_arg->fn(self, doc_num + mse_arg->start, score, mse_arg->arg);
 }
 
+/*
+ * Shard-parallel search
+ *
+ * When the MultiSearcher's max_threads is greater than 1 the sub-searchers
+ * are searched concurrently, each into its own results, and the results are
+ * merged in sub-searcher order by the searching thread so they come out just
+ * as they would from a sequential search. Post filters, search_each
+ * callbacks and filters written in ruby can't be called from the search
+ * threads so post filters and ruby filters make the search sequential and
+ * search_each hits are collected first and passed on afterwards. Searcher#search,
+ * #search_each and #scan run without the GVL on a MultiSearcher just as on an
+ * IndexSearcher, and an interrupt of the searching thread also stops the
+ * sub-searches run by the other threads.
+ */
+typedef struct ShardSearch {
+    FrtSearcher *searcher;
+    FrtWeight   *weight;
+    FrtFilter   *filter;
+    FrtSort     *sort;
+    int         limit;
+    int         offset_docnum;
+    int         total_hits_threshold;
+    FrtTopDocs  *td;
+    int         *docs;
+    float       *scores;
+    int         cnt;
+    int         capa;
+} ShardSearch;
+
+static bool msea_is_parallel(FrtSearcher *self, FrtFilter *filter,
+                             FrtPostFilter *post_filter)
+{
+    /* filters which can't be split per segment are ruby filters */
+    return MSEA(self)->max_threads > 1 && MSEA(self)->s_cnt > 1
+        && !post_filter && (!filter || filter->per_segment);
+}
+
+static ShardSearch *msea_shard_searches(FrtSearcher *self, FrtWeight *w,
+                                        FrtFilter *filter, FrtSort *sort,
+                                        int limit)
+{
+    FrtMultiSearcher *msea = MSEA(self);
+    ShardSearch *searches = FRT_ALLOC_AND_ZERO_N(ShardSearch, msea->s_cnt);
+    int i;
+    for (i = 0; i < msea->s_cnt; i++) {
+        searches[i].searcher = msea->searchers[i];
+        searches[i].weight = w;
+        searches[i].filter = filter;
+        searches[i].sort = sort;
+        searches[i].limit = limit;
+    }
+    return searches;
+}
+
+static void msea_shard_searches_destroy(ShardSearch *searches, int s_cnt)
+{
+    int i;
+    for (i = 0; i < s_cnt; i++) {
+        if (searches[i].td) frt_td_destroy(searches[i].td);
+        free(searches[i].docs);
+        free(searches[i].scores);
+    }
+    free(searches);
+}
+
+static void msea_run_shard_searches(FrtSearcher *self, void (*run)(void *task),
+                                    ShardSearch *searches)
+{
+    char ex_msg[FRT_XMSG_BUFFER_FINAL_SIZE];
+    int s_cnt = MSEA(self)->s_cnt;
+    int ex_code = sea_run_parallel(run, searches, sizeof(ShardSearch), s_cnt,
+                                   MSEA(self)->max_threads, ex_msg);
+    if (ex_code) {
+        msea_shard_searches_destroy(searches, s_cnt);
+        FRT_RAISE(ex_code, "%s", ex_msg);
+    }
+}
+
+static void ss_search(void *task)
+{
+    ShardSearch *ss = (ShardSearch *)task;
+    FrtSearcher *s = ss->searcher;
+    ss->td = s->search_w(s, ss->weight, 0, ss->limit, ss->filter, ss->sort,
+                         NULL, true, ss->total_hits_threshold);
+}
+
+static void ss_search_each_i(FrtSearcher *self, int doc_num, float score, void *arg)
+{
+    ShardSearch *ss = (ShardSearch *)arg;
+    (void)self;
+    if (ss->cnt >= ss->capa) {
+        ss->capa = ss->capa ? ss->capa * 2 : 64;
+        FRT_REALLOC_N(ss->docs, int, ss->capa);
+        FRT_REALLOC_N(ss->scores, float, ss->capa);
+    }
+    ss->docs[ss->cnt] = doc_num;
+    ss->scores[ss->cnt] = score;
+    ss->cnt++;
+}
+
+static void ss_search_each(void *task)
+{
+    ShardSearch *ss = (ShardSearch *)task;
+    FrtSearcher *s = ss->searcher;
+    s->search_each_w(s, ss->weight, ss->filter, NULL, &ss_search_each_i, ss);
+}
+
+static void ss_search_unscored(void *task)
+{
+    ShardSearch *ss = (ShardSearch *)task;
+    FrtSearcher *s = ss->searcher;
+    int limit = s->max_doc(s) - ss->offset_docnum;
+    if (limit > ss->limit) limit = ss->limit;
+    if (limit <= 0) return;
+    ss->docs = FRT_ALLOC_N(int, limit);
+    ss->cnt = s->search_unscored_w(s, ss->weight, ss->docs, limit,
+                                   ss->offset_docnum);
+}
+
 static void msea_search_each_w(FrtSearcher *self, FrtWeight *w, FrtFilter *filter,
                                FrtPostFilter *post_filter,
                                void (*fn)(FrtSearcher *, int, float, void *),
@@ -1501,6 +2303,21 @@ static void msea_search_each_w(FrtSearcher *self, FrtWeight *w, FrtFilter *filte
     FrtMultiSearcher *msea = MSEA(self);
     FrtSearcher *s;
 
+    if (msea_is_parallel(self, filter, post_filter)) {
+        ShardSearch *searches = msea_shard_searches(self, w, filter, NULL, 0);
+        msea_run_shard_searches(self, &ss_search_each, searches);
+        for (i = 0; i < msea->s_cnt; i++) {
+            ShardSearch *ss = &searches[i];
+            int j;
+            for (j = 0; j < ss->cnt; j++) {
+                fn(ss->searcher, ss->docs[j] + msea->starts[i], ss->scores[j],
+                   arg);
+            }
+        }
+        msea_shard_searches_destroy(searches, msea->s_cnt);
+        return;
+    }
+
     mse_arg.fn = fn;
     mse_arg.arg = arg;
     for (i = 0; i < msea->s_cnt; i++) {
@@ -1530,6 +2347,28 @@ static int msea_search_unscored_w(FrtSearcher *self,
     int i, count = 0;
     FrtMultiSearcher *msea = MSEA(self);
 
+    if (msea_is_parallel(self, NULL, NULL) && limit > 0) {
+        /* each sub-searcher is asked for the full limit as we don't know
+         * beforehand how many of them will be needed to fill it */
+        ShardSearch *searches = msea_shard_searches(self, w, NULL, NULL, limit);
+        for (i = 0; i < msea->s_cnt; i++) {
+            const int index_offset = msea->starts[i];
+            searches[i].offset_docnum = offset_docnum > index_offset
+                ? offset_docnum - index_offset
+                : 0;
+        }
+        msea_run_shard_searches(self, &ss_search_unscored, searches);
+        for (i = 0; count < limit && i < msea->s_cnt; i++) {
+            ShardSearch *ss = &searches[i];
+            int j;
+            for (j = 0; count < limit && j < ss->cnt; j++) {
+                buf[count++] = ss->docs[j] + msea->starts[i];
+            }
+        }
+        msea_shard_searches_destroy(searches, msea->s_cnt);
+        return count;
+    }
+
     for (i = 0; count < limit && i < msea->s_cnt; i++) {
         /* if offset_docnum falls in this or previous indexes */
         if (offset_docnum < msea->starts[i+1]) {
@@ -1597,7 +2436,8 @@ static FrtTopDocs *msea_search_w(FrtSearcher *self,
                               FrtFilter *filter,
                               FrtSort *sort,
                               FrtPostFilter *post_filter,
-                              bool load_fields) {
+                              bool load_fields,
+                              int total_hits_threshold) {
     int max_size = num_docs + (num_docs == INT_MAX ? 0 : first_doc);
     int i;
     int total_hits = 0;
@@ -1606,6 +2446,9 @@ static FrtTopDocs *msea_search_w(FrtSearcher *self,
     FrtPriorityQueue *hq;
     FrtHit *(*hq_pop)(FrtPriorityQueue *pq);
     void (*hq_insert)(FrtPriorityQueue *pq, FrtHit *hit);
+    ShardSearch *searches = NULL;
+    FrtTopDocs *top_docs;
+    bool exact = true;
 
     float max_score = 0.0f;
 
@@ -1623,9 +2466,20 @@ static FrtTopDocs *msea_search_w(FrtSearcher *self,
         hq_pop = &hit_pq_pop;
     }
 
+    if (msea_is_parallel(self, filter, post_filter)) {
+        searches = msea_shard_searches(self, weight, filter, sort, max_size);
+        for (i = 0; i < MSEA(self)->s_cnt; i++) {
+            searches[i].total_hits_threshold = total_hits_threshold;
+        }
+        msea_run_shard_searches(self, &ss_search, searches);
+    }
+
     for (i = 0; i < MSEA(self)->s_cnt; i++) {
         FrtSearcher *s = MSEA(self)->searchers[i];
-        FrtTopDocs *td = s->search_w(s, weight, 0, max_size, filter, sort, post_filter, true);
+        FrtTopDocs *td = searches
+            ? searches[i].td
+            : s->search_w(s, weight, 0, max_size, filter, sort, post_filter,
+                          true, total_hits_threshold);
         if (td->size > 0) {
             int j;
             int start = MSEA(self)->starts[i];
@@ -1638,8 +2492,11 @@ static FrtTopDocs *msea_search_w(FrtSearcher *self,
             if (td->max_score > max_score) max_score = td->max_score;
         }
         total_hits += td->total_hits;
+        if (!td->total_hits_exact) exact = false;
         frt_td_destroy(td);
+        if (searches) searches[i].td = NULL;
     }
+    if (searches) msea_shard_searches_destroy(searches, MSEA(self)->s_cnt);
 
     if (hq->size > first_doc) {
         if ((hq->size - first_doc) < num_docs) {
@@ -1655,7 +2512,9 @@ static FrtTopDocs *msea_search_w(FrtSearcher *self,
     frt_pq_clear(hq);
     frt_pq_destroy(hq);
 
-    return frt_td_new(total_hits, num_docs, score_docs, max_score);
+    top_docs = frt_td_new(total_hits, num_docs, score_docs, max_score);
+    top_docs->total_hits_exact = exact;
+    return top_docs;
 }
 
 static FrtTopDocs *msea_search(FrtSearcher *self,
@@ -1665,11 +2524,12 @@ static FrtTopDocs *msea_search(FrtSearcher *self,
                             FrtFilter *filter,
                             FrtSort *sort,
                             FrtPostFilter *post_filter,
-                            bool load_fields) {
+                            bool load_fields,
+                            int total_hits_threshold) {
     FrtTopDocs *td;
     FrtWeight *weight = frt_q_weight(query, self);
     td = msea_search_w(self, weight, first_doc, num_docs, filter,
-                       sort, post_filter, load_fields);
+                       sort, post_filter, load_fields, total_hits_threshold);
     weight->destroy(weight);
     return td;
 }
@@ -1755,11 +2615,13 @@ FrtSearcher *frt_msea_init(FrtSearcher *self, FrtSearcher **searchers, int s_cnt
     MSEA(self)->searchers   = searchers;
     MSEA(self)->starts      = starts;
     MSEA(self)->max_doc     = max_doc;
+    MSEA(self)->max_threads = 1;
     self->ref_cnt           = 1;
     self->similarity        = frt_sim_create_default();
     self->doc_freq          = &msea_doc_freq;
     self->get_doc           = &msea_get_doc;
     self->get_lazy_doc      = &msea_get_lazy_doc;
+    self->get_docs          = &msea_get_docs;
     self->max_doc           = &msea_max_doc;
     self->create_weight     = &msea_create_weight;
     self->search            = &msea_search;
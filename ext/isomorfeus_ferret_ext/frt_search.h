@@ -83,6 +83,9 @@ typedef struct FrtTopDocs {
     int    size;
     FrtHit **hits;
     float  max_score;
+    /* false when the search stopped counting at its total_hits_threshold so
+     * total_hits is only a lower bound */
+    bool   total_hits_exact;
 } FrtTopDocs;
 
 extern FrtTopDocs *frt_td_new(int total_hits, int size, FrtHit **hits, float max_score);
@@ -103,6 +106,10 @@ typedef struct FrtFilter {
     unsigned long long (*hash)(struct FrtFilter *self);
     int           (*eq)(struct FrtFilter *self, struct FrtFilter *o);
     void          (*destroy_i)(struct FrtFilter *self);
+    /* evaluate the filter against each segment so that the bits can be
+     * cached per SegmentReader. Only for filters which don't depend on the
+     * doc numbers of the reader as a whole. */
+    bool          per_segment : 1;
     _Atomic unsigned int   ref_cnt;
     VALUE         rfilter;
 } FrtFilter;
@@ -651,6 +658,15 @@ struct FrtScorer {
     bool           (*skip_to)(FrtScorer *self, int doc_num);
     FrtExplanation *(*explain)(FrtScorer *self, int doc_num);
     void           (*destroy)(FrtScorer *self);
+    /* optional, may be NULL. Returns an upper bound for the scores of the
+     * documents from +doc_num+ up to and including *+up_to+, which it sets.
+     * +doc_num+ must not go backwards, except that a negative +doc_num+ asks
+     * for a bound for all of the documents and can be passed at any time */
+    float          (*max_score)(FrtScorer *self, int doc_num, int *up_to);
+    /* optional, may be NULL. Documents scoring less than +min_score+ are no
+     * longer wanted so the scorer may skip them. It must not go down.
+     * Returns false if the scorer can't skip any documents */
+    bool           (*set_min_score)(FrtScorer *self, float min_score);
 };
 
 #define frt_scorer_new(type, similarity) frt_scorer_create(sizeof(type), similarity)
@@ -761,6 +777,8 @@ extern void frt_fshq_pq_insert(FrtPriorityQueue *pq, FrtHit *hit);
 extern void frt_fshq_pq_destroy(FrtPriorityQueue *pq);
 extern FrtPriorityQueue *frt_fshq_pq_new(int size, FrtSort *sort, FrtIndexReader *ir);
 extern FrtHit *frt_fshq_pq_pop_fd(FrtPriorityQueue *pq);
+extern void frt_fshq_sort_docs(FrtSort *sort, FrtIndexReader *ir, int *docs, int cnt);
+extern void frt_fshq_sort_docs_by(FrtSort *sort, FrtFieldIndex **field_indexes, int *docs, int cnt);
 
 /***************************************************************************
  * FrtFieldDoc
@@ -795,10 +813,17 @@ struct FrtSearcher {
     int            (*doc_freq)(FrtSearcher *self, ID field, const char *term);
     FrtDocument    *(*get_doc)(FrtSearcher *self, int doc_num);
     FrtLazyDoc     *(*get_lazy_doc)(FrtSearcher *self, int doc_num);
+    /* see frt_fr_get_docs */
+    void           (*get_docs)(FrtSearcher *self, const int *doc_nums, int cnt, const ID *fields, int field_cnt, FrtDocument **docs);
     int            (*max_doc)(FrtSearcher *self);
     FrtWeight      *(*create_weight)(FrtSearcher *self, FrtQuery *query);
-    FrtTopDocs     *(*search)(FrtSearcher *self, FrtQuery *query, int first_doc, int num_docs, FrtFilter *filter, FrtSort *sort, FrtPostFilter *post_filter, bool load_fields);
-    FrtTopDocs     *(*search_w)(FrtSearcher *self, FrtWeight *weight, int first_doc, int num_docs, FrtFilter *filter, FrtSort *sort, FrtPostFilter *post_filter, bool load_fields);
+    /*
+     * total_hits is only counted exactly up to total_hits_threshold. Past
+     * that it is a lower bound and the documents which can't make it into
+     * the top num_docs hits may be skipped. INT_MAX counts every hit.
+     */
+    FrtTopDocs     *(*search)(FrtSearcher *self, FrtQuery *query, int first_doc, int num_docs, FrtFilter *filter, FrtSort *sort, FrtPostFilter *post_filter, bool load_fields, int total_hits_threshold);
+    FrtTopDocs     *(*search_w)(FrtSearcher *self, FrtWeight *weight, int first_doc, int num_docs, FrtFilter *filter, FrtSort *sort, FrtPostFilter *post_filter, bool load_fields, int total_hits_threshold);
     void           (*search_each)(FrtSearcher *self, FrtQuery *query, FrtFilter *filter, FrtPostFilter *post_filter, void (*fn)(FrtSearcher *, int, float, void *), void *arg);
     void           (*search_each_w)(FrtSearcher *self, FrtWeight *weight, FrtFilter *filter, FrtPostFilter *post_filter, void (*fn)(FrtSearcher *, int, float, void *), void *arg);
     /*
@@ -826,7 +851,7 @@ struct FrtSearcher {
 #define frt_searcher_rewrite(s, q)          s->rewrite(s, q)
 #define frt_searcher_explain(s, q, dn)      s->explain(s, q, dn)
 #define frt_searcher_close(s)               s->close(s)
-#define frt_searcher_search(s, q, fd, nd, filt, sort, ff)   s->search(s, q, fd, nd, filt, sort, ff, false)
+#define frt_searcher_search(s, q, fd, nd, filt, sort, ff)   s->search(s, q, fd, nd, filt, sort, ff, false, INT_MAX)
 #define frt_searcher_search_each(s, q, filt, ff, fn, arg)   s->search_each(s, q, filt, ff, fn, arg)
 #define frt_searcher_search_unscored(s, q, buf, limit, offset_docnum)   s->search_unscored(s, q, buf, limit, offset_docnum)
 
@@ -850,6 +875,9 @@ extern char **frt_searcher_highlight(FrtSearcher *self,
 typedef struct FrtIndexSearcher {
     FrtSearcher    super;
     FrtIndexReader *ir;
+    /* the number of threads used to score the segments of the index, 1
+     * scores them sequentially in the searching thread */
+    int            max_threads;
 } FrtIndexSearcher;
 
 extern FrtSearcher *frt_isea_alloc(void);
@@ -869,6 +897,7 @@ typedef struct FrtMultiSearcher {
     FrtSearcher **searchers;
     int         *starts;
     int         max_doc;
+    int         max_threads;
 } FrtMultiSearcher;
 
 extern FrtSearcher *frt_msea_alloc(void);
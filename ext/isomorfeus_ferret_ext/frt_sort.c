@@ -64,6 +64,10 @@ FrtSortField *frt_sort_field_init(FrtSortField *sf, ID field, SortType type, boo
     return sf;
 }
 
+FrtSortField *frt_sort_field_new(ID field, SortType type, bool reverse) {
+    return frt_sort_field_init(frt_sort_field_alloc(), field, type, reverse);
+}
+
 void frt_sort_field_destroy(void *p) {
     free(p);
 }
@@ -251,12 +255,8 @@ static void sf_string_get_val(void *index, FrtHit *hit, FrtComparable *comparabl
         ((FrtStringIndex *)index)->index[hit->doc]];
 }
 
-static int sf_string_compare(void *index, FrtHit *hit1, FrtHit *hit2) {
-    char *s1 = ((FrtStringIndex *)index)->values[
-        ((FrtStringIndex *)index)->index[hit1->doc]];
-    char *s2 = ((FrtStringIndex *)index)->values[
-        ((FrtStringIndex *)index)->index[hit2->doc]];
-
+/* missing values sort last */
+static int string_compare(const char *s1, const char *s2) {
     if (s1 == NULL) return s2 ? 1 : 0;
     if (s2 == NULL) return -1;
 
@@ -265,6 +265,15 @@ static int sf_string_compare(void *index, FrtHit *hit1, FrtHit *hit2) {
 #else
     return strcoll(s1, s2);
 #endif
+}
+
+static int sf_string_compare(void *index, FrtHit *hit1, FrtHit *hit2) {
+    char *s1 = ((FrtStringIndex *)index)->values[
+        ((FrtStringIndex *)index)->index[hit1->doc]];
+    char *s2 = ((FrtStringIndex *)index)->values[
+        ((FrtStringIndex *)index)->index[hit2->doc]];
+
+    return string_compare(s1, s2);
 
     /*
      * TODO: investigate whether it would be a good idea to presort strings.
@@ -285,6 +294,94 @@ FrtSortField *frt_sort_field_string_new(ID field, bool reverse) {
     return sort_field_new(field, FRT_SORT_TYPE_STRING, reverse, &sf_string_compare, &sf_string_get_val, &FRT_STRING_FIELD_INDEX_CLASS);
 }
 
+/***************************************************************************
+ * DocValues
+ *
+ * Doc values fields are sorted straight from their segments' columns. See
+ * FrtDocValuesIndex. The byte comparators read the ord of a sorted value
+ * which, like the term rank of the byte index, only orders the values of a
+ * single segment.
+ ***************************************************************************/
+
+/* find the column holding +doc+ and make +doc+ relative to it */
+static FrtDocValues *dvi_find(FrtDocValuesIndex *dvi, int *doc) {
+    int lo = 0, hi = dvi->size - 1;
+    while (lo < hi) {
+        const int mid = (lo + hi + 1) >> 1;
+        if (dvi->starts[mid] <= *doc) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    *doc -= dvi->starts[lo];
+    return dvi->dvs[lo];
+}
+
+static long dvi_get_byte(FrtDocValuesIndex *dvi, int doc) {
+    FrtDocValues *dv = dvi_find(dvi, &doc);
+    if (NULL == dv) return 0;
+    return dv->type == FRT_DOC_VALUES_NUMERIC
+        ? (long)frt_dv_get_long(dv, doc) : frt_dv_get_ord(dv, doc) + 1;
+}
+
+static long dvi_get_long(FrtDocValuesIndex *dvi, int doc) {
+    FrtDocValues *dv = dvi_find(dvi, &doc);
+    return dv ? (long)frt_dv_get_long(dv, doc) : 0;
+}
+
+static char *dvi_get_string(FrtDocValuesIndex *dvi, int doc) {
+    FrtDocValues *dv = dvi_find(dvi, &doc);
+    int ord;
+    if (NULL == dv || (ord = frt_dv_get_ord(dv, doc)) < 0) return NULL;
+    return dv->ords[ord];
+}
+
+static void sf_dv_byte_get_val(void *index, FrtHit *hit, FrtComparable *comparable) {
+    comparable->val.l = dvi_get_byte((FrtDocValuesIndex *)index, hit->doc);
+}
+
+static int sf_dv_byte_compare(void *index, FrtHit *hit1, FrtHit *hit2) {
+    long val1 = dvi_get_byte((FrtDocValuesIndex *)index, hit1->doc);
+    long val2 = dvi_get_byte((FrtDocValuesIndex *)index, hit2->doc);
+    if (val1 > val2) return 1;
+    else if (val1 < val2) return -1;
+    else return 0;
+}
+
+static void sf_dv_int_get_val(void *index, FrtHit *hit, FrtComparable *comparable) {
+    comparable->val.l = dvi_get_long((FrtDocValuesIndex *)index, hit->doc);
+}
+
+static int sf_dv_int_compare(void *index, FrtHit *hit1, FrtHit *hit2) {
+    long val1 = dvi_get_long((FrtDocValuesIndex *)index, hit1->doc);
+    long val2 = dvi_get_long((FrtDocValuesIndex *)index, hit2->doc);
+    if (val1 > val2) return 1;
+    else if (val1 < val2) return -1;
+    else return 0;
+}
+
+static void sf_dv_float_get_val(void *index, FrtHit *hit, FrtComparable *comparable) {
+    comparable->val.f = (float)dvi_get_long((FrtDocValuesIndex *)index, hit->doc);
+}
+
+static int sf_dv_float_compare(void *index, FrtHit *hit1, FrtHit *hit2) {
+    float val1 = (float)dvi_get_long((FrtDocValuesIndex *)index, hit1->doc);
+    float val2 = (float)dvi_get_long((FrtDocValuesIndex *)index, hit2->doc);
+    if (val1 > val2) return 1;
+    else if (val1 < val2) return -1;
+    else return 0;
+}
+
+static void sf_dv_string_get_val(void *index, FrtHit *hit, FrtComparable *comparable) {
+    comparable->val.s = dvi_get_string((FrtDocValuesIndex *)index, hit->doc);
+}
+
+static int sf_dv_string_compare(void *index, FrtHit *hit1, FrtHit *hit2) {
+    return string_compare(dvi_get_string((FrtDocValuesIndex *)index, hit1->doc),
+                          dvi_get_string((FrtDocValuesIndex *)index, hit2->doc));
+}
+
 /***************************************************************************
  * AutoSortField
  ***************************************************************************/
@@ -311,13 +408,15 @@ typedef struct Comparator {
     void *index;
     bool  reverse : 1;
     int   (*compare)(void *index_ptr, FrtHit *hit1, FrtHit *hit2);
+    void  (*get_val)(void *index_ptr, FrtHit *hit, FrtComparable *comparable);
 } Comparator;
 
-static Comparator *comparator_new(void *index, bool reverse, int (*compare)(void *index_ptr, FrtHit *hit1, FrtHit *hit2)) {
+static Comparator *comparator_new(void *index, bool reverse, int (*compare)(void *index_ptr, FrtHit *hit1, FrtHit *hit2), void (*get_val)(void *index_ptr, FrtHit *hit, FrtComparable *comparable)) {
     Comparator *self = FRT_ALLOC(Comparator);
     self->index = index;
     self->reverse = reverse;
     self->compare = compare;
+    self->get_val = get_val;
     return self;
 }
 
@@ -356,28 +455,71 @@ static void sort_field_auto_evaluate(FrtSortField *sf, char *text) {
     }
 }
 
+/* read the values of +sf+ straight from the doc values columns of +dvi+ */
+static void comparator_use_doc_values(Comparator *self, FrtSortField *sf, FrtDocValuesIndex *dvi) {
+    self->index = dvi;
+    switch (sf->type) {
+        case FRT_SORT_TYPE_BYTE:
+            self->compare = &sf_dv_byte_compare;
+            self->get_val = &sf_dv_byte_get_val;
+            break;
+        case FRT_SORT_TYPE_INTEGER:
+            self->compare = &sf_dv_int_compare;
+            self->get_val = &sf_dv_int_get_val;
+            break;
+        case FRT_SORT_TYPE_FLOAT:
+            self->compare = &sf_dv_float_compare;
+            self->get_val = &sf_dv_float_get_val;
+            break;
+        default:
+            self->compare = &sf_dv_string_compare;
+            self->get_val = &sf_dv_string_get_val;
+            break;
+    }
+}
+
+/* the comparator of +sf+ reading its values from +field_index+, which is
+ * NULL for the score and doc sort fields */
+static Comparator *sorter_comparator_new(FrtSortField *sf, FrtFieldIndex *field_index) {
+    Comparator *self = comparator_new(field_index ? field_index->index : NULL,
+                                      sf->reverse, sf->compare, sf->get_val);
+    if (field_index && field_index->dv_index) {
+        comparator_use_doc_values(self, sf, field_index->dv_index);
+    }
+    return self;
+}
+
 static Comparator *sorter_get_comparator(FrtSortField *sf, FrtIndexReader *ir) {
-    void *index = NULL;
+    FrtFieldIndex *field_index = NULL;
     if (sf->type > FRT_SORT_TYPE_DOC) {
-        FrtFieldIndex *field_index = NULL;
         if (sf->type == FRT_SORT_TYPE_AUTO) {
-            FrtTermEnum *te = frt_ir_terms(ir, sf->field);
-            if (te) {
-                if (!te->next(te) && (ir->num_docs(ir) > 0)) {
-                    FRT_RAISE(FRT_ARG_ERROR,
-                        "Cannot sort by field \"%s\" as there are no terms "
-                        "in that field in the index.", rb_id2name(sf->field));
+            FrtFieldInfo *fi = frt_fis_get_field(ir->fis, sf->field);
+            /* doc values fields know the type of their values */
+            const FrtDocValuesType dv_type =
+                fi ? bits_doc_values_type(fi->bits) : FRT_DOC_VALUES_NONE;
+            if (dv_type == FRT_DOC_VALUES_NUMERIC) {
+                SET_AUTO(INTEGER, int);
+            } else if (dv_type != FRT_DOC_VALUES_NONE) {
+                SET_AUTO(STRING, string);
+            } else {
+                FrtTermEnum *te = frt_ir_terms(ir, sf->field);
+                if (te) {
+                    if (!te->next(te) && (ir->num_docs(ir) > 0)) {
+                        FRT_RAISE(FRT_ARG_ERROR,
+                            "Cannot sort by field \"%s\" as there are no terms "
+                            "in that field in the index.", rb_id2name(sf->field));
+                    }
+                    sort_field_auto_evaluate(sf, te->curr_term);
+                    te->close(te);
                 }
-                sort_field_auto_evaluate(sf, te->curr_term);
-                te->close(te);
             }
         }
-        frt_mutex_lock(&ir->field_index_mutex);
-        field_index = frt_field_index_get(ir, sf->field, sf->field_index_class);
-        frt_mutex_unlock(&ir->field_index_mutex);
-        index = field_index->index;
+        FrtIndexReader *core = frt_ir_core(ir);
+        frt_mutex_lock(&core->field_index_mutex);
+        field_index = frt_field_index_get(core, sf->field, sf->field_index_class);
+        frt_mutex_unlock(&core->field_index_mutex);
     }
-    return comparator_new(index, sf->reverse, sf->compare);
+    return sorter_comparator_new(sf, field_index);
 }
 
 static void sorter_destroy(Sorter *self) {
@@ -523,6 +665,56 @@ FrtPriorityQueue *frt_fshq_pq_new(int size, FrtSort *sort, FrtIndexReader *ir) {
     return self;
 }
 
+static void fshq_sort_docs(FrtPriorityQueue *pq, int *docs, int cnt) {
+    FrtHit hit;
+    FrtHit *top;
+    int i;
+
+    hit.score = 0.0f;
+    for (i = 0; i < cnt; i++) {
+        hit.doc = docs[i];
+        frt_fshq_pq_insert(pq, &hit);
+    }
+    /* the queue pops the hit which sorts last first */
+    for (i = cnt - 1; NULL != (top = frt_fshq_pq_pop(pq)); i--) {
+        docs[i] = top->doc;
+        free(top);
+    }
+    frt_fshq_pq_destroy(pq);
+}
+
+/*
+ * Sort the +cnt+ document numbers in +docs+ into the order +sort+ would
+ * return them in when searching +ir+. This is used to sort the documents of
+ * a segment by the index sort.
+ */
+void frt_fshq_sort_docs(FrtSort *sort, FrtIndexReader *ir, int *docs, int cnt) {
+    if (cnt <= 1) return;
+    fshq_sort_docs(frt_fshq_pq_new(cnt, sort, ir), docs, cnt);
+}
+
+/*
+ * Sort +docs+ like frt_fshq_sort_docs but read the values of each sort field
+ * from +field_indexes+, which holds one field index for each field of +sort+,
+ * or NULL for the score and doc sort fields. This sorts documents which
+ * aren't in an index yet.
+ */
+void frt_fshq_sort_docs_by(FrtSort *sort, FrtFieldIndex **field_indexes, int *docs, int cnt) {
+    FrtPriorityQueue *pq;
+    Sorter *sorter;
+    int i;
+
+    if (cnt <= 1) return;
+    pq = frt_pq_new(cnt, &fshq_less_than, &free);
+    sorter = sorter_new(sort);
+    for (i = 0; i < sort->size; i++) {
+        sorter->comparators[i] = sorter_comparator_new(sort->sort_fields[i],
+                                                       field_indexes[i]);
+    }
+    pq->heap[0] = sorter;
+    fshq_sort_docs(pq, docs, cnt);
+}
+
 FrtHit *frt_fshq_pq_pop_fd(FrtPriorityQueue *pq) {
     if (pq->size <= 0) {
         return NULL;
@@ -548,7 +740,7 @@ FrtHit *frt_fshq_pq_pop_fd(FrtPriorityQueue *pq) {
         for (j = 0; j < cmp_cnt; j++) {
             FrtSortField *sf = sort_fields[j];
             Comparator *comparator = comparators[j];
-            sf->get_val(comparator->index, hit, &(comparables[j]));
+            comparator->get_val(comparator->index, hit, &(comparables[j]));
             comparables[j].type = sf->type;
             comparables[j].reverse = comparator->reverse;
         }
@@ -2,7 +2,7 @@
 #include <string.h>
 
 #define VINT_MAX_LEN 10
-#define VINT_END FRT_BUFFER_SIZE - VINT_MAX_LEN
+#define VINT_END (os->buf.size - VINT_MAX_LEN)
 
 /*
  * TODO: add try finally
@@ -52,8 +52,18 @@ FrtStore *frt_store_alloc(void) {
     return FRT_ALLOC(FrtStore);
 }
 
+static _Atomic frt_u64 store_next_generation = 0;
+
+/**
+ * Give +store+ a generation no store has had before.
+ */
+void frt_store_new_generation(FrtStore *store) {
+    store->generation = ++store_next_generation;
+}
+
 FrtStore *frt_store_init(FrtStore *store) {
     store->ref_cnt = 1;
+    frt_store_new_generation(store);
     frt_mutex_init(&store->mutex_i, NULL);
     frt_mutex_init(&store->mutex, NULL);
     store->locks = frt_hs_new_ptr((frt_free_ft)&frt_close_lock_i);
@@ -95,6 +105,8 @@ void frt_store_close(FrtStore *store) {
  */
 FrtOutStream *frt_os_new(void) {
     FrtOutStream *os = FRT_ALLOC(FrtOutStream);
+    os->buf.size = FRT_BUFFER_SIZE;
+    os->buf.buf = FRT_ALLOC_N(frt_uchar, os->buf.size);
     os->buf.start = 0;
     os->buf.pos = 0;
     os->buf.len = 0;
@@ -117,9 +129,17 @@ void frt_os_close(FrtOutStream *os)
 {
     frt_os_flush(os);
     os->m->close_i(os);
+    free(os->buf.buf);
     free(os);
 }
 
+void frt_os_set_buffer_size(FrtOutStream *os, int size)
+{
+    frt_os_flush(os);
+    os->buf.size = size;
+    FRT_REALLOC_N(os->buf.buf, frt_uchar, size);
+}
+
 off_t frt_os_pos(FrtOutStream *os)
 {
     return os->buf.start + os->buf.pos;
@@ -147,7 +167,7 @@ void frt_os_seek(FrtOutStream *os, frt_off_t new_pos)
  */
 void frt_os_write_byte(FrtOutStream *os, frt_uchar b)
 {
-    if (os->buf.pos >= (FRT_BUFFER_SIZE - 1)) {
+    if (os->buf.pos >= (os->buf.size - 1)) {
         frt_os_flush(os);
     }
     write_byte(os, b);
@@ -155,7 +175,7 @@ void frt_os_write_byte(FrtOutStream *os, frt_uchar b)
 
 void frt_os_write_bytes(FrtOutStream *os, const frt_uchar *buf, int len)
 {
-    if (len < (FRT_BUFFER_SIZE - os->buf.pos)) {
+    if (len < (os->buf.size - os->buf.pos)) {
         memcpy(os->buf.buf + os->buf.pos, buf, len);
         os->buf.pos += len;
     }
@@ -164,11 +184,11 @@ void frt_os_write_bytes(FrtOutStream *os, const frt_uchar *buf, int len)
         int pos = 0;
         int size;
         while (pos < len) {
-            if (len - pos < FRT_BUFFER_SIZE) {
+            if (len - pos < os->buf.size) {
                 size = len - pos;
             }
             else {
-                size = FRT_BUFFER_SIZE;
+                size = os->buf.size;
             }
             os->m->flush_i(os, buf + pos, size);
             pos += size;
@@ -186,6 +206,9 @@ FrtInStream *frt_is_new(void) {
     FrtInStream *is = FRT_ALLOC(FrtInStream);
     is->f = FRT_ALLOC_AND_ZERO(FrtInStreamFile);
     is->f->ref_cnt = 1;
+    is->buf.size = FRT_BUFFER_SIZE;
+    is->buf.own = FRT_ALLOC_N(frt_uchar, is->buf.size);
+    is->buf.buf = is->buf.own;
     is->buf.start = 0;
     is->buf.pos = 0;
     is->buf.len = 0;
@@ -193,6 +216,80 @@ FrtInStream *frt_is_new(void) {
     return is;
 }
 
+/**
+ * Create a newly allocated InStream which reads the +len+ bytes at +bytes+
+ * directly, without a buffer of its own. +bytes+ must stay valid until the
+ * InStream's file is closed.
+ *
+ * @return a newly allocated and initialized InStream
+ */
+FrtInStream *frt_is_new_mapped(const frt_uchar *bytes, frt_off_t len) {
+    FrtInStream *is = FRT_ALLOC(FrtInStream);
+    is->f = FRT_ALLOC_AND_ZERO(FrtInStreamFile);
+    is->f->ref_cnt = 1;
+    is->buf.own = NULL;
+    is->buf.size = 0;
+    is->buf.buf = bytes;
+    is->buf.start = 0;
+    is->buf.pos = 0;
+    is->buf.len = len;
+    is->ref_cnt = 1;
+    return is;
+}
+
+static void ownedi_read_i(FrtInStream *is, frt_uchar *buf, int len)
+{
+    frt_off_t pos = frt_is_pos(is);
+    if (pos + len > is->f->file.map.len) {
+        FRT_RAISE(FRT_EOF_ERROR, "couldn't read %d chars from buffer", len);
+    }
+    memcpy(buf, is->f->file.map.addr + pos, len);
+}
+
+static void ownedi_seek_i(FrtInStream *is, frt_off_t pos)
+{
+    (void)is;
+    (void)pos;
+}
+
+static frt_off_t ownedi_length_i(FrtInStream *is)
+{
+    return is->f->file.map.len;
+}
+
+static void ownedi_close_i(FrtInStream *is)
+{
+    free(is->f->file.map.addr);
+}
+
+static const struct FrtInStreamMethods OWNED_IN_STREAM_METHODS = {
+    ownedi_read_i,
+    ownedi_seek_i,
+    ownedi_length_i,
+    ownedi_close_i
+};
+
+/**
+ * Create a newly allocated InStream which reads the +len+ bytes at +bytes+
+ * like frt_is_new_mapped but takes them over. +bytes+ must have been
+ * allocated with malloc and they are freed when the InStream's file is
+ * closed, ie. when the InStream and all of its clones are closed.
+ *
+ * @return a newly allocated and initialized InStream
+ */
+FrtInStream *frt_is_new_owned(frt_uchar *bytes, frt_off_t len) {
+    FrtInStream *is = frt_is_new_mapped(bytes, len);
+    is->f->file.map.addr = bytes;
+    is->f->file.map.len = len;
+    is->m = &OWNED_IN_STREAM_METHODS;
+    return is;
+}
+
+bool frt_is_mapped(FrtInStream *is)
+{
+    return NULL == is->buf.own;
+}
+
 /**
  * Refill the InStream's buffer from the store source (filesystem or memory).
  *
@@ -203,9 +300,14 @@ FrtInStream *frt_is_new(void) {
 static void is_refill(FrtInStream *is)
 {
     frt_off_t start = is->buf.start + is->buf.pos;
-    frt_off_t last = start + FRT_BUFFER_SIZE;
+    frt_off_t last = start + is->buf.size;
     frt_off_t flen = is->m->length_i(is);
 
+    if (frt_is_mapped(is)) {    /* the whole file is already buffered */
+        FRT_RAISE(FRT_EOF_ERROR, "current pos = %"FRT_OFF_T_PFX"d, "
+              "file length = %"FRT_OFF_T_PFX"d", start, flen);
+    }
+
     if (last > flen) {          /* don't read past EOF */
         last = flen;
     }
@@ -216,7 +318,7 @@ static void is_refill(FrtInStream *is)
               "file length = %"FRT_OFF_T_PFX"d", start, flen);
     }
 
-    is->m->read_i(is, is->buf.buf, is->buf.len);
+    is->m->read_i(is, is->buf.own, is->buf.len);
 
     is->buf.start = start;
     is->buf.pos = 0;
@@ -256,7 +358,16 @@ frt_uchar *frt_is_read_bytes(FrtInStream *is, frt_uchar *buf, int len)
     int i;
     frt_off_t start;
 
-    if ((is->buf.pos + len) < is->buf.len) {
+    if (frt_is_mapped(is)) {
+        if (is->buf.pos + len > is->buf.len) {
+            FRT_RAISE(FRT_EOF_ERROR, "Tried to read past end of file. File "
+                      "length is <%"FRT_OFF_T_PFX"d> and tried to read to "
+                      "<%"FRT_OFF_T_PFX"d>", is->buf.len, is->buf.pos + len);
+        }
+        memcpy(buf, is->buf.buf + is->buf.pos, len);
+        is->buf.pos += len;
+    }
+    else if ((is->buf.pos + len) < is->buf.len) {
         for (i = 0; i < len; i++) {
             buf[i] = read_byte(is);
         }
@@ -274,7 +385,9 @@ frt_uchar *frt_is_read_bytes(FrtInStream *is, frt_uchar *buf, int len)
 }
 
 void frt_is_seek(FrtInStream *is, frt_off_t pos) {
-    if (pos >= is->buf.start && pos < (is->buf.start + is->buf.len)) {
+    if (frt_is_mapped(is)) {
+        is->buf.pos = pos;                  /* the whole file is buffered */
+    } else if (pos >= is->buf.start && pos < (is->buf.start + is->buf.len)) {
         is->buf.pos = pos - is->buf.start;  /* seek within buffer */
     } else {
         is->buf.start = pos;
@@ -295,21 +408,65 @@ void frt_is_close(FrtInStream *is) {
             is->m->close_i(is);
             free(is->f);
         }
+        free(is->buf.own);
         free(is);
     }
 }
 
+void frt_is_read_bytes_at(FrtInStream *is, frt_off_t pos, frt_uchar *buf, int len)
+{
+    FrtInStream view;
+    if (frt_is_mapped(is)) {
+        if (pos + len > is->buf.len) {
+            FRT_RAISE(FRT_EOF_ERROR, "Tried to read past end of file. File "
+                      "length is <%"FRT_OFF_T_PFX"d> and tried to read to "
+                      "<%"FRT_OFF_T_PFX"d>", is->buf.len, pos + len);
+        }
+        memcpy(buf, is->buf.buf + pos, len);
+        return;
+    }
+    /* read through a copy of the stream positioned at +pos+ */
+    memcpy(&view, is, sizeof(FrtInStream));
+    view.buf.start = pos;
+    view.buf.pos = 0;
+    view.buf.len = 0;
+    view.m->seek_i(&view, pos);
+    view.m->read_i(&view, buf, len);
+}
+
 FrtInStream *frt_is_clone(FrtInStream *is)
 {
     if (!(is->f))
         return NULL;
     FrtInStream *new_is = FRT_ALLOC(FrtInStream);
     memcpy(new_is, is, sizeof(FrtInStream));
+    if (is->buf.own) {
+        new_is->buf.own = FRT_ALLOC_N(frt_uchar, is->buf.size);
+        memcpy(new_is->buf.own, is->buf.own, is->buf.len);
+        new_is->buf.buf = new_is->buf.own;
+    }
     new_is->ref_cnt = 1;
     FRT_REF(new_is->f);
     return new_is;
 }
 
+void frt_is_set_buffer_size(FrtInStream *is, int size)
+{
+    frt_off_t pos;
+    if (frt_is_mapped(is) || size == is->buf.size) {
+        return;
+    }
+    /* drop the buffered bytes, the next read refills at the same position */
+    pos = frt_is_pos(is);
+    is->buf.start = pos;
+    is->buf.pos = 0;
+    is->buf.len = 0;
+    is->m->seek_i(is, pos);
+    is->buf.size = size;
+    FRT_REALLOC_N(is->buf.own, frt_uchar, size);
+    is->buf.buf = is->buf.own;
+}
+
 frt_i32 frt_is_read_i32(FrtInStream *is)
 {
     return ((frt_i32)frt_is_read_byte(is) << 24) |
@@ -613,15 +770,19 @@ int frt_file_is_lock(const char *filename)
     return ((start > 0) && (strcmp(FRT_LOCK_EXT, &filename[start]) == 0));
 }
 
+/* copies straight from +is+'s buffer so the bytes are only copied once */
 void frt_is2os_copy_bytes(FrtInStream *is, FrtOutStream *os, int cnt)
 {
     int len;
-    frt_uchar buf[FRT_BUFFER_SIZE];
 
-    for (; cnt > 0; cnt -= FRT_BUFFER_SIZE) {
-        len = ((cnt > FRT_BUFFER_SIZE) ? FRT_BUFFER_SIZE : cnt);
-        frt_is_read_bytes(is, buf, len);
-        frt_os_write_bytes(os, buf, len);
+    while (cnt > 0) {
+        if (is->buf.pos >= is->buf.len) {
+            is_refill(is);
+        }
+        len = (int)FRT_MIN(is->buf.len - is->buf.pos, cnt);
+        frt_os_write_bytes(os, is->buf.buf + is->buf.pos, len);
+        is->buf.pos += len;
+        cnt -= len;
     }
 }
 
@@ -10,14 +10,41 @@
 #define FRT_LOCK_PREFIX "ferret-"
 #define FRT_LOCK_EXT ".lck"
 
+/*
+ * Streams buffer FRT_BUFFER_SIZE bytes unless they are told otherwise with
+ * frt_is_set_buffer_size or frt_os_set_buffer_size. Streams which read or
+ * write a whole file front to back, like those of merges and flushes, should
+ * use FRT_SEQUENTIAL_BUFFER_SIZE. Streams which seek for a few bytes at a
+ * time should use FRT_RANDOM_BUFFER_SIZE so that each seek reads less.
+ */
+#define FRT_SEQUENTIAL_BUFFER_SIZE 65536
+#define FRT_RANDOM_BUFFER_SIZE 1024
+
 typedef struct FrtBuffer
 {
-    frt_uchar buf[FRT_BUFFER_SIZE];
+    frt_uchar *buf;
+    int       size;
     frt_off_t start;
     frt_off_t pos;
     frt_off_t len;
 } FrtBuffer;
 
+/*
+ * The read buffer of an FrtInStream. +buf+ usually points at the 4KB +own+
+ * buffer which is refilled from the file. Streams of memory mapped files
+ * have no +own+ buffer, instead +buf+ points straight into the mapping and
+ * covers the whole file so they never need refilling.
+ */
+typedef struct FrtInBuffer
+{
+    const frt_uchar *buf;
+    frt_uchar *own;
+    int size;
+    frt_off_t start;
+    frt_off_t pos;
+    frt_off_t len;
+} FrtInBuffer;
+
 typedef struct FrtOutStream FrtOutStream;
 struct FrtOutStreamMethods {
     /* internal functions for the FrtInStream */
@@ -114,16 +141,22 @@ struct FrtInStreamMethods
     void (*close_i)(struct FrtInStream *is);
 };
 
+typedef struct FrtFSFile FrtFSFile;
+
 typedef struct FrtInStreamFile {
     _Atomic unsigned int ref_cnt;
     union {
-        int fd;
+        FrtFSFile *fsf;         /* only used by FSIn */
         FrtRAMFile *rf;
+        struct {
+            frt_uchar *addr;
+            frt_off_t len;
+        } map;                  /* only used by MMapIn and OwnedIn */
     } file;
 } FrtInStreamFile;
 
 struct FrtInStream {
-    FrtBuffer buf;
+    FrtInBuffer buf;
     struct FrtInStreamFile *f;
     union {
         frt_off_t pointer;      /* only used by RAMIn */
@@ -325,6 +358,13 @@ struct FrtStore {
      * Reference to be used within ruby realm.
      */
     VALUE rstore;
+
+    /**
+     * Changes whenever an index is created in the store, which starts the
+     * segment names over. No two stores share a generation, except that a
+     * compound store has the one of the store the compound file is in.
+     */
+    _Atomic frt_u64 generation;
 };
 
 /**
@@ -336,6 +376,19 @@ struct FrtStore {
  */
 extern FrtStore *frt_open_fs_store(const char *pathname);
 
+/**
+ * Create a newly allocated file-system FrtStore at the pathname designated
+ * which memory maps the files it opens for reading. Reading from the
+ * resulting input streams copies nothing, they read straight from the page
+ * cache and their clones share the mapping. Writing works the same as for
+ * frt_open_fs_store. On systems without mmap this is the same as
+ * frt_open_fs_store.
+ *
+ * @param pathname the pathname of the directory to be used by the index
+ * @return a newly allocated memory mapping file-system FrtStore.
+ */
+extern FrtStore *frt_open_mmap_store(const char *pathname);
+
 /**
  * Create a newly allocated in-memory or RAM FrtStore.
  *
@@ -459,6 +512,15 @@ extern void frt_os_flush(FrtOutStream *os);
  */
 extern void frt_os_close(FrtOutStream *os);
 
+/**
+ * Flush FrtOutStream +os+ and change the size of its buffer to +size+ bytes.
+ *
+ * @param os the FrtOutStream to resize the buffer of
+ * @param size the new buffer size in bytes, see FRT_SEQUENTIAL_BUFFER_SIZE
+ * @raise FRT_IO_ERROR if there is an error flushing the buffer
+ */
+extern void frt_os_set_buffer_size(FrtOutStream *os, int size);
+
 /**
  * Return the current position of FrtOutStream +os+.
  *
@@ -619,6 +681,16 @@ extern void frt_is_close(FrtInStream *is);
  */
 extern FrtInStream *frt_is_clone(FrtInStream *is);
 
+/**
+ * Change the size of +is+'s buffer to +size+ bytes. Streams of memory mapped
+ * files have no buffer of their own and ignore this.
+ *
+ * @param is the FrtInStream to resize the buffer of
+ * @param size the new buffer size in bytes, see FRT_SEQUENTIAL_BUFFER_SIZE and
+ *   FRT_RANDOM_BUFFER_SIZE
+ */
+extern void frt_is_set_buffer_size(FrtInStream *is, int size);
+
 /**
  * Read a singly byte (unsigned char) from the FrtInStream +is+.
  *
@@ -641,6 +713,22 @@ extern frt_uchar frt_is_read_byte(FrtInStream *is);
  */
 extern frt_uchar *frt_is_read_bytes(FrtInStream *is, frt_uchar *buf, int len);
 
+/**
+ * Read +len+ bytes at position +pos+ of the file FrtInStream +is+ reads from
+ * into buffer +buf+. Neither the position nor the buffer of +is+ is used or
+ * changed so any number of threads can read through one stream at once, as
+ * long as the file's own reads don't share a position. File-system streams
+ * read with pread, except on Windows.
+ *
+ * @param is     the FrtInStream to read from
+ * @param pos    the position in the file to read from
+ * @param buf    the buffer to read into
+ * @param len    the number of bytes to read
+ * @raise FRT_IO_ERROR if there is a error reading from the file-system
+ * @raise FRT_EOF_ERROR if there is an attempt to read past the end of the file
+ */
+extern void frt_is_read_bytes_at(FrtInStream *is, frt_off_t pos, frt_uchar *buf, int len);
+
 /**
  * Read a 32-bit unsigned integer from the FrtInStream.
  *
@@ -787,8 +875,12 @@ extern void frt_close_lock(FrtLock *lock);
 extern FrtStore *frt_store_alloc();
 extern FrtStore *frt_store_init(FrtStore *store);
 extern FrtStore *frt_store_new();
+extern void frt_store_new_generation(FrtStore *store);
 extern FrtOutStream *frt_os_new();
 extern FrtInStream *frt_is_new();
+extern FrtInStream *frt_is_new_mapped(const frt_uchar *bytes, frt_off_t len);
+extern FrtInStream *frt_is_new_owned(frt_uchar *bytes, frt_off_t len);
+extern bool frt_is_mapped(FrtInStream *is);
 extern int frt_file_is_lock(const char *filename);
 extern bool frt_file_name_filter_is_index_file(const char *file_name, bool include_locks);
 
@@ -2,8 +2,11 @@
 #define FRT_THREADING_H
 
 #include <pthread.h>
+#include "frt_config.h"
 
 typedef pthread_mutex_t frt_mutex_t;
+typedef pthread_cond_t frt_cond_t;
+typedef pthread_t frt_thread_t;
 typedef struct FrtHash *frt_thread_key_t;
 typedef pthread_once_t frt_thread_once_t;
 
@@ -12,18 +15,36 @@ extern int frb_thread_key_create(frt_thread_key_t *key, void (*destr_function)(v
 extern void frb_thread_key_delete(frt_thread_key_t key);
 extern void frb_thread_setspecific(frt_thread_key_t key, const void *pointer);
 extern void *frb_thread_getspecific(frt_thread_key_t key);
+extern bool frb_thread_has_gvl(void);
+extern bool frb_thread_interrupted(void);
+extern void *frb_thread_call_without_gvl(void *(*func)(void *), void *arg);
+extern void *frb_thread_call_without_gvl_uninterruptible(void *(*func)(void *), void *arg);
+extern void *frb_thread_call_with_gvl(void *(*func)(void *), void *arg);
 
 #define FRT_MUTEX_INITIALIZER PTHREAD_MUTEX_INITIALIZER
 #define FRT_THREAD_ONCE_INIT PTHREAD_ONCE_INIT
+#define FRT_COND_INITIALIZER PTHREAD_COND_INITIALIZER
 #define frt_mutex_init(a, b) pthread_mutex_init(a, b)
 #define frt_mutex_lock(a) pthread_mutex_lock(a)
 #define frt_mutex_trylock(a) pthread_mutex_trylock(a)
 #define frt_mutex_unlock(a) pthread_mutex_unlock(a)
 #define frt_mutex_destroy(a) pthread_mutex_destroy(a)
+#define frt_cond_init(a, b) pthread_cond_init(a, b)
+#define frt_cond_wait(a, b) pthread_cond_wait(a, b)
+#define frt_cond_timedwait(a, b, c) pthread_cond_timedwait(a, b, c)
+#define frt_cond_signal(a) pthread_cond_signal(a)
+#define frt_cond_broadcast(a) pthread_cond_broadcast(a)
+#define frt_cond_destroy(a) pthread_cond_destroy(a)
+#define frt_thread_create(a, b, c) pthread_create(a, NULL, b, c)
+#define frt_thread_join(a) pthread_join(a, NULL)
+#define frt_thread_detach(a) pthread_detach(a)
 #define frt_thread_key_create(a, b) frb_thread_key_create(a, b)
 #define frt_thread_key_delete(a) frb_thread_key_delete(a)
 #define frt_thread_setspecific(a, b) frb_thread_setspecific(a, b)
 #define frt_thread_getspecific(a) frb_thread_getspecific(a)
 #define frt_thread_once(a, b) pthread_once(a, b)
+#define frt_thread_has_gvl() frb_thread_has_gvl()
+#define frt_thread_interrupted() frb_thread_interrupted()
+#define frt_thread_call_with_gvl(a, b) frb_thread_call_with_gvl(a, b)
 
 #endif
@@ -6,6 +6,7 @@
 #include "frt_hashset.h"
 #include "frt_threading.h"
 #include "ruby.h"
+#include <ruby/thread.h>
 
 /* IDs */
 ID id_new;
@@ -62,21 +63,192 @@ void frb_thread_once(int *once_control, void (*init_routine) (void)) {
     }
 }
 
+/* the thread key hashes are shared by all threads and may be accessed while
+ * the GVL is released so all access to them must be synchronized */
+static frt_mutex_t thread_key_mutex = FRT_MUTEX_INITIALIZER;
+
+/* native threads started by ferret, like the merge threads, aren't ruby
+ * threads so they are identified by their pthread id */
+static void *frb_thread_id(void) {
+    if (ruby_native_thread_p()) {
+        return (void *)rb_thread_current();
+    }
+    return (void *)pthread_self();
+}
+
 int frb_thread_key_create(frt_thread_key_t *key, void (*destr_function)(void *)) {
     *key = frt_h_new(&value_hash, &value_eq, NULL, destr_function);
     return 0;
 }
 
 void frb_thread_key_delete(frt_thread_key_t key) {
+    frt_mutex_lock(&thread_key_mutex);
     frt_h_destroy(key);
+    frt_mutex_unlock(&thread_key_mutex);
 }
 
 void frb_thread_setspecific(frt_thread_key_t key, const void *pointer) {
-    frt_h_set(key, (void *)rb_thread_current(), (void *)pointer);
+    frt_mutex_lock(&thread_key_mutex);
+    frt_h_set(key, frb_thread_id(), (void *)pointer);
+    frt_mutex_unlock(&thread_key_mutex);
 }
 
 void *frb_thread_getspecific(frt_thread_key_t key) {
-    return frt_h_get(key, (void *)rb_thread_current());
+    void *pointer;
+    frt_mutex_lock(&thread_key_mutex);
+    pointer = frt_h_get(key, frb_thread_id());
+    frt_mutex_unlock(&thread_key_mutex);
+    return pointer;
+}
+
+/****************************************************************************
+ *
+ * GVL Methods
+ *
+ * Long running C code like searching, adding documents or merging segments
+ * is run with the GVL released so that other ruby threads can run in the
+ * meantime. Exceptions raised in the C code are caught while the GVL is
+ * released and re-raised as ruby exceptions once it has been reacquired.
+ * Callbacks into ruby code, for example ruby analyzers or filter procs, must
+ * be made using frb_thread_call_with_gvl.
+ *
+ ****************************************************************************/
+
+typedef struct FrbNoGvlCall {
+    void *(*func)(void *);
+    void *arg;
+    void *result;
+    int ex_code;
+    int rb_state;
+    /* set by the unblocking function when ruby wants to interrupt the thread,
+     * for example on Ctrl-C or Thread#kill */
+    volatile int interrupted;
+    /* set once the C code has seen the interrupt and so may have given up */
+    volatile int interrupt_seen;
+    char msg[FRT_XMSG_BUFFER_FINAL_SIZE];
+} FrbNoGvlCall;
+
+typedef struct FrbGvlCall {
+    void *(*func)(void *);
+    void *arg;
+    void *result;
+    int rb_state;
+} FrbGvlCall;
+
+/* set while the current native thread runs without the GVL */
+static _Thread_local FrbNoGvlCall *no_gvl_call = NULL;
+
+bool frb_thread_has_gvl(void) {
+    return NULL == no_gvl_call && ruby_native_thread_p();
+}
+
+bool frb_thread_interrupted(void) {
+    if (NULL != no_gvl_call && no_gvl_call->interrupted) {
+        no_gvl_call->interrupt_seen = 1;
+        return true;
+    }
+    return false;
+}
+
+static void frb_no_gvl_ubf(void *arg) {
+    ((FrbNoGvlCall *)arg)->interrupted = 1;
+}
+
+static void *frb_no_gvl_i(void *arg) {
+    FrbNoGvlCall *volatile call = (FrbNoGvlCall *)arg;
+    no_gvl_call = call;
+    FRT_TRY
+        call->result = call->func(call->arg);
+    FRT_XCATCHALL
+        call->ex_code = xcontext.excode;
+        snprintf(call->msg, FRT_XMSG_BUFFER_FINAL_SIZE, "%s",
+                 xcontext.msg ? xcontext.msg : "");
+        FRT_HANDLED();
+    FRT_XENDTRY
+    no_gvl_call = NULL;
+    return NULL;
+}
+
+static void *frb_call_without_gvl(void *(*func)(void *), void *arg, rb_unblock_function_t *ubf) {
+    FrbNoGvlCall call;
+    if (NULL != no_gvl_call) {
+        /* we are already running without the GVL */
+        return func(arg);
+    }
+    call.func = func;
+    call.arg = arg;
+    while (true) {
+        call.result = NULL;
+        call.ex_code = 0;
+        call.rb_state = 0;
+        call.interrupted = 0;
+        call.interrupt_seen = 0;
+        call.msg[0] = '\0';
+        rb_thread_call_without_gvl(&frb_no_gvl_i, &call, ubf, ubf ? &call : NULL);
+        if (!call.ex_code || !call.interrupt_seen) {
+            break;
+        }
+        /* the C code gave up because of the interrupt so raise the pending
+         * interrupt rather than the error it was aborted with. If there is
+         * nothing to raise, a signal handler for example, just run it again */
+        rb_thread_check_ints();
+    }
+    if (call.rb_state) {
+        /* re-raise the exception raised by a ruby callback */
+        rb_jump_tag(call.rb_state);
+    }
+    if (call.ex_code) {
+        frb_raise(call.ex_code, call.msg);
+    }
+    return call.result;
+}
+
+/* long running C code checks frt_thread_interrupted() now and then and
+ * raises when ruby wants to interrupt the thread */
+void *frb_thread_call_without_gvl(void *(*func)(void *), void *arg) {
+    return frb_call_without_gvl(func, arg, &frb_no_gvl_ubf);
+}
+
+/* for code which must run to the end, like closing an IndexWriter */
+void *frb_thread_call_without_gvl_uninterruptible(void *(*func)(void *), void *arg) {
+    return frb_call_without_gvl(func, arg, NULL);
+}
+
+static VALUE frb_gvl_protected_i(VALUE arg) {
+    FrbGvlCall *call = (FrbGvlCall *)arg;
+    call->result = call->func(call->arg);
+    return Qnil;
+}
+
+static void *frb_gvl_i(void *arg) {
+    FrbGvlCall *call = (FrbGvlCall *)arg;
+    rb_protect(&frb_gvl_protected_i, (VALUE)call, &call->rb_state);
+    return NULL;
+}
+
+void *frb_thread_call_with_gvl(void *(*func)(void *), void *arg) {
+    FrbNoGvlCall *outer = no_gvl_call;
+    FrbGvlCall call;
+    if (NULL == outer) {
+        if (!ruby_native_thread_p()) {
+            FRT_RAISE(FRT_STATE_ERROR, "ruby can't be called from a native thread");
+        }
+        return func(arg);
+    }
+    call.func = func;
+    call.arg = arg;
+    call.result = NULL;
+    call.rb_state = 0;
+    no_gvl_call = NULL;
+    rb_thread_call_with_gvl(&frb_gvl_i, &call);
+    no_gvl_call = outer;
+    if (call.rb_state) {
+        /* unwind the C code, the ruby exception is re-raised once the GVL
+         * has been reacquired */
+        outer->rb_state = call.rb_state;
+        FRT_RAISE(FRT_EXCEPTION, "exception raised in ruby callback");
+    }
+    return call.result;
 }
 
 void frb_create_dir(VALUE rpath) {
@@ -104,9 +276,13 @@ char *rs2s(VALUE rstr) {
     return (char *)(RSTRING_PTR(rstr) ? RSTRING_PTR(rstr) : FRT_EMPTY_STRING);
 }
 
+/* copies all RSTRING_LEN bytes, so binary strings holding '\0' survive */
 char *rstrdup(VALUE rstr) {
-    char *old = rs2s(rstr);
-    return frt_estrdup(old);
+    long len = RSTRING_LEN(rstr);
+    char *new_str = FRT_ALLOC_N(char, len + 1);
+    memcpy(new_str, rs2s(rstr), len);
+    new_str[len] = '\0';
+    return new_str;
 }
 
 ID frb_field(VALUE rfield) {
@@ -3,6 +3,7 @@
 #include "frt_global.h"
 #include "frt_hashset.h"
 #include "frt_document.h"
+#include "frt_threading.h"
 #include <ruby.h>
 
 /* IDs */
@@ -918,6 +918,24 @@ static void test_lowercase_filter(TestCase *tc, void *data)
     frt_ts_deref(ts);
 }
 
+static void test_mb_lowercase_filter(TestCase *tc, void *data)
+{
+    FrtTokenStream *ts = frt_whitespace_tokenizer_new();
+    ts = frt_lowercase_filter_new(ts);
+    char text[200] =
+        "@AZ[`az{ 0123ABCDEFGHIJKLMNOPQRSTUVWXYZ HELLO-WÖRLD ÄBC ÅNGSTRÖM-ÅNGSTRÖM";
+    (void)data;
+    rb_encoding *enc = utf8_encoding;
+    ts->reset(ts, text, enc);
+    test_token(frt_ts_next(ts), "@az[`az{", 0, 8, enc);
+    test_token(frt_ts_next(ts), "0123abcdefghijklmnopqrstuvwxyz", 9, 39, enc);
+    test_token(frt_ts_next(ts), "hello-wörld", 40, 52, enc);
+    test_token(frt_ts_next(ts), "äbc", 53, 57, enc);
+    test_token(frt_ts_next(ts), "ångström-ångström", 58, 79, enc);
+    Assert(frt_ts_next(ts) == NULL, "Should be no more tokens");
+    frt_ts_deref(ts);
+}
+
 static void test_hyphen_filter(TestCase *tc, void *data)
 {
     FrtToken *tk = frt_tk_new();
@@ -1217,6 +1235,7 @@ TestSuite *ts_analysis(TestSuite *suite)
 
     /* Filters */
     tst_run_test(suite, test_lowercase_filter, NULL);
+    tst_run_test(suite, test_mb_lowercase_filter, NULL);
     tst_run_test(suite, test_hyphen_filter, NULL);
     tst_run_test(suite, test_stop_filter, NULL);
     tst_run_test(suite, test_mapping_filter, NULL);
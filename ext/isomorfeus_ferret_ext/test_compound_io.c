@@ -112,6 +112,51 @@ void test_compound_io(TestCase *tc, void *data)
     frt_store_close(c_reader);
 }
 
+void test_compound_io_interleaved(TestCase *tc, void *data)
+{
+    FrtStore *store = (FrtStore *)data;
+    FrtOutStream *os1 = store->new_output(store, "file1");
+    FrtOutStream *os2 = store->new_output(store, "file2");
+    FrtCompoundWriter *cw;
+    FrtStore *c_reader;
+    FrtInStream *is1, *is2, *is3;
+    frt_uchar buf[8];
+    int i;
+
+    for (i = 0; i < 3000; i++) {
+        frt_os_write_u32(os1, i);
+        frt_os_write_u32(os2, 3000 - i);
+    }
+    frt_os_close(os1);
+    frt_os_close(os2);
+    cw = frt_open_cw(store, "cfile");
+    frt_cw_add_file(cw, "file1");
+    frt_cw_add_file(cw, "file2");
+    frt_cw_close(cw, NULL);
+
+    /* the streams of a compound store all read through the same sub-stream
+     * so reading from one mustn't move the others */
+    c_reader = frt_open_cmpd_store(store, "cfile");
+    is1 = c_reader->open_input(c_reader, "file1");
+    is2 = c_reader->open_input(c_reader, "file2");
+    is3 = frt_is_clone(is1);
+    frt_is_seek(is3, 6000);
+    for (i = 0; i < 3000; i++) {
+        Aiequal(i, frt_is_read_u32(is1));
+        Aiequal(3000 - i, frt_is_read_u32(is2));
+        if (i < 1500) {
+            Aiequal(1500 + i, frt_is_read_u32(is3));
+        }
+    }
+    frt_is_read_bytes_at(is2, 4, buf, 8);
+    Aiequal(2999, ((frt_u32)buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3]);
+    Aiequal(2998, ((frt_u32)buf[4] << 24) | (buf[5] << 16) | (buf[6] << 8) | buf[7]);
+    frt_is_close(is3);
+    frt_is_close(is2);
+    frt_is_close(is1);
+    frt_store_close(c_reader);
+}
+
 #define MAX_TEST_WORDS 50
 #define TEST_FILE_CNT 100
 
@@ -163,6 +208,7 @@ TestSuite *ts_compound_io(TestSuite *suite)
     tst_run_test(suite, test_compound_writer, store);
     tst_run_test(suite, test_compound_io, store);
     tst_run_test(suite, test_compound_io_many_files, store);
+    tst_run_test(suite, test_compound_io_interleaved, store);
 
     frt_store_close(store);
 
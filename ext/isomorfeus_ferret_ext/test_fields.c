@@ -329,7 +329,7 @@ static void test_fields_rw_single(TestCase *tc, void *data)
     Aiequal(4, fis->size);
     Aiequal(6, doc->size);
 
-    fw = frt_fw_open(store, "_0", fis);
+    fw = frt_fw_open(store, "_0", fis, FRT_STORED_FIELDS_FORMAT_PLAIN);
     frt_fw_add_doc(fw, doc);
     frt_fw_write_tv_index(fw);
     frt_fw_close(fw);
@@ -339,7 +339,7 @@ static void test_fields_rw_single(TestCase *tc, void *data)
     do_field_prop_test(tc, frt_fis_get_field(fis, rb_intern("binary")), rb_intern("binary"), 1.0, T, F, T, T, F, F, F, F);
     do_field_prop_test(tc, frt_fis_get_field(fis, rb_intern("array")), rb_intern("array"), 1.0, T, F, T, T, F, F, F, F);
 
-    fr = frt_fr_open(store, "_0", fis);
+    fr = frt_fr_open(store, "_0", fis, FRT_STORED_FIELDS_FORMAT_PLAIN);
     doc = frt_fr_get_doc(fr, 0);
     frt_fr_close(fr);
 
@@ -391,7 +391,7 @@ static void test_fields_rw_multi(TestCase *tc, void *data)
     (void)data;
     rb_encoding *enc = rb_enc_find("ASCII-8BIT");
 
-    fw = frt_fw_open(store, "_as3", fis);
+    fw = frt_fw_open(store, "_as3", fis, FRT_STORED_FIELDS_FORMAT_PLAIN);
     for (i = 0; i < 100; i++) {
         char buf[100];
         char *bufc;
@@ -419,7 +419,7 @@ static void test_fields_rw_multi(TestCase *tc, void *data)
         do_field_prop_test(tc, frt_fis_get_field(fis, rb_intern(buf)), rb_intern(buf), 1.0, T, F, T, T, F, F, F, F);
     }
 
-    fr = frt_fr_open(store, "_as3", fis);
+    fr = frt_fr_open(store, "_as3", fis, FRT_STORED_FIELDS_FORMAT_PLAIN);
     doc = frt_fr_get_doc(fr, 100);
     frt_fr_close(fr);
 
@@ -472,7 +472,7 @@ static void test_lazy_field_loading(TestCase *tc, void *data)
     (void)data;
     rb_encoding *enc = rb_enc_find("ASCII-8BIT");
 
-    fw = frt_fw_open(store, "_as3", fis);
+    fw = frt_fw_open(store, "_as3", fis, FRT_STORED_FIELDS_FORMAT_PLAIN);
     doc = frt_doc_new();
     df = frt_df_new(rb_intern("stored"));
     frt_df_add_data(df, (char *)"this is a stored field", enc);
@@ -486,7 +486,7 @@ static void test_lazy_field_loading(TestCase *tc, void *data)
     frt_doc_destroy(doc);
     frt_fw_close(fw);
 
-    fr = frt_fr_open(store, "_as3", fis);
+    fr = frt_fr_open(store, "_as3", fis, FRT_STORED_FIELDS_FORMAT_PLAIN);
     lazy_doc = frt_fr_get_lazy_doc(fr, 0);
     frt_fr_close(fr);
     frt_fis_deref(fis);
@@ -494,6 +494,8 @@ static void test_lazy_field_loading(TestCase *tc, void *data)
 
     lazy_df = frt_lazy_doc_get(lazy_doc, rb_intern("stored"));
     Apnull(lazy_doc->fields[0]->data[0].text);
+    /* RAM files aren't read in place */
+    Apnull(frt_lazy_df_peek_data(lazy_df, 0));
     Asequal("this is a stored field", text = frt_lazy_df_get_data(lazy_df, 0));
     Asequal("this is a stored field", lazy_doc->fields[0]->data[0].text);
     Apequal(text, frt_lazy_df_get_data(lazy_df, 0));
@@ -518,6 +520,326 @@ static void test_lazy_field_loading(TestCase *tc, void *data)
     frt_lazy_doc_close(lazy_doc);
 }
 
+#define BLOCK_DOC_CNT 2000
+
+static FrtDocument *prepare_block_doc(int i)
+{
+    char buf[100];
+    FrtDocument *doc = frt_doc_new();
+    rb_encoding *enc = rb_enc_find("ASCII-8BIT");
+    if (i % 7 == 3) {
+        /* nothing stored */
+        frt_doc_add_field(doc, frt_df_add_data(frt_df_new(rb_intern("ignored")), (char *)"ignored", enc));
+        return doc;
+    }
+    sprintf(buf, "<<%d>> the quick brown fox jumped over the lazy dog", i);
+    frt_doc_add_field(doc, frt_df_add_data(frt_df_new(rb_intern("stored")), frt_estrdup(buf), enc))->destroy_data = true;
+    sprintf(buf, "%d", i * 3);
+    frt_doc_add_field(doc, frt_df_add_data(frt_df_new(rb_intern("stored_array")), frt_estrdup(buf), enc))->destroy_data = true;
+    return doc;
+}
+
+static void write_block_docs(FrtStore *store, const char *segment,
+                             FrtFieldInfos *fis, FrtStoredFieldsFormat format)
+{
+    int i;
+    FrtFieldsWriter *fw = frt_fw_open(store, segment, fis, format);
+    for (i = 0; i < BLOCK_DOC_CNT; i++) {
+        FrtDocument *doc = i == 1000 ? prepare_doc() : prepare_block_doc(i);
+        frt_fw_add_doc(fw, doc);
+        frt_fw_write_tv_index(fw);
+        frt_doc_destroy(doc);
+    }
+    frt_fw_close(fw);
+}
+
+/**
+ * Test that documents written in blocks read back in any order, including
+ * documents without stored fields and a lazily loaded document, and that the
+ * blocks take less space than the plain stored fields.
+ */
+static void test_fields_rw_blocks(TestCase *tc, void *data)
+{
+    int i;
+    char buf[100];
+    FrtStore *store = frt_open_ram_store(NULL);
+    char *bin_data = prepare_bin_data(BIN_DATA_LEN);
+    FrtFieldInfos *fis = prepare_fis();
+    FrtFieldsReader *fr, *fr_clone;
+    FrtDocument *doc;
+    FrtDocField *df;
+    FrtLazyDoc *lazy_doc;
+    frt_off_t plain_len;
+    const char *peeked;
+    (void)data;
+
+    write_block_docs(store, "_pl", fis, FRT_STORED_FIELDS_FORMAT_PLAIN);
+    plain_len = store->length(store, "_pl.fdt");
+    Assert(store->exists(store, "_pl.fdb"), "plain segments have an empty .fdb");
+    Aiequal(0, store->length(store, "_pl.fdb"));
+    write_block_docs(store, "_bl", fis, FRT_STORED_FIELDS_FORMAT_BLOCK);
+    Assert(store->length(store, "_bl.fdt") + store->length(store, "_bl.fdb")
+           < plain_len / 2, "blocks should be much smaller");
+
+    fr = frt_fr_open(store, "_bl", fis, FRT_STORED_FIELDS_FORMAT_BLOCK);
+    Aiequal(BLOCK_DOC_CNT, fr->size);
+    for (i = BLOCK_DOC_CNT - 1; i >= 0; i -= 3) {
+        doc = frt_fr_get_doc(fr, i);
+        if (i == 1000) {
+            df = frt_doc_get_field(doc, rb_intern("stored_array"));
+            Aiequal(5, df->size);
+            check_df_data(df, 3, "four");
+            check_df_bin_data(df, 4, bin_data, BIN_DATA_LEN);
+        } else if (i % 7 == 3) {
+            Aiequal(0, doc->size);
+        } else {
+            Aiequal(2, doc->size);
+            sprintf(buf, "<<%d>> the quick brown fox jumped over the lazy dog", i);
+            check_df_data(frt_doc_get_field(doc, rb_intern("stored")), 0, buf);
+            sprintf(buf, "%d", i * 3);
+            check_df_data(frt_doc_get_field(doc, rb_intern("stored_array")), 0, buf);
+        }
+        frt_doc_destroy(doc);
+    }
+
+    /* the lazy document keeps its block after the reader moved on */
+    fr_clone = frt_fr_clone(fr);
+    lazy_doc = frt_fr_get_lazy_doc(fr_clone, 1000);
+    doc = frt_fr_get_doc(fr_clone, 5);
+    frt_doc_destroy(doc);
+    frt_fr_close(fr_clone);
+    frt_fr_close(fr);
+    Asequal("three", frt_lazy_df_get_data(frt_lazy_doc_get(lazy_doc, rb_intern("stored_array")), 2));
+    /* the values of decompressed blocks can be read in place */
+    peeked = frt_lazy_df_peek_data(frt_lazy_doc_get(lazy_doc, rb_intern("stored_array")), 3);
+    Apnotnull(peeked);
+    if (peeked) Assert(0 == memcmp("four", peeked, 4), "peeked the wrong value");
+    Apnull(frt_lazy_df_peek_data(frt_lazy_doc_get(lazy_doc, rb_intern("stored_array")), 5));
+    frt_lazy_df_get_bytes(frt_lazy_doc_get(lazy_doc, rb_intern("array")), buf, 5, 6);
+    buf[6] = 0;
+    Asequal("ni san", buf);
+    frt_lazy_doc_close(lazy_doc);
+
+    free(bin_data);
+    frt_store_close(store);
+    frt_fis_deref(fis);
+}
+
+static void check_docs_equal(TestCase *tc, FrtDocument *expected,
+                             FrtDocument *doc, ID field)
+{
+    int i, j;
+    Aiequal(field && expected->size > 0 ? 1 : expected->size, doc->size);
+    for (i = 0; i < doc->size; i++) {
+        FrtDocField *df = doc->fields[i];
+        FrtDocField *exp_df = frt_doc_get_field(expected, df->name);
+        if (field) Asequal(rb_id2name(field), rb_id2name(df->name));
+        Apnotnull(exp_df);
+        if (!exp_df) continue;
+        Aiequal(exp_df->size, df->size);
+        for (j = 0; j < df->size; j++) {
+            Aiequal(exp_df->lengths[j], df->lengths[j]);
+            Assert(0 == memcmp(exp_df->data[j], df->data[j], df->lengths[j]),
+                   "field data differs");
+        }
+    }
+}
+
+/**
+ * Test that documents read together come back in the order they were asked
+ * for, with all or only the requested fields, in both stored field formats.
+ */
+/* copy the first +len+ bytes of the file +from+ in +store+ to +to+ */
+static void copy_file_head(FrtStore *store, const char *from, const char *to,
+                           frt_off_t len)
+{
+    FrtInStream *is = store->open_input(store, from);
+    FrtOutStream *os = store->new_output(store, to);
+    frt_uchar *bytes = FRT_ALLOC_N(frt_uchar, len);
+    frt_is_read_bytes(is, bytes, (int)len);
+    frt_os_write_bytes(os, bytes, (int)len);
+    free(bytes);
+    frt_os_close(os);
+    frt_is_close(is);
+}
+
+static void test_fields_get_docs(TestCase *tc, void *data)
+{
+    int i, f;
+    const int doc_nums[] = {1000, 5, 3, BLOCK_DOC_CNT - 1, 5, 6, 0, 1200, 7};
+    const int cnt = sizeof(doc_nums) / sizeof(doc_nums[0]);
+    const char *segments[] = {"_pl", "_bl"};
+    const FrtStoredFieldsFormat formats[] = {FRT_STORED_FIELDS_FORMAT_PLAIN,
+                                             FRT_STORED_FIELDS_FORMAT_BLOCK};
+    ID field = rb_intern("stored_array");
+    FrtStore *store = frt_open_ram_store(NULL);
+    FrtFieldInfos *fis = prepare_fis();
+    FrtDocument *docs[9];
+    (void)data;
+
+    for (f = 0; f < 2; f++) {
+        FrtFieldsReader *fr;
+        write_block_docs(store, segments[f], fis, formats[f]);
+        fr = frt_fr_open(store, segments[f], fis, formats[f]);
+
+        frt_fr_get_docs(fr, doc_nums, cnt, NULL, 0, docs);
+        for (i = 0; i < cnt; i++) {
+            FrtDocument *expected = frt_fr_get_doc(fr, doc_nums[i]);
+            check_docs_equal(tc, expected, docs[i], 0);
+            frt_doc_destroy(expected);
+            frt_doc_destroy(docs[i]);
+        }
+
+        frt_fr_get_docs(fr, doc_nums, cnt, &field, 1, docs);
+        for (i = 0; i < cnt; i++) {
+            FrtDocument *expected = frt_fr_get_doc(fr, doc_nums[i]);
+            check_docs_equal(tc, expected, docs[i], field);
+            frt_doc_destroy(expected);
+            frt_doc_destroy(docs[i]);
+        }
+
+        FRT_TRY
+            const int bad_doc_nums[] = {2, BLOCK_DOC_CNT};
+            frt_fr_get_docs(fr, bad_doc_nums, 2, NULL, 0, docs);
+            Assert(false, "should have raised an index error");
+        FRT_XCATCHALL
+            FRT_HANDLED();
+        FRT_XENDTRY
+        frt_fr_close(fr);
+    }
+
+    /* the documents read before a read fails are freed */
+    copy_file_head(store, "_pl.fdx", "_tr.fdx", store->length(store, "_pl.fdx"));
+    copy_file_head(store, "_pl.fdt", "_tr.fdt", store->length(store, "_pl.fdt") / 2);
+    {
+        FrtFieldsReader *fr = frt_fr_open(store, "_tr", fis, FRT_STORED_FIELDS_FORMAT_PLAIN);
+        const int cut_doc_nums[] = {0, BLOCK_DOC_CNT - 1, 1};
+        FRT_TRY
+            frt_fr_get_docs(fr, cut_doc_nums, 3, NULL, 0, docs);
+            Assert(false, "should have raised an error reading past the end");
+        FRT_XCATCHALL
+            FRT_HANDLED();
+        FRT_XENDTRY
+        for (i = 0; i < 3; i++) {
+            Apnull(docs[i]);
+        }
+        frt_fr_close(fr);
+    }
+
+    frt_store_close(store);
+    frt_fis_deref(fis);
+}
+
+static void read_all_docs(FrtFieldsReader *fr)
+{
+    int i;
+    for (i = 0; i < fr->size; i++) {
+        frt_doc_destroy(frt_fr_get_doc(fr, i));
+    }
+}
+
+/**
+ * Test that a stored cache saves decompressing the same values and blocks
+ * again, that it is shared by clones of a reader and by readers of the same
+ * segment, that it tells a segment from one written after the index was
+ * created again and that it drops the least recently used data once it is
+ * full.
+ */
+static void test_stored_cache(TestCase *tc, void *data)
+{
+    int i;
+    frt_u64 blocks;
+    FrtStore *store = frt_open_ram_store(NULL);
+    FrtFieldInfos *fis = prepare_fis();
+    FrtStoredCache *sc = frt_sc_new(1024 * 1024);
+    FrtFieldsReader *fr, *fr_clone;
+    FrtDocument *doc;
+    (void)data;
+
+    write_block_docs(store, "_pl", fis, FRT_STORED_FIELDS_FORMAT_PLAIN);
+    write_block_docs(store, "_bl", fis, FRT_STORED_FIELDS_FORMAT_BLOCK);
+
+    /* plain segments cache their compressed values */
+    fr = frt_fr_open(store, "_pl", fis, FRT_STORED_FIELDS_FORMAT_PLAIN);
+    frt_fr_set_stored_cache(fr, sc);
+    for (i = 0; i < 10; i++) {
+        frt_doc_destroy(frt_fr_get_doc(fr, i));
+    }
+    Aiequal(0, frt_sc_hits(sc));
+    Aiequal(9, frt_sc_misses(sc));
+    fr_clone = frt_fr_clone(fr);
+    for (i = 0; i < 10; i++) {
+        doc = frt_fr_get_doc(fr_clone, i);
+        if (i % 7 != 3) {
+            char buf[20];
+            sprintf(buf, "%d", i * 3);
+            check_df_data(frt_doc_get_field(doc, rb_intern("stored_array")), 0, buf);
+        }
+        frt_doc_destroy(doc);
+    }
+    Aiequal(9, frt_sc_hits(sc));
+    Aiequal(9, frt_sc_misses(sc));
+    frt_fr_close(fr_clone);
+    frt_fr_close(fr);
+
+    /* block segments cache whole blocks */
+    fr = frt_fr_open(store, "_bl", fis, FRT_STORED_FIELDS_FORMAT_BLOCK);
+    frt_fr_set_stored_cache(fr, sc);
+    read_all_docs(fr);
+    blocks = frt_sc_misses(sc) - 9;
+    Assert(blocks > 4, "expected more blocks, got %d", (int)blocks);
+    Aiequal(9, frt_sc_hits(sc));
+    fr_clone = frt_fr_clone(fr);
+    read_all_docs(fr_clone);
+    Aiequal(9 + blocks, frt_sc_hits(sc));
+    Aiequal(9 + blocks, frt_sc_misses(sc));
+    Assert(frt_sc_bytes(sc) <= frt_sc_max_bytes(sc), "cache overfilled");
+    frt_fr_close(fr_clone);
+    frt_fr_close(fr);
+
+    /* a reader opened on the same segment later finds its values */
+    fr = frt_fr_open(store, "_pl", fis, FRT_STORED_FIELDS_FORMAT_PLAIN);
+    frt_fr_set_stored_cache(fr, sc);
+    for (i = 0; i < 10; i++) {
+        frt_doc_destroy(frt_fr_get_doc(fr, i));
+    }
+    Aiequal(18 + blocks, frt_sc_hits(sc));
+    Aiequal(9 + blocks, frt_sc_misses(sc));
+    frt_fr_close(fr);
+
+    /* but not once the segment names have started over */
+    frt_store_new_generation(store);
+    fr = frt_fr_open(store, "_pl", fis, FRT_STORED_FIELDS_FORMAT_PLAIN);
+    frt_fr_set_stored_cache(fr, sc);
+    for (i = 0; i < 10; i++) {
+        frt_doc_destroy(frt_fr_get_doc(fr, i));
+    }
+    Aiequal(18 + blocks, frt_sc_hits(sc));
+    Aiequal(18 + blocks, frt_sc_misses(sc));
+    frt_fr_close(fr);
+    frt_sc_deref(sc);
+
+    /* a small cache only keeps the most recently used blocks */
+    sc = frt_sc_new(3 * FRT_STORED_FIELDS_BLOCK_SIZE);
+    fr = frt_fr_open(store, "_bl", fis, FRT_STORED_FIELDS_FORMAT_BLOCK);
+    frt_fr_set_stored_cache(fr, sc);
+    read_all_docs(fr);
+    Aiequal(blocks, frt_sc_misses(sc));
+    Assert(frt_sc_bytes(sc) <= frt_sc_max_bytes(sc), "cache overfilled");
+    frt_doc_destroy(frt_fr_get_doc(fr, 0));
+    Aiequal(0, frt_sc_hits(sc));
+    Aiequal(blocks + 1, frt_sc_misses(sc));
+    frt_doc_destroy(frt_fr_get_doc(fr, BLOCK_DOC_CNT - 1));
+    Aiequal(1, frt_sc_hits(sc));
+    Aiequal(blocks + 1, frt_sc_misses(sc));
+    Assert(frt_sc_bytes(sc) <= frt_sc_max_bytes(sc), "cache overfilled");
+    frt_fr_close(fr);
+    frt_sc_deref(sc);
+
+    frt_store_close(store);
+    frt_fis_deref(fis);
+}
+
 TestSuite *ts_fields(TestSuite *suite)
 {
     suite = ADD_SUITE(suite);
@@ -528,6 +850,9 @@ TestSuite *ts_fields(TestSuite *suite)
     tst_run_test(suite, test_fields_rw_single, NULL);
     tst_run_test(suite, test_fields_rw_multi, NULL);
     tst_run_test(suite, test_lazy_field_loading, NULL);
+    tst_run_test(suite, test_fields_rw_blocks, NULL);
+    tst_run_test(suite, test_stored_cache, NULL);
+    tst_run_test(suite, test_fields_get_docs, NULL);
 
     return suite;
 }
@@ -14,7 +14,13 @@ const FrtConfig lucene_config = {
     10,             /* max_buffered_docs */
     INT_MAX,        /* max_merged_docs */
     10000,          /* maximum field length (number of terms) */
-    true            /* use compound file by default */
+    true,           /* use compound file by default */
+    1,              /* max_doc_writers */
+    0,              /* max_merge_threads */
+    0,              /* max_merge_bytes_per_sec */
+    FRT_MERGE_POLICY_LOG_DOC, /* merge policy */
+    0x140000000LL,  /* max_merged_segment_bytes */
+    20              /* deletes_pct_allowed */
 };
 
 
@@ -15,7 +15,7 @@ struct FilterData {
 
 static ID num, date, flipflop;
 
-void prepare_filter_index(FrtStore *store)
+static void prepare_filter_index_conf(FrtStore *store, const FrtConfig *config)
 {
     int i;
     FrtIndexWriter *iw;
@@ -42,7 +42,7 @@ void prepare_filter_index(FrtStore *store)
     frt_index_create(store, fis);
     frt_fis_deref(fis);
 
-    iw = frt_iw_open(NULL, store, frt_whitespace_analyzer_new(false), NULL);
+    iw = frt_iw_open(NULL, store, frt_whitespace_analyzer_new(false), config);
     for (i = 0; i < FILTER_DOCS_SIZE; i++) {
         FrtDocument *doc = frt_doc_new();
         doc->boost = (float)(i+1);
@@ -56,6 +56,11 @@ void prepare_filter_index(FrtStore *store)
     return;
 }
 
+void prepare_filter_index(FrtStore *store)
+{
+    prepare_filter_index_conf(store, NULL);
+}
+
 static void check_filtered_hits(TestCase *tc, FrtSearcher *searcher, FrtQuery *query, FrtFilter *f, FrtPostFilter *post_filter, const char *expected_hits, int top)
 {
     static int num_array[ARRAY_SIZE];
@@ -308,6 +313,72 @@ static void test_score_altering_filter_func(TestCase *tc, void *data)
     frt_q_deref(q);
 }
 
+/*
+ * Filter bits are cached per SegmentReader so a reopened reader only needs
+ * to evaluate the filter against the new segments.
+ */
+static void test_filter_per_segment(TestCase *tc, void *data)
+{
+    FrtStore *store = (FrtStore *)data;
+    FrtIndexReader *ir = frt_ir_open(NULL, store), *ir2;
+    FrtMultiReader *mr = (FrtMultiReader *)ir, *mr2;
+    FrtFilter *rf = frt_rfilt_new(num, "2", "6", true, true);
+    FrtFilter *qf = frt_qfilt_new_nr(frt_tq_new(flipflop, "on"));
+    FrtBitVector *bv, *sub_bvs[FILTER_DOCS_SIZE];
+    FrtConfig config = frt_default_config;
+    FrtIndexWriter *iw;
+    FrtDocument *doc;
+    rb_encoding *enc = rb_enc_find("ASCII-8BIT");
+    int i;
+
+    Aiequal(FRT_MULTI_READER, ir->type);
+    Assert(mr->r_cnt > 1, "index should have more than one segment");
+
+    bv = frt_filt_get_bv(rf, ir);
+    Aiequal(5, bv->count);
+    for (i = 0; i < FILTER_DOCS_SIZE; i++) {
+        Aiequal(i >= 2 && i <= 6, frt_bv_get(bv, i));
+    }
+    Apequal(bv, frt_filt_get_bv(rf, ir));
+    bv = frt_filt_get_bv(qf, ir);
+    Aiequal(5, bv->count);
+    for (i = 0; i < FILTER_DOCS_SIZE; i++) {
+        Aiequal(i % 2 == 0, frt_bv_get(bv, i));
+    }
+    for (i = 0; i < mr->r_cnt; i++) {
+        sub_bvs[i] = frt_filt_get_bv(rf, mr->sub_readers[i]);
+    }
+
+    config.max_buffered_docs = 3;
+    config.merge_factor = 20;
+    iw = frt_iw_open(NULL, store, frt_whitespace_analyzer_new(false), &config);
+    doc = frt_doc_new();
+    frt_doc_add_field(doc, frt_df_add_data(frt_df_new(num), (char *)"4", enc));
+    frt_doc_add_field(doc, frt_df_add_data(frt_df_new(flipflop), (char *)"off", enc));
+    frt_iw_add_doc(iw, doc);
+    frt_doc_destroy(doc);
+    frt_iw_close(iw);
+
+    ir2 = frt_ir_reopen(ir);
+    mr2 = (FrtMultiReader *)ir2;
+    Aiequal(mr->r_cnt + 1, mr2->r_cnt);
+    for (i = 0; i < mr->r_cnt; i++) {
+        Apequal(sub_bvs[i], frt_filt_get_bv(rf, mr2->sub_readers[i]));
+    }
+    frt_ir_close(ir);
+
+    bv = frt_filt_get_bv(rf, ir2);
+    Aiequal(6, bv->count);
+    Atrue(frt_bv_get(bv, FILTER_DOCS_SIZE));
+    bv = frt_filt_get_bv(qf, ir2);
+    Aiequal(5, bv->count);
+    Atrue(!frt_bv_get(bv, FILTER_DOCS_SIZE));
+
+    frt_filt_deref(rf);
+    frt_filt_deref(qf);
+    frt_ir_close(ir2);
+}
+
 TestSuite *ts_filter(TestSuite *suite)
 {
     FrtStore *store;
@@ -330,6 +401,25 @@ TestSuite *ts_filter(TestSuite *suite)
 
     frt_searcher_close(searcher);
     frt_ir_close(ir);
+
+    {
+        FrtConfig config = frt_default_config;
+        config.max_buffered_docs = 3;
+        config.merge_factor = 20; /* keep the small segments */
+        prepare_filter_index_conf(store, &config);
+    }
+    ir = frt_ir_open(NULL, store);
+    searcher = frt_isea_new(ir);
+    tst_run_test(suite, test_range_filter, (void *)searcher);
+    tst_run_test(suite, test_query_filter, (void *)searcher);
+    /* score the segments in parallel */
+    ((FrtIndexSearcher *)searcher)->max_threads = 4;
+    tst_run_test(suite, test_range_filter, (void *)searcher);
+    tst_run_test(suite, test_query_filter, (void *)searcher);
+    frt_searcher_close(searcher);
+    frt_ir_close(ir);
+    tst_run_test(suite, test_filter_per_segment, (void *)store);
+
     frt_store_close(store);
     return suite;
 }
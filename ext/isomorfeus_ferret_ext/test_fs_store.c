@@ -2,6 +2,118 @@
 #include "test_store.h"
 #include "test.h"
 
+/**
+ * Test that a memory mapped store reads straight from the mapping, that
+ * clones share it and that compound files hand out views of it.
+ */
+static void test_mmap_store(TestCase *tc, void *data)
+{
+    int i;
+    char *p;
+    FrtStore *store = (FrtStore *)data;
+    FrtStore *c_reader;
+    FrtOutStream *os = store->new_output(store, "_mmap.cfs");
+    FrtInStream *is, *clone, *is1, *is2;
+
+    frt_os_write_vint(os, 2);
+    frt_os_write_u64(os, 29);
+    frt_os_write_string(os, "file1");
+    frt_os_write_u64(os, 33);
+    frt_os_write_string(os, "file2");
+    frt_os_write_u32(os, 20);
+    frt_os_write_string(os, "this is file 2");
+    for (i = 0; i < 2000; i++) {
+        frt_os_write_vint(os, i);
+    }
+    frt_os_close(os);
+
+    is = store->open_input(store, "_mmap.cfs");
+#if !defined POSH_OS_WIN32 && !defined POSH_OS_WIN64
+    Assert(frt_is_mapped(is), "input stream should be mapped");
+#endif
+    Aiequal(store->length(store, "_mmap.cfs"), frt_is_length(is));
+    frt_is_seek(is, 48);
+    for (i = 0; i < 1000; i++) {
+        Aiequal(i, frt_is_read_vint(is));
+    }
+    clone = frt_is_clone(is);
+    Aiequal(frt_is_pos(is), frt_is_pos(clone));
+    for (i = 1000; i < 2000; i++) {
+        Aiequal(i, frt_is_read_vint(clone));
+    }
+    Aiequal(frt_is_length(is), frt_is_pos(clone));
+    FRT_TRY
+        frt_is_read_byte(clone);
+        Assert(false, "reading past the end of the file should raise");
+    FRT_XCATCHALL
+        FRT_HANDLED();
+    FRT_XENDTRY
+    Aiequal(1000, frt_is_read_vint(is));
+    frt_is_close(clone);
+    frt_is_close(is);
+
+    c_reader = frt_open_cmpd_store(store, "_mmap.cfs");
+    is1 = c_reader->open_input(c_reader, "file1");
+    is2 = c_reader->open_input(c_reader, "file2");
+    Aiequal(4, frt_is_length(is1));
+    Aiequal(20, frt_is_read_u32(is1));
+    Asequal("this is file 2", p = frt_is_read_string(is2)); free(p);
+    frt_is_seek(is2, 0);
+    Asequal("this is file 2", p = frt_is_read_string(is2)); free(p);
+    frt_is_close(is1);
+    frt_store_close(c_reader);
+    /* the view keeps the mapping alive after the compound store is closed */
+    frt_is_seek(is2, 0);
+    Asequal("this is file 2", p = frt_is_read_string(is2)); free(p);
+    frt_is_close(is2);
+}
+
+/**
+ * Test that input streams of the same file share its descriptor, can read
+ * it in turns and that a file replaced under the same name is reopened.
+ */
+static void test_shared_files(TestCase *tc, void *data)
+{
+    int i;
+    FrtStore *store = (FrtStore *)data;
+    FrtOutStream *os = store->new_output(store, "_shared.cfs");
+    FrtInStream *is1, *is2;
+
+    for (i = 0; i < 3000; i++) {
+        frt_os_write_u32(os, i);
+    }
+    frt_os_close(os);
+
+    is1 = store->open_input(store, "_shared.cfs");
+    is2 = store->open_input(store, "_shared.cfs");
+#if !defined POSH_OS_WIN32 && !defined POSH_OS_WIN64
+    Assert(is1->f->file.fsf == is2->f->file.fsf, "files should be shared");
+#endif
+    frt_is_seek(is2, 8000);
+    for (i = 0; i < 2000; i++) {
+        Aiequal(i, frt_is_read_u32(is1));
+        Aiequal((i + 2000) % 3000, frt_is_read_u32(is2));
+        if (i + 2000 == 2999) frt_is_seek(is2, 0);
+    }
+
+#if !defined POSH_OS_WIN32 && !defined POSH_OS_WIN64
+    /* open files can't be removed on windows */
+    store->remove(store, "_shared.cfs");
+    os = store->new_output(store, "_shared.cfs");
+    frt_os_write_u32(os, 12345);
+    frt_os_close(os);
+    FrtInStream *is3 = store->open_input(store, "_shared.cfs");
+    Aiequal(4, frt_is_length(is3));
+    Aiequal(12345, frt_is_read_u32(is3));
+    /* the old streams still read the file they opened */
+    frt_is_seek(is1, 400);
+    Aiequal(100, frt_is_read_u32(is1));
+    frt_is_close(is3);
+#endif
+    frt_is_close(is1);
+    frt_is_close(is2);
+}
+
 /**
  * Test a FileSystem store
  */
@@ -18,6 +130,21 @@ TestSuite *ts_fs_store(TestSuite *suite)
     suite = ADD_SUITE(suite);
 
     create_test_store_suite(suite, store);
+    tst_run_test(suite, test_shared_files, store);
+    store->clear_all(store);
+
+    frt_store_close(store);
+
+    /* the same tests against a store which memory maps its input */
+#if defined POSH_OS_WIN32 || defined POSH_OS_WIN64
+    store = frt_open_mmap_store(".\\test\\testdir\\store");
+#else
+    store = frt_open_mmap_store("./test/testdir/store");
+#endif
+
+    create_test_store_suite(suite, store);
+    tst_run_test(suite, test_mmap_store, store);
+    store->clear_all(store);
 
     frt_store_close(store);
 
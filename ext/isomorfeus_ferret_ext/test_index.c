@@ -1,4 +1,5 @@
 #include "frt_index.h"
+#include "frt_field_index.h"
 #include "testhelper.h"
 #include "test.h"
 
@@ -572,9 +573,12 @@ static void test_segment_term_doc_enum(TestCase *tc, void *data)
     skip_interval = ((FrtSegmentTermEnum *)tir->orig_te)->skip_interval;
     frq_in = store->open_input(store, "_0.frq");
     prx_in = store->open_input(store, "_0.prx");
-    tde = frt_stde_new(tir, frq_in, bv, skip_interval);
-    tde_reader = frt_stde_new(tir, frq_in, bv, skip_interval);
-    tde_skip_to = frt_stde_new(tir, frq_in, bv, skip_interval);
+    tde = frt_stde_new(tir, frq_in, bv, skip_interval, FRT_POSTINGS_FORMAT_VINT,
+                       true, true);
+    tde_reader = frt_stde_new(tir, frq_in, bv, skip_interval, FRT_POSTINGS_FORMAT_VINT,
+                       true, true);
+    tde_skip_to = frt_stde_new(tir, frq_in, bv, skip_interval, FRT_POSTINGS_FORMAT_VINT,
+                       true, true);
 
     fi = frt_fis_get_field(fis, rb_intern("tv"));
     for (i = 0; i < 300; i++) {
@@ -615,8 +619,10 @@ static void test_segment_term_doc_enum(TestCase *tc, void *data)
     tde_skip_to->close(tde_skip_to);
 
 
-    tde = frt_stpe_new(tir, frq_in, prx_in, bv, skip_interval);
-    tde_skip_to = frt_stpe_new(tir, frq_in, prx_in, bv, skip_interval);
+    tde = frt_stpe_new(tir, frq_in, prx_in, bv, skip_interval,
+                       FRT_POSTINGS_FORMAT_VINT, true, true);
+    tde_skip_to = frt_stpe_new(tir, frq_in, prx_in, bv, skip_interval,
+                       FRT_POSTINGS_FORMAT_VINT, true, true);
 
     fi = frt_fis_get_field(fis, rb_intern("tv+offsets"));
     for (i = 0; i < 200; i++) {
@@ -702,7 +708,8 @@ static void test_segment_tde_deleted_docs(TestCase *tc, void *data)
     frq_in = store->open_input(store, "_0.frq");
     prx_in = store->open_input(store, "_0.prx");
     skip_interval = sfi->skip_interval;
-    tde = frt_stpe_new(tir, frq_in, prx_in, bv, skip_interval);
+    tde = frt_stpe_new(tir, frq_in, prx_in, bv, skip_interval,
+                       FRT_POSTINGS_FORMAT_VINT, true, true);
 
     tde->seek(tde, 0, "word");
     doc_num_expected = 0;
@@ -728,6 +735,207 @@ static void test_segment_tde_deleted_docs(TestCase *tc, void *data)
     frt_si_close(si);
 }
 
+#define NUM_BLOCK_TEST_DOCS 1000
+
+static FrtIndexReader *block_test_index(FrtStore *store,
+                                        FrtPostingsFormat postings_format,
+                                        bool optimize, int doc_cnt)
+{
+    int i, j;
+    char buf[2000];
+    FrtConfig config = frt_default_config;
+    FrtFieldInfos *fis = frt_fis_new(FRT_FI_DEFAULTS_BM);
+    FrtIndexWriter *iw;
+    FrtIndexReader *ir;
+    rb_encoding *enc = rb_enc_find("ASCII-8BIT");
+
+    config.max_buffered_docs = 300;
+    config.merge_factor = 3;
+    config.postings_format = postings_format;
+    frt_index_create(store, fis);
+    frt_fis_deref(fis);
+    iw = frt_iw_open(NULL, store, frt_whitespace_analyzer_new(false), &config);
+    for (i = 0; i < doc_cnt; i++) {
+        FrtDocument *doc = frt_doc_new();
+        int len = sprintf(buf, "all %s%s", i % 2 ? "" : "even ",
+                          i % 7 ? "" : "seventh ");
+        for (j = i % 5; j >= 0; j--) {
+            len += sprintf(buf + len, "many ");
+        }
+        /* more positions than fit in a block */
+        for (j = i % 50 ? 0 : 300; j > 0; j--) {
+            len += sprintf(buf + len, "lots ");
+        }
+        frt_doc_add_field(doc, frt_df_add_data(frt_df_new(rb_intern("f")),
+                                               buf, enc));
+        frt_iw_add_doc(iw, doc);
+        frt_doc_destroy(doc);
+    }
+    if (optimize) {
+        frt_iw_optimize(iw);
+    }
+    frt_iw_close(iw);
+
+    ir = frt_ir_open(NULL, store);
+    for (i = 0; i < doc_cnt; i += 11) {
+        frt_ir_delete_doc(ir, i);
+    }
+    return ir;
+}
+
+static void test_block_postings(TestCase *tc, void *data)
+{
+    int i, j, k, target, field_num;
+    const char *terms[] = {"all", "even", "seventh", "many", "lots", "missing"};
+    FrtStore *store = (FrtStore *)data;
+    FrtStore *block_store = frt_open_ram_store(NULL);
+    FrtIndexReader *ir, *block_ir;
+    ID f = rb_intern("f");
+
+    for (k = 0; k < 2; k++) {
+        store->clear_all(store);
+        block_store->clear_all(block_store);
+        ir = block_test_index(store, FRT_POSTINGS_FORMAT_VINT, k,
+                              NUM_BLOCK_TEST_DOCS);
+        block_ir = block_test_index(block_store, FRT_POSTINGS_FORMAT_BLOCK, k,
+                                    NUM_BLOCK_TEST_DOCS);
+        field_num = frt_fis_get_field_num(ir->fis, f);
+        for (i = 0; i < block_ir->sis->size; i++) {
+            Aiequal(FRT_POSTINGS_FORMAT_BLOCK,
+                    block_ir->sis->segs[i]->postings_format);
+        }
+
+        for (i = 0; i < (int)FRT_NELEMS(terms); i++) {
+            int docs[50], freqs[50], block_docs[50], block_freqs[50], cnt;
+            FrtTermDocEnum *tde = frt_ir_term_positions_for(ir, f, terms[i]);
+            FrtTermDocEnum *btde = frt_ir_term_positions_for(block_ir, f, terms[i]);
+            while (tde->next(tde)) {
+                Atrue(btde->next(btde));
+                Aiequal(tde->doc_num(tde), btde->doc_num(btde));
+                Aiequal(tde->freq(tde), btde->freq(btde));
+                for (j = tde->freq(tde); j > 0; j--) {
+                    Aiequal(tde->next_position(tde), btde->next_position(btde));
+                }
+            }
+            Atrue(!btde->next(btde));
+
+            /* skip forwards through the postings of the same enums */
+            tde->seek(tde, field_num, terms[i]);
+            btde->seek(btde, field_num, terms[i]);
+            for (target = 0; target < NUM_BLOCK_TEST_DOCS + 10; target += 97) {
+                bool found = tde->skip_to(tde, target);
+                Aiequal(found, btde->skip_to(btde, target));
+                if (!found) break;
+                Aiequal(tde->doc_num(tde), btde->doc_num(btde));
+                Aiequal(tde->freq(tde), btde->freq(btde));
+                Aiequal(tde->next_position(tde), btde->next_position(btde));
+            }
+            tde->close(tde);
+            btde->close(btde);
+
+            /* skip straight to each target from the start */
+            tde = ir_term_docs_for(ir, f, terms[i]);
+            btde = ir_term_docs_for(block_ir, f, terms[i]);
+            for (target = 0; target < NUM_BLOCK_TEST_DOCS; target += 13) {
+                bool found;
+                tde->seek(tde, field_num, terms[i]);
+                btde->seek(btde, field_num, terms[i]);
+                found = tde->skip_to(tde, target);
+                Aiequal(found, btde->skip_to(btde, target));
+                if (found) {
+                    Aiequal(tde->doc_num(tde), btde->doc_num(btde));
+                    Aiequal(tde->freq(tde), btde->freq(btde));
+                }
+            }
+
+            tde->seek(tde, field_num, terms[i]);
+            btde->seek(btde, field_num, terms[i]);
+            while ((cnt = tde->read(tde, docs, freqs, 50)) > 0) {
+                Aiequal(cnt, btde->read(btde, block_docs, block_freqs, 50));
+                for (j = 0; j < cnt; j++) {
+                    Aiequal(docs[j], block_docs[j]);
+                    Aiequal(freqs[j], block_freqs[j]);
+                }
+            }
+            Aiequal(0, btde->read(btde, block_docs, block_freqs, 50));
+            tde->close(tde);
+            btde->close(btde);
+        }
+        frt_ir_close(ir);
+        frt_ir_close(block_ir);
+    }
+    frt_store_close(block_store);
+}
+
+#define NUM_SKIP_TEST_DOCS 6000
+
+static void test_multi_level_skips(TestCase *tc, void *data)
+{
+    int i, k, target, doc, field_num;
+    static int expected[NUM_SKIP_TEST_DOCS];
+    const char *terms[] = {"all", "even", "seventh", "many"};
+    FrtStore *store = (FrtStore *)data;
+    ID f = rb_intern("f");
+
+    for (k = 0; k < 2; k++) {
+        FrtIndexReader *ir;
+        store->clear_all(store);
+        ir = block_test_index(store, k ? FRT_POSTINGS_FORMAT_BLOCK
+                                       : FRT_POSTINGS_FORMAT_VINT,
+                              true, NUM_SKIP_TEST_DOCS);
+        Atrue(ir->sis->segs[0]->multi_level_skips);
+        field_num = frt_fis_get_field_num(ir->fis, f);
+        for (i = 0; i < (int)FRT_NELEMS(terms); i++) {
+            FrtTermDocEnum *tde = ir_term_docs_for(ir, f, terms[i]);
+            FrtTermDocEnum *tpe = frt_ir_term_positions_for(ir, f, terms[i]);
+
+            /* expected[n] is the first document at or after n, or -1 */
+            target = 0;
+            while (tde->next(tde)) {
+                for (doc = tde->doc_num(tde); target <= doc; target++) {
+                    expected[target] = doc;
+                }
+            }
+            for (; target < NUM_SKIP_TEST_DOCS; target++) {
+                expected[target] = -1;
+            }
+
+            /* jump straight from the start of the postings */
+            for (target = 0; target < NUM_SKIP_TEST_DOCS; target += 61) {
+                tde->seek(tde, field_num, terms[i]);
+                if (expected[target] < 0) {
+                    Atrue(!tde->skip_to(tde, target));
+                } else {
+                    Atrue(tde->skip_to(tde, target));
+                    Aiequal(expected[target], tde->doc_num(tde));
+                }
+            }
+
+            /* jump forward in growing steps on the same enum and check the
+             * freqs and positions are still in step with the documents */
+            tpe->seek(tpe, field_num, terms[i]);
+            for (target = 1; target < NUM_SKIP_TEST_DOCS;
+                 target = doc + doc / 2 + 2) {
+                if (expected[target] < 0) {
+                    Atrue(!tpe->skip_to(tpe, target));
+                    break;
+                }
+                Atrue(tpe->skip_to(tpe, target));
+                doc = tpe->doc_num(tpe);
+                Aiequal(expected[target], doc);
+                if (i == 3) {
+                    Aiequal(doc % 5 + 1, tpe->freq(tpe));
+                    Aiequal(1 + (doc % 2 ? 0 : 1) + (doc % 7 ? 0 : 1),
+                            tpe->next_position(tpe));
+                }
+            }
+            tde->close(tde);
+            tpe->close(tpe);
+        }
+        frt_ir_close(ir);
+    }
+}
+
 /****************************************************************************
  *
  * Index
@@ -1209,6 +1417,133 @@ void test_iw_add_empty_tv(TestCase *tc, void *data)
    frt_doc_destroy(doc);
 }
 
+static void add_dv_doc(FrtIndexWriter *iw, const char *id, const char *price,
+                       const char *cat, const char *tag1, const char *tag2)
+{
+    rb_encoding *enc = rb_enc_find("ASCII-8BIT");
+    FrtDocument *doc = frt_doc_new();
+    FrtDocField *df;
+    frt_doc_add_field(doc, frt_df_add_data(frt_df_new(rb_intern("id")), (char *)id, enc));
+    if (price) {
+        frt_doc_add_field(doc, frt_df_add_data(frt_df_new(rb_intern("price")), (char *)price, enc));
+    }
+    if (cat) {
+        frt_doc_add_field(doc, frt_df_add_data(frt_df_new(rb_intern("cat")), (char *)cat, enc));
+    }
+    if (tag1) {
+        df = frt_doc_add_field(doc, frt_df_add_data(frt_df_new(rb_intern("tags")), (char *)tag1, enc));
+        if (tag2) frt_df_add_data(df, (char *)tag2, enc);
+    }
+    frt_iw_add_doc(iw, doc);
+    frt_doc_destroy(doc);
+}
+
+static void check_dv_segment(TestCase *tc, FrtIndexReader *ir, int start,
+                             bool deleted_b)
+{
+    FrtDocValues *price = frt_sr_get_doc_values(ir, rb_intern("price"));
+    FrtDocValues *cat = frt_sr_get_doc_values(ir, rb_intern("cat"));
+    FrtDocValues *tags = frt_sr_get_doc_values(ir, rb_intern("tags"));
+    const int *ords;
+    int i, doc;
+    Apnotnull(price);
+    Apnotnull(cat);
+    Apnotnull(tags);
+    Assert(NULL == frt_sr_get_doc_values(ir, rb_intern("id")),
+           "id has no doc values");
+    for (i = 0; i < price->size; i++) {
+        /* once "b" is deleted and merged away every later doc moves down */
+        doc = start + i + ((deleted_b && start + i >= 1) ? 1 : 0);
+        switch (doc) {
+            case 0:
+                Aiequal(5, frt_dv_get_long(price, i));
+                Asequal("b", cat->ords[frt_dv_get_ord(cat, i)]);
+                Aiequal(2, frt_dv_get_ords(tags, i, &ords));
+                Asequal("x", tags->ords[ords[0]]);
+                Asequal("y", tags->ords[ords[1]]);
+                break;
+            case 1:
+                Aiequal(-3, frt_dv_get_long(price, i));
+                Asequal("a", cat->ords[frt_dv_get_ord(cat, i)]);
+                Aiequal(1, frt_dv_get_ords(tags, i, &ords));
+                Asequal("z", tags->ords[ords[0]]);
+                break;
+            case 2:
+                Assert(!frt_dv_has_value(price, i), "doc 2 has no price");
+                Assert(!frt_dv_has_value(cat, i), "doc 2 has no cat");
+                Aiequal(0, frt_dv_get_ords(tags, i, &ords));
+                break;
+            case 3:
+                Aiequal(100, frt_dv_get_long(price, i));
+                Asequal("c", cat->ords[frt_dv_get_ord(cat, i)]);
+                Aiequal(2, frt_dv_get_ords(tags, i, &ords));
+                break;
+        }
+    }
+}
+
+static void test_doc_values(TestCase *tc, void *data)
+{
+    FrtStore *store = (FrtStore *)data;
+    FrtConfig config = frt_default_config;
+    FrtFieldInfos *fis = frt_fis_new(0 | FRT_FI_IS_STORED_BM | FRT_FI_IS_INDEXED_BM);
+    FrtIndexWriter *iw;
+    FrtIndexReader *ir;
+    FrtMultiReader *mr;
+    FrtFieldIndex *fld_idx;
+    int i;
+    config.max_buffered_docs = 2;
+    config.merge_factor = 20;
+
+    frt_fis_add_field(fis, frt_fi_new(rb_intern("price"), FRT_FI_DOC_VALUES_NUMERIC_BM));
+    frt_fis_add_field(fis, frt_fi_new(rb_intern("cat"), FRT_FI_IS_INDEXED_BM | FRT_FI_DOC_VALUES_SORTED_BM));
+    frt_fis_add_field(fis, frt_fi_new(rb_intern("tags"), FRT_FI_IS_INDEXED_BM | FRT_FI_DOC_VALUES_SORTED_SET_BM));
+    frt_index_create(store, fis);
+    frt_fis_deref(fis);
+
+    iw = frt_iw_open(NULL, store, frt_whitespace_analyzer_new(false), &config);
+    add_dv_doc(iw, "0", "5", "b", "y", "x");
+    add_dv_doc(iw, "1", "-3", "a", "z", NULL);
+    add_dv_doc(iw, "2", NULL, NULL, NULL, NULL);
+    add_dv_doc(iw, "3", "100", "c", "x", "y");
+    FRT_TRY
+        add_dv_doc(iw, "4", "cheap", NULL, NULL, NULL);
+        Assert(false, "non-integer numeric doc value should raise an error");
+    FRT_XCATCHALL
+        FRT_HANDLED();
+    FRT_XENDTRY
+    frt_iw_close(iw);
+
+    ir = frt_ir_open(NULL, store);
+    Aiequal(FRT_MULTI_READER, ir->type);
+    Aiequal(4, ir->max_doc(ir));
+    mr = (FrtMultiReader *)ir;
+    for (i = 0; i < mr->r_cnt; i++) {
+        check_dv_segment(tc, mr->sub_readers[i], mr->starts[i], false);
+    }
+    /* the field index reads the segments' columns in place */
+    fld_idx = frt_field_index_get(ir, rb_intern("price"), &FRT_INTEGER_FIELD_INDEX_CLASS);
+    Apnull(fld_idx->index);
+    Aiequal(mr->r_cnt, fld_idx->dv_index->size);
+    for (i = 0; i < mr->r_cnt; i++) {
+        Aiequal(mr->starts[i], fld_idx->dv_index->starts[i]);
+        Apequal(frt_sr_get_doc_values(mr->sub_readers[i], rb_intern("price")),
+                fld_idx->dv_index->dvs[i]);
+    }
+    frt_ir_close(ir);
+
+    iw = frt_iw_open(NULL, store, frt_whitespace_analyzer_new(false), &config);
+    frt_iw_delete_term(iw, rb_intern("id"), "1");
+    frt_iw_optimize(iw);
+    frt_iw_close(iw);
+
+    ir = frt_ir_open(NULL, store);
+    Aiequal(FRT_SEGMENT_READER, ir->type);
+    Aiequal(3, ir->max_doc(ir));
+    check_dv_segment(tc, ir, 0, true);
+    frt_ir_close(ir);
+}
+
 static void test_iw_del_terms(TestCase *tc, void *data)
 {
     int i;
@@ -1896,7 +2231,8 @@ static void test_ir_mtdpe(TestCase *tc, void *data)
 static void test_ir_norms(TestCase *tc, void *data)
 {
     int i;
-    frt_uchar *norms;
+    frt_uchar *norms, *text_norms;
+    frt_u32 norm_set[FRT_NORM_SET_SIZE];
     FrtIndexReader *ir, *ir2;
     FrtIndexWriter *iw;
     int type = *((int *)data);
@@ -1980,9 +2316,23 @@ static void test_ir_norms(TestCase *tc, void *data)
     Aiequal(255, norms[250]);
     Aiequal(76, norms[355]);
 
+    /* the norm set is kept until a norm of the field changes */
+    frt_ir_get_norm_set(ir, text, norm_set);
+    text_norms = frt_ir_get_norms(ir, text);
+    for (i = 0; i < 256; i++) {
+        int j, used = 0;
+        for (j = 0; j < ir->max_doc(ir); j++) {
+            if (text_norms[j] == i) used = 1;
+        }
+        Aiequal(used, (norm_set[i >> 5] >> (i & 31)) & 1);
+    }
+    Aiequal(0, (norm_set[201 >> 5] >> (201 & 31)) & 1);
+
     Atrue(!frt_index_is_locked(rte->stores[0]));
-    frt_ir_set_norm(ir, 0, text, 155);
+    frt_ir_set_norm(ir, 0, text, 201);
     Atrue(frt_index_is_locked(rte->stores[0]));
+    frt_ir_get_norm_set(ir, text, norm_set);
+    Aiequal(1, (norm_set[201 >> 5] >> (201 & 31)) & 1);
     frt_ir_close(ir);
     frt_ir_close(ir2);
     Atrue(!frt_index_is_locked(rte->stores[0]));
@@ -2228,6 +2578,8 @@ TestSuite *ts_index(TestSuite *suite)
     /* FrtTermDocEnum */
     tst_run_test(suite, test_segment_term_doc_enum, store);
     tst_run_test(suite, test_segment_tde_deleted_docs, store);
+    tst_run_test(suite, test_block_postings, store);
+    tst_run_test(suite, test_multi_level_skips, store);
 
     suite = ADD_SUITE(suite);
     /* Index */
@@ -2241,6 +2593,7 @@ TestSuite *ts_index(TestSuite *suite)
     tst_run_test(suite, test_iw_add_doc, store);
     tst_run_test(suite, test_iw_add_docs, store);
     tst_run_test(suite, test_iw_add_empty_tv, store);
+    tst_run_test(suite, test_doc_values, store);
     tst_run_test(suite, test_iw_del_terms, store);
     tst_run_test(suite, test_create_with_reader, store);
     tst_run_test(suite, test_simulated_crashed_writer, store);
@@ -1,4 +1,5 @@
 #include <ctype.h>
+#include <limits.h>
 #include "frt_search.h"
 #include "frt_array.h"
 #include "frt_helper.h"
@@ -1633,6 +1634,134 @@ static void test_search_unscored(TestCase *tc, void *data)
     frt_q_deref(tq);
 }
 
+/*
+ * Pruned searches skip documents which can't make it into the top hits so
+ * they must return exactly the same hits as a full search. Only total_hits
+ * is allowed to fall short of the real count.
+ */
+#define PRUNE_DOC_CNT 4000
+#define PRUNE_WORD_CNT 12
+
+static void prepare_prune_index(FrtStore *store)
+{
+    FrtIndexWriter *iw;
+    FrtConfig config = frt_default_config;
+    FrtFieldInfos *fis = frt_fis_new(0 | FRT_FI_IS_STORED_BM | FRT_FI_IS_INDEXED_BM | FRT_FI_IS_TOKENIZED_BM);
+    rb_encoding *enc = rb_enc_find("ASCII-8BIT");
+    unsigned int seed = 7;
+    char buf[1024];
+    int i, j;
+
+    frt_index_create(store, fis);
+    frt_fis_deref(fis);
+
+    config.max_buffered_docs = 900;
+    config.merge_factor = 20; /* keep several segments */
+    iw = frt_iw_open(NULL, store, frt_whitespace_analyzer_new(false), &config);
+    for (i = 0; i < PRUNE_DOC_CNT; i++) {
+        FrtDocument *doc = frt_doc_new();
+        int len = 0, word_cnt;
+        seed = seed * 1103515245 + 12345;
+        word_cnt = 1 + (seed >> 16) % 40;
+        for (j = 0; j < word_cnt; j++) {
+            int word = 0;
+            seed = seed * 1103515245 + 12345;
+            /* skew the distribution so the later words are much rarer */
+            while (word < PRUNE_WORD_CNT - 1 && ((seed >> (8 + word)) & 1)) {
+                word++;
+            }
+            len += sprintf(buf + len, "w%d ", word);
+        }
+        frt_doc_add_field(doc, frt_df_add_data(frt_df_new(field), buf, enc));
+        frt_iw_add_doc(iw, doc);
+        frt_doc_destroy(doc);
+    }
+    frt_iw_close(iw);
+}
+
+static void check_pruned_search(TestCase *tc, FrtSearcher *searcher,
+                                FrtQuery *q, int num_docs)
+{
+    static const int thresholds[] = {0, 1, 10, 100};
+    FrtTopDocs *full, *pruned;
+    int i, j;
+
+    full = searcher->search(searcher, q, 0, num_docs, NULL, NULL, NULL,
+                            false, INT_MAX);
+    Assert(full->total_hits_exact, "all hits should have been counted");
+    for (i = 0; i < (int)FRT_NELEMS(thresholds); i++) {
+        pruned = searcher->search(searcher, q, 0, num_docs, NULL, NULL, NULL,
+                                  false, thresholds[i]);
+        Aiequal(full->size, pruned->size);
+        Assert(pruned->total_hits <= full->total_hits,
+               "%d > %d", pruned->total_hits, full->total_hits);
+        Assert(pruned->total_hits >= pruned->size,
+               "%d < %d", pruned->total_hits, pruned->size);
+        if (pruned->total_hits < full->total_hits) {
+            Assert(!pruned->total_hits_exact, "total_hits should be a bound");
+        }
+        for (j = 0; j < full->size && j < pruned->size; j++) {
+            Aiequal(full->hits[j]->doc, pruned->hits[j]->doc);
+            Afequal(full->hits[j]->score, pruned->hits[j]->score);
+        }
+        frt_td_destroy(pruned);
+    }
+    frt_td_destroy(full);
+}
+
+static void test_pruned_search(TestCase *tc, void *data)
+{
+    FrtSearcher *searcher = (FrtSearcher *)data;
+    FrtQuery *bq, *sub_bq, *tq;
+    char word[8];
+    int i;
+
+    /* a single term skips whole blocks of its documents */
+    bq = frt_tq_new(field, "w3");
+    check_pruned_search(tc, searcher, bq, 10);
+    frt_q_deref(bq);
+
+    /* a mix of common and rare words */
+    bq = frt_bq_new(false);
+    frt_bq_add_query_nr(bq, frt_tq_new(field, "w0"), FRT_BC_SHOULD);
+    frt_bq_add_query_nr(bq, frt_tq_new(field, "w4"), FRT_BC_SHOULD);
+    frt_bq_add_query_nr(bq, frt_tq_new(field, "w7"), FRT_BC_SHOULD);
+    check_pruned_search(tc, searcher, bq, 10);
+    check_pruned_search(tc, searcher, bq, 1);
+    frt_q_deref(bq);
+
+    bq = frt_bq_new(true);
+    for (i = 0; i < PRUNE_WORD_CNT; i++) {
+        sprintf(word, "w%d", i);
+        frt_bq_add_query_nr(bq, frt_tq_new(field, word), FRT_BC_SHOULD);
+    }
+    check_pruned_search(tc, searcher, bq, 20);
+    frt_q_deref(bq);
+
+    /* the required clause skips the documents which can't compete even
+     * with the most the optional clauses could add */
+    bq = frt_bq_new(false);
+    frt_bq_add_query_nr(bq, frt_tq_new(field, "w2"), FRT_BC_MUST);
+    frt_bq_add_query_nr(bq, frt_tq_new(field, "w5"), FRT_BC_SHOULD);
+    frt_bq_add_query_nr(bq, frt_tq_new(field, "w8"), FRT_BC_SHOULD);
+    check_pruned_search(tc, searcher, bq, 10);
+    frt_q_deref(bq);
+
+    sub_bq = frt_bq_new(false);
+    frt_bq_add_query_nr(sub_bq, frt_tq_new(field, "w0"), FRT_BC_SHOULD);
+    frt_bq_add_query_nr(sub_bq, frt_tq_new(field, "w4"), FRT_BC_SHOULD);
+    frt_bq_add_query_nr(sub_bq, frt_tq_new(field, "w7"), FRT_BC_SHOULD);
+    tq = frt_tq_new(field, "w1");
+    tq->boost = 0.1f;
+    bq = frt_bq_new(false);
+    frt_bq_add_query_nr(bq, sub_bq, FRT_BC_MUST);
+    frt_bq_add_query_nr(bq, tq, FRT_BC_SHOULD);
+    frt_bq_add_query_nr(bq, frt_tq_new(field, "w6"), FRT_BC_MUST_NOT);
+    check_pruned_search(tc, searcher, bq, 10);
+    check_pruned_search(tc, searcher, bq, 1);
+    frt_q_deref(bq);
+}
+
 TestSuite *ts_search(TestSuite *suite)
 {
     FrtStore *store = frt_open_ram_store(NULL);
@@ -1688,6 +1817,18 @@ TestSuite *ts_search(TestSuite *suite)
 
     tst_run_test(suite, test_search_unscored, (void *)searcher);
 
+    frt_searcher_close(searcher);
+    frt_ir_close(ir);
+    frt_store_close(store);
+
+    store = frt_open_ram_store(NULL);
+    prepare_prune_index(store);
+    ir = frt_ir_open(NULL, store);
+    searcher = frt_isea_new(ir);
+    tst_run_test(suite, test_pruned_search, (void *)searcher);
+    /* prune each segment separately */
+    ((FrtIndexSearcher *)searcher)->max_threads = 2;
+    tst_run_test(suite, test_pruned_search, (void *)searcher);
     frt_searcher_close(searcher);
     frt_ir_close(ir);
     frt_store_close(store);
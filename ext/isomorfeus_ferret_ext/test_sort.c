@@ -1,3 +1,4 @@
+#include <limits.h>
 #include "frt_global.h"
 #include "testhelper.h"
 #include "frt_search.h"
@@ -288,6 +289,221 @@ static void test_sorts(TestCase *tc, void *data)
     frt_q_deref(q);
 }
 
+static FrtIndexWriter *sort_segments_iw_open(FrtStore *store)
+{
+    FrtConfig config = frt_default_config;
+    config.max_buffered_docs = 3;
+    config.merge_factor = 20; /* keep the small segments */
+    return frt_iw_open(NULL, store, frt_whitespace_analyzer_new(false), &config);
+}
+
+static void sort_segments_test_setup(FrtStore *store)
+{
+    int i;
+    FrtIndexWriter *iw;
+    FrtFieldInfos *fis = frt_fis_new(0 | FRT_FI_IS_STORED_BM | FRT_FI_IS_INDEXED_BM | FRT_FI_IS_TOKENIZED_BM | FRT_FI_STORE_TERM_VECTOR_BM);
+    frt_index_create(store, fis);
+    frt_fis_deref(fis);
+
+    iw = sort_segments_iw_open(store);
+
+    for (i = 0; i < FRT_NELEMS(data); i++) {
+        add_sort_test_data(&data[i], iw);
+    }
+    frt_iw_close(iw);
+}
+
+/*
+ * Field indexes are cached on each SegmentReader so a reopened reader only
+ * needs to build them for the new segments.
+ */
+static void test_sort_field_index_per_segment(TestCase *tc, void *store_ptr)
+{
+    FrtStore *store = (FrtStore *)store_ptr;
+    FrtIndexReader *ir = frt_ir_open(NULL, store), *ir2;
+    FrtMultiReader *mr = (FrtMultiReader *)ir, *mr2;
+    FrtIndexWriter *iw;
+    FrtSearcher *sea;
+    FrtFieldIndex *fi, *fi2, *sub_fi[ARRAY_SIZE];
+    FrtStringIndex *str_index;
+    FrtQuery *q;
+    FrtSort *sort;
+    SortTestData extra = {"findall", "bb", "0", "0.5"};
+    int i;
+
+    Aiequal(FRT_MULTI_READER, ir->type);
+    Assert(mr->r_cnt > 1, "index should have more than one segment");
+
+    fi = frt_field_index_get(ir, integer, &FRT_INTEGER_FIELD_INDEX_CLASS);
+    for (i = 0; i < FRT_NELEMS(data); i++) {
+        Aiequal(atol(data[i].integer), ((long *)fi->index)[i]);
+    }
+    fi = frt_field_index_get(ir, string, &FRT_STRING_FIELD_INDEX_CLASS);
+    str_index = (FrtStringIndex *)fi->index;
+    for (i = 0; i < FRT_NELEMS(data); i++) {
+        char *val = str_index->values[str_index->index[i]];
+        Asequal(data[i].string, val ? val : "");
+    }
+    for (i = 0; i < mr->r_cnt; i++) {
+        sub_fi[i] = frt_field_index_get(mr->sub_readers[i], integer, &FRT_INTEGER_FIELD_INDEX_CLASS);
+    }
+
+    iw = sort_segments_iw_open(store);
+    add_sort_test_data(&extra, iw);
+    frt_iw_close(iw);
+
+    ir2 = frt_ir_reopen(ir);
+    Assert(ir2 != ir, "reader should have been reopened");
+    mr2 = (FrtMultiReader *)ir2;
+    Aiequal(mr->r_cnt + 1, mr2->r_cnt);
+    fi2 = frt_field_index_get(ir2, integer, &FRT_INTEGER_FIELD_INDEX_CLASS);
+    for (i = 0; i < mr->r_cnt; i++) {
+        FrtIndexReader *sub_reader = mr2->sub_readers[i];
+        Apequal(mr->sub_readers[i], frt_ir_core(sub_reader));
+        Apequal(sub_fi[i], frt_field_index_get(sub_reader, integer, &FRT_INTEGER_FIELD_INDEX_CLASS));
+    }
+    for (i = 0; i < FRT_NELEMS(data); i++) {
+        Aiequal(atol(data[i].integer), ((long *)fi2->index)[i]);
+    }
+    Aiequal(0, ((long *)fi2->index)[FRT_NELEMS(data)]);
+    frt_ir_close(ir);
+
+    sea = frt_isea_new(ir2);
+    q = frt_tq_new(search, "findall");
+    sort = frt_sort_new();
+    frt_sort_add_sort_field(sort, frt_sort_field_int_new(integer, false));
+    do_test_top_docs(tc, sea, q, "10,3,2,7,4,8,5,9,1,6,0", sort);
+    frt_sort_clear(sort);
+    frt_sort_add_sort_field(sort, frt_sort_field_string_new(string, false));
+    do_test_top_docs(tc, sea, q, "0,9,10,1,8,2,7,3,6,4,5", sort);
+    frt_sort_destroy(sort);
+    frt_q_deref(q);
+    frt_searcher_close(sea);
+    frt_ir_close(ir2);
+}
+
+/* check that the documents of each of +ir+'s segments are sorted by integer */
+static void check_segments_sorted(TestCase *tc, FrtIndexReader *ir)
+{
+    FrtFieldIndex *fi = frt_field_index_get(ir, integer, &FRT_INTEGER_FIELD_INDEX_CLASS);
+    long *values = (long *)fi->index;
+    FrtSegmentReader *single = (FrtSegmentReader *)ir;
+    FrtMultiReader *mr = (FrtMultiReader *)ir;
+    const int seg_cnt = ir->type == FRT_MULTI_READER ? mr->r_cnt : 1;
+    int i, seg;
+
+    for (seg = 0; seg < seg_cnt; seg++) {
+        FrtSegmentReader *sr = ir->type == FRT_MULTI_READER
+            ? (FrtSegmentReader *)mr->sub_readers[seg] : single;
+        const int start = ir->type == FRT_MULTI_READER ? mr->starts[seg] : 0;
+        const int end = start + sr->ir.max_doc(&sr->ir);
+        int prev = -1;
+        Apnotnull(sr->si->index_sort);
+        Aiequal(1, sr->si->index_sort->size);
+        for (i = start; i < end; i++) {
+            FrtDocument *doc;
+            /* deleted documents have no field index value */
+            if (ir->is_deleted(ir, i)) continue;
+            /* the stored fields moved with the postings */
+            doc = ir->get_doc(ir, i);
+            Aiequal(values[i], atol(frt_doc_get_field(doc, integer)->data[0]));
+            frt_doc_destroy(doc);
+            if (prev >= 0) {
+                Assert(values[prev] <= values[i], "segment %d isn't sorted", seg);
+            }
+            prev = i;
+        }
+    }
+}
+
+static void check_index_sort_search(TestCase *tc, FrtIndexReader *ir)
+{
+    FrtSearcher *sea = frt_isea_new(ir);
+    FrtQuery *q = frt_tq_new(search, "findall");
+    FrtSort *sort = frt_sort_new();
+    FrtTopDocs *all, *early;
+    int i;
+
+    frt_sort_add_sort_field(sort, frt_sort_field_int_new(integer, false));
+    all = sea->search(sea, q, 0, 2, NULL, sort, NULL, false, INT_MAX);
+    early = sea->search(sea, q, 0, 2, NULL, sort, NULL, false, 0);
+    Aiequal(ir->num_docs(ir), all->total_hits);
+    Atrue(all->total_hits_exact);
+    Atrue(!early->total_hits_exact);
+    Assert(early->total_hits < all->total_hits, "segments should be cut short");
+    Aiequal(all->size, early->size);
+    for (i = 0; i < all->size; i++) {
+        Aiequal(all->hits[i]->doc, early->hits[i]->doc);
+    }
+    frt_td_destroy(all);
+    frt_td_destroy(early);
+
+    /* a reversed sort has to look at every document */
+    sort->sort_fields[0]->reverse = true;
+    early = sea->search(sea, q, 0, 2, NULL, sort, NULL, false, 0);
+    Aiequal(ir->num_docs(ir), early->total_hits);
+    Atrue(early->total_hits_exact);
+    frt_td_destroy(early);
+
+    frt_sort_destroy(sort);
+    frt_q_deref(q);
+    frt_searcher_close(sea);
+}
+
+/*
+ * With an index sort every segment, flushed or merged, holds its documents in
+ * sort order. Searches sorted the same way skip the rest of a segment once
+ * they have collected enough hits from it.
+ */
+static void test_index_sort(TestCase *tc, void *unused)
+{
+    FrtStore *store = frt_open_ram_store(NULL);
+    FrtFieldInfos *fis = frt_fis_new(0 | FRT_FI_IS_STORED_BM | FRT_FI_IS_INDEXED_BM | FRT_FI_IS_TOKENIZED_BM | FRT_FI_STORE_TERM_VECTOR_BM);
+    FrtConfig config = frt_default_config;
+    FrtSort *sort = frt_sort_new();
+    FrtIndexWriter *iw;
+    FrtIndexReader *ir;
+    int i;
+    (void)unused;
+
+    frt_index_create(store, fis);
+    frt_fis_deref(fis);
+
+    /* the trailing doc field is implied so it gets dropped */
+    frt_sort_add_sort_field(sort, frt_sort_field_int_new(integer, false));
+    frt_sort_add_sort_field(sort, frt_sort_field_doc_new(false));
+    config.max_buffered_docs = 3;
+    config.merge_factor = 20; /* keep the small segments */
+    config.index_sort = sort;
+    iw = frt_iw_open(NULL, store, frt_whitespace_analyzer_new(false), &config);
+    for (i = 0; i < FRT_NELEMS(data); i++) {
+        add_sort_test_data(&data[i], iw);
+    }
+    frt_iw_delete_term(iw, string, "c");
+    frt_iw_close(iw);
+
+    /* the flushed segments */
+    ir = frt_ir_open(NULL, store);
+    Aiequal(FRT_MULTI_READER, ir->type);
+    Aiequal(FRT_NELEMS(data) - 1, ir->num_docs(ir));
+    check_segments_sorted(tc, ir);
+    check_index_sort_search(tc, ir);
+    frt_ir_close(ir);
+
+    /* merged into one, dropping the deleted document */
+    iw = frt_iw_open(NULL, store, frt_whitespace_analyzer_new(false), &config);
+    frt_sort_destroy(sort);
+    frt_iw_optimize(iw);
+    frt_iw_close(iw);
+    ir = frt_ir_open(NULL, store);
+    Aiequal(FRT_SEGMENT_READER, ir->type);
+    Aiequal(FRT_NELEMS(data) - 1, ir->max_doc(ir));
+    check_segments_sorted(tc, ir);
+    check_index_sort_search(tc, ir);
+    frt_ir_close(ir);
+    frt_store_close(store);
+}
+
 TestSuite *ts_sort(TestSuite *suite)
 {
     FrtSearcher *sea, **searchers;
@@ -315,6 +531,18 @@ TestSuite *ts_sort(TestSuite *suite)
     frt_searcher_close(sea);
     frt_ir_close(ir0);
 
+    sort_segments_test_setup(store);
+    ir0 = frt_ir_open(NULL, store);
+    sea = frt_isea_new(ir0);
+    tst_run_test(suite, test_sorts, (void *)sea);
+    /* score the segments in parallel */
+    ((FrtIndexSearcher *)sea)->max_threads = 3;
+    tst_run_test(suite, test_sorts, (void *)sea);
+    frt_searcher_close(sea);
+    frt_ir_close(ir0);
+    tst_run_test(suite, test_sort_field_index_per_segment, (void *)store);
+    tst_run_test(suite, test_index_sort, NULL);
+
     do_byte_test = false;
 
 #if defined POSH_OS_WIN32 || defined POSH_OS_WIN64
@@ -333,6 +561,9 @@ TestSuite *ts_sort(TestSuite *suite)
     FRT_DEREF(searchers[1]);
     sea = frt_msea_new(searchers, 2);
     tst_run_test(suite, test_sorts, (void *)sea);
+    /* search the sub-searchers in parallel */
+    ((FrtMultiSearcher *)sea)->max_threads = 2;
+    tst_run_test(suite, test_sorts, (void *)sea);
 
     frt_searcher_close(sea);
     frt_ir_close(ir0);
@@ -562,6 +562,59 @@ static void test_read_bytes(TestCase *tc, void *data)
     frt_is_close(istream);
 }
 
+/**
+ * Test that streams read and write the same data whatever their buffer sizes
+ * and that resizing a buffer keeps the stream position.
+ */
+static void test_buffer_sizes(TestCase *tc, void *data)
+{
+    int i;
+    FrtStore *store = (FrtStore *)data;
+    FrtOutStream *ostream = store->new_output(store, "_buffers.cfs");
+    FrtOutStream *copy;
+    FrtInStream *istream, *alt_istream;
+
+    frt_os_set_buffer_size(ostream, 16);
+    for (i = 0; i < 5000; i++) {
+        frt_os_write_vint(ostream, i);
+        if (i == 2000) {
+            frt_os_set_buffer_size(ostream, FRT_SEQUENTIAL_BUFFER_SIZE);
+        }
+    }
+    frt_os_close(ostream);
+
+    istream = store->open_input(store, "_buffers.cfs");
+    frt_is_set_buffer_size(istream, FRT_RANDOM_BUFFER_SIZE);
+    for (i = 0; i < 1000; i++) {
+        Aiequal(i, frt_is_read_vint(istream));
+    }
+    frt_is_set_buffer_size(istream, 16);
+    alt_istream = frt_is_clone(istream);
+    for (i = 1000; i < 3000; i++) {
+        Aiequal(i, frt_is_read_vint(istream));
+    }
+    frt_is_set_buffer_size(istream, FRT_SEQUENTIAL_BUFFER_SIZE);
+    for (i = 3000; i < 5000; i++) {
+        Aiequal(i, frt_is_read_vint(istream));
+    }
+    Aiequal(frt_is_length(istream), frt_is_pos(istream));
+
+    /* copy through buffers of different sizes */
+    copy = store->new_output(store, "_buffers_copy.cfs");
+    frt_os_set_buffer_size(copy, 100);
+    frt_is2os_copy_bytes(alt_istream, copy,
+                         (int)(frt_is_length(alt_istream) - frt_is_pos(alt_istream)));
+    frt_os_close(copy);
+    frt_is_close(alt_istream);
+    frt_is_close(istream);
+
+    istream = store->open_input(store, "_buffers_copy.cfs");
+    for (i = 1000; i < 5000; i++) {
+        Aiequal(i, frt_is_read_vint(istream));
+    }
+    frt_is_close(istream);
+}
+
 /**
  * Create a test suite for a store. This function can be used to create a test
  * suite for both a FileSystem store and a RAM store and any other type of
@@ -587,6 +640,7 @@ void create_test_store_suite(TestSuite *suite, FrtStore *store)
     tst_run_test(suite, test_buffer_seek, store);
     tst_run_test(suite, test_is_clone, store);
     tst_run_test(suite, test_read_bytes, store);
+    tst_run_test(suite, test_buffer_sizes, store);
     tst_run_test(suite, test_lock, store);
 
     store->clear_all(store);
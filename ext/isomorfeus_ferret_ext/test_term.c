@@ -72,6 +72,133 @@ static char *rev(char *str)
 }
 */
 
+/*****************************************************************************
+ *
+ * Fst
+ *
+ *****************************************************************************/
+
+static int fst_expected_floor(const char *term)
+{
+    int i;
+    for (i = DICT_LEN - 1; i >= 0; i--) {
+        if (strcmp(DICT[i], term) <= 0) {
+            return i + 1;
+        }
+    }
+    return strcmp("", term) <= 0 ? 0 : -1;
+}
+
+static void check_fst_floor(TestCase *tc, FrtFst *fst, const char *term)
+{
+    char buf[FRT_MAX_WORD_SIZE + 1];
+    int len, ord = fst_expected_floor(term);
+    Aiequal(ord, frt_fst_floor(fst, term, buf, &len));
+    Asequal(ord > 0 ? DICT[ord - 1] : "", buf);
+    Aiequal(strlen(buf), len);
+}
+
+static void test_fst(TestCase *tc, void *data)
+{
+    int i, len, term_bytes = 0;
+    char buf[FRT_MAX_WORD_SIZE + 1];
+    FrtFstBuilder *fstb = frt_fstb_new();
+    FrtFst *fst;
+    (void)data;
+
+    /* like the term index, start with the empty term */
+    Aiequal(0, frt_fstb_add(fstb, "", 0));
+    for (i = 0; i < DICT_LEN; i++) {
+        Aiequal(i + 1, frt_fstb_add(fstb, DICT[i], strlen(DICT[i])));
+        term_bytes += strlen(DICT[i]);
+    }
+    Aiequal(DICT_LEN, frt_fstb_add(fstb, DICT[DICT_LEN - 1],
+                                   strlen(DICT[DICT_LEN - 1])));
+    FRT_TRY
+        frt_fstb_add(fstb, "dua", 3);
+        Assert(false, "adding terms out of order should raise");
+    FRT_XCATCHALL
+        FRT_HANDLED();
+    FRT_XENDTRY
+    fst = frt_fstb_finish(fstb);
+
+    Aiequal(DICT_LEN + 1, fst->count);
+    /* an array of the terms would need at least a pointer and a length
+     * per term on top of the term bytes */
+    Assert(fst->size < term_bytes + DICT_LEN * (int)(sizeof(char *) + sizeof(int)),
+           "fst should be smaller than an array of its terms");
+    Aiequal(0, frt_fst_get(fst, ""));
+    Aiequal(-1, frt_fst_get(fst, "du"));
+    Aiequal(-1, frt_fst_get(fst, "dubie"));
+    Aiequal(-1, frt_fst_get(fst, "duykers"));
+    Aiequal(-1, frt_fst_get_term(fst, -1, buf));
+    Aiequal(-1, frt_fst_get_term(fst, DICT_LEN + 1, buf));
+    Aiequal(0, frt_fst_get_term(fst, 0, buf));
+    Asequal("", buf);
+    for (i = 0; i < DICT_LEN; i++) {
+        Aiequal(i + 1, frt_fst_get(fst, DICT[i]));
+        len = frt_fst_get_term(fst, i + 1, buf);
+        Asequal(DICT[i], buf);
+        Aiequal(strlen(DICT[i]), len);
+    }
+
+    check_fst_floor(tc, fst, "");
+    check_fst_floor(tc, fst, "a");
+    check_fst_floor(tc, fst, "du");
+    check_fst_floor(tc, fst, "dv");
+    check_fst_floor(tc, fst, "zzz");
+    for (i = 0; i < DICT_LEN; i++) {
+        int term_len = (int)strlen(DICT[i]);
+        memcpy(buf, DICT[i], term_len + 1);
+        check_fst_floor(tc, fst, buf);
+        buf[term_len - 1]--;
+        check_fst_floor(tc, fst, buf);
+        buf[term_len - 1] += 2;
+        check_fst_floor(tc, fst, buf);
+        buf[term_len - 1] = '\0';
+        check_fst_floor(tc, fst, buf);
+        memcpy(buf, DICT[i], term_len);
+        memcpy(buf + term_len, "zz", 3);
+        check_fst_floor(tc, fst, buf);
+    }
+    frt_fst_destroy(fst);
+
+    /* wide nodes with arbitrary bytes */
+    {
+        static const int firsts[] = {0x01, 0x41, 0x7f, 0x80, 0xc3, 0xff};
+        char terms[6 * 37][3];
+        int j, cnt = 0;
+        fstb = frt_fstb_new();
+        for (i = 0; i < 6; i++) {
+            for (j = 1; j < 256; j += 7) {
+                terms[cnt][0] = (char)firsts[i];
+                terms[cnt][1] = (char)j;
+                terms[cnt][2] = '\0';
+                Aiequal(cnt, frt_fstb_add(fstb, terms[cnt], 2));
+                cnt++;
+            }
+        }
+        fst = frt_fstb_finish(fstb);
+        for (i = 0; i < cnt; i++) {
+            Aiequal(i, frt_fst_get(fst, terms[i]));
+            Aiequal(2, frt_fst_get_term(fst, i, buf));
+            Asequal(terms[i], buf);
+            buf[1]++;
+            Aiequal(i, frt_fst_floor(fst, buf, NULL, NULL));
+            buf[1] -= 2;
+            Aiequal(i - 1, frt_fst_floor(fst, buf, NULL, NULL));
+        }
+        frt_fst_destroy(fst);
+    }
+
+    /* an empty fst */
+    fst = frt_fstb_finish(frt_fstb_new());
+    Aiequal(0, fst->count);
+    Aiequal(-1, frt_fst_get(fst, ""));
+    Aiequal(-1, frt_fst_floor(fst, "dual", NULL, NULL));
+    frt_fst_destroy(fst);
+}
+
 /*****************************************************************************
  *
  * SegmentFieldIndex
@@ -344,6 +471,7 @@ TestSuite *ts_term(TestSuite *suite)
 
     suite = ADD_SUITE(suite);
 
+    tst_run_test(suite, test_fst, NULL);
     tst_run_test(suite, test_segment_field_index_single_field, store);
     tst_run_test(suite, test_segment_field_index_multi_field, store);
     tst_run_test(suite, test_segment_term_enum, store);
@@ -96,15 +96,15 @@ static void test_tv_single_doc(TestCase *tc, void *data)
     FrtOffset *offsets = create_tv_offsets(mp);
     FrtDocument *doc = frt_doc_new();
 
-    fw = frt_fw_open(store, "_0", fis);
+    fw = frt_fw_open(store, "_0", fis, FRT_STORED_FIELDS_FORMAT_PLAIN);
     frt_fw_close(fw);
 
-    fr = frt_fr_open(store, "_0", fis);
+    fr = frt_fr_open(store, "_0", fis, FRT_STORED_FIELDS_FORMAT_PLAIN);
     Aiequal(0, fr->size);
     frt_fr_close(fr);
 
 
-    fw = frt_fw_open(store, "_0", fis);
+    fw = frt_fw_open(store, "_0", fis, FRT_STORED_FIELDS_FORMAT_PLAIN);
     frt_fw_add_doc(fw, doc);
     frt_fw_add_postings(fw, frt_fis_get_field(fis, rb_intern("tv"))->number, plists, NUM_TERMS, offsets, NUM_TERMS);
     frt_fw_add_postings(fw, frt_fis_get_field(fis, rb_intern("tv_with_positions"))->number, plists, NUM_TERMS, offsets, NUM_TERMS);
@@ -114,7 +114,7 @@ static void test_tv_single_doc(TestCase *tc, void *data)
     frt_fw_close(fw);
    frt_doc_destroy(doc);
 
-    fr = frt_fr_open(store, "_0", fis);
+    fr = frt_fr_open(store, "_0", fis, FRT_STORED_FIELDS_FORMAT_PLAIN);
     Aiequal(1, fr->size);
 
     /* test individual field's term vectors */
@@ -238,7 +238,7 @@ static void test_tv_multi_doc(TestCase *tc, void *data)
     FrtOffset *offsets = create_tv_offsets(mp);
     FrtDocument *doc = frt_doc_new();
 
-    fw = frt_fw_open(store, "_0", fis);
+    fw = frt_fw_open(store, "_0", fis, FRT_STORED_FIELDS_FORMAT_PLAIN);
     frt_fw_add_doc(fw, doc);
     frt_fw_add_postings(fw, frt_fis_get_field(fis, rb_intern("tv"))->number, plists, NUM_TERMS, offsets, NUM_TERMS);
     frt_fw_write_tv_index(fw); frt_fw_add_doc(fw, doc);
@@ -257,7 +257,7 @@ static void test_tv_multi_doc(TestCase *tc, void *data)
     frt_fw_close(fw);
     frt_doc_destroy(doc);
 
-    fr = frt_fr_open(store, "_0", fis);
+    fr = frt_fr_open(store, "_0", fis, FRT_STORED_FIELDS_FORMAT_PLAIN);
     Aiequal(5, fr->size);
 
     tv = frt_fr_get_field_tv(fr, 0, frt_fis_get_field(fis, rb_intern("tv"))->number);
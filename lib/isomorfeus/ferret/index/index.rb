@@ -53,6 +53,17 @@ module Isomorfeus
         #                         concerned about performance. In that case you
         #                         should think about setting up a DRb indexing
         #                         service.
+        # near_real_time::        Default: false. Set this option to true if you
+        #                         mix reads and writes and want to search new
+        #                         documents without closing the writer every
+        #                         time. The reader is then opened from the
+        #                         writer and sees buffered documents as soon as
+        #                         they are searched for. As the writer stays
+        #                         open it keeps holding the write lock so other
+        #                         processes can't write to the index meanwhile.
+        # search_threads::        Default: 1. The number of threads used to
+        #                         search the segments of the index in parallel.
+        #                         See Searcher#max_threads=.
         # lock_retry_time::       Default: 2 seconds. This parameter specifies how
         #                         long to wait before retrying to obtain the
         #                         commit lock when detecting if the IndexReader is
@@ -139,6 +150,8 @@ module Isomorfeus
             options[:use_typed_range_query] = true
           end
 
+          @near_real_time = options[:near_real_time]
+          @search_threads = options[:search_threads] || 1
           @searcher = nil
           @writer = nil
           @reader = nil
@@ -217,14 +230,17 @@ module Isomorfeus
         end
 
         # Get the reader for this index.
-        # NOTE:: This will close the writer from this index.
+        # NOTE:: This will close the writer from this index unless
+        #        :near_real_time is set. Then the reader is opened from the
+        #        writer and can't be used to delete documents.
         def reader
           ensure_reader_open()
           return @reader
         end
 
         # Get the searcher for this index.
-        # NOTE:: This will close the writer from this index.
+        # NOTE:: This will close the writer from this index unless
+        #        :near_real_time is set.
         def searcher
           ensure_searcher_open()
           return @searcher
@@ -332,6 +348,10 @@ module Isomorfeus
         #               and the Searcher object as its parameters and returns a
         #               Boolean value specifying whether the result should be
         #               included in the result set.
+        # total_hits_threshold:: Default: all. The number of matches to count
+        #               exactly. Past it the search may skip the documents which
+        #               can't make it into the results so +total_hits+ is only a
+        #               lower bound. See TopDocs#total_hits_exact?
         def search(query, options = {})
           @dir.synchronize do
             return do_search(query, options)
@@ -375,6 +395,10 @@ module Isomorfeus
         #               and the Searcher object as its parameters and returns a
         #               Boolean value specifying whether the result should be
         #               included in the result set.
+        # total_hits_threshold:: Default: all. The number of matches to count
+        #               exactly. Past it the search may skip the documents which
+        #               can't make it into the results so +total_hits+ is only a
+        #               lower bound. See TopDocs#total_hits_exact?
         #
         # returns:: The total number of hits.
         #
@@ -516,7 +540,7 @@ module Isomorfeus
               ensure_writer_open()
               @writer.delete(@id_field, arg.to_s)
             elsif arg.is_a?(Integer)
-              ensure_reader_open()
+              ensure_reader_open(true, true)
               _cnt = @reader.delete(arg)
             elsif arg.is_a?(Hash) or arg.is_a?(Array)
               batch_delete(arg)
@@ -536,7 +560,7 @@ module Isomorfeus
         def query_delete(query)
           @dir.synchronize do
             ensure_writer_open()
-            ensure_searcher_open()
+            ensure_searcher_open(true)
             query = do_process_query(query)
             @searcher.search_each(query, :limit => :all) do |doc, score|
               @reader.delete(doc)
@@ -669,7 +693,7 @@ module Isomorfeus
         def query_update(query, new_val)
           @dir.synchronize do
             ensure_writer_open()
-            ensure_searcher_open()
+            ensure_searcher_open(true)
             docs_to_add = []
             query = do_process_query(query)
             @searcher.search_each(query, :limit => :all) do |id, score|
@@ -705,15 +729,17 @@ module Isomorfeus
         # index.
         def flush()
           @dir.synchronize do
-            if @reader
+            if @writer
+              # a reader opened alongside the writer has no changes of its own
+              close_reader
+              @writer.close
+              @writer = nil
+            elsif @reader
               if @searcher
                 @searcher.close
                 @searcher = nil
               end
               @reader.commit
-            elsif @writer
-              @writer.close
-              @writer = nil
             end
           end
         end
@@ -883,18 +909,28 @@ module Isomorfeus
           def ensure_writer_open()
             raise "tried to use a closed index" if not @open
             return if @writer
-            if @reader
-              @searcher.close if @searcher
-              @reader.close
-              @reader = nil
-              @searcher = nil
-            end
+            close_reader
             @writer = IndexWriter.new(@options)
           end
 
           # returns the new reader if one is opened
-          def ensure_reader_open(get_latest = true)
+          #
+          # With :near_real_time the reader is opened from the writer so the
+          # writer can stay open. Such a reader can't delete documents so pass
+          # +writable+ if the reader is used for deleting, which closes the
+          # writer instead.
+          def ensure_reader_open(get_latest = true, writable = false)
             raise "tried to use a closed index" if not @open
+            if @writer and @near_real_time and not writable
+              if @reader
+                return false if not get_latest or @writer.reader_latest?(@reader)
+                @searcher.close if @searcher
+                @reader.close
+              end
+              return @reader = @writer.reader
+            elsif @writer
+              close_reader
+            end
             if @reader
               if get_latest
                 latest = false
@@ -906,8 +942,10 @@ module Isomorfeus
                 end
                 if not latest
                   @searcher.close if @searcher
-                  @reader.close
-                  return @reader = IndexReader.new(@dir)
+                  # only the segments which have changed are read again
+                  reader = @reader.reopen
+                  @reader.close unless reader.equal?(@reader)
+                  return @reader = reader
                 end
               end
             else
@@ -920,13 +958,22 @@ module Isomorfeus
             return false
           end
 
-          def ensure_searcher_open()
+          def ensure_searcher_open(writable = false)
             raise "tried to use a closed index" if not @open
-            if ensure_reader_open() or not @searcher
+            if ensure_reader_open(true, writable) or not @searcher
               @searcher = Searcher.new(@reader)
+              @searcher.max_threads = @search_threads
             end
           end
 
+          def close_reader()
+            return unless @reader
+            @searcher.close if @searcher
+            @reader.close
+            @reader = nil
+            @searcher = nil
+          end
+
         private
           def do_process_query(query)
             if query.is_a?(String)
@@ -985,7 +1032,7 @@ module Isomorfeus
               end
             end
             if ids.size > 0
-              ensure_reader_open
+              ensure_reader_open(true, true)
               ids.each {|id| @reader.delete(id)}
             end
             if terms.size > 0
@@ -656,6 +656,37 @@ class IndexTest < Test::Unit::TestCase
     index2.close
   end
 
+  def test_near_real_time
+    index = Index.new(:analyzer => WhiteSpaceAnalyzer.new, :near_real_time => true)
+    index << {:id => "0", :content => "zero"}
+    index << {:id => "1", :content => "one"}
+    assert_equal(2, index.size)
+    writer = index.writer
+    index << {:id => "2", :content => "two"}
+    assert_equal(1, index.search("content:two").total_hits)
+    assert_same(writer, index.writer)
+    index.delete("1")
+    assert_equal(0, index.search("content:one").total_hits)
+    assert_same(writer, index.writer)
+    # deleting by document number needs a reader which owns the write lock
+    index.delete(0)
+    assert_equal(1, index.size)
+    assert_equal("two", index["2"][:content])
+    index.close
+  end
+
+  def test_search_threads
+    index = Index.new(:analyzer => WhiteSpaceAnalyzer.new, :search_threads => 3,
+                      :max_buffered_docs => 3, :merge_factor => 20)
+    20.times { |i| index << {:id => i.to_s, :num => "%02d" % (19 - i), :content => "word#{i % 3}"} }
+    index.flush
+    top_docs = index.search("content:word1", :sort => :num)
+    assert_equal(7, top_docs.total_hits)
+    assert_equal([19, 16, 13, 10, 7, 4, 1], top_docs.hits.map { |hit| hit.doc })
+    assert_equal(3, index.searcher.max_threads)
+    index.close
+  end
+
   def test_doc_specific_analyzer
     index = Index.new
     index.add_document("abc", Isomorfeus::Ferret::Analysis::Analyzer.new)
@@ -716,6 +747,36 @@ class IndexTest < Test::Unit::TestCase
     threads.each{|t| t.join }
   end
 
+  def test_search_survives_wakeup
+    index = Isomorfeus::Ferret::I.new
+    5000.times { |i| index << {:title => "word#{i % 50} other#{i % 7} text"} }
+    index.flush
+    errors = []
+    searcher = Thread.new do
+      50.times do
+        begin
+          index.search('word1 OR other3 OR text', :limit => 5)
+        rescue => e
+          errors << e
+        end
+      end
+    end
+    while searcher.alive?
+      searcher.wakeup rescue nil
+      Thread.pass
+    end
+    searcher.join
+    assert_equal([], errors)
+  end
+
+  def test_binary_field_data
+    index = Isomorfeus::Ferret::I.new
+    index << {:id => '1', :data => "ab\0cd"}
+    index << {:id => '2', :data => ["x\0y", "z"]}
+    assert_equal("ab\0cd", index[0][:data])
+    assert_equal(["x\0y", "z"], index[1][:data])
+  end
+
   def test_wildcard
     j = nil
     Isomorfeus::Ferret::I.new do |i|
@@ -851,9 +912,11 @@ class IndexTest < Test::Unit::TestCase
     field_infos.add_field(:table, index: :no)
     field_infos.add_field(:column, store: :no, index: :yes, term_vector: :with_positions, boost: 2.0)
     field_infos.add_field(:row, store: :yes, compression: :brotli)
+    field_infos.add_field(:rank, store: :no, index: :no, doc_values: :numeric)
     assert_equal({index: :untokenized, store: :yes, compression: :no, term_vector: :no, boost: 1.0}, field_infos[:id].to_h)
     assert_equal({index: :no, store: :yes, compression: :no, term_vector: :no, boost: 1.0}, field_infos[:table].to_h)
     assert_equal({index: :yes, store: :no, compression: :no, term_vector: :with_positions, boost: 2.0}, field_infos[:column].to_h)
     assert_equal({index: :yes, store: :yes, compression: :brotli, term_vector: :no, boost: 1.0}, field_infos[:row].to_h)
+    assert_equal({index: :no, store: :no, compression: :no, term_vector: :no, doc_values: :numeric, boost: 1.0}, field_infos[:rank].to_h)
   end
 end
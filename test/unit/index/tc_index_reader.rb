@@ -688,5 +688,226 @@ class IndexReaderTest < Test::Unit::TestCase
     assert(ir.latest?)
     ir.close
   end
-end
 
+  def test_reopen
+    iw = IndexWriter.new(:dir => @dir, :analyzer => WhiteSpaceAnalyzer.new,
+                         :create => true, :max_buffered_docs => 2,
+                         :merge_factor => 100)
+    6.times {|i| iw << {:id => i.to_s, :field => "content#{i}"}}
+    iw.close
+
+    ir = IndexReader.new(@dir)
+    assert_same(ir, ir.reopen)
+
+    iw = IndexWriter.new(:dir => @dir, :analyzer => WhiteSpaceAnalyzer.new)
+    iw << {:id => "6", :field => "content6", :new_field => "new"}
+    iw.delete(:id, "0")
+    iw.close
+
+    ir2 = ir.reopen
+    assert_not_same(ir, ir2)
+    assert(ir2.latest?)
+    assert_equal(6, ir.num_docs)
+    assert_equal(6, ir2.num_docs)
+    assert_equal(7, ir2.max_doc)
+    assert(ir2.deleted?(0))
+    assert_equal(1, ir2.doc_freq(:new_field, "new"))
+    assert_equal("content3", ir2[3][:field])
+    ir.close
+
+    # the reopened reader can still delete from the shared segments
+    ir2.delete(3)
+    ir2.commit
+    assert_same(ir2, ir2.reopen)
+    ir2.close
+    ir = IndexReader.new(@dir)
+    assert_equal(5, ir.num_docs)
+    assert(ir.deleted?(3))
+    ir.close
+  end
+
+  def test_reopen_keeps_deletions_apart
+    iw = IndexWriter.new(:dir => @dir, :analyzer => WhiteSpaceAnalyzer.new,
+                         :create => true, :max_buffered_docs => 2,
+                         :merge_factor => 100)
+    6.times {|i| iw << {:id => i.to_s, :field => "content#{i}"}}
+    iw.close
+
+    ir = IndexReader.new(@dir)
+    iw = IndexWriter.new(:dir => @dir, :analyzer => WhiteSpaceAnalyzer.new)
+    iw << {:id => "6", :field => "content6"}
+    iw.close
+    ir2 = ir.reopen
+
+    # deleting through the reopened reader copies the shared deletions
+    ir2.delete(3)
+    assert(ir2.deleted?(3))
+    assert(!ir.deleted?(3))
+    assert_equal(6, ir2.num_docs)
+    assert_equal(6, ir.num_docs)
+    assert_equal("content3", ir[3][:field])
+
+    # the shared segments outlive the reader they were opened by
+    ir.close
+    assert_equal("content4", ir2[4][:field])
+    assert_equal(1, ir2.doc_freq(:field, "content2"))
+    ir2.delete(4)
+    ir2.commit
+    ir2.close
+    ir = IndexReader.new(@dir)
+    assert_equal(5, ir.num_docs)
+    assert(ir.deleted?(3))
+    assert(ir.deleted?(4))
+    ir.close
+  end
+
+  def test_stored_fields_cache
+    iw = IndexWriter.new(:dir => @dir, :analyzer => WhiteSpaceAnalyzer.new,
+                         :create => true, :stored_fields_format => :block,
+                         :max_buffered_docs => 100, :merge_factor => 100)
+    content = lambda {|i| "doc#{i} " + "word#{i} " * 150}
+    200.times {|i| iw << {:id => i.to_s, :content => content.call(i)}}
+    iw.close
+
+    cache = StoredFieldsCache.new(1024 * 1024)
+    assert_equal(1024 * 1024, cache.max_size)
+    assert_equal(0, cache.size)
+    ir = IndexReader.new(@dir)
+    assert_nil(ir.stored_fields_cache)
+    ir.stored_fields_cache = cache
+    assert_same(cache, ir.stored_fields_cache)
+    ir.max_doc.times {|d| assert_equal(content.call(d), ir[d][:content])}
+    misses = cache.misses
+    assert(misses > 2)
+    assert(cache.size > 0)
+    ir.max_doc.times {|d| assert_equal(content.call(d), ir[d][:content])}
+    assert_equal(misses, cache.misses)
+    assert(cache.hits > 0)
+
+    iw = IndexWriter.new(:dir => @dir, :analyzer => WhiteSpaceAnalyzer.new)
+    iw << {:id => "200", :content => content.call(200)}
+    iw.close
+    ir2 = ir.reopen
+    assert_same(cache, ir2.stored_fields_cache)
+    ir.close
+    hits = cache.hits
+    200.times {|d| assert_equal(content.call(d), ir2[d][:content])}
+    assert_equal(content.call(200), ir2[200][:content])
+    assert(cache.hits > hits)
+
+    ir2.stored_fields_cache = nil
+    assert_nil(ir2.stored_fields_cache)
+    hits = cache.hits
+    misses = cache.misses
+    ir2.max_doc.times {|d| assert_equal(content.call(d), ir2[d][:content])}
+    assert_equal([hits, misses], [cache.hits, cache.misses])
+    ir2.close
+  end
+
+  def test_stored_fields_cache_with_compound_files
+    iw = IndexWriter.new(:dir => @dir, :analyzer => WhiteSpaceAnalyzer.new,
+                         :create => true, :stored_fields_format => :block,
+                         :use_compound_file => true)
+    content = lambda {|i| "doc#{i} " + "word#{i} " * 150}
+    100.times {|i| iw << {:id => i.to_s, :content => content.call(i)}}
+    iw.optimize
+    iw.close
+
+    cache = StoredFieldsCache.new(1024 * 1024)
+    ir = IndexReader.new(@dir)
+    ir.stored_fields_cache = cache
+    ir.max_doc.times {|d| assert_equal(content.call(d), ir[d][:content])}
+    misses = cache.misses
+    # the segments of another reader are in compound files of their own
+    ir2 = IndexReader.new(@dir)
+    ir2.stored_fields_cache = cache
+    ir2.max_doc.times {|d| assert_equal(content.call(d), ir2[d][:content])}
+    assert_equal(misses, cache.misses)
+    ir2.close
+    ir.close
+  end
+
+  def test_stored_fields_cache_with_compressed_fields
+    fis = FieldInfos.new
+    fis.add_field(:id, :index => :untokenized)
+    fis.add_field(:body, :compression => :brotli)
+    content = lambda {|i| "doc#{i} " + "word#{i % 13} " * (i % 29)}
+    iw = IndexWriter.new(:dir => @dir, :field_infos => fis, :create => true,
+                         :analyzer => WhiteSpaceAnalyzer.new)
+    300.times {|i| iw << {:id => i.to_s, :body => content.call(i)}}
+    iw.close
+    iw = IndexWriter.new(:dir => @dir, :analyzer => WhiteSpaceAnalyzer.new,
+                         :stored_fields_format => :block)
+    iw << {:id => "300", :body => content.call(300)}
+    iw.optimize
+    iw.close
+
+    ir = IndexReader.new(@dir)
+    ir.stored_fields_cache = StoredFieldsCache.new(1024 * 1024)
+    searcher = Isomorfeus::Ferret::Search::Searcher.new(ir)
+    ids = (0...ir.max_doc).to_a
+    2.times do
+      searcher.get_documents(ids).each do |doc|
+        assert_equal(content.call(doc[:id].to_i), doc[:body])
+      end
+    end
+    ir.close
+  end
+
+  def test_doc_values
+    fis = FieldInfos.new
+    fis.add_field(:id, :index => :untokenized)
+    fis.add_field(:price, :store => :no, :index => :no, :term_vector => :no,
+                  :doc_values => :numeric)
+    fis.add_field(:cat, :index => :untokenized, :doc_values => :sorted)
+    fis.add_field(:tags, :index => :untokenized, :doc_values => :sorted_set)
+    assert_equal(:numeric, fis[:price].doc_values)
+    assert_equal(:no, fis[:id].doc_values)
+    iw = IndexWriter.new(:dir => @dir, :field_infos => fis, :create => true,
+                         :max_buffered_docs => 2, :merge_factor => 20)
+    iw << {:id => "0", :price => "5", :cat => "b", :tags => ["x", "y"]}
+    iw << {:id => "1", :price => "-3", :cat => "a", :tags => "z"}
+    iw << {:id => "2"}
+    iw << {:id => "3", :price => "100", :cat => "c", :tags => ["y", "x"]}
+    assert_raise(ArgumentError) { iw << {:id => "4", :price => "cheap"} }
+    assert_raise(ArgumentError) { iw << {:id => "4", :cat => ["a", "b"]} }
+    iw.close
+
+    ir = IndexReader.new(@dir)
+    assert_equal([5, -3, nil, 100], ir.doc_values(:price))
+    assert_equal(["b", "a", nil, "c"], ir.doc_values(:cat))
+    assert_equal([["x", "y"], ["z"], nil, ["x", "y"]], ir.doc_values(:tags))
+    assert_raise(ArgumentError) { ir.doc_values(:id) }
+    searcher = Isomorfeus::Ferret::Search::Searcher.new(ir)
+    sort = Isomorfeus::Ferret::Search::Sort.new(
+      [Isomorfeus::Ferret::Search::SortField.new(:price, :reverse => true)])
+    top_docs = searcher.search(Isomorfeus::Ferret::Search::MatchAllQuery.new,
+                               :sort => sort)
+    assert_equal(%w(3 0 2 1), top_docs.hits.map {|hit| ir[hit.doc][:id]})
+    assert_equal(%w(1 2 0 3), dv_sorted_ids(searcher, ir, :price, :float))
+    assert_equal(%w(1 0 3 2), dv_sorted_ids(searcher, ir, :cat, :string))
+    ir.close
+
+    iw = IndexWriter.new(:dir => @dir)
+    iw.delete(:id, "1")
+    iw.optimize
+    iw.close
+    ir = IndexReader.new(@dir)
+    assert_equal([5, nil, 100], ir.doc_values(:price))
+    assert_equal(["b", nil, "c"], ir.doc_values(:cat))
+    assert_equal([["x", "y"], nil, ["x", "y"]], ir.doc_values(:tags))
+    searcher = Isomorfeus::Ferret::Search::Searcher.new(ir)
+    assert_equal(%w(2 0 3), dv_sorted_ids(searcher, ir, :price, :integer))
+    assert_equal(%w(2 0 3), dv_sorted_ids(searcher, ir, :cat, :byte))
+    assert_equal(%w(0 3 2), dv_sorted_ids(searcher, ir, :tags, :string))
+    ir.close
+  end
+
+  def dv_sorted_ids(searcher, ir, field, type)
+    sort = Isomorfeus::Ferret::Search::Sort.new(
+      [Isomorfeus::Ferret::Search::SortField.new(field, :type => type)])
+    top_docs = searcher.search(Isomorfeus::Ferret::Search::MatchAllQuery.new,
+                               :sort => sort)
+    top_docs.hits.map {|hit| ir[hit.doc][:id]}
+  end
+end
@@ -60,6 +60,324 @@ class IndexWriterTest < Test::Unit::TestCase
     iw << {:content => "http://" + 'x' * 1_000_000}
   end
 
+  class RubyAnalyzer
+    def token_stream(field, str)
+      Isomorfeus::Ferret::Analysis::WhiteSpaceTokenizer.new(str)
+    end
+  end
+
+  def test_add_documents_from_threads
+    iw = IndexWriter.new(:dir => @dir, :analyzer => RubyAnalyzer.new)
+    iw.max_buffered_docs = 7
+    threads = 4.times.map do |t|
+      Thread.new do
+        25.times {|i| iw << {:id => "#{t}-#{i}", :content => "thread#{t} doc#{i}"}}
+      end
+    end
+    threads.each {|thread| thread.join}
+    assert_equal(100, iw.doc_count)
+    iw.delete(:id, ["0-0", "1-1"])
+    iw.optimize
+    iw.close
+    ir = IndexReader.new(@dir)
+    assert_equal(98, ir.num_docs)
+    assert_equal(25, ir.doc_freq(:content, "thread3"))
+    ir.close
+  end
+
+  def test_concurrent_doc_writers
+    iw = IndexWriter.new(:dir => @dir, :analyzer => StandardAnalyzer.new,
+                         :max_doc_writers => 4, :max_buffered_docs => 10)
+    assert_equal(4, iw.max_doc_writers)
+    threads = 4.times.map do |t|
+      Thread.new do
+        50.times do |i|
+          doc = {:id => "#{t}-#{i}", :content => "thread#{t} doc#{i}"}
+          # new fields may only be added while no documents are analyzed
+          doc[:"field#{t}"] = "extra" if i == 20
+          iw << doc
+        end
+      end
+    end
+    threads.each {|thread| thread.join}
+    assert_equal(200, iw.doc_count)
+    iw.delete(:id, "2-2")
+    iw.close
+    ir = IndexReader.new(@dir)
+    assert_equal(199, ir.num_docs)
+    4.times do |t|
+      assert_equal(50, ir.doc_freq(:content, "thread#{t}"))
+      assert_equal(1, ir.doc_freq(:"field#{t}", "extra"))
+    end
+    assert_equal(4, ir.doc_freq(:content, "doc49"))
+    ir.close
+  end
+
+  def test_background_merges
+    iw = IndexWriter.new(:dir => @dir, :analyzer => StandardAnalyzer.new,
+                         :max_merge_threads => 2, :max_doc_writers => 2,
+                         :max_buffered_docs => 3, :merge_factor => 3)
+    assert_equal(2, iw.max_merge_threads)
+    iw.max_merge_bytes_per_sec = 10_000_000
+    assert_equal(10_000_000, iw.max_merge_bytes_per_sec)
+    threads = 2.times.map do |t|
+      Thread.new do
+        150.times {|i| iw << {:id => "#{t}-#{i}", :content => "thread#{t} doc#{i}"}}
+      end
+    end
+    threads.each {|thread| thread.join}
+    iw.commit
+    assert_equal(300, iw.doc_count)
+    iw.delete(:id, ["0-0", "1-149"])
+    iw << {:id => "last", :content => "last doc"}
+    iw.optimize
+    iw.close
+    ir = IndexReader.new(@dir)
+    assert_equal(299, ir.num_docs)
+    assert_equal(149, ir.doc_freq(:content, "thread0"))
+    assert_equal(1, ir.doc_freq(:content, "last"))
+    ir.close
+  end
+
+  def test_tiered_merge_policy
+    assert_equal(:log_doc, IndexWriter::DEFAULT_MERGE_POLICY)
+    iw = IndexWriter.new(:dir => @dir, :analyzer => StandardAnalyzer.new,
+                         :merge_policy => :tiered, :max_buffered_docs => 5,
+                         :merge_factor => 4, :deletes_pct_allowed => 30)
+    assert_equal(:tiered, iw.merge_policy)
+    assert_equal(30, iw.deletes_pct_allowed)
+    assert_equal(IndexWriter::DEFAULT_MAX_MERGED_SEGMENT_BYTES, iw.max_merged_segment_bytes)
+    iw.max_merged_segment_bytes = 100_000_000
+    assert_equal(100_000_000, iw.max_merged_segment_bytes)
+    assert_raise(ArgumentError) {iw.merge_policy = :unknown}
+    100.times {|i| iw << {:id => i.to_s, :content => "doc#{i} #{i.even? ? 'even' : 'odd'}"}}
+    iw.commit
+    assert_equal(100, iw.doc_count)
+    iw.delete(:content, "odd")
+    # the segment with 50% deleted documents gets rewritten
+    iw << {:id => "last", :content => "last doc"}
+    iw.commit
+    iw.merge_policy = :log_doc
+    assert_equal(:log_doc, iw.merge_policy)
+    iw.close
+    ir = IndexReader.new(@dir)
+    assert_equal(51, ir.num_docs)
+    assert_equal(51, ir.max_doc)
+    assert_equal(50, ir.doc_freq(:content, "even"))
+    assert_equal(0, ir.doc_freq(:content, "odd"))
+    assert_equal("doc0", ir[0][:content].split.first)
+    assert_equal("last", ir[50][:id])
+    ir.close
+  end
+
+  def test_block_postings_format
+    assert_equal(:vint, IndexWriter::DEFAULT_POSTINGS_FORMAT)
+    iw = IndexWriter.new(:dir => @dir, :analyzer => WhiteSpaceAnalyzer.new,
+                         :postings_format => :block, :max_buffered_docs => 150)
+    assert_equal(:block, iw.postings_format)
+    assert_raise(ArgumentError) {iw.postings_format = :unknown}
+    200.times {|i| iw << {:id => i.to_s, :content => "all #{i.even? ? 'even' : 'odd'} #{'many ' * (i % 3)}"}}
+    # segments keep the format they were written in
+    iw.postings_format = :vint
+    100.times {|i| iw << {:id => (200 + i).to_s, :content => "all #{i.even? ? 'even' : 'odd'}"}}
+    iw.close
+    ir = IndexReader.new(@dir)
+    assert_equal(300, ir.doc_freq(:content, "all"))
+    assert_equal(150, ir.doc_freq(:content, "even"))
+    tde = ir.term_docs_for(:content, "all")
+    300.times do |i|
+      assert(tde.next?)
+      assert_equal(i, tde.doc)
+    end
+    assert(!tde.next?)
+    tde = ir.term_docs_for(:content, "even")
+    assert(tde.skip_to(161))
+    assert_equal(162, tde.doc)
+    assert(tde.skip_to(251))
+    assert_equal(252, tde.doc)
+    tde = ir.term_positions_for(:content, "many")
+    assert(tde.skip_to(140))
+    assert_equal(140, tde.doc)
+    assert_equal(2, tde.freq)
+    assert_equal([2, 3], [tde.next_position, tde.next_position])
+    ir.close
+  end
+
+  def test_block_stored_fields_format
+    assert_equal(:plain, IndexWriter::DEFAULT_STORED_FIELDS_FORMAT)
+    iw = IndexWriter.new(:dir => @dir, :analyzer => WhiteSpaceAnalyzer.new,
+                         :stored_fields_format => :block,
+                         :max_buffered_docs => 70, :merge_factor => 3)
+    assert_equal(:block, iw.stored_fields_format)
+    assert_raise(ArgumentError) {iw.stored_fields_format = :unknown}
+    content = lambda {|i| "doc#{i} all #{'word ' * (i % 5)}"}
+    300.times {|i| iw << {:id => i.to_s, :content => content.call(i)}}
+    # merges mix both formats and move the values between them
+    iw.stored_fields_format = :plain
+    100.times {|i| iw << {:id => (300 + i).to_s, :content => content.call(300 + i)}}
+    iw.delete(:id, "7")
+    iw.stored_fields_format = :block
+    iw.optimize
+    iw.close
+
+    ir = IndexReader.new(@dir)
+    assert_equal(399, ir.num_docs)
+    ir.max_doc.times do |d|
+      id = ir[d][:id].to_i
+      assert_equal(content.call(id), ir[d][:content])
+      assert(ir.term_vector(d, :content).terms.any? {|t| t.text == "doc#{id}"})
+    end
+
+    dir = Isomorfeus::Ferret::Store::RAMDirectory.new
+    iw = IndexWriter.new(:dir => dir, :analyzer => WhiteSpaceAnalyzer.new, :create => true)
+    iw.add_readers([ir])
+    iw.close
+    ir.close
+    ir = IndexReader.new(dir)
+    assert_equal(399, ir.num_docs)
+    ir.max_doc.times {|d| assert_equal(content.call(ir[d][:id].to_i), ir[d][:content])}
+    ir.close
+    dir.close
+  end
+
+  def test_compressed_fields_merged_into_blocks
+    fis = FieldInfos.new
+    fis.add_field(:id, :index => :untokenized)
+    [:brotli, :bz2, :lz4].each {|c| fis.add_field(c, :compression => c)}
+    iw = IndexWriter.new(:dir => @dir, :field_infos => fis, :create => true,
+                         :analyzer => WhiteSpaceAnalyzer.new, :max_buffered_docs => 50)
+    content = lambda {|i| "doc#{i} #{'text ' * (i % 7)}"}
+    120.times do |i|
+      iw << {:id => i.to_s, :brotli => content.call(i), :bz2 => content.call(i + 1),
+             :lz4 => content.call(i + 2)}
+    end
+    # the blocks are compressed as a whole so the values go in uncompressed
+    iw.stored_fields_format = :block
+    iw.optimize
+    iw.close
+
+    ir = IndexReader.new(@dir)
+    assert_equal(120, ir.num_docs)
+    ir.max_doc.times do |d|
+      id = ir[d][:id].to_i
+      assert_equal(content.call(id), ir[d][:brotli])
+      assert_equal(content.call(id + 1), ir[d][:bz2])
+      assert_equal(content.call(id + 2), ir[d][:lz4])
+    end
+    ir.close
+  end
+
+  def test_index_sort
+    sort_field = Isomorfeus::Ferret::Search::SortField
+    assert_raise(ArgumentError) {IndexWriter.new(:dir => @dir, :index_sort => :rank)}
+    iw = IndexWriter.new(:dir => @dir, :analyzer => WhiteSpaceAnalyzer.new,
+                         :max_buffered_docs => 7, :merge_factor => 3,
+                         :index_sort => sort_field.new(:rank, :type => :integer))
+    ranks = (0...50).map {|i| (i * 37) % 50}
+    ranks.each_with_index {|r, i| iw << {:id => i.to_s, :rank => r.to_s, :content => "all"}}
+    iw.delete(:id, "3")
+    iw.close
+    ir = IndexReader.new(@dir)
+    assert_equal(49, ir.num_docs)
+    ir.max_doc.times do |d|
+      next if ir.deleted?(d)
+      assert_equal(ranks[ir[d][:id].to_i].to_s, ir[d][:rank])
+    end
+    searcher = Isomorfeus::Ferret::Search::Searcher.new(ir)
+    query = Isomorfeus::Ferret::Search::TermQuery.new(:content, "all")
+    sort = Isomorfeus::Ferret::Search::Sort.new([sort_field.new(:rank, :type => :integer)])
+    all = searcher.search(query, :sort => sort, :limit => 5)
+    early = searcher.search(query, :sort => sort, :limit => 5, :total_hits_threshold => 0)
+    assert_equal(%w(0 1 2 3 4), all.hits.map {|h| ir[h.doc][:rank]})
+    assert_equal(all.hits.map {|h| h.doc}, early.hits.map {|h| h.doc})
+    assert_equal(49, all.total_hits)
+    assert(all.total_hits_exact?)
+    ir.close
+  end
+
+  def test_index_sort_by_doc_values
+    sort_field = Isomorfeus::Ferret::Search::SortField
+    fis = FieldInfos.new
+    fis.add_field(:id, :index => :untokenized)
+    fis.add_field(:price, :index => :no, :term_vector => :no, :doc_values => :numeric)
+    fis.add_field(:content, :term_vector => :with_positions_offsets)
+    iw = IndexWriter.new(:dir => @dir, :field_infos => fis, :create => true,
+                         :analyzer => WhiteSpaceAnalyzer.new,
+                         :stored_fields_format => :block, :use_compound_file => false,
+                         :max_buffered_docs => 7, :merge_policy => :log_doc,
+                         :max_merge_docs => 5,
+                         :index_sort => sort_field.new(:price, :type => :integer))
+    prices = (0...30).map {|i| (i * 13) % 30 - 10}
+    prices.each_with_index {|p, i| iw << {:id => i.to_s, :price => p.to_s, :content => "doc#{i} all"}}
+    iw.close
+    # each segment is sorted as it is flushed, there are no merges
+    5.times do |i|
+      assert(@dir.exists?("_#{i}.fdt"))
+      assert(!@dir.exists?("_#{i}_u.fdt"))
+    end
+
+    ir = IndexReader.new(@dir)
+    assert_equal(30, ir.num_docs)
+    values = ir.doc_values(:price)
+    values.each_slice(7) {|seg| assert_equal(seg.sort, seg)}
+    searcher = Isomorfeus::Ferret::Search::Searcher.new(ir)
+    ir.max_doc.times do |d|
+      id = ir[d][:id].to_i
+      assert_equal(prices[id], values[d])
+      assert(ir.term_vector(d, :content).terms.any? {|t| t.text == "doc#{id}"})
+      query = Isomorfeus::Ferret::Search::TermQuery.new(:content, "doc#{id}")
+      assert_equal([d], searcher.search(query).hits.map {|h| h.doc})
+    end
+    ir.close
+  end
+
+  def test_index_sort_with_merge_threads
+    sort_field = Isomorfeus::Ferret::Search::SortField
+    iw = IndexWriter.new(:dir => @dir, :analyzer => WhiteSpaceAnalyzer.new,
+                         :max_buffered_docs => 7, :merge_factor => 3,
+                         :max_merge_threads => 2,
+                         :index_sort => sort_field.new(:rank, :type => :integer))
+    ranks = (0...300).map {|i| (i * 37) % 300}
+    ranks.each_with_index {|r, i| iw << {:id => i.to_s, :rank => r.to_s}}
+    iw.optimize
+    iw.close
+    ir = IndexReader.new(@dir)
+    assert_equal(300, ir.num_docs)
+    assert_equal((0...300).map(&:to_s), (0...300).map {|d| ir[d][:rank]})
+    ir.close
+  end
+
+  def test_reader_from_writer
+    iw = IndexWriter.new(:dir => @dir, :analyzer => StandardAnalyzer.new,
+                         :max_buffered_docs => 3)
+    5.times {|i| iw << {:id => i.to_s, :content => "doc#{i}"}}
+    ir = iw.reader
+    assert_equal(5, ir.num_docs)
+    assert_equal("doc4", ir[4][:content])
+    assert(iw.reader_latest?(ir))
+    # the segment flushed for the reader isn't committed until the writer is
+    committed = IndexReader.new(@dir)
+    assert_equal(3, committed.num_docs)
+    committed.close
+    assert_raise(Isomorfeus::Ferret::Store::Lock::LockError) {ir.delete(0)}
+    iw << {:id => "5", :content => "doc5 new_field", :other => "field"}
+    assert(!iw.reader_latest?(ir))
+    assert_equal(5, ir.num_docs)
+    assert_equal(0, ir.doc_freq(:content, "new_field"))
+    ir2 = iw.reader
+    assert_equal(6, ir2.num_docs)
+    assert_equal(1, ir2.doc_freq(:other, "field"))
+    iw.delete(:id, "0")
+    assert(!iw.reader_latest?(ir2))
+    ir3 = iw.reader
+    assert_equal(5, ir3.num_docs)
+    assert(ir3.deleted?(0))
+    ir.close
+    ir2.close
+    iw.close
+    ir3.close
+  end
+
   private
 
   WORDS = [
@@ -91,4 +91,25 @@ class LazyDocTest < Test::Unit::TestCase
     ld2 = index[1]
     assert_equal("one", ld2[:xxx])
   end
+
+  def test_lazy_doc_compressed_fields
+    dir = RAMDirectory.new
+    fis = FieldInfos.new
+    [:brotli, :bz2, :lz4].each {|c| fis.add_field(c, :compression => c)}
+    iw = IndexWriter.new(:dir => dir, :field_infos => fis, :create => true,
+                         :analyzer => WhiteSpaceAnalyzer.new)
+    content = lambda {|i| "body#{i} " + "word#{i % 11} " * (i * 3)}
+    300.times {|i| iw << {:brotli => content.call(i), :bz2 => content.call(i + 1),
+                          :lz4 => content.call(i + 2)}}
+    iw.close
+    ir = IndexReader.new(dir)
+    300.times do |i|
+      ld = ir[i]
+      assert_equal(content.call(i), ld[:brotli])
+      assert_equal(content.call(i + 1), ld[:bz2])
+      assert_equal(content.call(i + 2), ld[:lz4])
+    end
+    ir.close
+    dir.close
+  end
 end
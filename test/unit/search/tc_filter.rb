@@ -152,4 +152,15 @@ class FilterTest < Test::Unit::TestCase
     docs = top_docs.hits.collect {|hit| hit.doc}
     assert_equal(docs, [0,7,1,3,5,6,8,9,2,4])
   end
+
+  def test_filter_proc_exception
+    searcher = Searcher.new(@dir)
+    q = MatchAllQuery.new
+    filter_proc = lambda {|doc, score, s| raise ArgumentError, "filter failed"}
+    e = assert_raise(ArgumentError) do
+      searcher.search(q, :filter_proc => filter_proc)
+    end
+    assert_equal("filter failed", e.message)
+    assert_equal(10, searcher.search(q).total_hits)
+  end
 end
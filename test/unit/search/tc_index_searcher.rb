@@ -63,4 +63,56 @@ class SearcherTest < Test::Unit::TestCase
     assert_equal("cat1/sub2/subsub2", @searcher.get_document(4)[:category])
     assert_equal("20051012", @searcher.get_document(12)[:date])
   end
+
+  def test_get_documents
+    doc_ids = [12, 0, 4, 17, 4, 9]
+    docs = @searcher.get_documents(doc_ids)
+    assert_equal(doc_ids.map {|d| @searcher.get_document(d).to_h}, docs)
+    assert_equal("20051012", docs[0][:date])
+    assert_equal([{:date => "20051012"}, {:date => "20050930"}],
+                 @searcher.get_documents([12, 0], :date))
+    assert_equal(doc_ids.map {|d| @searcher.get_document(d).to_h.slice(:date, :field)},
+                 @searcher.get_documents(doc_ids, [:date, "field"]))
+    assert_equal([], @searcher.get_documents([]))
+    assert_raise(ArgumentError) { @searcher.get_documents([1, 18]) }
+  end
+end
+
+class ParallelSearcherTest < SearcherTest
+  # run all of the searcher tests with the segments searched in parallel
+  SearcherTest.public_instance_methods.grep(/\Atest_/).each do |test|
+    define_method(test) { super() }
+  end
+
+  def setup
+    @dir = RAMDirectory.new
+    iw = IndexWriter.new(:dir => @dir,
+                         :analyzer => WhiteSpaceAnalyzer.new,
+                         :create => true,
+                         :max_buffered_docs => 4,
+                         :merge_factor => 20)
+    @documents = IndexTestHelper::SEARCH_TEST_DOCS
+    @documents.each { |doc| iw << doc }
+    iw.close
+    @searcher = Searcher.new(@dir)
+    @searcher.max_threads = 3
+  end
+
+  def test_max_threads
+    assert_equal(3, @searcher.max_threads)
+    assert_raise(ArgumentError) { @searcher.max_threads = 0 }
+    serial = Searcher.new(@dir)
+    assert_equal(1, serial.max_threads)
+    [TermQuery.new(:field, "word1"),
+     TermQuery.new(:date, "20051012")].each do |query|
+      [nil, Sort.new([SortField.new(:date, :type => :integer)])].each do |sort|
+        expected = serial.search(query, :sort => sort, :limit => 7)
+        top_docs = @searcher.search(query, :sort => sort, :limit => 7)
+        assert_equal(expected.total_hits, top_docs.total_hits)
+        assert_equal(expected.hits.map {|h| h.doc}, top_docs.hits.map {|h| h.doc})
+        assert_equal(expected.max_score, top_docs.max_score)
+      end
+    end
+    serial.close
+  end
 end
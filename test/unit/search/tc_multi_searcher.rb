@@ -125,4 +125,43 @@ class MultiSearcherTest < Test::Unit::TestCase
     assert_equal("cat1/sub2/subsub2", @single[4][:cat])
     assert_equal("20051012", @single.get_document(12)[:date])
   end
+
+  def test_get_documents
+    doc_ids = [12, 0, 4, 17, 4, 9]
+    assert_equal(doc_ids.map {|d| @single.get_document(d).to_h},
+                 @searcher.get_documents(doc_ids))
+    assert_equal([{:cat => "cat1/sub2/subsub2"}, {:cat => "cat1/"}],
+                 @searcher.get_documents([4, 0], [:cat]))
+  end
+end
+
+class ParallelMultiSearcherTest < MultiSearcherTest
+  # run all of the multi searcher tests with the sub-searchers searched in
+  # parallel
+  MultiSearcherTest.public_instance_methods.grep(/\Atest_/).each do |test|
+    define_method(test) { super() }
+  end
+
+  def setup
+    super
+    @searcher.max_threads = 2
+  end
+
+  def test_max_threads
+    assert_equal(2, @searcher.max_threads)
+    assert_raise(ArgumentError) { @searcher.max_threads = 0 }
+    query = TermQuery.new(:field, "word1")
+
+    expected = []
+    @single.search_each(query, :limit => :all) { |doc, score| expected << doc }
+    docs = []
+    @searcher.search_each(query, :limit => :all) { |doc, score| docs << doc }
+    assert_equal(expected.sort, docs.sort)
+
+    assert_equal(@single.scan(query, :limit => 5), @searcher.scan(query, :limit => 5))
+    assert_equal(@single.scan(query, :start_doc => 7, :limit => 5),
+                 @searcher.scan(query, :start_doc => 7, :limit => 5))
+    assert_equal(@single.scan(query, :start_doc => 12),
+                 @searcher.scan(query, :start_doc => 12))
+  end
 end
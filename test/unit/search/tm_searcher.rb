@@ -61,6 +61,47 @@ module SearcherTests
     check_docs(tq, {:limit => :all, :offset => 2}, expected[2..-1])
   end
 
+  def test_total_hits_threshold
+    tq = TermQuery.new(:field, "word1")
+    top_docs = @searcher.search(tq)
+    assert(top_docs.total_hits_exact?)
+    total_hits = top_docs.total_hits
+
+    assert_raise(ArgumentError) { @searcher.search(tq, :total_hits_threshold => -1) }
+    assert_raise(TypeError) { @searcher.search(tq, :total_hits_threshold => "10") }
+    assert_raise(RangeError) { @searcher.search(tq, :total_hits_threshold => 2**40) }
+    filter = QueryFilter.new(TermQuery.new(:field, "word1"))
+    assert_raise(ArgumentError) do
+      @searcher.search(tq, :filter => filter, :total_hits_threshold => -1)
+    end
+    assert_equal(total_hits, @searcher.search(tq, :filter => filter).total_hits)
+
+    # hits in index order can't change once the page is full
+    top_docs = @searcher.search(tq, :limit => 3, :sort => Sort::INDEX_ORDER,
+                                :total_hits_threshold => 0)
+    assert(!top_docs.total_hits_exact?)
+    assert(top_docs.total_hits >= 3)
+    assert(top_docs.total_hits < total_hits)
+    assert_equal([0, 1, 2], top_docs.hits.map { |hit| hit.doc })
+    assert_match(/total_hits = #{top_docs.total_hits}\+/, top_docs.to_s)
+
+    top_docs = @searcher.search(tq, :limit => 3, :sort => Sort::INDEX_ORDER,
+                                :total_hits_threshold => total_hits + 1)
+    assert(top_docs.total_hits_exact?)
+    assert_equal(total_hits, top_docs.total_hits)
+
+    # skipping documents mustn't change the hits
+    bq = BooleanQuery.new()
+    bq.add_query(TermQuery.new(:field, "word2"), :should)
+    bq.add_query(TermQuery.new(:field, "word3"), :should)
+    expected = @searcher.search(bq, :limit => 3)
+    top_docs = @searcher.search(bq, :limit => 3, :total_hits_threshold => 0)
+    assert_equal(expected.hits.map { |hit| hit.doc },
+                 top_docs.hits.map { |hit| hit.doc })
+    assert(top_docs.total_hits <= expected.total_hits)
+    assert(top_docs.total_hits >= 3)
+  end
+
   def test_multi_term_query
     mtq = MultiTermQuery.new(:field, :max_terms => 4, :min_score => 0.5)
     check_hits(mtq, [])
@@ -0,0 +1,75 @@
+require File.expand_path(File.join(File.dirname(__FILE__), "..", "..", "test_helper.rb"))
+require File.expand_path(File.join(File.dirname(__FILE__), "tm_store"))
+require File.expand_path(File.join(File.dirname(__FILE__), "tm_store_lock"))
+
+class MMapStoreTest < Test::Unit::TestCase
+  include Isomorfeus::Ferret::Store
+  include StoreTest
+  include StoreLockTest
+  def setup
+    @dpath = File.expand_path(File.join(File.dirname(__FILE__), '../../temp/mmapdir'))
+    @dir = MMapDirectory.new(@dpath, true)
+  end
+
+  def teardown
+    @dir.close
+    Dir[File.join(@dpath, "*")].each {|path| begin File.delete(path) rescue nil end}
+  end
+
+  def test_mmap_index
+    assert_kind_of(FSDirectory, @dir)
+    fis = Isomorfeus::Ferret::Index::FieldInfos.new
+    fis.add_field(:rank, :store => :no, :index => :no, :term_vector => :no,
+                  :doc_values => :numeric)
+    index = Isomorfeus::Ferret::Index::Index.new(:dir => @dir, :field_infos => fis)
+    100.times {|i| index << {:id => i.to_s, :content => "word#{i % 10} common", :rank => (i * 3).to_s}}
+    index.commit
+    assert_equal(100, index.search("common", :limit => 200).total_hits)
+    assert_equal(10, index.search("word3").total_hits)
+    assert_equal("42", index["42"][:id])
+    index.optimize
+    assert_equal(10, index.search("word7").total_hits)
+    assert_equal((0...100).map {|i| i * 3}, index.reader.doc_values(:rank))
+    index.close
+
+    fs_dir = FSDirectory.new(@dpath)
+    index = Isomorfeus::Ferret::Index::Index.new(:dir => fs_dir)
+    assert_equal(100, index.size)
+    index.close
+  end
+
+  def test_mmap_stored_fields_in_place
+    big = "large stored field " * 1000
+    iw = Isomorfeus::Ferret::Index::IndexWriter.new(:dir => @dir, :create => true)
+    iw << {:id => "0", :content => big, :parts => [big, "small"]}
+    iw.close
+
+    ir = Isomorfeus::Ferret::Index::IndexReader.new(@dir)
+    doc = ir[0]
+    content = doc[:content]
+    parts = doc[:parts]
+    assert_equal(big, content)
+    assert_equal(Encoding::UTF_8, content.encoding)
+    # large values point right at the mapped file so they can't be changed
+    assert(content.frozen?)
+    assert_raise(FrozenError) { content << "more" }
+    assert(parts[0].frozen?)
+    assert(!parts[1].frozen?)
+    assert(!doc[:id].frozen?)
+    assert_equal([], content.instance_variables)
+    copy = content.dup
+    copy << "more"
+    assert_equal(big + "more", copy)
+
+    # the strings keep the mapping alive
+    slice = content[10, 8000]
+    doc = nil
+    ir.close
+    GC.start
+    assert_equal(big, content)
+    assert_equal(big[10, 8000], slice)
+    content = parts = nil
+    GC.start
+    assert_equal(big[10, 8000], slice)
+  end
+end